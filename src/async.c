@@ -0,0 +1,409 @@
+/*=========================================================================*\
+* Background execution of blocking calls
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#include <pthread.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "auxiliar.h"
+#include "socket.h"
+#include "async.h"
+
+/* hard limit on the number of worker threads */
+#define ASYNC_MAXTHREADS 64
+
+/* Lua object representing a submitted job */
+typedef struct t_jobobj_ {
+    p_job job;
+    p_jobpush push;
+    t_timeout tm;
+} t_jobobj;
+typedef t_jobobj *p_jobobj;
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_stats(lua_State *L);
+static int global_setlimits(lua_State *L);
+static int global_shutdown(lua_State *L);
+static int meth_result(lua_State *L);
+static int meth_cancel(lua_State *L);
+static int meth_close(lua_State *L);
+static int meth_settimeout(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_dirty(lua_State *L);
+static void *worker(void *arg);
+
+/* job object methods */
+static luaL_Reg job_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"cancel",      meth_cancel},
+    {"close",       meth_close},
+    {"dirty",       meth_dirty},
+    {"getfd",       meth_getfd},
+    {"result",      meth_result},
+    {"settimeout",  meth_settimeout},
+    {NULL,          NULL}
+};
+
+/* functions in socket.async namespace */
+static luaL_Reg func[] = {
+    {"setlimits",   global_setlimits},
+    {"stats",       global_stats},
+    {NULL,          NULL}
+};
+
+/* pool state, protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t threads[ASYNC_MAXTHREADS];
+static p_job first = NULL, last = NULL;
+static int users = 0, stopping = 0;
+static int maxthreads = 4, nthreads = 0, idle = 0;
+static size_t maxdepth = 256, depth = 0;
+
+/* statistics, also protected by lock */
+static struct {
+    size_t submitted, completed, canceled, rejected, peak;
+    double wait, maxwait, run;
+} stats;
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int async_open(lua_State *L) {
+    auxiliar_newclass(L, "async{job}", job_methods);
+    lua_pushstring(L, "async");
+    lua_newtable(L);
+    luaL_openlib(L, NULL, func, 0);
+    lua_settable(L, -3);
+    /* worker threads run our code, so they must be gone before the
+     * library is unloaded. a sentinel is collected when the state closes */
+    pthread_mutex_lock(&lock);
+    users++;
+    pthread_mutex_unlock(&lock);
+    lua_newuserdata(L, 1);
+    lua_newtable(L);
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, global_shutdown);
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, "socket.async");
+    return 0;
+}
+
+/*=========================================================================*\
+* Exported functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Initializes the generic part of a job. The job starts with one
+* reference, owned by the caller.
+\*-------------------------------------------------------------------------*/
+void async_init(p_job job, p_jobrun run, p_jobfree free, p_event done) {
+    job->run = run;
+    job->free = free;
+    job->done = done;
+    job->state = ASYNC_QUEUED;
+    job->refs = 1;
+    job->queued = job->started = job->finished = 0.0;
+    job->next = NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Queues a job, starting a new worker if all existing ones are busy.
+* Returns IO_DONE, or EAGAIN if the queue is full.
+\*-------------------------------------------------------------------------*/
+int async_submit(p_job job) {
+    pthread_mutex_lock(&lock);
+    if (depth >= maxdepth) {
+        stats.rejected++;
+        pthread_mutex_unlock(&lock);
+        return EAGAIN;
+    }
+    if (idle == 0 && nthreads < maxthreads) {
+        int err = pthread_create(&threads[nthreads], NULL, worker, NULL);
+        if (err == 0) nthreads++;
+        else if (nthreads == 0) {
+            pthread_mutex_unlock(&lock);
+            return err;
+        }
+    }
+    job->refs++;
+    job->state = ASYNC_QUEUED;
+    job->queued = timeout_gettime();
+    job->next = NULL;
+    if (last) last->next = job;
+    else first = job;
+    last = job;
+    depth++;
+    stats.submitted++;
+    if (depth > stats.peak) stats.peak = depth;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&lock);
+    return IO_DONE;
+}
+
+/*-------------------------------------------------------------------------*\
+* Removes a job from the queue if no worker has picked it up yet.
+* Returns 1 if the job was canceled.
+\*-------------------------------------------------------------------------*/
+int async_cancel(p_job job) {
+    p_job *link, prev = NULL;
+    pthread_mutex_lock(&lock);
+    if (job->state != ASYNC_QUEUED) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    for (link = &first; *link != job; link = &(*link)->next)
+        prev = *link;
+    *link = job->next;
+    if (last == job) last = prev;
+    depth--;
+    stats.canceled++;
+    __atomic_store_n(&job->state, ASYNC_CANCELED, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+    if (job->done) event_signal(job->done);
+    /* drop the reference held by the queue */
+    async_release(job);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Drops a reference to a job, destroying it when there are none left
+\*-------------------------------------------------------------------------*/
+void async_release(p_job job) {
+    if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        job->free(job);
+}
+
+/*-------------------------------------------------------------------------*\
+* Submits a job and pushes a Lua object representing it. The caller's
+* reference to the job is handed over to the object. The push function
+* is called by the object's result method once the job is done.
+\*-------------------------------------------------------------------------*/
+int async_pushjob(lua_State *L, p_job job, p_jobpush push) {
+    p_jobobj obj = (p_jobobj) lua_newuserdata(L, sizeof(t_jobobj));
+    int err;
+    obj->job = NULL;
+    obj->push = push;
+    timeout_init(&obj->tm, -1, -1);
+    auxiliar_setclass(L, "async{job}", -1);
+    if ((err = async_submit(job)) != IO_DONE) {
+        async_release(job);
+        lua_pushnil(L);
+        lua_pushstring(L, err == EAGAIN? "queue full": socket_strerror(err));
+        return 2;
+    }
+    obj->job = job;
+    return 1;
+}
+
+/*=========================================================================*\
+* Worker threads
+\*=========================================================================*/
+static void *worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    for ( ;; ) {
+        p_job job;
+        double wait;
+        while (!first && !stopping) {
+            idle++;
+            pthread_cond_wait(&wakeup, &lock);
+            idle--;
+        }
+        if (stopping) break;
+        job = first;
+        first = job->next;
+        if (!first) last = NULL;
+        depth--;
+        job->state = ASYNC_RUNNING;
+        job->started = timeout_gettime();
+        wait = job->started - job->queued;
+        stats.wait += wait;
+        if (wait > stats.maxwait) stats.maxwait = wait;
+        pthread_mutex_unlock(&lock);
+        job->run(job);
+        job->finished = timeout_gettime();
+        pthread_mutex_lock(&lock);
+        stats.completed++;
+        stats.run += job->finished - job->started;
+        __atomic_store_n(&job->state, ASYNC_DONE, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&lock);
+        if (job->done) event_signal(job->done);
+        async_release(job);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Stops all workers once the last Lua state using the library is closed.
+* Jobs still queued are canceled.
+\*-------------------------------------------------------------------------*/
+static int global_shutdown(lua_State *L) {
+    int i, n;
+    p_job job;
+    (void) L;
+    pthread_mutex_lock(&lock);
+    if (--users > 0) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    stopping = 1;
+    n = nthreads;
+    pthread_cond_broadcast(&wakeup);
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_lock(&lock);
+    nthreads = 0;
+    stopping = 0;
+    while ((job = first) != NULL) {
+        first = job->next;
+        depth--;
+        job->state = ASYNC_CANCELED;
+        if (job->done) event_signal(job->done);
+        async_release(job);
+    }
+    last = NULL;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/*=========================================================================*\
+* Global Lua functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Returns a table with pool statistics
+\*-------------------------------------------------------------------------*/
+static void setnumber(lua_State *L, const char *name, double value) {
+    lua_pushnumber(L, value);
+    lua_setfield(L, -2, name);
+}
+
+static int global_stats(lua_State *L) {
+    size_t started;
+    lua_newtable(L);
+    pthread_mutex_lock(&lock);
+    started = stats.submitted - stats.canceled - depth;
+    setnumber(L, "threads", nthreads);
+    setnumber(L, "idle", idle);
+    setnumber(L, "depth", (double) depth);
+    setnumber(L, "maxdepth", (double) stats.peak);
+    setnumber(L, "submitted", (double) stats.submitted);
+    setnumber(L, "completed", (double) stats.completed);
+    setnumber(L, "canceled", (double) stats.canceled);
+    setnumber(L, "rejected", (double) stats.rejected);
+    setnumber(L, "wait", started > 0? stats.wait/started: 0.0);
+    setnumber(L, "maxwait", stats.maxwait);
+    setnumber(L, "run", stats.completed > 0? stats.run/stats.completed: 0.0);
+    pthread_mutex_unlock(&lock);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Changes the number of worker threads and the size of the queue
+\*-------------------------------------------------------------------------*/
+static int global_setlimits(lua_State *L) {
+    int limit = luaL_optint(L, 1, maxthreads);
+    int queue = luaL_optint(L, 2, (int) maxdepth);
+    luaL_argcheck(L, limit > 0 && limit <= ASYNC_MAXTHREADS, 1,
+        "invalid number of threads");
+    luaL_argcheck(L, queue > 0, 2, "invalid queue size");
+    pthread_mutex_lock(&lock);
+    /* threads already running are kept until the library is unloaded */
+    if (limit > maxthreads) maxthreads = limit;
+    maxdepth = (size_t) queue;
+    pthread_mutex_unlock(&lock);
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Waits for the job to finish and returns its results
+\*-------------------------------------------------------------------------*/
+static int meth_result(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    p_job job = obj->job;
+    if (!job) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    timeout_markstart(&obj->tm);
+    while (!async_isdone(job)) {
+        int err = event_wait(job->done, &obj->tm);
+        if (err != IO_DONE) {
+            lua_pushnil(L);
+            lua_pushstring(L, socket_strerror(err));
+            return 2;
+        }
+    }
+    if (job->state == ASYNC_CANCELED) {
+        lua_pushnil(L);
+        lua_pushstring(L, "canceled");
+        return 2;
+    }
+    return obj->push(L, job);
+}
+
+/*-------------------------------------------------------------------------*\
+* Cancels a job that has not started yet
+\*-------------------------------------------------------------------------*/
+static int meth_cancel(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    if (obj->job && async_cancel(obj->job)) {
+        lua_pushnumber(L, 1);
+        return 1;
+    }
+    lua_pushnil(L);
+    lua_pushstring(L, obj->job && obj->job->state == ASYNC_RUNNING?
+        "running": "done");
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Drops our reference to the job, canceling it if it is still queued
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    if (obj->job) {
+        async_cancel(obj->job);
+        async_release(obj->job);
+        obj->job = NULL;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Just call tm methods
+\*-------------------------------------------------------------------------*/
+static int meth_settimeout(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    return timeout_meth_settimeout(L, &obj->tm);
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    lua_pushnumber(L, obj->job? (int) event_getfd(obj->job->done):
+        (int) SOCKET_INVALID);
+    return 1;
+}
+
+static int meth_dirty(lua_State *L) {
+    p_jobobj obj = (p_jobobj) auxiliar_checkclass(L, "async{job}", 1);
+    lua_pushboolean(L, obj->job && async_isdone(obj->job));
+    return 1;
+}
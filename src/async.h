@@ -0,0 +1,67 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+/*=========================================================================*\
+* Background execution of blocking calls
+* LuaSocket toolkit
+*
+* Some system calls, most notably the resolver, block for as long as they
+* please and cannot be made non-blocking. This module keeps a small pool
+* of worker threads that run such calls on behalf of Lua code, so that a
+* slow name server does not stall every other connection in the process.
+*
+* A job is a C structure that embeds t_job as its first member. The
+* worker thread calls its run function, and then raises the job's done
+* event. Jobs are reference counted because both the queue and the Lua
+* object that represents them may be the last to let go.
+*
+* The queue is bounded. Submitting to a full queue fails immediately
+* rather than piling up work that would complete too late to matter.
+* The module keeps statistics on queue depth and on how long jobs wait
+* before a worker picks them up.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "event.h"
+#include "timeout.h"
+
+/* job states */
+enum {
+    ASYNC_QUEUED = 0,       /* waiting for a worker */
+    ASYNC_RUNNING,          /* a worker is running it */
+    ASYNC_DONE,             /* finished, results are available */
+    ASYNC_CANCELED          /* removed from the queue before running */
+};
+
+typedef struct t_job_ t_job;
+typedef t_job *p_job;
+
+/* runs the blocking call, in a worker thread */
+typedef void (*p_jobrun)(p_job job);
+/* frees whatever the job owns, in whatever thread drops the last ref */
+typedef void (*p_jobfree)(p_job job);
+/* pushes the results of a finished job, in the Lua thread */
+typedef int (*p_jobpush)(lua_State *L, p_job job);
+
+struct t_job_ {
+    p_jobrun run;           /* the blocking call */
+    p_jobfree free;         /* destructor */
+    p_event done;           /* raised when state changes to done */
+    int state;              /* one of the states above */
+    int refs;               /* references held by queue and Lua objects */
+    double queued;          /* time the job was submitted */
+    double started;         /* time a worker picked it up */
+    double finished;        /* time it completed */
+    p_job next;             /* queue link */
+};
+
+int async_open(lua_State *L);
+void async_init(p_job job, p_jobrun run, p_jobfree free, p_event done);
+int async_submit(p_job job);
+int async_cancel(p_job job);
+void async_release(p_job job);
+int async_pushjob(lua_State *L, p_job job, p_jobpush push);
+
+#define async_isdone(job) \
+    (__atomic_load_n(&(job)->state, __ATOMIC_ACQUIRE) >= ASYNC_DONE)
+
+#endif /* ASYNC_H */
@@ -2,6 +2,8 @@
 * Input/Output interface for Lua programs
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <string.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 
@@ -13,9 +15,21 @@
 static int recvraw(p_buffer buf, size_t wanted, luaL_Buffer *b);
 static int recvline(p_buffer buf, luaL_Buffer *b);
 static int recvall(p_buffer buf, luaL_Buffer *b);
+static int recvblock(p_buffer buf, luaL_Buffer *b);
+static const char *lineend(const char *p, const char *eol);
+static int parseheaders(lua_State *L, const char *data, size_t size, int t);
+static int recvsizeline(p_buffer buf, const char **line, size_t *len);
+static int skipline(p_buffer buf);
+static int parsesize(const char *line, size_t len, size_t *size);
+static int peekchunk(p_buffer buf, size_t *len, size_t *size);
+static int recvhead(p_buffer buf, size_t *len);
 static int buffer_get(p_buffer buf, const char **data, size_t *count);
 static void buffer_skip(p_buffer buf, size_t count);
 static int sendraw(p_buffer buf, const char *data, size_t count, size_t *sent);
+static int global_serializeheaders(lua_State *L);
+static void checkheaders(lua_State *L, int t, int names);
+static size_t headerssize(lua_State *L, int t, int names);
+static void writeheaders(lua_State *L, int t, int names, char *p);
 
 /* min and max macros */
 #ifndef MIN
@@ -31,11 +45,40 @@ static int sendraw(p_buffer buf, const char *data, size_t count, size_t *sent);
 /*-------------------------------------------------------------------------*\
 * Initializes module
 \*-------------------------------------------------------------------------*/
+/* lower case of each byte, for header names */
+static unsigned char lower[256];
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"serializeheaders", global_serializeheaders},
+    {NULL, NULL}
+};
+
 int buffer_open(lua_State *L) {
-    (void) L;
+    int i;
+    for (i = 0; i < 256; i++)
+        lower[i] = (unsigned char) (i >= 'A' && i <= 'Z' ? i - 'A' + 'a' : i);
+    luaL_openlib(L, NULL, func, 0);
     return 0;
 }
 
+/*-------------------------------------------------------------------------*\
+* Serializes a table of headers into a block ready to send
+* block = serializeheaders(headers [, canonic])
+\*-------------------------------------------------------------------------*/
+static int global_serializeheaders(lua_State *L) {
+    char small[1024];
+    char *block = small;
+    size_t size;
+    checkheaders(L, 1, 2);
+    size = headerssize(L, 1, 2);
+    /* as in sendheaders, only large blocks need a scratch userdatum */
+    if (size > sizeof(small)) block = (char *) lua_newuserdata(L, size);
+    writeheaders(L, 1, 2, block);
+    lua_pushlstring(L, block, size);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Initializes C structure 
 \*-------------------------------------------------------------------------*/
@@ -103,6 +146,33 @@ int buffer_meth_send(lua_State *L, p_buffer buf) {
     return lua_gettop(L) - top;
 }
 
+/*-------------------------------------------------------------------------*\
+* object:sendheaders() interface
+* Sends a block of headers, serialized as by serializeheaders, in a single
+* write. Returns like send, counting bytes of the block
+* sent, err, partial = object:sendheaders(headers [, canonic])
+\*-------------------------------------------------------------------------*/
+int buffer_meth_sendheaders(lua_State *L, p_buffer buf) {
+    char small[1024];
+    char *block = small;
+    size_t size, sent = 0;
+    int err;
+    checkheaders(L, 2, 3);
+    size = headerssize(L, 2, 3);
+    /* large blocks are rare, and go through a Lua userdatum */
+    if (size > sizeof(small)) block = (char *) lua_newuserdata(L, size);
+    writeheaders(L, 2, 3, block);
+    err = sendraw(buf, block, size, &sent);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        lua_pushnumber(L, sent);
+        return 3;
+    }
+    lua_pushnumber(L, sent);
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * object:receive() interface
 \*-------------------------------------------------------------------------*/
@@ -154,6 +224,175 @@ int buffer_meth_receive(lua_State *L, p_buffer buf) {
     return lua_gettop(L) - top;
 }
 
+/*-------------------------------------------------------------------------*\
+* object:receiveheaders() interface
+* Reads MIME headers up to the blank line that ends them, unfolding
+* continuation lines and joining repeated fields with commas. Names are
+* lower cased. Fills the optional table argument, or a new one.
+\*-------------------------------------------------------------------------*/
+int buffer_meth_receiveheaders(lua_State *L, p_buffer buf) {
+    int err, top;
+    luaL_Buffer b;
+    size_t size;
+    const char *data;
+    if (lua_isnoneornil(L, 2)) {
+        lua_settop(L, 1);
+        lua_newtable(L);
+    } else {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_settop(L, 2);
+    }
+    top = lua_gettop(L);
+    luaL_buffinit(L, &b);
+    err = recvblock(buf, &b);
+    luaL_pushresult(&b);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        return 2;
+    }
+    data = lua_tolstring(L, -1, &size);
+    if (!parseheaders(L, data, size, top)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "malformed reponse headers");
+        return 2;
+    }
+    lua_settop(L, top);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* object:receivechunk() interface
+* Decodes the next chunk of an HTTP chunked body. Further chunks that are
+* already complete in the buffer are appended, as long as the result is
+* shorter than the optional coalesce size. After the last chunk, trailers
+* go into the optional headers table and the method returns nil.
+\*-------------------------------------------------------------------------*/
+int buffer_meth_receivechunk(lua_State *L, p_buffer buf) {
+    int err, top;
+    luaL_Buffer b;
+    const char *line;
+    size_t len, size, total = 0;
+    size_t coalesce = (size_t) luaL_optnumber(L, 3, 0);
+    if (lua_isnoneornil(L, 2)) {
+        lua_settop(L, 1);
+        lua_newtable(L);
+    } else {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_settop(L, 2);
+    }
+    top = lua_gettop(L);
+    luaL_buffinit(L, &b);
+    err = recvsizeline(buf, &line, &len);
+    if (err != IO_DONE) {
+        luaL_pushresult(&b);
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        return 2;
+    }
+    if (!line || !parsesize(line, len, &size)) {
+        if (line) buffer_skip(buf, len+1);
+        luaL_pushresult(&b);
+        lua_pushnil(L);
+        lua_pushliteral(L, "invalid chunk size");
+        return 2;
+    }
+    buffer_skip(buf, len+1);
+    while (size > 0) {
+        /* chunk data, and whatever is left on its line */
+        err = recvraw(buf, size, &b);
+        if (err == IO_DONE) err = skipline(buf);
+        if (err != IO_DONE) {
+            luaL_pushresult(&b);
+            lua_pushnil(L);
+            lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+            return 2;
+        }
+        total += size;
+        /* never wait for more data while holding some */
+        if (total >= coalesce || !peekchunk(buf, &len, &size)) {
+            luaL_pushresult(&b);
+            return 1;
+        }
+        buffer_skip(buf, len+1);
+    }
+    /* last chunk, read trailers */
+    luaL_pushresult(&b);
+    lua_pop(L, 1);
+    luaL_buffinit(L, &b);
+    err = recvblock(buf, &b);
+    luaL_pushresult(&b);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        return 2;
+    }
+    line = lua_tolstring(L, -1, &len);
+    if (!parseheaders(L, line, len, top)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "malformed reponse headers");
+        return 2;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* object:receiverequest() interface
+* Reads the request line and headers of an HTTP request. Nothing is taken
+* from the buffer until the whole head has arrived, so a timeout can be
+* followed by another call once more data is available. Fills the
+* optional table argument with the headers, or a new one.
+* method, target, version, headers = object:receiverequest([headers])
+\*-------------------------------------------------------------------------*/
+int buffer_meth_receiverequest(lua_State *L, p_buffer buf) {
+    int err, top;
+    size_t len;
+    const char *data, *end, *eol, *sp1, *sp2;
+    if (lua_isnoneornil(L, 2)) {
+        lua_settop(L, 1);
+        lua_newtable(L);
+    } else {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_settop(L, 2);
+    }
+    top = lua_gettop(L);
+    err = recvhead(buf, &len);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        if (err == IO_UNKNOWN) lua_pushliteral(L, "request too large");
+        else lua_pushstring(L, buf->io->error(buf->io->ctx, err));
+        return 2;
+    }
+    data = buf->data + buf->first;
+    end = data + len;
+    /* request line: method SP target SP version */
+    eol = memchr(data, '\n', len);
+    sp1 = memchr(data, ' ', eol - data);
+    sp2 = sp1 ? memchr(sp1 + 1, ' ', eol - sp1 - 1) : NULL;
+    if (!sp1 || sp1 == data || !sp2 || sp2 == sp1 + 1 ||
+            lineend(sp2, eol) - sp2 < 6 || strncmp(sp2 + 1, "HTTP/", 5) != 0) {
+        buffer_skip(buf, len);
+        lua_pushnil(L);
+        lua_pushliteral(L, "bad request");
+        return 2;
+    }
+    lua_pushlstring(L, data, sp1 - data);
+    lua_pushlstring(L, sp1 + 1, sp2 - sp1 - 1);
+    lua_pushlstring(L, sp2 + 1, lineend(sp2, eol) - sp2 - 1);
+    /* headers, up to the empty line that ends them */
+    end = lineend(data, end - 1);
+    if (!parseheaders(L, eol + 1, end - eol - 1, top)) {
+        buffer_skip(buf, len);
+        lua_pushnil(L);
+        lua_pushliteral(L, "bad request");
+        return 2;
+    }
+    buffer_skip(buf, len);
+    lua_pushvalue(L, top);
+    return 4;
+}
+
 /*-------------------------------------------------------------------------*\
 * Determines if there is any data in the read buffer
 \*-------------------------------------------------------------------------*/
@@ -164,6 +403,76 @@ int buffer_isempty(p_buffer buf) {
 /*=========================================================================*\
 * Internal functions
 \*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Header serialization. Names are looked up in the canonic table, if one
+* is given, and values may be strings or numbers. The table is walked
+* twice, once to size the block and once to write it, so the block is
+* built without intermediate strings
+\*-------------------------------------------------------------------------*/
+static void checkheaders(lua_State *L, int t, int names) {
+    luaL_checktype(L, t, LUA_TTABLE);
+    if (lua_isnoneornil(L, names)) {
+        lua_settop(L, t);
+        lua_pushnil(L);
+    } else {
+        luaL_checktype(L, names, LUA_TTABLE);
+        lua_settop(L, names);
+    }
+}
+
+/* pushes the name to send for the key at the top of the stack */
+static const char *headername(lua_State *L, int names, size_t *len) {
+    if (lua_type(L, -2) != LUA_TSTRING)
+        luaL_error(L, "invalid header name");
+    if (!lua_isnil(L, names)) {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, names);
+        if (lua_type(L, -1) == LUA_TSTRING) return lua_tolstring(L, -1, len);
+        lua_pop(L, 1);
+    }
+    lua_pushvalue(L, -2);
+    return lua_tolstring(L, -1, len);
+}
+
+static const char *headervalue(lua_State *L, size_t *len) {
+    /* lua_tolstring would turn a number key into a string and confuse
+     * lua_next, but values are safe */
+    if (lua_type(L, -2) != LUA_TSTRING && lua_type(L, -2) != LUA_TNUMBER) {
+        lua_pushvalue(L, -3);
+        luaL_error(L, "invalid value for header '%s'", lua_tostring(L, -1));
+    }
+    return lua_tolstring(L, -2, len);
+}
+
+static size_t headerssize(lua_State *L, int t, int names) {
+    size_t size = 2, len;
+    lua_pushnil(L);
+    while (lua_next(L, t)) {
+        headername(L, names, &len);
+        size += len + 4;
+        headervalue(L, &len);
+        size += len;
+        lua_pop(L, 2);
+    }
+    return size;
+}
+
+static void writeheaders(lua_State *L, int t, int names, char *p) {
+    const char *s;
+    size_t len;
+    lua_pushnil(L);
+    while (lua_next(L, t)) {
+        s = headername(L, names, &len);
+        memcpy(p, s, len); p += len;
+        *p++ = ':'; *p++ = ' ';
+        s = headervalue(L, &len);
+        memcpy(p, s, len); p += len;
+        *p++ = '\r'; *p++ = '\n';
+        lua_pop(L, 2);
+    }
+    *p++ = '\r'; *p++ = '\n';
+}
+
 /*-------------------------------------------------------------------------*\
 * Sends a block of data (unbuffered)
 \*-------------------------------------------------------------------------*/
@@ -245,6 +554,228 @@ static int recvline(p_buffer buf, luaL_Buffer *b) {
     return err;
 }
 
+/*-------------------------------------------------------------------------*\
+* Reads lines up to and excluding the first empty one. Lines keep their
+* LF, CRs are discarded. Each buffer refill is scanned once, and copied
+* in runs rather than one character at a time
+\*-------------------------------------------------------------------------*/
+static int recvblock(p_buffer buf, luaL_Buffer *b) {
+    int err = IO_DONE;
+    int bol = 1; /* at the beginning of a line */
+    while (err == IO_DONE) {
+        size_t count, pos, run; const char *data;
+        err = buffer_get(buf, &data, &count);
+        pos = run = 0;
+        while (pos < count) {
+            char c = data[pos];
+            if (c == '\r') {
+                luaL_addlstring(b, data+run, pos-run);
+                run = pos+1;
+            } else if (c == '\n') {
+                if (bol) {
+                    luaL_addlstring(b, data+run, pos-run);
+                    buffer_skip(buf, pos+1);
+                    return IO_DONE;
+                }
+                bol = 1;
+            } else bol = 0;
+            pos++;
+        }
+        luaL_addlstring(b, data+run, pos-run);
+        buffer_skip(buf, pos);
+    }
+    return err;
+}
+
+/*-------------------------------------------------------------------------*\
+* Stores the fields of a header block in the table at index t. Lines end
+* in LF, optionally preceded by CR. Returns 0 if a line is not a field or
+* a continuation
+\*-------------------------------------------------------------------------*/
+#define isspace_(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || \
+    (c) == '\v' || (c) == '\f' || (c) == '\r')
+
+/* end of the text from p to the LF at eol, without a CR before it */
+static const char *lineend(const char *p, const char *eol) {
+    return eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+}
+
+static int parseheaders(lua_State *L, const char *data, size_t size, int t) {
+    const char *p = data, *end = data + size;
+    while (p < end) {
+        luaL_Buffer b;
+        const char *eol = memchr(p, '\n', end - p);
+        const char *colon = memchr(p, ':', eol - p);
+        if (!colon || isspace_(*p)) return 0;
+        /* field name, lower cased */
+        luaL_buffinit(L, &b);
+        while (p < colon) luaL_addchar(&b, (char) lower[(unsigned char) *p++]);
+        luaL_pushresult(&b);
+        /* value, with continuation lines appended as they are */
+        p = colon + 1;
+        while (p < eol && isspace_(*p)) p++;
+        luaL_buffinit(L, &b);
+        luaL_addlstring(&b, p, lineend(p, eol) - p);
+        p = eol + 1;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            eol = memchr(p, '\n', end - p);
+            luaL_addlstring(&b, p, lineend(p, eol) - p);
+            p = eol + 1;
+        }
+        luaL_pushresult(&b);
+        /* repeated fields are joined */
+        lua_pushvalue(L, -2);
+        lua_rawget(L, t);
+        if (!lua_isnil(L, -1)) {
+            lua_pushliteral(L, ", ");
+            lua_pushvalue(L, -3);
+            lua_concat(L, 3);
+            lua_replace(L, -2);
+        } else lua_pop(L, 1);
+        lua_rawset(L, t);
+    }
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Makes sure a whole line is in the buffer, reading more and moving what
+* is there to the front if needed. Returns the line without its LF, or a
+* null line if it does not fit in the buffer
+\*-------------------------------------------------------------------------*/
+static int recvsizeline(p_buffer buf, const char **line, size_t *len) {
+    p_io io = buf->io;
+    for ( ;; ) {
+        size_t got;
+        int err;
+        const char *data = buf->data + buf->first;
+        const char *eol = memchr(data, '\n', buf->last - buf->first);
+        if (eol) {
+            *line = data;
+            *len = eol - data;
+            return IO_DONE;
+        }
+        if (buf->first > 0) {
+            memmove(buf->data, data, buf->last - buf->first);
+            buf->last -= buf->first;
+            buf->first = 0;
+        }
+        if (buf->last >= BUF_SIZE) {
+            *line = NULL;
+            return IO_DONE;
+        }
+        err = io->recv(io->ctx, buf->data + buf->last, BUF_SIZE - buf->last,
+            &got, buf->tm);
+        buf->last += got;
+        if (err != IO_DONE) return err;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Makes sure the buffer holds a whole request head, that is, lines up to
+* an empty one. Empty lines before the request line are discarded. Returns
+* IO_UNKNOWN if the head does not fit in the buffer
+\*-------------------------------------------------------------------------*/
+static int recvhead(p_buffer buf, size_t *len) {
+    p_io io = buf->io;
+    size_t scanned = 0;
+    for ( ;; ) {
+        size_t got;
+        int err;
+        const char *data = buf->data + buf->first, *p;
+        size_t count = buf->last - buf->first;
+        while (count > 0 && (*data == '\r' || *data == '\n')) {
+            buffer_skip(buf, 1);
+            data = buf->data + buf->first;
+            count = buf->last - buf->first;
+            scanned = 0;
+        }
+        /* resume the search where the last one stopped */
+        p = data + scanned;
+        while ((p = memchr(p, '\n', count - (p - data))) != NULL) {
+            size_t left = count - (p - data) - 1;
+            if (left >= 1 && p[1] == '\n') {
+                *len = p - data + 2;
+                return IO_DONE;
+            }
+            if (left >= 2 && p[1] == '\r' && p[2] == '\n') {
+                *len = p - data + 3;
+                return IO_DONE;
+            }
+            /* the end may be split between reads */
+            if (left < 2) break;
+            p++;
+        }
+        scanned = p ? (size_t) (p - data) : count;
+        if (buf->first > 0) {
+            memmove(buf->data, data, count);
+            buf->last = count;
+            buf->first = 0;
+        }
+        if (buf->last >= BUF_SIZE) return IO_UNKNOWN;
+        err = io->recv(io->ctx, buf->data + buf->last, BUF_SIZE - buf->last,
+            &got, buf->tm);
+        buf->last += got;
+        if (err != IO_DONE) return err;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Discards everything up to and including the next LF
+\*-------------------------------------------------------------------------*/
+static int skipline(p_buffer buf) {
+    int err = IO_DONE;
+    while (err == IO_DONE) {
+        size_t count; const char *data, *eol;
+        err = buffer_get(buf, &data, &count);
+        eol = memchr(data, '\n', count);
+        if (eol) {
+            buffer_skip(buf, eol - data + 1);
+            return IO_DONE;
+        }
+        buffer_skip(buf, count);
+    }
+    return err;
+}
+
+/*-------------------------------------------------------------------------*\
+* Reads the hexadecimal size at the start of a chunk line. Extensions
+* after a semicolon are ignored
+\*-------------------------------------------------------------------------*/
+static int parsesize(const char *line, size_t len, size_t *size) {
+    const char *p = line, *end = line + len;
+    size_t value = 0;
+    int digits = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    for ( ; p < end; p++, digits++) {
+        int d;
+        if (*p >= '0' && *p <= '9') d = *p - '0';
+        else if (*p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+        else break;
+        if (value > ((size_t) -1 - d) / 16) return 0;
+        value = value*16 + d;
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if (!digits || (p < end && *p != ';')) return 0;
+    *size = value;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Checks if the buffer holds a whole chunk that is not the last one,
+* with its size line and the line end after its data
+\*-------------------------------------------------------------------------*/
+static int peekchunk(p_buffer buf, size_t *len, size_t *size) {
+    const char *data = buf->data + buf->first;
+    size_t count = buf->last - buf->first;
+    const char *eol = memchr(data, '\n', count);
+    if (!eol) return 0;
+    *len = eol - data;
+    if (!parsesize(data, *len, size) || *size == 0) return 0;
+    if (*size > count - *len - 1) return 0;
+    return memchr(eol + 1 + *size, '\n', count - *len - 1 - *size) != NULL;
+}
+
 /*-------------------------------------------------------------------------*\
 * Skips a given number of bytes from read buffer. No data is read from the
 * transport layer
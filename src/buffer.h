@@ -37,7 +37,11 @@ typedef t_buffer *p_buffer;
 int buffer_open(lua_State *L);
 void buffer_init(p_buffer buf, p_io io, p_timeout tm);
 int buffer_meth_send(lua_State *L, p_buffer buf);
+int buffer_meth_sendheaders(lua_State *L, p_buffer buf);
 int buffer_meth_receive(lua_State *L, p_buffer buf);
+int buffer_meth_receiveheaders(lua_State *L, p_buffer buf);
+int buffer_meth_receivechunk(lua_State *L, p_buffer buf);
+int buffer_meth_receiverequest(lua_State *L, p_buffer buf);
 int buffer_meth_getstats(lua_State *L, p_buffer buf);
 int buffer_meth_setstats(lua_State *L, p_buffer buf);
 int buffer_isempty(p_buffer buf);
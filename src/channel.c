@@ -0,0 +1,537 @@
+/*=========================================================================*\
+* Message channels between Lua states
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "auxiliar.h"
+#include "socket.h"
+#include "channel.h"
+
+/* largest number of slots a channel can have */
+#define CHANNEL_MAXSIZE (1 << 24)
+
+/* tags of serialized values */
+enum {
+    MSG_FALSE = 0,
+    MSG_TRUE,
+    MSG_NUMBER,
+    MSG_STRING,
+    MSG_TABLE
+};
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int meth_send(lua_State *L);
+static int meth_receive(lua_State *L);
+static int meth_close(lua_State *L);
+static int meth_settimeout(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_dirty(lua_State *L);
+static int meth_getstats(lua_State *L);
+
+static p_chanstate chanstate_acquire(const char *name, size_t size,
+        int spsc, int *err);
+static void chanstate_release(p_chanstate s);
+static int chanstate_send(p_chanstate s, p_message msg, p_timeout tm);
+static int chanstate_receive(p_chanstate s, p_message *msg, p_timeout tm);
+static int chanstate_isempty(p_chanstate s);
+static p_message message_pack(lua_State *L, int idx);
+static void message_unpack(lua_State *L, p_message msg);
+
+/* channel object methods */
+static luaL_Reg channel_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"close",       meth_close},
+    {"dirty",       meth_dirty},
+    {"getfd",       meth_getfd},
+    {"getstats",    meth_getstats},
+    {"receive",     meth_receive},
+    {"send",        meth_send},
+    {"settimeout",  meth_settimeout},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"channel",     global_create},
+    {NULL,          NULL}
+};
+
+/* registry of named channels, shared by all Lua states in the process */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static p_chanstate registry = NULL;
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int channel_open(lua_State *L) {
+    auxiliar_newclass(L, "channel{client}", channel_methods);
+    auxiliar_add2group(L, "channel{client}", "channel{any}");
+    luaL_openlib(L, NULL, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Queues a value, waiting for a free slot if the channel is full
+\*-------------------------------------------------------------------------*/
+static int meth_send(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkclass(L, "channel{client}", 1);
+    p_message msg;
+    int err;
+    luaL_checkany(L, 2);
+    if (!ch->state) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    msg = message_pack(L, 2);
+    err = chanstate_send(ch->state, msg, timeout_markstart(&ch->tm));
+    if (err != IO_DONE) {
+        free(msg);
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Dequeues a value, waiting for one to arrive if the channel is empty
+\*-------------------------------------------------------------------------*/
+static int meth_receive(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkclass(L, "channel{client}", 1);
+    p_message msg = NULL;
+    int err;
+    if (!ch->state) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    err = chanstate_receive(ch->state, &msg, timeout_markstart(&ch->tm));
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    message_unpack(L, msg);
+    free(msg);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Drops our reference to the channel
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkgroup(L, "channel{any}", 1);
+    if (ch->state) {
+        chanstate_release(ch->state);
+        ch->state = NULL;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Just call tm methods
+\*-------------------------------------------------------------------------*/
+static int meth_settimeout(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkgroup(L, "channel{any}", 1);
+    return timeout_meth_settimeout(L, &ch->tm);
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkgroup(L, "channel{any}", 1);
+    lua_pushnumber(L, ch->state ? (int) event_getfd(&ch->state->readable):
+        (int) SOCKET_INVALID);
+    return 1;
+}
+
+static int meth_dirty(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkgroup(L, "channel{any}", 1);
+    lua_pushboolean(L, ch->state && !chanstate_isempty(ch->state));
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns number of messages received, sent, and currently queued
+\*-------------------------------------------------------------------------*/
+static int meth_getstats(lua_State *L) {
+    p_channel ch = (p_channel) auxiliar_checkgroup(L, "channel{any}", 1);
+    p_chanstate s = ch->state;
+    size_t head, tail;
+    if (!s) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    head = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&s->tail, __ATOMIC_RELAXED);
+    lua_pushnumber(L, (lua_Number) __atomic_load_n(&s->received,
+        __ATOMIC_RELAXED));
+    lua_pushnumber(L, (lua_Number) __atomic_load_n(&s->sent,
+        __ATOMIC_RELAXED));
+    lua_pushnumber(L, (lua_Number) (tail > head ? tail - head : 0));
+    return 3;
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Opens a channel by name, creating it if needed. Channels without a name
+* are private to the object returned, and to whatever it is passed to.
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    static const char *modes[] = { "mpmc", "spsc", NULL };
+    const char *name = luaL_optstring(L, 1, NULL);
+    int size = luaL_optint(L, 2, 64);
+    int spsc = luaL_checkoption(L, 3, "mpmc", modes);
+    int err = IO_DONE;
+    p_chanstate s;
+    p_channel ch;
+    luaL_argcheck(L, size > 0 && size <= CHANNEL_MAXSIZE, 2,
+        "invalid channel size");
+    s = chanstate_acquire(name, (size_t) size, spsc, &err);
+    if (!s) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    ch = (p_channel) lua_newuserdata(L, sizeof(t_channel));
+    auxiliar_setclass(L, "channel{client}", -1);
+    ch->state = s;
+    timeout_init(&ch->tm, -1, -1);
+    return 1;
+}
+
+/*=========================================================================*\
+* Shared channel state
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Finds a channel in the registry, or creates a new one
+\*-------------------------------------------------------------------------*/
+static p_chanstate chanstate_acquire(const char *name, size_t size,
+        int spsc, int *err) {
+    p_chanstate s;
+    size_t i, capacity = 2;
+    pthread_mutex_lock(&registry_lock);
+    if (name) {
+        for (s = registry; s; s = s->next) {
+            if (strcmp(s->name, name) == 0) {
+                s->refs++;
+                pthread_mutex_unlock(&registry_lock);
+                return s;
+            }
+        }
+    }
+    while (capacity < size) capacity <<= 1;
+    s = (p_chanstate) calloc(1, sizeof(t_chanstate));
+    if (s) s->slots = (p_slot) malloc(capacity*sizeof(t_slot));
+    if (s && name) s->name = (char *) malloc(strlen(name)+1);
+    if (!s || !s->slots || (name && !s->name)) goto nomem;
+    if ((*err = event_init(&s->readable)) != IO_DONE) goto fail;
+    if ((*err = event_init(&s->writable)) != IO_DONE) {
+        event_destroy(&s->readable);
+        goto fail;
+    }
+    for (i = 0; i < capacity; i++) {
+        s->slots[i].seq = i;
+        s->slots[i].msg = NULL;
+    }
+    s->mask = capacity-1;
+    s->spsc = spsc;
+    s->refs = 1;
+    if (name) {
+        strcpy(s->name, name);
+        s->next = registry;
+        registry = s;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return s;
+nomem:
+    *err = ENOMEM;
+fail:
+    if (s) {
+        free(s->slots);
+        free(s->name);
+        free(s);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Drops a reference, destroying the channel when there are none left
+\*-------------------------------------------------------------------------*/
+static void chanstate_release(p_chanstate s) {
+    p_message msg;
+    pthread_mutex_lock(&registry_lock);
+    if (--s->refs > 0) {
+        pthread_mutex_unlock(&registry_lock);
+        return;
+    }
+    if (s->name) {
+        p_chanstate *link = &registry;
+        while (*link != s) link = &(*link)->next;
+        *link = s->next;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    while ((msg = s->slots[s->head & s->mask].msg) != NULL &&
+            s->slots[s->head & s->mask].seq == s->head+1) {
+        free(msg);
+        s->head++;
+    }
+    event_destroy(&s->readable);
+    event_destroy(&s->writable);
+    free(s->slots);
+    free(s->name);
+    free(s);
+}
+
+/*-------------------------------------------------------------------------*\
+* Lock-free enqueue. Returns 0 if the channel is full.
+\*-------------------------------------------------------------------------*/
+static int chanstate_trysend(p_chanstate s, p_message msg) {
+    size_t pos = __atomic_load_n(&s->tail, __ATOMIC_RELAXED);
+    p_slot slot;
+    for ( ;; ) {
+        long diff;
+        slot = &s->slots[pos & s->mask];
+        diff = (long) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            /* slot is free. with a single producer, it is ours */
+            if (s->spsc) {
+                __atomic_store_n(&s->tail, pos+1, __ATOMIC_RELAXED);
+                break;
+            }
+            if (__atomic_compare_exchange_n(&s->tail, &pos, pos+1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return 0;
+        } else pos = __atomic_load_n(&s->tail, __ATOMIC_RELAXED);
+    }
+    slot->msg = msg;
+    __atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&s->sent, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Lock-free dequeue. Returns NULL if the channel is empty.
+\*-------------------------------------------------------------------------*/
+static p_message chanstate_tryreceive(p_chanstate s) {
+    size_t pos = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    p_slot slot;
+    p_message msg;
+    for ( ;; ) {
+        long diff;
+        slot = &s->slots[pos & s->mask];
+        diff = (long) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)-(pos+1));
+        if (diff == 0) {
+            if (s->spsc) {
+                __atomic_store_n(&s->head, pos+1, __ATOMIC_RELAXED);
+                break;
+            }
+            if (__atomic_compare_exchange_n(&s->head, &pos, pos+1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return NULL;
+        } else pos = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    }
+    msg = slot->msg;
+    slot->msg = NULL;
+    __atomic_store_n(&slot->seq, pos+s->mask+1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&s->received, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+/*-------------------------------------------------------------------------*\
+* Checks if there is a message ready to be received
+\*-------------------------------------------------------------------------*/
+static int chanstate_isempty(p_chanstate s) {
+    size_t pos = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    return __atomic_load_n(&s->slots[pos & s->mask].seq, __ATOMIC_ACQUIRE)
+        != pos+1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Enqueue with timeout
+\*-------------------------------------------------------------------------*/
+static int chanstate_send(p_chanstate s, p_message msg, p_timeout tm) {
+    for ( ;; ) {
+        int err;
+        if (chanstate_trysend(s, msg)) break;
+        /* clear before checking again, or we could miss a wake-up */
+        event_clear(&s->writable);
+        if (chanstate_trysend(s, msg)) break;
+        if ((err = event_wait(&s->writable, tm)) != IO_DONE) return err;
+    }
+    event_signal(&s->readable);
+    return IO_DONE;
+}
+
+/*-------------------------------------------------------------------------*\
+* Dequeue with timeout
+\*-------------------------------------------------------------------------*/
+static int chanstate_receive(p_chanstate s, p_message *msg, p_timeout tm) {
+    for ( ;; ) {
+        int err;
+        if ((*msg = chanstate_tryreceive(s)) != NULL) break;
+        event_clear(&s->readable);
+        if ((*msg = chanstate_tryreceive(s)) != NULL) break;
+        if ((err = event_wait(&s->readable, tm)) != IO_DONE) return err;
+    }
+    if (chanstate_isempty(s)) {
+        /* keep select from reporting an empty channel as readable */
+        if (event_israised(&s->readable)) {
+            event_clear(&s->readable);
+            if (!chanstate_isempty(s)) event_signal(&s->readable);
+        }
+    /* other consumers may have been sleeping on the wake-up we just ate */
+    } else if (!s->spsc) event_signal(&s->readable);
+    event_signal(&s->writable);
+    return IO_DONE;
+}
+
+/*=========================================================================*\
+* Message serialization
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Returns the number of bytes needed to serialize a scalar, or 0 if the
+* value has a type we don't support
+\*-------------------------------------------------------------------------*/
+static size_t scalar_size(lua_State *L, int idx) {
+    switch (lua_type(L, idx)) {
+        case LUA_TBOOLEAN: return 1;
+        case LUA_TNUMBER: return 1 + sizeof(lua_Number);
+        case LUA_TSTRING: return 1 + sizeof(size_t) + lua_objlen(L, idx);
+        default: return 0;
+    }
+}
+
+static char *scalar_write(lua_State *L, int idx, char *p) {
+    switch (lua_type(L, idx)) {
+        case LUA_TBOOLEAN:
+            *p++ = lua_toboolean(L, idx) ? MSG_TRUE: MSG_FALSE;
+            break;
+        case LUA_TNUMBER: {
+            lua_Number n = lua_tonumber(L, idx);
+            *p++ = MSG_NUMBER;
+            memcpy(p, &n, sizeof(n));
+            p += sizeof(n);
+            break;
+        }
+        case LUA_TSTRING: {
+            size_t len;
+            const char *str = lua_tolstring(L, idx, &len);
+            *p++ = MSG_STRING;
+            memcpy(p, &len, sizeof(len));
+            p += sizeof(len);
+            memcpy(p, str, len);
+            p += len;
+            break;
+        }
+    }
+    return p;
+}
+
+static const char *scalar_read(lua_State *L, const char *p) {
+    switch (*p++) {
+        case MSG_FALSE: lua_pushboolean(L, 0); break;
+        case MSG_TRUE: lua_pushboolean(L, 1); break;
+        case MSG_NUMBER: {
+            lua_Number n;
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            lua_pushnumber(L, n);
+            break;
+        }
+        case MSG_STRING: {
+            size_t len;
+            memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+            lua_pushlstring(L, p, len);
+            p += len;
+            break;
+        }
+    }
+    return p;
+}
+
+/*-------------------------------------------------------------------------*\
+* Copies a Lua value into a newly allocated message. Raises an error for
+* values that can't be sent.
+\*-------------------------------------------------------------------------*/
+static p_message message_pack(lua_State *L, int idx) {
+    size_t size = 0;
+    unsigned int count = 0;
+    p_message msg;
+    char *p;
+    if (lua_istable(L, idx)) {
+        size = 1 + sizeof(count);
+        lua_pushnil(L);
+        while (lua_next(L, idx)) {
+            size_t k = scalar_size(L, -2), v = scalar_size(L, -1);
+            if (!k || !v) luaL_argerror(L, idx,
+                "table keys and values must be strings, numbers or booleans");
+            size += k + v;
+            count++;
+            lua_pop(L, 1);
+        }
+    } else if (!(size = scalar_size(L, idx))) {
+        auxiliar_typeerror(L, idx, "string, number, boolean or table");
+    }
+    msg = (p_message) malloc(sizeof(t_message) + size);
+    if (!msg) luaL_error(L, "not enough memory");
+    msg->size = size;
+    p = msg->data;
+    if (lua_istable(L, idx)) {
+        *p++ = MSG_TABLE;
+        memcpy(p, &count, sizeof(count));
+        p += sizeof(count);
+        lua_pushnil(L);
+        while (lua_next(L, idx)) {
+            p = scalar_write(L, -2, p);
+            p = scalar_write(L, -1, p);
+            lua_pop(L, 1);
+        }
+    } else scalar_write(L, idx, p);
+    return msg;
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes the value stored in a message
+\*-------------------------------------------------------------------------*/
+static void message_unpack(lua_State *L, p_message msg) {
+    const char *p = msg->data;
+    if (*p == MSG_TABLE) {
+        unsigned int i, count;
+        p++;
+        memcpy(&count, p, sizeof(count));
+        p += sizeof(count);
+        lua_createtable(L, 0, (int) count);
+        for (i = 0; i < count; i++) {
+            p = scalar_read(L, p);
+            p = scalar_read(L, p);
+            lua_rawset(L, -3);
+        }
+    } else scalar_read(L, p);
+}
@@ -0,0 +1,69 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+/*=========================================================================*\
+* Message channels between Lua states
+* LuaSocket toolkit
+*
+* A channel is a bounded queue of messages that lives outside of any Lua
+* state, so that several states running on different threads can use it
+* to pass work around without going through a loopback socket. Messages
+* are Lua strings, numbers, booleans or flat tables of those, copied into
+* a private serialized form on send and rebuilt on receive.
+*
+* The queue is a lock-free ring of sequenced slots. In "spsc" mode each
+* end is owned by a single state, and no atomic read-modify-write is
+* needed to advance the indices. In "mpmc" mode, any number of states can
+* send and receive concurrently.
+*
+* Channels are found by name in a process-wide registry, and are
+* reference counted: they go away when the last object that refers to
+* them is closed or collected. Each object exports getfd and dirty, so
+* that socket.select can wait on channels alongside sockets.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "event.h"
+#include "timeout.h"
+
+/* serialized message */
+typedef struct t_message_ {
+    size_t size;            /* number of bytes in data */
+    char data[1];           /* serialized values */
+} t_message;
+typedef t_message *p_message;
+
+/* queue slot, sequenced as in Vyukov's bounded queue */
+typedef struct t_slot_ {
+    size_t seq;
+    p_message msg;
+} t_slot;
+typedef t_slot *p_slot;
+
+/* state shared by every object that refers to the same channel */
+typedef struct t_chanstate_ {
+    size_t head;            /* next slot to receive from */
+    char pad1[64];          /* keep producers and consumers apart */
+    size_t tail;            /* next slot to send into */
+    char pad2[64];
+    size_t mask;            /* capacity - 1, capacity is a power of 2 */
+    int spsc;               /* single producer, single consumer */
+    int refs;               /* number of objects referring to us */
+    size_t sent, received;  /* message counters */
+    t_event readable;       /* raised when messages are queued */
+    t_event writable;       /* raised when slots are freed */
+    char *name;             /* registry name, or NULL */
+    struct t_chanstate_ *next; /* registry link */
+    p_slot slots;
+} t_chanstate;
+typedef t_chanstate *p_chanstate;
+
+/* per-state object */
+typedef struct t_channel_ {
+    p_chanstate state;
+    t_timeout tm;
+} t_channel;
+typedef t_channel *p_channel;
+
+int channel_open(lua_State *L);
+
+#endif /* CHANNEL_H */
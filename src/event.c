@@ -0,0 +1,94 @@
+/*=========================================================================*\
+* Pollable event notification
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#include <sys/poll.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "event.h"
+
+/*=========================================================================*\
+* Exported functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates the descriptors backing an event
+\*-------------------------------------------------------------------------*/
+int event_init(p_event ev) {
+    ev->raised = 0;
+#ifdef __linux__
+    ev->rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ev->rfd == SOCKET_INVALID) return errno;
+    ev->wfd = ev->rfd;
+#else
+    {
+        int fds[2];
+        if (pipe(fds) < 0) return errno;
+        ev->rfd = fds[0];
+        ev->wfd = fds[1];
+        fcntl(ev->rfd, F_SETFD, FD_CLOEXEC);
+        fcntl(ev->wfd, F_SETFD, FD_CLOEXEC);
+        socket_setnonblocking(&ev->rfd);
+        socket_setnonblocking(&ev->wfd);
+    }
+#endif
+    return IO_DONE;
+}
+
+/*-------------------------------------------------------------------------*\
+* Releases the descriptors backing an event
+\*-------------------------------------------------------------------------*/
+void event_destroy(p_event ev) {
+    if (ev->wfd != ev->rfd && ev->wfd != SOCKET_INVALID) close(ev->wfd);
+    if (ev->rfd != SOCKET_INVALID) close(ev->rfd);
+    ev->rfd = ev->wfd = SOCKET_INVALID;
+}
+
+/*-------------------------------------------------------------------------*\
+* Raises the event. Can be called from any thread.
+\*-------------------------------------------------------------------------*/
+void event_signal(p_event ev) {
+    /* only the thread that raises the flag needs to touch the descriptor */
+    if (__atomic_exchange_n(&ev->raised, 1, __ATOMIC_ACQ_REL) == 0) {
+#ifdef __linux__
+        uint64_t one = 1;
+        while (write(ev->wfd, &one, sizeof(one)) < 0 && errno == EINTR);
+#else
+        char one = 1;
+        while (write(ev->wfd, &one, sizeof(one)) < 0 && errno == EINTR);
+#endif
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Lowers the event. Whoever waits must clear the event, check its own
+* condition again, and only then call event_wait. Otherwise a wake-up
+* raised in between could be lost.
+\*-------------------------------------------------------------------------*/
+void event_clear(p_event ev) {
+    char drain[64];
+    __atomic_store_n(&ev->raised, 0, __ATOMIC_SEQ_CST);
+    while (read(ev->rfd, drain, sizeof(drain)) > 0);
+}
+
+/*-------------------------------------------------------------------------*\
+* Waits until the event is raised or the timeout expires
+\*-------------------------------------------------------------------------*/
+int event_wait(p_event ev, p_timeout tm) {
+    int ret;
+    struct pollfd pfd;
+    pfd.fd = ev->rfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (timeout_iszero(tm)) return IO_TIMEOUT;
+    do {
+        int t = (int)(timeout_getretry(tm)*1e3);
+        ret = poll(&pfd, 1, t >= 0? t: -1);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) return errno;
+    if (ret == 0) return IO_TIMEOUT;
+    return IO_DONE;
+}
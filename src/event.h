@@ -0,0 +1,35 @@
+#ifndef EVENT_H
+#define EVENT_H
+/*=========================================================================*\
+* Pollable event notification
+* LuaSocket toolkit
+*
+* An event is a flag that can be raised from any thread and waited upon
+* with poll or select. It is used by objects that are not sockets
+* themselves, but that want to take part in socket.select through the
+* getfd/dirty protocol described in select.h.
+*
+* On Linux the event is backed by an eventfd. Elsewhere a non-blocking
+* pipe is used. In both cases, event_signal only performs a system call
+* when the event goes from cleared to raised, so that producers that
+* signal repeatedly do not pay for it.
+\*=========================================================================*/
+#include "socket.h"
+
+typedef struct t_event_ {
+    t_socket rfd;           /* descriptor that becomes readable */
+    t_socket wfd;           /* descriptor written to raise the event */
+    int raised;             /* non-zero if a wake-up is pending */
+} t_event;
+typedef t_event *p_event;
+
+int event_init(p_event ev);
+void event_destroy(p_event ev);
+void event_signal(p_event ev);
+void event_clear(p_event ev);
+int event_wait(p_event ev, p_timeout tm);
+
+#define event_getfd(ev) ((ev)->rfd)
+#define event_israised(ev) __atomic_load_n(&(ev)->raised, __ATOMIC_ACQUIRE)
+
+#endif /* EVENT_H */
@@ -3,6 +3,7 @@
 -- LuaSocket toolkit.
 -- Author: Diego Nehab
 -----------------------------------------------------------------------------
+local core = require("socket.core")
 module("socket.headers")
 
 canonic = {
@@ -97,3 +98,9 @@ canonic = {
     ["www-authenticate"] = "WWW-Authenticate",
     ["x-mailer"] = "X-Mailer",
 }
+
+-- builds a header block, blank line included, in a single pass in C.
+-- names are written as the canonic table says, or as given
+function serialize(tosend, names)
+    return core.serializeheaders(tosend, names or canonic)
+end
@@ -13,8 +13,12 @@ local ltn12 = require("ltn12")
 local mime = require("mime")
 local string = require("string")
 local headers = require("socket.headers")
+local pool = require("socket.pool")
 local base = _G
 local table = require("table")
+local coroutine = require("coroutine")
+local io = require("io")
+local math = require("math")
 module("socket.http")
 
 -----------------------------------------------------------------------------
@@ -26,11 +30,29 @@ TIMEOUT = 60
 PORT = 80
 -- user agent field sent in request
 USERAGENT = socket._VERSION
+-- pool of persistent connections, or nil to close after each request
+POOL = pool.default
+-- requests written ahead of their responses by pipeline
+PIPELINE = 16
+-- requests in flight at once, and connections per server, in requestmany
+CONCURRENCY = 16
+PERHOST = 6
+-- byte ranges download fetches at once, and how often it resumes them
+SEGMENTS = 4
+RETRIES = 3
+-- seconds a request with expect waits for 100 Continue before sending
+-- its body anyway
+CONTINUE = 1
+-- bytes multipart reads from a file at a time
+BLOCKSIZE = 65536
 
 -----------------------------------------------------------------------------
 -- Reads MIME headers from a connection, unfolding where needed
 -----------------------------------------------------------------------------
 local function receiveheaders(sock, headers)
+    -- LuaSocket sockets parse the whole block in C. anything else a create
+    -- function returns is read line by line
+    if sock.receiveheaders then return sock:receiveheaders(headers) end
     local line, name, value, err
     headers = headers or {}
     -- get first line
@@ -61,7 +83,18 @@ end
 -----------------------------------------------------------------------------
 -- Extra sources and sinks
 -----------------------------------------------------------------------------
-socket.sourcet["http-chunked"] = function(sock, headers)
+socket.sourcet["http-chunked"] = function(sock, headers, coalesce)
+    -- LuaSocket sockets decode chunks in C, and can join small ones
+    if sock.receivechunk then
+        return base.setmetatable({
+            getfd = function() return sock:getfd() end,
+            dirty = function() return sock:dirty() end
+        }, {
+            __call = function()
+                return sock:receivechunk(headers, coalesce)
+            end
+        })
+    end
     return base.setmetatable({
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
@@ -105,8 +138,21 @@ end
 -----------------------------------------------------------------------------
 local metat = { __index = {} }
 
-function open(host, port, create)
+-- with family "unix", host is the path of a unix domain socket
+function open(host, port, create, p, family)
+    -- with a pool, reuse an idle connection to the same server if possible
+    if p then
+        local c, reused = socket.try(p:checkout(host, port or PORT, family,
+            TIMEOUT))
+        local h = base.setmetatable({ c = c, pool = p, reused = reused }, metat)
+        h.try = socket.newtry(function() h:close() end)
+        h.try(c:settimeout(TIMEOUT))
+        return h
+    end
     -- create socket with user connect function, or with default
+    if not create and family == "unix" then
+        create = socket.try(socket.unix, "unix sockets not supported")
+    end
     local c = socket.try((create or socket.tcp)())
     local h = base.setmetatable({ c = c }, metat)
     -- create finalized try
@@ -124,12 +170,10 @@ function metat.__index:sendrequestline(method, uri)
 end
 
 function metat.__index:sendheaders(tosend)
-    local canonic = headers.canonic
-    local h = "\r\n"
-    for f, v in base.pairs(tosend) do
-        h = (canonic[f] or f) .. ": " .. v .. "\r\n" .. h
-    end
-    self.try(self.c:send(h))
+    -- LuaSocket sockets write the block straight from C
+    if self.c.sendheaders then
+        self.try(self.c:sendheaders(tosend, headers.canonic))
+    else self.try(self.c:send(headers.serialize(tosend))) end
     return 1
 end
 
@@ -142,31 +186,71 @@ function metat.__index:sendbody(headers, source, step)
     return self.try(ltn12.pump.all(source, socket.sink(mode, self.c), step))
 end
 
-function metat.__index:receivestatusline()
-    local status = self.try(self.c:receive(5))
+-- returns false and what was read for HTTP/0.9 servers, which send no
+-- status line, or nil and an error message. it raises no errors, because
+-- requestmany cannot yield from inside a pcall
+local function receivestatusline(sock, prefix)
+    local status, err = sock:receive(5, prefix)
+    if not status then return nil, err end
     -- identify HTTP/0.9 responses, which do not contain a status line
     -- this is just a heuristic, but is what the RFC recommends
-    if status ~= "HTTP/" then return nil, status end
+    if status ~= "HTTP/" then return false, status end
     -- otherwise proceed reading a status line
-    status = self.try(self.c:receive("*l", status))
+    status, err = sock:receive("*l", status)
+    if not status then return nil, err end
     local code = socket.skip(2, string.find(status, "HTTP/%d*%.%d* (%d%d%d)"))
-    return self.try(base.tonumber(code), status)
+    code = base.tonumber(code)
+    if not code then return nil, status end
+    return code, status
+end
+
+function metat.__index:receivestatusline()
+    local code, status = receivestatusline(self.c)
+    if code == false then return nil, status end
+    return self.try(code, status)
 end
 
 function metat.__index:receiveheaders()
     return self.try(receiveheaders(self.c))
 end
 
-function metat.__index:receivebody(headers, sink, step)
+-- content codings mime.inflate undoes
+local compressed = { gzip = true, ["x-gzip"] = true, deflate = true }
+
+-- passes the body through a filter before the sink. unlike a chained
+-- sink, this one reports errors from the filter
+local function filtersink(filter, sink)
+    return function(chunk, err)
+        if not chunk and err then return sink(nil, err) end
+        local data, ferr = filter(chunk)
+        if ferr then return nil, ferr end
+        if data and data ~= "" then
+            local ret, serr = sink(data)
+            if not ret or chunk then return ret, serr end
+        end
+        if chunk then return 1 end
+        return sink(nil, err)
+    end
+end
+
+function metat.__index:receivebody(headers, sink, step, decompress)
     sink = sink or ltn12.sink.null()
     step = step or ltn12.pump.step
+    local coding = headers["content-encoding"]
+    if decompress and mime.inflate and coding and
+            compressed[string.lower(coding)] then
+        sink = filtersink(mime.inflate(), sink)
+    end
     local length = base.tonumber(headers["content-length"])
     local t = headers["transfer-encoding"] -- shortcut
-    local mode = "default" -- connection close
-    if t and t ~= "identity" then mode = "http-chunked"
-    elseif base.tonumber(headers["content-length"]) then mode = "by-length" end
-    return self.try(ltn12.pump.all(socket.source(mode, self.c, length),
-        sink, step))
+    local source
+    if t and t ~= "identity" then
+        -- trailers go into the response headers. small chunks are joined
+        source = socket.source("http-chunked", self.c, headers,
+            ltn12.BLOCKSIZE)
+    elseif length then source = socket.source("by-length", self.c, length)
+    else source = socket.source("default", self.c) end -- connection close
+    return self.try(ltn12.pump.all(source, sink, step))
 end
 
 function metat.__index:receive09body(status, sink, step)
@@ -176,6 +260,16 @@ function metat.__index:receive09body(status, sink, step)
 end
 
 function metat.__index:close()
+    -- a failed try has closed the connection already
+    if self.closed then return 1 end
+    self.closed = true
+    if self.pool then return self.pool:discard(self.c) end
+    return self.c:close()
+end
+
+-- returns a connection whose response was read in full to the pool
+function metat.__index:release()
+    if self.pool then return self.pool:checkin(self.c) end
     return self.c:close()
 end
 
@@ -185,7 +279,7 @@ end
 local function adjusturi(reqt)
     local u = reqt
     -- if there is a proxy, we need the full url. otherwise, just a part.
-    if not reqt.proxy and not PROXY then
+    if (not reqt.proxy and not PROXY) or reqt.unixpath then
         u = {
            path = socket.try(reqt.path, "invalid path 'nil'"),
            params = reqt.params,
@@ -198,7 +292,8 @@ end
 
 local function adjustproxy(reqt)
     local proxy = reqt.proxy or PROXY
-    if proxy then
+    -- a unix socket is always reached directly
+    if proxy and not reqt.unixpath then
         proxy = url.parse(proxy)
         return proxy.host, proxy.port or 3128
     else
@@ -211,7 +306,7 @@ local function adjustheaders(reqt)
     local lower = {
         ["user-agent"] = USERAGENT,
         ["host"] = reqt.host,
-        ["connection"] = "close, TE",
+        ["connection"] = reqt.pool and "TE" or "close, TE",
         ["te"] = "trailers"
     }
     -- if we have authentication information, pass it along
@@ -219,6 +314,10 @@ local function adjustheaders(reqt)
         lower["authorization"] = 
             "Basic " ..  (mime.b64(reqt.user .. ":" .. reqt.password))
     end
+    -- ask for a compressed body if we can undo the compression
+    if reqt.decompress and mime.inflate then
+        lower["accept-encoding"] = "gzip, deflate"
+    end
     -- override with user headers
     for i,v in base.pairs(reqt.headers or lower) do
         lower[string.lower(i)] = v
@@ -239,6 +338,11 @@ local function adjustrequest(reqt)
     local nreqt = reqt.url and url.parse(reqt.url, default) or {}
     -- explicit components override url
     for i,v in base.pairs(reqt) do nreqt[i] = v end
+    -- http+unix urls carry the escaped path of the socket as their host
+    if nreqt.scheme == "http+unix" and not nreqt.unixpath then
+        nreqt.unixpath = url.unescape(nreqt.host or "")
+        nreqt.host = "localhost"
+    end
     if nreqt.port == "" then nreqt.port = 80 end
     socket.try(nreqt.host and nreqt.host ~= "", 
         "invalid host '" .. base.tostring(nreqt.host) .. "'")
@@ -246,8 +350,19 @@ local function adjustrequest(reqt)
     nreqt.uri = reqt.uri or adjusturi(nreqt)
     -- ajust host and port if there is a proxy
     nreqt.host, nreqt.port = adjustproxy(nreqt)
+    -- connections made by a user function are not ours to keep
+    if reqt.pool == nil then nreqt.pool = POOL end
+    if reqt.create or not nreqt.pool then nreqt.pool = nil end
     -- adjust headers in request
     nreqt.headers = adjustheaders(nreqt)
+    -- the host was only needed for the headers
+    if nreqt.unixpath then
+        nreqt.host, nreqt.port, nreqt.family = nreqt.unixpath, nil, "unix"
+    end
+    -- only a body is worth asking the server about
+    if nreqt.source and nreqt.expect then
+        nreqt.headers["expect"] = "100-continue"
+    else nreqt.expect = nil end
     return nreqt
 end
 
@@ -267,11 +382,75 @@ local function shouldreceivebody(reqt, code)
     return 1
 end
 
+-- whether the connection can carry another request once the body is read
+local function shouldkeepalive(reqt, code, status, headers)
+    local function has(value, token)
+        return value and string.find(string.lower(value), token, 1, true)
+    end
+    if has(reqt.headers.connection, "close") then return nil end
+    if has(headers.connection, "close") then return nil end
+    if not string.find(status, "^HTTP/1%.1") and
+        not has(headers.connection, "keep-alive") then return nil end
+    if not shouldreceivebody(reqt, code) then return 1 end
+    -- without a length, the body ends when the server closes
+    local t = headers["transfer-encoding"]
+    return (t and t ~= "identity") or
+        base.tonumber(headers["content-length"]) ~= nil
+end
+
+-- the connection goes in opened, if given, for whoever has to close it
+-- after an error raised from a source or a sink
+local function sendrequest(nreqt, opened)
+    local h = open(nreqt.host, nreqt.port, nreqt.create, nreqt.pool,
+        nreqt.family)
+    if opened then opened.h = h end
+    -- send request line and headers
+    h:sendrequestline(nreqt.method, nreqt.uri)
+    h:sendheaders(nreqt.headers)
+    -- if there is a body, send it, unless the server has to agree first
+    if nreqt.source and not nreqt.expect then
+        h:sendbody(nreqt.headers, nreqt.source, nreqt.step) 
+    end
+    return h
+end
+
+-- sends the body of an expect request once the server asks for it, or
+-- once it has waited long enough for servers that ignore the header. a
+-- final response instead means the body is not wanted. returns the first
+-- status read after that, and whether the body was sent
+local function continuerequest(h, nreqt)
+    local c = h.c
+    local wait = nreqt.expect
+    if base.type(wait) ~= "number" then wait = CONTINUE end
+    h.try(c:settimeout(wait))
+    local first, err, partial = c:receive(5)
+    h.try(c:settimeout(TIMEOUT))
+    if not first and err ~= "timeout" then return nil, err end
+    if first or partial ~= "" then
+        local code, status = receivestatusline(c, first or partial)
+        if code ~= 100 then return code, status end
+        h:receiveheaders()
+    end
+    h:sendbody(nreqt.headers, nreqt.source, nreqt.step)
+    local code, status = receivestatusline(c)
+    return code, status, true
+end
+
+local function receivefirst(h, nreqt)
+    if nreqt.expect then return continuerequest(h, nreqt) end
+    local code, status = receivestatusline(h.c)
+    return code, status, nreqt.source ~= nil
+end
+
+-- methods that can be sent again without changing the outcome
+local idempotent = { GET = true, HEAD = true, PUT = true, DELETE = true,
+    OPTIONS = true, TRACE = true }
+
 -- forward declarations
 local trequest, tredirect
 
-function tredirect(reqt, location)
-    local result, code, headers, status = trequest {
+function tredirect(reqt, location, opened)
+    local result, code, headers, status = trequest({
         -- the RFC says the redirect URL has to be absolute, but some
         -- servers do not respect that
         url = url.absolute(reqt.url, location),
@@ -280,30 +459,40 @@ function tredirect(reqt, location)
         headers = reqt.headers,
         proxy = reqt.proxy, 
         nredirects = (reqt.nredirects or 0) + 1,
-        create = reqt.create
-    }   
+        create = reqt.create,
+        pool = reqt.pool,
+        expect = reqt.expect,
+        unixpath = reqt.unixpath
+    }, opened)
     -- pass location header back as a hint we redirected
     headers = headers or {}
     headers.location = headers.location or location
     return result, code, headers, status
 end
 
-function trequest(reqt)
+function trequest(reqt, opened)
     -- we loop until we get what we want, or
     -- until we are sure there is no way to get it
     local nreqt = adjustrequest(reqt)
-    local h = open(nreqt.host, nreqt.port, nreqt.create)
-    -- send request line and headers
-    h:sendrequestline(nreqt.method, nreqt.uri)
-    h:sendheaders(nreqt.headers)
-    -- if there is a body, send it
-    if nreqt.source then
-        h:sendbody(nreqt.headers, nreqt.source, nreqt.step) 
+    local h = sendrequest(nreqt, opened)
+    local code, status, sent = receivefirst(h, nreqt)
+    while code == nil do
+        -- the server may have closed an idle connection just as we reused
+        -- it. a request that cannot have changed anything is sent again on
+        -- the next one, until we are down to a fresh connection. anything
+        -- else, such as a timeout, may mean the server acted on it
+        if not h.reused or sent or status ~= "closed" or
+            not idempotent[string.upper(nreqt.method or "GET")] then
+            h.try(nil, status)
+        end
+        h:close()
+        h = sendrequest(nreqt, opened)
+        code, status, sent = receivefirst(h, nreqt)
     end
-    local code, status = h:receivestatusline()
     -- if it is an HTTP/0.9 server, simply get the body and we are done
     if not code then
         h:receive09body(status, nreqt.sink, nreqt.step)
+        h:close()
         return 1, 200
     end
     local headers
@@ -315,15 +504,19 @@ function trequest(reqt)
     headers = h:receiveheaders()
     -- at this point we should have a honest reply from the server
     -- we can't redirect if we already used the source, so we report the error 
-    if shouldredirect(nreqt, code, headers) and not nreqt.source then
+    if shouldredirect(nreqt, code, headers) and not sent then
         h:close()
-        return tredirect(reqt, headers.location)
+        return tredirect(reqt, headers.location, opened)
     end
     -- here we are finally done
     if shouldreceivebody(nreqt, code) then
-        h:receivebody(headers, nreqt.sink, nreqt.step)
+        h:receivebody(headers, nreqt.sink, nreqt.step, nreqt.decompress)
     end
-    h:close()
+    -- a server that turned the body down may still be waiting for it
+    if nreqt.pool and (sent or not nreqt.source) and
+            shouldkeepalive(nreqt, code, status, headers) then
+        h:release()
+    else h:close() end
     return 1, code, headers, status
 end
 
@@ -345,7 +538,644 @@ local function srequest(u, b)
     return table.concat(t), code, headers, status
 end
 
+-----------------------------------------------------------------------------
+-- Pipelining
+-----------------------------------------------------------------------------
+-- whether a request may go out behind others, and be sent again if the
+-- connection closes before its response arrives. bodies cannot be replayed
+local function canpipeline(nreqt)
+    return idempotent[string.upper(nreqt.method or "GET")] and
+        not nreqt.source
+end
+
+local function requesttext(nreqt)
+    return string.format("%s %s HTTP/1.1\r\n", nreqt.method or "GET",
+        nreqt.uri) .. headers.serialize(nreqt.headers)
+end
+
+local function splithost(host)
+    if string.find(host, "://", 1, true) then
+        local parsed = url.parse(host, default)
+        return parsed.host, parsed.port
+    end
+    local name, port = socket.skip(2, string.find(host, "^(.-):(%d+)$"))
+    return name or host, port or PORT
+end
+
+local adjust = socket.protect(adjustrequest)
+
+-- runs f(h, ...). an error that is not a reported failure, such as one
+-- raised by a source or a sink, closes h before it goes on, so that the
+-- pool does not count the connection busy forever
+local function guard(f, h, ...)
+    local ret = { base.pcall(f, h, ...) }
+    if not ret[1] then
+        h:close()
+        base.error(ret[2], 0)
+    end
+    return base.unpack(ret, 2, table.maxn(ret))
+end
+
+-- sends a window of requests. pipelined ones go out in a single write
+local sendwindow = socket.protect(function(h, nreqts, window)
+    local first = nreqts[window[1]]
+    if first.source then
+        h:sendrequestline(first.method, first.uri)
+        h:sendheaders(first.headers)
+        h:sendbody(first.headers, first.source, first.step)
+        return 1
+    end
+    local t = {}
+    for k, i in base.ipairs(window) do t[k] = requesttext(nreqts[i]) end
+    return h.try(h.c:send(table.concat(t)))
+end)
+
+local receivestatus = socket.protect(function(h)
+    local code, status = h:receivestatusline()
+    -- HTTP/0.9 servers cannot keep connections open
+    h.try(code, "invalid status line")
+    while code == 100 do
+        h:receiveheaders()
+        code, status = h:receivestatusline()
+    end
+    return code, status
+end)
+
+local receiveresponse = socket.protect(function(h, nreqt, code)
+    local headers = h:receiveheaders()
+    if shouldreceivebody(nreqt, code) then
+        h:receivebody(headers, nreqt.sink, nreqt.step, nreqt.decompress)
+    end
+    return headers
+end)
+
+function pipeline(host, reqts)
+    local port
+    host, port = splithost(host)
+    -- pipelining needs persistent connections, even if nobody keeps them
+    local p = POOL or pool.new{ maxidle = 0 }
+    local n = #reqts
+    local nreqts, responses, errors, tries = {}, {}, {}, {}
+    for i = 1, n do
+        local reqt = {}
+        for k, v in base.pairs(reqts[i]) do reqt[k] = v end
+        reqt.host, reqt.port, reqt.pool, reqt.create = host, port, p, nil
+        nreqts[i], errors[i] = adjust(reqt)
+    end
+    local i = 1
+    while i <= n do
+        while i <= n and not nreqts[i] do i = i + 1 end
+        if i > n then break end
+        local ok, h = base.pcall(open, host, port, nil, p)
+        if not ok then
+            if base.type(h) ~= "table" then base.error(h, 0) end
+            -- nothing more can be sent
+            for k = i, n do
+                if nreqts[k] then errors[k] = h[1] end
+            end
+            break
+        end
+        -- a request that may not be repeated goes out alone, once every
+        -- response before it has arrived
+        local window = {}
+        local j = i
+        while j <= n and #window < PIPELINE do
+            local nreqt = nreqts[j]
+            if nreqt then
+                if window[1] and not canpipeline(nreqt) then break end
+                window[#window+1] = j
+                if not canpipeline(nreqt) then break end
+            end
+            j = j + 1
+        end
+        -- a failed write shows up as missing responses below
+        guard(sendwindow, h, nreqts, window)
+        local broken = false
+        for _, k in base.ipairs(window) do
+            local nreqt = nreqts[k]
+            local code, status = receivestatus(h)
+            if not code then
+                -- the connection closed before the response started. what
+                -- is safe to repeat goes out again on a new connection
+                tries[k] = (tries[k] or 0) + 1
+                if not canpipeline(nreqt) or tries[k] > 1 then
+                    errors[k] = status
+                    i = k + 1
+                end
+                broken = true
+                break
+            end
+            local headers, err = guard(receiveresponse, h, nreqt, code)
+            i = k + 1
+            if not headers then
+                errors[k] = err
+                broken = true
+                break
+            end
+            responses[k] = { code = code, headers = headers, status = status }
+            if not shouldkeepalive(nreqt, code, status, headers) then
+                broken = true
+                break
+            end
+        end
+        if broken then h:close() else h:release() end
+    end
+    return responses, errors
+end
+
+-----------------------------------------------------------------------------
+-- Concurrent requests
+-----------------------------------------------------------------------------
+-- each request runs in a coroutine. whenever a socket would block, the
+-- coroutine yields the object it waits for, and the loop in requestmany
+-- resumes it once a poller finds the object ready, or its time is up
+local function wait(obj, events, limit)
+    return coroutine.yield(obj, events, limit) == "timeout"
+end
+
+-- a connection whose blocking calls yield instead. it has no C header or
+-- chunk parsers, which cannot resume after a timeout
+local function yielding(c)
+    local y, limit = {}, nil
+    function y:receive(pattern, prefix)
+        while true do
+            local data, err, partial = c:receive(pattern, prefix)
+            if err ~= "timeout" then return data, err, partial end
+            prefix = partial
+            if wait(c, "r", limit) then return nil, err, partial end
+        end
+    end
+    function y:send(data, i, j)
+        i = i or 1
+        while true do
+            local last, err, sent = c:send(data, i, j)
+            if last then return last end
+            if err ~= "timeout" then return nil, err, sent end
+            i = sent + 1
+            if wait(c, "w") then return nil, err, sent end
+        end
+    end
+    -- only shortens the wait for data to arrive
+    function y:settimeout(t)
+        if t and t >= 0 then limit = t else limit = nil end
+        return 1
+    end
+    function y:alive() return c:alive() end
+    function y:close() return c:close() end
+    function y:getfd() return c:getfd() end
+    function y:dirty() return c:dirty() end
+    return y
+end
+
+local function connect(host, port, family)
+    local addrs, err
+    if family == "unix" then
+        -- a local connection is taken or refused at once, so it does not
+        -- go through the poller
+        local c
+        c, err = socket.connectunix(host, TIMEOUT)
+        if not c then return nil, err end
+        c:settimeout(0)
+        return yielding(c)
+    elseif string.find(host, "^[%d%.]+$") then
+        addrs = { { family = "inet", addr = host } }
+    elseif string.find(host, ":", 1, true) then
+        addrs = { { family = "inet6", addr = host } }
+    else
+        -- names are resolved by the worker threads
+        local job
+        job, err = socket.dns.getaddrinfo_async(host)
+        if not job then return nil, err end
+        job:settimeout(0)
+        while true do
+            addrs, err = job:result()
+            if addrs or err ~= "timeout" then break end
+            if wait(job, "r") then job:close(); return nil, err end
+        end
+        if not addrs then return nil, err end
+    end
+    for _, alt in base.ipairs(addrs) do
+        local c
+        c, err = (alt.family == "inet6" and socket.tcp6 or socket.tcp)()
+        if c then
+            c:settimeout(0)
+            local r
+            r, err = c:connect(alt.addr, port)
+            -- once writable, a second call reports how the first went
+            if err == "timeout" and not wait(c, "w") then
+                r, err = c:connect(alt.addr, port)
+            end
+            if r then
+                c:setoption("tcp-nodelay", true)
+                return yielding(c)
+            end
+            c:close()
+        end
+    end
+    return nil, err
+end
+
+-- a pool private to one requestmany call. it opens at most perhost
+-- connections to each server, and makes the rest wait for one of them
+local function manypool(perhost, wake)
+    local p = { idle = {}, count = {}, waiting = {},
+        keys = base.setmetatable({}, { __mode = "k" }) }
+    local function release(key)
+        p.count[key] = p.count[key] - 1
+        local waiting = p.waiting[key]
+        if waiting and waiting[1] then wake(table.remove(waiting, 1)) end
+    end
+    function p:checkout(host, port, family)
+        local key = host .. ":" .. base.tostring(port) .. ":" ..
+            base.tostring(family)
+        while true do
+            local idle = self.idle[key]
+            if idle and idle[1] then
+                local c = table.remove(idle)
+                if c:alive() then return c, true end
+                c:close()
+                self.count[key] = self.count[key] - 1
+            elseif (self.count[key] or 0) < perhost then
+                break
+            else
+                self.waiting[key] = self.waiting[key] or {}
+                table.insert(self.waiting[key], coroutine.running())
+                coroutine.yield()
+            end
+        end
+        self.count[key] = (self.count[key] or 0) + 1
+        local c, err = connect(host, port, family)
+        if not c then release(key); return nil, err end
+        self.keys[c] = key
+        return c, false
+    end
+    function p:checkin(c)
+        local key = self.keys[c]
+        self.idle[key] = self.idle[key] or {}
+        table.insert(self.idle[key], c)
+        local waiting = self.waiting[key]
+        if waiting and waiting[1] then wake(table.remove(waiting, 1)) end
+        return 1
+    end
+    function p:discard(c)
+        c:close()
+        release(self.keys[c])
+        return 1
+    end
+    function p:close()
+        for _, idle in base.pairs(self.idle) do
+            for _, c in base.ipairs(idle) do c:close() end
+        end
+        self.idle = {}
+    end
+    return p
+end
+
+local function manyrequest(reqt, p)
+    local t, nreqt = nil, {}
+    if base.type(reqt) == "string" then
+        t = {}
+        nreqt.url, nreqt.sink = reqt, ltn12.sink.table(t)
+    else
+        for k, v in base.pairs(reqt) do nreqt[k] = v end
+    end
+    nreqt.pool, nreqt.create = p, nil
+    local code, headers, status = socket.skip(1, trequest(nreqt))
+    return { code = code, headers = headers, status = status,
+        body = t and table.concat(t) }
+end
+
+function requestmany(reqts, options)
+    options = options or {}
+    local concurrency = options.concurrency or CONCURRENCY
+    local timeout = options.timeout or TIMEOUT
+    local poller, err = socket.poller()
+    if not poller then return nil, err end
+    local responses, errors = {}, {}
+    local n, nexti, active = #reqts, 1, 0
+    -- tasks ready to resume, tasks by coroutine, and tasks by the object
+    -- they wait for
+    local runnable, tasks, waits = {}, {}, {}
+    local p = manypool(options.perhost or PERHOST, function(co)
+        runnable[#runnable+1] = tasks[co]
+    end)
+    local function resume(task, ...)
+        local ret = { coroutine.resume(task.co, ...) }
+        if coroutine.status(task.co) ~= "dead" then
+            -- a task waiting for a connection from the pool yields nothing
+            if ret[2] then
+                poller:add(ret[2], ret[3])
+                task.deadline = socket.gettime() +
+                    math.min(ret[4] or timeout, timeout)
+                waits[ret[2]] = task
+            end
+            return
+        end
+        active = active - 1
+        tasks[task.co] = nil
+        if ret[1] then responses[task.i] = ret[2]
+        elseif base.type(ret[2]) == "table" then errors[task.i] = ret[2][1]
+        else
+            -- not a reported failure, but a bug
+            for obj in base.pairs(waits) do poller:remove(obj) end
+            poller:close()
+            p:close()
+            base.error(ret[2], 0)
+        end
+        if options.oncomplete then
+            options.oncomplete(task.i, responses[task.i], errors[task.i])
+        end
+    end
+    local function ready(obj, ...)
+        local task = waits[obj]
+        if not task then return end
+        waits[obj] = nil
+        poller:remove(obj)
+        resume(task, ...)
+    end
+    while true do
+        while active < concurrency and nexti <= n do
+            local i = nexti
+            local task = { i = i, co = coroutine.create(function()
+                return manyrequest(reqts[i], p)
+            end) }
+            tasks[task.co] = task
+            runnable[#runnable+1] = task
+            nexti = nexti + 1
+            active = active + 1
+        end
+        if runnable[1] then
+            local list = runnable
+            runnable = {}
+            for _, task in base.ipairs(list) do resume(task) end
+        elseif active == 0 then
+            break
+        else
+            -- whoever shares the thread gets a turn between short waits
+            if options.step then options.step() end
+            local readable, writable = poller:wait(options.step and 0.01
+                or 0.25)
+            -- errors make sockets both readable and writable, but each
+            -- object is resumed once per wait
+            local seen = {}
+            for _, list in base.ipairs{ readable or {}, writable or {} } do
+                for _, obj in base.ipairs(list) do
+                    if not seen[obj] then seen[obj] = true; ready(obj) end
+                end
+            end
+            local now, late = socket.gettime(), {}
+            for obj, task in base.pairs(waits) do
+                if task.deadline < now then late[#late+1] = obj end
+            end
+            for _, obj in base.ipairs(late) do ready(obj, "timeout") end
+        end
+    end
+    poller:close()
+    p:close()
+    return responses, errors
+end
+
+-----------------------------------------------------------------------------
+-- Segmented downloads
+-----------------------------------------------------------------------------
+-- writes a segment at its offset in a file. the offset advances with each
+-- chunk, so a resumed request continues where the last one stopped
+local function segmentsink(f, segment)
+    return function(chunk, err)
+        if not chunk then return 1 end
+        local size = string.len(chunk)
+        if segment.length and segment.done + size > segment.length then
+            return nil, "range too long"
+        end
+        local ok
+        ok, err = f:seek("set", segment.offset + segment.done)
+        if ok then ok, err = f:write(chunk) end
+        if not ok then return nil, err end
+        segment.done = segment.done + size
+        return 1
+    end
+end
+
+local function rangeable(probe, length)
+    local ranges = probe and probe.headers["accept-ranges"]
+    return probe and probe.code == 200 and length and length > 0 and
+        ranges and string.find(string.lower(ranges), "bytes", 1, true)
+end
+
+-- fetches every segment not yet complete, until none is left or the
+-- retries run out
+local function fetchsegments(u, f, segments, validator, many)
+    local err = "no segments"
+    for try = 0, RETRIES do
+        local reqts, pending = {}, {}
+        for _, segment in base.ipairs(segments) do
+            if not segment.complete then
+                local h = {}
+                if segment.length then
+                    h.range = string.format("bytes=%d-%d",
+                        segment.offset + segment.done,
+                        segment.offset + segment.length - 1)
+                    h["if-range"] = validator
+                else segment.done = 0 end
+                reqts[#reqts+1] = { url = u, headers = h,
+                    sink = segmentsink(f, segment) }
+                pending[#pending+1] = segment
+            end
+        end
+        if not pending[1] then return 1 end
+        local responses, errors = requestmany(reqts, many)
+        if not responses then return nil, errors end
+        for i, segment in base.ipairs(pending) do
+            local response = responses[i]
+            local expected = segment.length and 206 or 200
+            if response and response.code ~= expected then
+                -- the resource changed since the probe, or the server
+                -- does not mean what it said
+                return nil, response.status
+            end
+            if response and (not segment.length or
+                    segment.done == segment.length) then
+                segment.complete = true
+                segment.headers = response.headers
+            else err = errors[i] or "incomplete range" end
+        end
+    end
+    return nil, err
+end
+
+function download(u, dest, options)
+    options = options or {}
+    local n = options.segments or SEGMENTS
+    local many = { step = options.step, timeout = options.timeout,
+        concurrency = n, perhost = n }
+    -- segments arrive out of order, so a sink gets them from a scratch file
+    local f, err = dest, nil
+    if io.type(dest) ~= "file" then
+        f, err = io.tmpfile()
+        if not f then return nil, err end
+    end
+    local responses, errors = requestmany({ { url = u, method = "HEAD" } },
+        many)
+    if not responses then return nil, errors end
+    local probe = responses[1]
+    local length = probe and base.tonumber(probe.headers["content-length"])
+    local segments = {}
+    local validator
+    if rangeable(probe, length) then
+        local size = math.ceil(length / n)
+        for offset = 0, length - 1, size do
+            segments[#segments+1] = { offset = offset, done = 0,
+                length = math.min(size, length - offset) }
+        end
+        validator = probe.headers.etag or probe.headers["last-modified"]
+    else
+        -- without ranges, a failed stream starts over
+        segments[1] = { offset = 0, done = 0 }
+        length = nil
+    end
+    local ok
+    ok, err = fetchsegments(u, f, segments, validator, many)
+    if not ok then
+        if f ~= dest then f:close() end
+        return nil, err
+    end
+    local headers = length and probe.headers or segments[1].headers
+    length = length or segments[1].done
+    if f == dest then
+        f:seek("set", length)
+        return length, headers
+    end
+    f:seek("set", 0)
+    ok, err = ltn12.pump.all(ltn12.source.file(f), dest)
+    if not ok then return nil, err end
+    return length, headers
+end
+
+-----------------------------------------------------------------------------
+-- Multipart form data
+-----------------------------------------------------------------------------
+-- quotes, and line breaks, are escaped in names as browsers do
+local function quote(s)
+    return '"' .. (string.gsub(s, '[\r\n"]',
+        { ["\r"] = "%0D", ["\n"] = "%0A", ['"'] = "%22" })) .. '"'
+end
+
+local function newboundary()
+    local t = { "luasocket", string.format("%08x",
+        math.floor(socket.gettime()*1e6) % 2^32) }
+    for i = 1, 6 do t[#t+1] = string.format("%04x", math.random(0, 65535)) end
+    return table.concat(t)
+end
+
+-- the bytes left in a file, from where a handle stands or from the start
+-- of a path. the file is reopened when its turn comes
+local function filesize(part)
+    local f = part.file
+    if not f then
+        local err
+        f, err = io.open(part.path, "rb")
+        if not f then return nil, err end
+    end
+    local start = f:seek()
+    local size = f:seek("end")
+    f:seek("set", start)
+    if not part.file then f:close() end
+    if not size then return nil, "cannot size " .. (part.path or "file") end
+    return size - start
+end
+
+-- reads a file part in blocks, and stops at the size it was measured at
+local function filesource(part, size, blocksize)
+    local f, left = part.file, size
+    return function()
+        if left == 0 then return nil end
+        if not f then
+            local err
+            f, err = io.open(part.path, "rb")
+            if not f then return nil, err end
+        end
+        local chunk = f:read(math.min(left, blocksize))
+        if not chunk then
+            f:close()
+            left = 0
+            return nil, "file " .. (part.path or "") .. " shrank"
+        end
+        left = left - string.len(chunk)
+        if left == 0 then f:close() end
+        return chunk
+    end
+end
+
+-- a source for a multipart/form-data body made of the parts, which are
+-- fields, { name = n, value = v }, or files, { name = n, path = p } or
+-- { name = n, file = handle }. returns it with the headers that describe
+-- it, its length among them, or nil and an error if a file cannot be read
+function multipart(parts)
+    local boundary = parts.boundary or newboundary()
+    local blocksize = parts.blocksize or BLOCKSIZE
+    -- what lies between the files is joined into strings ahead of time
+    local pieces, text, length = {}, {}, 0
+    local function flush()
+        local s = table.concat(text)
+        if s ~= "" then pieces[#pieces+1] = s end
+        length = length + string.len(s)
+        text = {}
+    end
+    for _, part in base.ipairs(parts) do
+        text[#text+1] = "--" .. boundary ..
+            "\r\nContent-Disposition: form-data; name=" ..
+            quote(base.tostring(part.name))
+        if part.value then
+            text[#text+1] = "\r\n\r\n" .. base.tostring(part.value) .. "\r\n"
+        else
+            local size, err = filesize(part)
+            if not size then return nil, err end
+            local filename = part.filename or
+                (part.path and string.match(part.path, "([^/\\]*)$")) or ""
+            text[#text+1] = "; filename=" .. quote(filename) ..
+                "\r\nContent-Type: " .. (part.type or
+                "application/octet-stream") .. "\r\n\r\n"
+            flush()
+            pieces[#pieces+1] = filesource(part, size, blocksize)
+            length = length + size
+            text[1] = "\r\n"
+        end
+    end
+    text[#text+1] = "--" .. boundary .. "--\r\n"
+    flush()
+    local i = 1
+    local source = function()
+        while true do
+            local piece = pieces[i]
+            if not piece then return nil end
+            if base.type(piece) == "string" then
+                i = i + 1
+                return piece
+            end
+            local chunk, err = piece()
+            if chunk or err then return chunk, err end
+            i = i + 1
+        end
+    end
+    return source, {
+        ["content-type"] = "multipart/form-data; boundary=" .. boundary,
+        ["content-length"] = length
+    }
+end
+
+-- requestmany cannot yield across a pcall, and runs trequest without one
+local function guardedrequest(reqt)
+    local opened = {}
+    local ok, r, code, headers, status = base.pcall(trequest, reqt, opened)
+    if not ok then
+        -- a failed try has closed it already, and closing is idempotent
+        if opened.h then opened.h:close() end
+        base.error(r, 0)
+    end
+    return r, code, headers, status
+end
+
 request = socket.protect(function(reqt, body)
     if base.type(reqt) == "string" then return srequest(reqt, body)
-    else return trequest(reqt) end
+    else return guardedrequest(reqt) end
 end)
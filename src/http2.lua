@@ -0,0 +1,1098 @@
+-----------------------------------------------------------------------------
+-- HTTP/2 client support for the Lua language, over cleartext TCP (h2c)
+-- LuaSocket toolkit.
+-----------------------------------------------------------------------------
+
+-----------------------------------------------------------------------------
+-- Declare module and import dependencies
+-----------------------------------------------------------------------------
+local base = _G
+local string = require("string")
+local table = require("table")
+local math = require("math")
+local socket = require("socket")
+local url = require("socket.url")
+local ltn12 = require("ltn12")
+local mime = require("mime")
+module("socket.http2")
+
+-----------------------------------------------------------------------------
+-- Program constants
+-----------------------------------------------------------------------------
+-- connection timeout in seconds
+TIMEOUT = 60
+-- default port for document retrieval
+PORT = 80
+-- user agent field sent in request
+USERAGENT = socket._VERSION
+-- flow control window opened for each response, and for the connection
+WINDOW = 1048576
+-- streams open at once, unless the server allows fewer
+CONCURRENCY = 100
+-- times a request the server did not process is sent again
+RETRIES = 3
+-- size of the header tables. the decoder's is the size the server
+-- assumes by default, and the encoder never uses more either
+TABLESIZE = 4096
+
+-----------------------------------------------------------------------------
+-- Bytes
+-----------------------------------------------------------------------------
+-- Lua has no bit operations, so fields are taken apart with arithmetic
+local char, byte = string.char, string.byte
+
+local function pack(n, size)
+    local t = {}
+    for i = size, 1, -1 do
+        t[i] = n % 256
+        n = math.floor(n / 256)
+    end
+    return char(base.unpack(t))
+end
+
+local function unpack(s, i, size)
+    local n = 0
+    for k = i, i + size - 1 do n = n * 256 + byte(s, k) end
+    return n
+end
+
+local function has(flags, bit)
+    return math.floor(flags / bit) % 2 == 1
+end
+
+-----------------------------------------------------------------------------
+-- HPACK header compression (RFC 7541)
+-----------------------------------------------------------------------------
+local static = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+}
+
+-- Huffman codes and their lengths in bits, by symbol plus one. the last
+-- one is EOS
+local huffcodes = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6,
+    0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea,
+    0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee, 0xfffffef,
+    0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3, 0xffffff4,
+    0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa,
+    0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa,
+    0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18, 0x0, 0x1, 0x2, 0x19, 0x1a,
+    0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65,
+    0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71,
+    0x72, 0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22, 0x7ffd,
+    0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26, 0x27, 0x6, 0x74, 0x75, 0x28,
+    0x29, 0x2a, 0x7, 0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78, 0x79,
+    0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2,
+    0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6,
+    0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2,
+    0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6,
+    0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc,
+    0x7fffe8, 0x7fffe9, 0x1fffde, 0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0,
+    0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0,
+    0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1, 0x3ffffe0,
+    0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5,
+    0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1,
+    0x3ffffe7, 0x7ffffe2, 0xfffff2, 0x1fffe4, 0x1fffe5, 0x3ffffe8,
+    0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5, 0xfffec,
+    0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea,
+    0x7ffff4, 0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7,
+    0x7ffffe8, 0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec,
+    0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff
+}
+local hufflens = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28,
+    28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12,
+    13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6,
+    7, 8, 15, 6, 12, 10, 13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5, 6, 5, 6,
+    6, 6, 5, 7, 7, 6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14,
+    13, 28, 20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21,
+    20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21,
+    23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23,
+    22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24,
+    21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22,
+    25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27,
+    27, 27, 27, 26, 30
+}
+
+local staticfull, staticname = {}, {}
+for i, e in base.ipairs(static) do
+    staticfull[e[1] .. "\0" .. e[2]] = staticfull[e[1] .. "\0" .. e[2]] or i
+    staticname[e[1]] = staticname[e[1]] or i
+end
+
+-- the decoding tree. leaves hold their symbol
+local root = {}
+for sym = 0, 256 do
+    local node, code, len = root, huffcodes[sym+1], hufflens[sym+1]
+    for k = len - 1, 1, -1 do
+        local bit = math.floor(code / 2^k) % 2
+        node[bit] = node[bit] or {}
+        node = node[bit]
+    end
+    node[code % 2] = { sym = sym }
+end
+
+-- where a string may end: at the root, or up to 7 bits into the all ones
+-- code of EOS
+local padding = { [root] = true }
+do
+    local node = root
+    for i = 1, 7 do
+        node = node[1]
+        padding[node] = true
+    end
+end
+
+-- walks the tree through the bits of a byte. the node remembers where
+-- each byte leads, so the bits of a byte are walked only once per node
+local function walk(node, b)
+    local memo = node.memo
+    if not memo then
+        memo = {}
+        node.memo = memo
+    end
+    local t = memo[b]
+    if t then return t[1], t[2] end
+    local out = {}
+    local next = node
+    for k = 7, 0, -1 do
+        next = next[math.floor(b / 2^k) % 2]
+        if next.sym then
+            if next.sym == 256 then return nil end
+            out[#out+1] = char(next.sym)
+            next = root
+        end
+    end
+    t = { next, table.concat(out) }
+    memo[b] = t
+    return t[1], t[2]
+end
+
+local function huffdecode(s)
+    local node, out = root, {}
+    for i = 1, string.len(s) do
+        node, out[i] = walk(node, byte(s, i))
+        if not node then return nil end
+    end
+    if not padding[node] then return nil end
+    return table.concat(out)
+end
+
+local function huffencode(s)
+    local out, acc, bits = {}, 0, 0
+    for i = 1, string.len(s) do
+        local sym = byte(s, i) + 1
+        local len = hufflens[sym]
+        acc = acc * 2^len + huffcodes[sym]
+        bits = bits + len
+        while bits >= 8 do
+            bits = bits - 8
+            local b = math.floor(acc / 2^bits)
+            out[#out+1] = char(b)
+            acc = acc - b * 2^bits
+        end
+    end
+    if bits > 0 then
+        out[#out+1] = char(acc * 2^(8 - bits) + 2^(8 - bits) - 1)
+    end
+    return table.concat(out)
+end
+
+-- integers fill the low bits of the first byte, and continue in 7 bit
+-- groups if they do not fit
+local function encodeint(n, prefix, first)
+    local max = 2^prefix - 1
+    if n < max then return char(first + n) end
+    local t = { first + max }
+    n = n - max
+    while n >= 128 do
+        t[#t+1] = n % 128 + 128
+        n = math.floor(n / 128)
+    end
+    t[#t+1] = n
+    return char(base.unpack(t))
+end
+
+local function decodeint(s, i, prefix)
+    local max = 2^prefix - 1
+    local n = byte(s, i) % 2^prefix
+    i = i + 1
+    if n < max then return n, i end
+    local m = 1
+    repeat
+        local b = byte(s, i)
+        if not b or m > 2^28 then return nil end
+        i = i + 1
+        n = n + (b % 128) * m
+        m = m * 128
+    until b < 128
+    return n, i
+end
+
+-- strings are Huffman coded whenever that makes them shorter
+local function encodestring(s)
+    local h = huffencode(s)
+    if string.len(h) < string.len(s) then
+        return encodeint(string.len(h), 7, 128) .. h
+    end
+    return encodeint(string.len(s), 7, 0) .. s
+end
+
+local function decodestring(s, i)
+    local b = byte(s, i)
+    if not b then return nil end
+    local len
+    len, i = decodeint(s, i, 7)
+    if not len or i + len - 1 > string.len(s) then return nil end
+    local value = string.sub(s, i, i + len - 1)
+    if b >= 128 then
+        value = huffdecode(value)
+        if not value then return nil end
+    end
+    return value, i + len
+end
+
+-- dynamic tables hold their entries from first to last, newest last.
+-- encoders also find entries by field and by name
+local function newtable(maxsize, find)
+    return { first = 1, last = 0, size = 0, maxsize = maxsize,
+        full = find and {}, names = find and {} }
+end
+
+local function evict(t, room)
+    while t.last >= t.first and t.size + room > t.maxsize do
+        local e = t[t.first]
+        if t.full then
+            local key = e[1] .. "\0" .. e[2]
+            if t.full[key] == t.first then t.full[key] = nil end
+            if t.names[e[1]] == t.first then t.names[e[1]] = nil end
+        end
+        t[t.first] = nil
+        t.first = t.first + 1
+        t.size = t.size - (string.len(e[1]) + string.len(e[2]) + 32)
+    end
+end
+
+local function add(t, name, value)
+    local size = string.len(name) + string.len(value) + 32
+    evict(t, size)
+    -- an entry larger than the table just empties it
+    if size > t.maxsize then return end
+    t.last = t.last + 1
+    t[t.last] = { name, value }
+    t.size = t.size + size
+    if t.full then
+        t.full[name .. "\0" .. value] = t.last
+        t.names[name] = t.last
+    end
+end
+
+local function get(t, index)
+    if index <= #static then return static[index] end
+    local pos = t.last - (index - #static - 1)
+    if pos < t.first then return nil end
+    return t[pos]
+end
+
+local function find(t, pos)
+    if pos and pos >= t.first then return #static + 1 + t.last - pos end
+    return nil
+end
+
+-- fields that change with every request would only push others out of
+-- the table, and credentials stay out of every table on the way
+local volatile = { [":path"] = true, ["content-length"] = true }
+local secret = { authorization = true, ["proxy-authorization"] = true }
+
+local encoder = { __index = {} }
+local decoder = { __index = {} }
+
+function newencoder()
+    return base.setmetatable({ t = newtable(TABLESIZE, true) }, encoder)
+end
+
+-- follows the size the peer allows. the next block tells the peer about
+-- the smallest size used since the last one, and the current one
+function encoder.__index:setmaxsize(size)
+    size = math.min(size, TABLESIZE)
+    if size == self.t.maxsize then return end
+    self.smallest = math.min(self.smallest or size, size)
+    self.t.maxsize = size
+    evict(self.t, 0)
+end
+
+-- encodes a list of { name, value } pairs into a header block
+function encoder.__index:encode(fields)
+    local t, out = self.t, {}
+    if self.smallest then
+        out[1] = encodeint(self.smallest, 5, 32)
+        if self.smallest ~= t.maxsize then
+            out[2] = encodeint(t.maxsize, 5, 32)
+        end
+        self.smallest = nil
+    end
+    for _, f in base.ipairs(fields) do
+        local name, value = f[1], f[2]
+        local key = name .. "\0" .. value
+        local index = staticfull[key] or find(t, t.full[key])
+        if index then out[#out+1] = encodeint(index, 7, 128)
+        else
+            local nameindex = staticname[name] or find(t, t.names[name])
+            local first, prefix = 64, 6
+            if secret[name] then first, prefix = 16, 4
+            elseif volatile[name] then first, prefix = 0, 4 end
+            out[#out+1] = encodeint(nameindex or 0, prefix, first)
+            if not nameindex then out[#out+1] = encodestring(name) end
+            out[#out+1] = encodestring(value)
+            if first == 64 then add(t, name, value) end
+        end
+    end
+    return table.concat(out)
+end
+
+function newdecoder()
+    return base.setmetatable({ t = newtable(TABLESIZE) }, decoder)
+end
+
+-- decodes a header block into a list of { name, value } pairs, or
+-- returns nil if it is malformed
+function decoder.__index:decode(block)
+    local t, fields, i, n = self.t, {}, 1, string.len(block)
+    while i <= n do
+        local b = byte(block, i)
+        if b >= 128 then
+            local index
+            index, i = decodeint(block, i, 7)
+            local e = index and index > 0 and get(t, index)
+            if not e then return nil end
+            fields[#fields+1] = { e[1], e[2] }
+        elseif b >= 32 and b < 64 then
+            local size
+            size, i = decodeint(block, i, 5)
+            if not size or size > TABLESIZE then return nil end
+            t.maxsize = size
+            evict(t, 0)
+        else
+            local index, name, value
+            index, i = decodeint(block, i, b >= 64 and 6 or 4)
+            if not index then return nil end
+            if index > 0 then
+                local e = get(t, index)
+                if not e then return nil end
+                name = e[1]
+            else
+                name, i = decodestring(block, i)
+                if not name then return nil end
+            end
+            value, i = decodestring(block, i)
+            if not value then return nil end
+            if b >= 64 then add(t, name, value) end
+            fields[#fields+1] = { name, value }
+        end
+    end
+    return fields
+end
+
+-----------------------------------------------------------------------------
+-- Connections
+-----------------------------------------------------------------------------
+-- frame types and flags
+local DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING,
+    GOAWAY, WINDOW_UPDATE, CONTINUATION = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9
+local END_STREAM, ACK, END_HEADERS, PADDED, PRIO = 1, 1, 4, 8, 32
+-- error codes used here
+local PROTOCOL_ERROR, FLOW_CONTROL_ERROR, FRAME_SIZE_ERROR, REFUSED_STREAM,
+    CANCEL, COMPRESSION_ERROR = 1, 3, 6, 7, 8, 9
+
+local PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+-- the largest frame either side sends unless the other allows more
+local FRAMESIZE = 16384
+local MAXID = 2^31 - 1
+
+local reasons = { [0] = "no error", "protocol error", "internal error",
+    "flow control error", "settings timeout", "stream closed",
+    "frame size error", "refused stream", "cancel", "compression error",
+    "connect error", "enhance your calm", "inadequate security",
+    "http/1.1 required" }
+
+local function reason(code)
+    return reasons[code] or "error " .. base.tostring(code)
+end
+
+local metat = { __index = {} }
+
+-- frames are collected, and written together before the next read
+function metat.__index:frame(kind, flags, id, payload)
+    local out = self.out
+    out[#out+1] = pack(string.len(payload), 3) .. char(kind, flags) ..
+        pack(id, 4) .. payload
+    self.outsize = self.outsize + 9 + string.len(payload)
+    if self.outsize >= 65536 then self:flush() end
+end
+
+function metat.__index:flush()
+    if self.out[1] then
+        local data = table.concat(self.out)
+        self.out, self.outsize = {}, 0
+        self.try(self.c:send(data))
+    end
+end
+
+-- tells the server why, and gives up on the connection
+function metat.__index:fail(code)
+    -- the server opens no streams, so none of its streams was processed
+    self:frame(GOAWAY, 0, 0, pack(0, 4) .. pack(code, 4))
+    base.pcall(self.flush, self)
+    self.try(nil, reason(code))
+end
+
+function metat.__index:readframe()
+    self:flush()
+    local head = self.try(self.c:receive(9))
+    local length = unpack(head, 1, 3)
+    if length > FRAMESIZE then self:fail(FRAME_SIZE_ERROR) end
+    local payload = ""
+    if length > 0 then payload = self.try(self.c:receive(length)) end
+    return byte(head, 4), byte(head, 5), unpack(head, 6, 4) % 2^31, payload
+end
+
+-- whether a frame can be read without blocking
+function metat.__index:readable()
+    if self.c.dirty and self.c:dirty() then return true end
+    return socket.select({ self.c }, nil, 0)[1] ~= nil
+end
+
+local function unpad(self, flags, payload)
+    if not has(flags, PADDED) then return payload end
+    local pad = byte(payload, 1)
+    if not pad or pad >= string.len(payload) then self:fail(PROTOCOL_ERROR) end
+    return string.sub(payload, 2, string.len(payload) - pad)
+end
+
+-- ends a stream. its sink hears about the end with the results, once
+-- the request is not going to be sent again
+function metat.__index:finish(s, err)
+    if s.done then return end
+    s.done = true
+    s.err = s.err or err
+    if s.id and self.streams[s.id] == s then
+        self.streams[s.id] = nil
+        self.active = self.active - 1
+    end
+end
+
+function metat.__index:reset(s, code, err)
+    self:frame(RST_STREAM, 0, s.id, pack(code, 4))
+    self:finish(s, err or reason(code))
+end
+
+-- gives data back to the server once half of a window is used
+local function consume(self, s, size)
+    self.received = self.received + size
+    if self.received >= WINDOW / 2 then
+        self:frame(WINDOW_UPDATE, 0, 0, pack(self.received, 4))
+        self.received = 0
+    end
+    if s then
+        s.received = s.received + size
+        if s.received >= WINDOW / 2 then
+            self:frame(WINDOW_UPDATE, 0, s.id, pack(s.received, 4))
+            s.received = 0
+        end
+    end
+end
+
+local function onheaders(self, s, fields, last)
+    local headers, code = {}, nil
+    for _, f in base.ipairs(fields) do
+        local name, value = f[1], f[2]
+        if name == ":status" then code = base.tonumber(value)
+        elseif string.sub(name, 1, 1) ~= ":" then
+            -- repeated fields are joined, as HTTP/1.1 would send them
+            if headers[name] then value = headers[name] .. ", " .. value end
+            headers[name] = value
+        end
+    end
+    if not s.code then
+        if not code then
+            return self:reset(s, PROTOCOL_ERROR, "malformed response")
+        end
+        -- interim responses are skipped
+        if code < 200 then return end
+        s.code, s.headers = code, headers
+        -- the body of a redirect that will be followed is nobody's
+        if s.follow and s.follow(code, headers) then
+            s.sink = ltn12.sink.null()
+        end
+    else
+        -- trailers join the headers, as they do for chunked bodies
+        for name, value in base.pairs(headers) do s.headers[name] = value end
+    end
+    if last then self:finish(s) end
+end
+
+local handlers = {}
+
+handlers[DATA] = function(self, flags, id, payload)
+    if id == 0 then self:fail(PROTOCOL_ERROR) end
+    local s = self.streams[id]
+    consume(self, s, string.len(payload))
+    if not s then return end
+    local data = unpad(self, flags, payload)
+    if not s.code then return self:reset(s, PROTOCOL_ERROR) end
+    if data ~= "" then
+        local ok, err = s.sink(data)
+        if not ok then return self:reset(s, CANCEL, err) end
+    end
+    if has(flags, END_STREAM) then self:finish(s) end
+end
+
+handlers[HEADERS] = function(self, flags, id, payload)
+    if id == 0 then self:fail(PROTOCOL_ERROR) end
+    local block = unpad(self, flags, payload)
+    if has(flags, PRIO) then block = string.sub(block, 6) end
+    local parts, done = { block }, has(flags, END_HEADERS)
+    while not done do
+        local kind, cflags, cid, more = self:readframe()
+        if kind ~= CONTINUATION or cid ~= id then self:fail(PROTOCOL_ERROR) end
+        parts[#parts+1] = more
+        done = has(cflags, END_HEADERS)
+    end
+    -- every block goes through the decoder, which must track the table
+    local fields = self.decoder:decode(table.concat(parts))
+    if not fields then self:fail(COMPRESSION_ERROR) end
+    local s = self.streams[id]
+    if s then onheaders(self, s, fields, has(flags, END_STREAM)) end
+end
+
+handlers[RST_STREAM] = function(self, flags, id, payload)
+    local s = self.streams[id]
+    if not s or string.len(payload) ~= 4 then return end
+    local code = unpack(payload, 1, 4)
+    -- the server did not even look at a refused request
+    s.retry = code == REFUSED_STREAM and not s.started
+    self:finish(s, reason(code))
+end
+
+handlers[SETTINGS] = function(self, flags, id, payload)
+    if has(flags, ACK) then return end
+    if string.len(payload) % 6 ~= 0 then self:fail(FRAME_SIZE_ERROR) end
+    for i = 1, string.len(payload), 6 do
+        local key, value = unpack(payload, i, 2), unpack(payload, i + 2, 4)
+        if key == 1 then self.encoder:setmaxsize(value)
+        elseif key == 3 then self.maxstreams = value
+        elseif key == 4 then
+            if value > MAXID then self:fail(FLOW_CONTROL_ERROR) end
+            -- open streams see the change too
+            local delta = value - self.initialwindow
+            self.initialwindow = value
+            for _, s in base.pairs(self.streams) do
+                s.window = s.window + delta
+            end
+        elseif key == 5 then
+            if value < FRAMESIZE or value >= 2^24 then
+                self:fail(PROTOCOL_ERROR)
+            end
+            self.framesize = value
+        end
+    end
+    self:frame(SETTINGS, ACK, 0, "")
+end
+
+handlers[PUSH_PROMISE] = function(self)
+    -- the preface disabled push
+    self:fail(PROTOCOL_ERROR)
+end
+
+handlers[PING] = function(self, flags, id, payload)
+    if string.len(payload) ~= 8 then self:fail(FRAME_SIZE_ERROR) end
+    if not has(flags, ACK) then self:frame(PING, ACK, 0, payload) end
+end
+
+handlers[GOAWAY] = function(self, flags, id, payload)
+    local last = unpack(payload, 1, 4) % 2^31
+    self.goaway = true
+    -- streams past the last one the server will process can go elsewhere
+    for sid, s in base.pairs(self.streams) do
+        if sid > last then
+            s.retry = not s.started
+            self:finish(s, "connection closed")
+        end
+    end
+end
+
+handlers[WINDOW_UPDATE] = function(self, flags, id, payload)
+    local increment = unpack(payload, 1, 4) % 2^31
+    if id == 0 then self.window = self.window + increment
+    elseif self.streams[id] then
+        local s = self.streams[id]
+        s.window = s.window + increment
+    end
+end
+
+handlers[CONTINUATION] = function(self)
+    -- only expected right after HEADERS
+    self:fail(PROTOCOL_ERROR)
+end
+
+function metat.__index:dispatch(kind, flags, id, payload)
+    local handler = handlers[kind]
+    -- PRIORITY and unknown frames are ignored
+    if handler then handler(self, flags, id, payload) end
+end
+
+-- opens a stream for a request, sending its headers
+function metat.__index:open(s)
+    local id = self.nextid
+    self.nextid = id + 2
+    s.id, s.window, s.received = id, self.initialwindow, 0
+    self.streams[id] = s
+    self.active = self.active + 1
+    local block, size = self.encoder:encode(s.fields), self.framesize
+    local flags = 0
+    if not s.source then flags = END_STREAM end
+    if string.len(block) <= size then flags = flags + END_HEADERS end
+    self:frame(HEADERS, flags, id, string.sub(block, 1, size))
+    for i = size + 1, string.len(block), size do
+        local part = string.sub(block, i, i + size - 1)
+        self:frame(CONTINUATION, i + size > string.len(block) and END_HEADERS
+            or 0, id, part)
+    end
+end
+
+-- sends as much of a body as the windows allow. returns true if
+-- anything was sent
+function metat.__index:pump(s)
+    local sent = false
+    while s.source and not s.done do
+        if not s.pending then
+            local chunk, err = s.source()
+            if not chunk then
+                if err then
+                    self:reset(s, CANCEL, err)
+                    return sent
+                end
+                s.source = nil
+                self:frame(DATA, END_STREAM, s.id, "")
+                return true
+            end
+            s.started = true
+            if chunk ~= "" then s.pending = chunk end
+        else
+            local n = math.min(string.len(s.pending), s.window, self.window,
+                self.framesize)
+            if n <= 0 then return sent end
+            self:frame(DATA, 0, s.id, string.sub(s.pending, 1, n))
+            if n < string.len(s.pending) then
+                s.pending = string.sub(s.pending, n + 1)
+            else s.pending = nil end
+            s.window = s.window - n
+            self.window = self.window - n
+            sent = true
+        end
+    end
+    return sent
+end
+
+-- runs requests on the connection until each has ended, opening no more
+-- streams at once than the server allows. returns how many got a stream
+local runstreams = socket.protect(function(self, streams)
+    local i = 1
+    while true do
+        while streams[i] and self.active < self.maxstreams and
+                not self.goaway and self.nextid <= MAXID do
+            self:open(streams[i])
+            i = i + 1
+        end
+        if self.active == 0 then break end
+        local sent = false
+        for _, s in base.pairs(self.streams) do
+            if self:pump(s) then sent = true end
+        end
+        -- reading waits for the server, so it comes when there is
+        -- nothing left to send, or something has arrived
+        if not sent or self:readable() then
+            self:dispatch(self:readframe())
+        end
+    end
+    self:flush()
+    return i - 1
+end)
+
+-- the default url parts
+local default = {
+    host = "",
+    port = PORT,
+    path = "/",
+    scheme = "http"
+}
+
+local function shouldredirect(reqt, code, headers)
+    return headers.location and
+           string.gsub(headers.location, "%s", "") ~= "" and
+           (reqt.redirect ~= false) and
+           (code == 301 or code == 302 or code == 303 or code == 307) and
+           (not reqt.method or reqt.method == "GET" or reqt.method == "HEAD")
+           and (not reqt.nredirects or reqt.nredirects < 5)
+end
+
+-- connection specific fields have no place in HTTP/2
+local hopbyhop = { connection = true, ["keep-alive"] = true,
+    ["proxy-connection"] = true, ["transfer-encoding"] = true,
+    upgrade = true, host = true, te = true }
+
+local function newstream(reqt)
+    local nreqt = reqt.url and url.parse(reqt.url, default) or {}
+    for i, v in base.pairs(reqt) do nreqt[i] = v end
+    socket.try(nreqt.scheme == "http", "unsupported scheme '" ..
+        base.tostring(nreqt.scheme) .. "'")
+    socket.try(nreqt.host and nreqt.host ~= "",
+        "invalid host '" .. base.tostring(nreqt.host) .. "'")
+    if nreqt.port == "" then nreqt.port = PORT end
+    local port = base.tonumber(nreqt.port)
+    local authority = nreqt.host
+    if port ~= PORT then authority = authority .. ":" .. port end
+    local uri = url.build{ path = nreqt.path, params = nreqt.params,
+        query = nreqt.query }
+    local fields = { { ":method", nreqt.method or "GET" },
+        { ":scheme", "http" }, { ":authority", authority },
+        { ":path", uri } }
+    local lower = { ["user-agent"] = USERAGENT }
+    if nreqt.user and nreqt.password then
+        lower["authorization"] =
+            "Basic " .. (mime.b64(nreqt.user .. ":" .. nreqt.password))
+    end
+    for name, value in base.pairs(reqt.headers or {}) do
+        lower[string.lower(name)] = value
+    end
+    -- a fixed order lets the encoder find the same fields in its table
+    local names = {}
+    for name in base.pairs(lower) do
+        if not hopbyhop[name] then names[#names+1] = name end
+    end
+    table.sort(names)
+    for _, name in base.ipairs(names) do
+        fields[#fields+1] = { name, base.tostring(lower[name]) }
+    end
+    if lower.te == "trailers" then fields[#fields+1] = { "te", "trailers" } end
+    local s = { reqt = reqt, fields = fields, host = nreqt.host, port = port,
+        create = reqt.create, source = reqt.source,
+        sink = reqt.sink or ltn12.sink.null() }
+    if reqt.follow then
+        s.follow = function(code, headers)
+            return shouldredirect(reqt, code, headers)
+        end
+    end
+    return s
+end
+
+-- a request that has to be sent again starts over
+local function restart(s)
+    local n = newstream(s.reqt)
+    for k in base.pairs(s) do s[k] = nil end
+    for k, v in base.pairs(n) do s[k] = v end
+end
+
+-- a request that cannot be made is done already, with its error
+local function prepare(reqt)
+    local ok, s = base.pcall(newstream, reqt)
+    if ok then return s end
+    if base.type(s) == "table" then s = s[1] end
+    return { done = true, err = s, sink = reqt.sink or ltn12.sink.null() }
+end
+
+local function results(streams)
+    local responses, errors = {}, {}
+    for i, s in base.ipairs(streams) do
+        s.sink(nil, s.err)
+        if s.done and not s.err then
+            responses[i] = { code = s.code, headers = s.headers,
+                status = "HTTP/2 " .. s.code }
+        else errors[i] = s.err or "connection closed" end
+    end
+    return responses, errors
+end
+
+connect = socket.protect(function(host, port, create)
+    local c = socket.try((create or socket.tcp)())
+    local self = base.setmetatable({
+        c = c,
+        encoder = newencoder(),
+        decoder = newdecoder(),
+        streams = {},
+        active = 0,
+        nextid = 1,
+        maxstreams = CONCURRENCY,
+        initialwindow = 65535,  -- the server's, for what we send
+        window = 65535,
+        framesize = FRAMESIZE,
+        received = 0,           -- data not yet given back to the server
+        out = {},
+        outsize = 0
+    }, metat)
+    -- the streams are left to whoever ran them, with the error
+    self.try = socket.newtry(function()
+        self.closed = true
+        self.c:close()
+    end)
+    self.try(c:settimeout(TIMEOUT))
+    self.try(c:connect(host, port or PORT))
+    if c.setoption then c:setoption("tcp-nodelay", true) end
+    -- no pushes, and a large window for each response
+    self.out[1] = PREFACE
+    self:frame(SETTINGS, 0, 0, pack(2, 2) .. pack(0, 4) ..
+        pack(4, 2) .. pack(WINDOW, 4))
+    if WINDOW > 65535 then
+        self:frame(WINDOW_UPDATE, 0, 0, pack(WINDOW - 65535, 4))
+    end
+    -- the server's preface starts with its settings, which say how many
+    -- streams it takes: no stream is opened before they are known
+    local kind, flags, id, payload = self:readframe()
+    if kind ~= SETTINGS or has(flags, ACK) then self:fail(PROTOCOL_ERROR) end
+    self:dispatch(kind, flags, id, payload)
+    self:flush()
+    return self
+end)
+
+-- reads whatever the server sent while the connection was idle. returns
+-- true if it can still take requests
+local poll = socket.protect(function(self)
+    while not self.closed and self:readable() do
+        self:dispatch(self:readframe())
+    end
+    self:flush()
+    return not self.closed and not self.goaway and self.nextid <= MAXID
+end)
+
+function metat.__index:alive()
+    if self.closed then return false end
+    return poll(self) or false
+end
+
+-- sends requests on this connection, all at once. returns a table of
+-- responses and a table of errors, both indexed like the requests
+function metat.__index:requestmany(reqts)
+    local streams, open = {}, {}
+    for i, reqt in base.ipairs(reqts) do
+        streams[i] = prepare(reqt)
+        if not streams[i].done then open[#open+1] = streams[i] end
+    end
+    self:run(open)
+    return results(streams)
+end
+
+function metat.__index:run(streams)
+    local opened, err = runstreams(self, streams)
+    if not opened then
+        for _, s in base.pairs(self.streams) do self:finish(s, err) end
+    end
+    return opened, err
+end
+
+function metat.__index:request(reqt)
+    local responses, errors = self:requestmany{ reqt }
+    local r = responses[1]
+    if not r then return nil, errors[1] end
+    return 1, r.code, r.headers, r.status
+end
+
+function metat.__index:close()
+    for _, s in base.pairs(self.streams) do
+        self:finish(s, "connection closed")
+    end
+    if self.closed then return 1 end
+    self.closed = true
+    return self.c:close()
+end
+
+-----------------------------------------------------------------------------
+-- High level HTTP/2 API
+-----------------------------------------------------------------------------
+-- connections kept open between calls, by server
+local connections = {}
+
+local function getconnection(host, port, create)
+    local key = host .. ":" .. port
+    local conn = not create and connections[key]
+    if conn and conn:alive() then return conn, true end
+    if conn then conn:close() end
+    local err
+    conn, err = connect(host, port, create)
+    if conn and not create then connections[key] = conn end
+    return conn, false, err
+end
+
+-- runs the streams bound for one server, on as few connections as the
+-- server allows
+local function runserver(streams)
+    local pending = streams
+    local create = streams[1].create
+    for attempt = 0, RETRIES do
+        local s1 = pending[1]
+        local conn, reused, err = getconnection(s1.host, s1.port, create)
+        if not conn then
+            for _, s in base.ipairs(pending) do s.err, s.done = err, true end
+            return
+        end
+        local opened = conn:run(pending)
+        -- requests the connection never got to, those the server turned
+        -- away unseen, and, on a reused connection that failed, those
+        -- with neither an answer nor a body, go on the next connection
+        local left = {}
+        for _, s in base.ipairs(pending) do
+            if not s.id or s.retry or (not opened and reused and
+                    not s.code and not s.reqt.source) then
+                left[#left+1] = s
+            end
+        end
+        if create or not conn:alive() then conn:close() end
+        if not left[1] then return end
+        for _, s in base.ipairs(left) do
+            if attempt == RETRIES then s.done = true
+            else restart(s) end
+        end
+        pending = left
+    end
+end
+
+-- sends requests to their servers, those bound for the same one over a
+-- single connection. returns a table of responses and a table of errors,
+-- both indexed like the requests
+function requestmany(reqts)
+    local streams, servers, order = {}, {}, {}
+    for i, reqt in base.ipairs(reqts) do
+        local s = prepare(reqt)
+        streams[i] = s
+        if not s.done then
+            local key = s.host .. ":" .. s.port .. ":" ..
+                base.tostring(s.create)
+            if not servers[key] then
+                servers[key] = {}
+                order[#order+1] = key
+            end
+            table.insert(servers[key], s)
+        end
+    end
+    for _, key in base.ipairs(order) do runserver(servers[key]) end
+    return results(streams)
+end
+
+local function trequest(reqt)
+    local nreqt = { follow = true }
+    for k, v in base.pairs(reqt) do nreqt[k] = v end
+    local responses, errors = requestmany{ nreqt }
+    local r = responses[1]
+    if not r then return nil, errors[1] end
+    if shouldredirect(reqt, r.code, r.headers) then
+        -- HTTP/2 without TLS can only follow to other http urls
+        local location = url.absolute(reqt.url, r.headers.location)
+        if url.parse(location).scheme == "http" then
+            nreqt.url = location
+            nreqt.nredirects = (reqt.nredirects or 0) + 1
+            local ok, code, headers, status = trequest(nreqt)
+            if ok then headers.location = headers.location or location end
+            return ok, code, headers, status
+        end
+    end
+    return 1, r.code, r.headers, r.status
+end
+
+local function srequest(u, b)
+    local t = {}
+    local reqt = {
+        url = u,
+        sink = ltn12.sink.table(t)
+    }
+    if b then
+        reqt.source = ltn12.source.string(b)
+        reqt.headers = {
+            ["content-length"] = string.len(b),
+            ["content-type"] = "application/x-www-form-urlencoded"
+        }
+        reqt.method = "POST"
+    end
+    local r, code, headers, status = trequest(reqt)
+    if not r then return nil, code end
+    return table.concat(t), code, headers, status
+end
+
+function request(reqt, body)
+    if base.type(reqt) == "string" then return srequest(reqt, body)
+    else return trequest(reqt) end
+end
+
+-- closes the connections kept for later requests
+function close()
+    for key, conn in base.pairs(connections) do
+        conn:close()
+        connections[key] = nil
+    end
+    return 1
+end
@@ -0,0 +1,424 @@
+-----------------------------------------------------------------------------
+-- HTTP response cache
+-- LuaSocket toolkit.
+-----------------------------------------------------------------------------
+
+-----------------------------------------------------------------------------
+-- Declare module and import dependencies
+-----------------------------------------------------------------------------
+local base = _G
+local string = require("string")
+local table = require("table")
+local math = require("math")
+local io = require("io")
+local os = require("os")
+local socket = require("socket")
+local http = require("socket.http")
+local ltn12 = require("ltn12")
+module("socket.http.cache")
+
+-----------------------------------------------------------------------------
+-- Program constants
+-----------------------------------------------------------------------------
+-- bytes of bodies kept in memory, and in the cache directory
+MAXMEMORY = 4194304
+MAXDISK = 67108864
+-- bodies larger than this go to the cache directory
+INLINE = 65536
+
+-----------------------------------------------------------------------------
+-- Dates and directives
+-----------------------------------------------------------------------------
+local months = { jan = 1, feb = 2, mar = 3, apr = 4, may = 5, jun = 6,
+    jul = 7, aug = 8, sep = 9, oct = 10, nov = 11, dec = 12 }
+
+-- seconds since the epoch of an HTTP date, in any of the three forms
+-- servers send, or nil
+local function parsedate(s)
+    if not s then return nil end
+    local d, m, y, hh, mm, ss = string.match(s,
+        "(%d+)[ %-](%a+)[ %-](%d+) (%d+):(%d+):(%d+)")
+    if not d then
+        -- asctime, as in "Sun Nov  6 08:49:37 1994"
+        m, d, hh, mm, ss, y = string.match(s,
+            "(%a+) +(%d+) (%d+):(%d+):(%d+) (%d+)")
+    end
+    m = months[string.lower(m or "")]
+    if not m then return nil end
+    y = base.tonumber(y)
+    if y < 100 then
+        if y < 70 then y = y + 2000 else y = y + 1900 end
+    end
+    -- days from the civil calendar, which has no time zones to get wrong
+    if m <= 2 then y = y - 1 end
+    local era = math.floor(y / 400)
+    local yoe = y - era * 400
+    local mp = m > 2 and m - 3 or m + 9
+    local doy = math.floor((153 * mp + 2) / 5) + d - 1
+    local doe = yoe * 365 + math.floor(yoe / 4) - math.floor(yoe / 100) + doy
+    local days = era * 146097 + doe - 719468
+    return days * 86400 + hh * 3600 + mm * 60 + ss
+end
+
+-- the directives of a Cache-Control field, with their arguments or true
+local function directives(value)
+    local t = {}
+    for token in string.gmatch(string.lower(value or ""), "[^,]+") do
+        local name, arg = string.match(token,
+            "^%s*([%w%-]+)%s*=?%s*\"?([^\"]*)")
+        if name then
+            if arg == "" then arg = true end
+            t[name] = arg
+        end
+    end
+    return t
+end
+
+local function lower(headers)
+    local t = {}
+    for name, value in base.pairs(headers or {}) do
+        t[string.lower(name)] = value
+    end
+    return t
+end
+
+local function copy(t)
+    local c = {}
+    for name, value in base.pairs(t) do c[name] = value end
+    return c
+end
+
+-- statuses whose responses can be reused
+local cacheable = { [200] = true, [203] = true, [300] = true,
+    [301] = true, [404] = true, [410] = true }
+
+-- sets how long a stored response is fresh, and how old it already was
+-- when it arrived
+local function setfreshness(entry, now)
+    local h = entry.headers
+    local cc = directives(h["cache-control"])
+    entry.stored = now
+    entry.age = math.max(0, base.tonumber(h.age) or 0)
+    entry.nocache = cc["no-cache"]
+    local date = parsedate(h.date) or now
+    local lifetime = base.tonumber(cc["max-age"])
+    if not lifetime and h.expires then
+        -- an Expires that does not parse has already passed
+        lifetime = (parsedate(h.expires) or 0) - date
+    end
+    if not lifetime then
+        -- the usual heuristic: a tenth of the time since the last change
+        local modified = parsedate(h["last-modified"])
+        lifetime = modified and (date - modified) / 10 or 0
+    end
+    entry.lifetime = math.max(0, lifetime)
+end
+
+local function fresh(entry, rcc, now)
+    if entry.nocache or rcc["no-cache"] then return false end
+    local age = entry.age + now - entry.stored
+    local maxage = base.tonumber(rcc["max-age"])
+    if maxage and age > maxage then return false end
+    return age < entry.lifetime
+end
+
+-----------------------------------------------------------------------------
+-- Store
+-----------------------------------------------------------------------------
+local metat = { __index = {} }
+
+function new(options)
+    options = options or {}
+    local lru = {}
+    lru.prev, lru.next = lru, lru
+    local self = base.setmetatable({
+        dir = options.dir,
+        maxmemory = options.maxmemory or MAXMEMORY,
+        maxdisk = options.maxdisk or MAXDISK,
+        inline = options.inline or INLINE,
+        fetch = options.request or http.request,
+        keys = {},      -- vary names and variants by method and url
+        lru = lru,      -- entries, most recently used first
+        memory = 0,
+        disk = 0,
+        count = 0,
+        serial = 0,
+        metrics = { hits = 0, misses = 0, revalidated = 0, stored = 0,
+            evicted = 0 }
+    }, metat)
+    -- file names start with the time and address the cache was created
+    -- at, so that caches in other processes sharing the directory do not
+    -- pick the same ones
+    self.prefix = string.format("%.0f-%s", socket.gettime()*1e6,
+        string.match(base.tostring(self), "%x+$"))
+    -- tables are not finalized, so a userdatum removes the files once
+    -- the cache is collected
+    if self.dir then
+        self.gc = base.newproxy(true)
+        base.getmetatable(self.gc).__gc = function() self:clear() end
+    end
+    return self
+end
+
+local function unlink(entry)
+    entry.prev.next, entry.next.prev = entry.next, entry.prev
+end
+
+local function link(self, entry)
+    entry.next, entry.prev = self.lru.next, self.lru
+    self.lru.next.prev = entry
+    self.lru.next = entry
+end
+
+local function touch(self, entry)
+    unlink(entry)
+    link(self, entry)
+end
+
+-- a file name that is not in use yet
+local function newpath(self)
+    while true do
+        self.serial = self.serial + 1
+        local path = string.format("%s/%s-%d.http", self.dir, self.prefix,
+            self.serial)
+        local f = io.open(path, "rb")
+        if not f then return path end
+        f:close()
+    end
+end
+
+local function drop(self, entry)
+    unlink(entry)
+    local key = self.keys[entry.key]
+    key.variants[entry.sig] = nil
+    if not base.next(key.variants) then self.keys[entry.key] = nil end
+    if entry.path then
+        os.remove(entry.path)
+        self.disk = self.disk - entry.size
+    else self.memory = self.memory - entry.size end
+    self.count = self.count - 1
+end
+
+-- the request header values a response varies on
+local function signature(names, rh)
+    local t = {}
+    for i, name in base.ipairs(names) do
+        t[i] = name .. "=" .. base.tostring(rh[name] or "")
+    end
+    return table.concat(t, "\n")
+end
+
+local function lookup(self, key, rh)
+    local k = self.keys[key]
+    if not k then return nil end
+    return k.variants[signature(k.names, rh)]
+end
+
+local function insert(self, entry, names, rh)
+    local k = self.keys[entry.key]
+    -- variants stored under other Vary fields cannot be matched any more
+    if k and table.concat(k.names, ",") ~= table.concat(names, ",") then
+        for _, old in base.pairs(copy(k.variants)) do drop(self, old) end
+        k = nil
+    end
+    k = k or { names = names, variants = {} }
+    entry.sig = signature(names, rh)
+    if k.variants[entry.sig] then drop(self, k.variants[entry.sig]) end
+    self.keys[entry.key] = k
+    k.variants[entry.sig] = entry
+    link(self, entry)
+    if entry.path then self.disk = self.disk + entry.size
+    else self.memory = self.memory + entry.size end
+    self.count = self.count + 1
+    self.metrics.stored = self.metrics.stored + 1
+    -- the least recently used go first, from whichever store is over its
+    -- budget, but never the one just stored
+    local old = self.lru.prev
+    while old ~= self.lru and
+            (self.memory > self.maxmemory or self.disk > self.maxdisk) do
+        local prev = old.prev
+        if old ~= entry and (old.path and self.disk > self.maxdisk or
+                not old.path and self.memory > self.maxmemory) then
+            drop(self, old)
+            self.metrics.evicted = self.metrics.evicted + 1
+        end
+        old = prev
+    end
+end
+
+-- collects a body for the cache: in memory while it is small, then in a
+-- file in the cache directory. it gives up once the body outgrows what
+-- the cache may hold, without bothering the sink it shadows
+local function storesink(self)
+    local s = { size = 0, parts = {} }
+    local function fail()
+        if s.file then s.file:close(); os.remove(s.path) end
+        s.failed, s.parts, s.file = true, nil, nil
+    end
+    s.sink = function(chunk)
+        if s.failed or not chunk then return 1 end
+        s.size = s.size + string.len(chunk)
+        if s.file then
+            if s.size > self.maxdisk or not s.file:write(chunk) then fail() end
+        elseif s.size <= self.inline then
+            s.parts[#s.parts+1] = chunk
+        elseif not self.dir or s.size > self.maxdisk then
+            fail()
+        else
+            s.path = newpath(self)
+            s.file = io.open(s.path, "wb")
+            if not s.file then fail(); return 1 end
+            s.file:write(table.concat(s.parts))
+            s.parts = nil
+            if not s.file:write(chunk) then fail() end
+        end
+        return 1
+    end
+    s.abort = function() if not s.failed then fail() end end
+    s.finish = function(entry)
+        if s.failed then return nil end
+        if s.file then
+            s.file:close()
+            entry.path = s.path
+        else entry.body = table.concat(s.parts) end
+        entry.size = s.size
+        return entry
+    end
+    return s
+end
+
+-- passes the body on to the sink, and a copy of it to the store
+local function tee(sink, store)
+    return function(chunk, err)
+        store(chunk)
+        return sink(chunk, err)
+    end
+end
+
+local function serve(self, entry, sink, step)
+    local source
+    if entry.path then
+        local f, err = io.open(entry.path, "rb")
+        if not f then drop(self, entry); return nil, err end
+        source = ltn12.source.file(f)
+    else source = ltn12.source.string(entry.body) end
+    local ok, err = ltn12.pump.all(source, sink or ltn12.sink.null(), step)
+    if not ok then return nil, err end
+    return 1, entry.code, copy(entry.headers), entry.status
+end
+
+-- whatever is stored for an url is stale once it is changed through it
+local function invalidate(self, u)
+    for _, method in base.ipairs{ "GET", "HEAD" } do
+        local k = self.keys[method .. " " .. u]
+        if k then
+            for _, entry in base.pairs(copy(k.variants)) do
+                drop(self, entry)
+            end
+        end
+    end
+end
+
+-- fields a 304 response cannot change
+local framing = { ["content-length"] = true, ["transfer-encoding"] = true,
+    ["content-encoding"] = true, connection = true }
+
+-----------------------------------------------------------------------------
+-- High level API
+-----------------------------------------------------------------------------
+function metat.__index:request(reqt, body)
+    if base.type(reqt) == "string" then
+        if body then return self.fetch(reqt, body) end
+        local t = {}
+        local r, code, headers, status = self:request{ url = reqt,
+            sink = ltn12.sink.table(t) }
+        if not r then return nil, code end
+        return table.concat(t), code, headers, status
+    end
+    local method = string.upper(reqt.method or "GET")
+    if method ~= "GET" and method ~= "HEAD" then
+        if reqt.url then invalidate(self, reqt.url) end
+        return self.fetch(reqt)
+    end
+    if reqt.source or not reqt.url then return self.fetch(reqt) end
+    local key = method .. " " .. reqt.url
+    local rh = lower(reqt.headers)
+    local rcc = directives(rh["cache-control"])
+    local pragma = string.lower(rh.pragma or "")
+    if string.find(pragma, "no-cache", 1, true) then
+        rcc["no-cache"] = true
+    end
+    local entry = lookup(self, key, rh)
+    if entry and fresh(entry, rcc, socket.gettime()) then
+        self.metrics.hits = self.metrics.hits + 1
+        touch(self, entry)
+        return serve(self, entry, reqt.sink, reqt.step)
+    end
+    -- ask the server, and let it answer 304 if what we have is still good
+    local nreqt = copy(reqt)
+    nreqt.headers = copy(rh)
+    if entry then
+        nreqt.headers["if-none-match"] = entry.headers.etag
+        nreqt.headers["if-modified-since"] = entry.headers["last-modified"]
+    end
+    local store = storesink(self)
+    nreqt.sink = tee(reqt.sink or ltn12.sink.null(), store.sink)
+    local r, code, headers, status = self.fetch(nreqt)
+    local now = socket.gettime()
+    if not r then
+        store.abort()
+        return nil, code
+    end
+    if code == 304 and entry then
+        store.abort()
+        self.metrics.revalidated = self.metrics.revalidated + 1
+        for name, value in base.pairs(headers) do
+            if not framing[name] then entry.headers[name] = value end
+        end
+        setfreshness(entry, now)
+        touch(self, entry)
+        return serve(self, entry, reqt.sink, reqt.step)
+    end
+    self.metrics.misses = self.metrics.misses + 1
+    local cc = directives(headers["cache-control"])
+    local vary = string.lower(headers.vary or "")
+    if not cacheable[code] or cc["no-store"] or rcc["no-store"] or
+            string.find(vary, "*", 1, true) then
+        store.abort()
+        return r, code, headers, status
+    end
+    local stored = { key = key, code = code, status = status,
+        headers = copy(headers) }
+    setfreshness(stored, now)
+    -- a response that is stale already is worth keeping only if it can
+    -- be revalidated
+    if (stored.lifetime > 0 or headers.etag or headers["last-modified"]) and
+            store.finish(stored) then
+        local names = {}
+        for name in string.gmatch(vary, "[^%s,]+") do
+            names[#names+1] = name
+        end
+        table.sort(names)
+        insert(self, stored, names, rh)
+    else store.abort() end
+    return r, code, headers, status
+end
+
+function metat.__index:getstats()
+    local stats = copy(self.metrics)
+    local used = stats.hits + stats.revalidated
+    local total = used + stats.misses
+    stats.hitrate = total > 0 and used / total or 0
+    stats.entries = self.count
+    stats.memory = self.memory
+    stats.disk = self.disk
+    return stats
+end
+
+-- forgets every response, and removes their files
+function metat.__index:clear()
+    while self.lru.next ~= self.lru do drop(self, self.lru.next) end
+    return 1
+end
+
+metat.__index.close = metat.__index.clear
@@ -0,0 +1,496 @@
+-----------------------------------------------------------------------------
+-- HTTP/1.1 server support for the Lua language.
+-- LuaSocket toolkit.
+-----------------------------------------------------------------------------
+
+-----------------------------------------------------------------------------
+-- Declare module and import dependencies
+-----------------------------------------------------------------------------
+local base = _G
+local string = require("string")
+local math = require("math")
+local coroutine = require("coroutine")
+local io = require("io")
+local os = require("os")
+local debug = require("debug")
+local socket = require("socket")
+local ltn12 = require("ltn12")
+local url = require("socket.url")
+local headers = require("socket.headers")
+-- registers the http-chunked source
+local http = require("socket.http")
+module("socket.http.server")
+
+-----------------------------------------------------------------------------
+-- Program constants
+-----------------------------------------------------------------------------
+-- seconds a request may take, from its head to the end of the response
+TIMEOUT = 30
+-- seconds a connection may wait for its next request
+IDLE = 15
+-- connections served at once. more wait in the listen backlog
+MAXCONNECTIONS = 1024
+-- listen backlog
+BACKLOG = 128
+-- server field sent in responses
+SERVER = socket._VERSION
+
+local reasons = {
+    [100] = "Continue", [200] = "OK", [201] = "Created",
+    [202] = "Accepted", [204] = "No Content", [206] = "Partial Content",
+    [301] = "Moved Permanently", [302] = "Found", [303] = "See Other",
+    [304] = "Not Modified", [307] = "Temporary Redirect",
+    [400] = "Bad Request", [401] = "Unauthorized", [403] = "Forbidden",
+    [404] = "Not Found", [405] = "Method Not Allowed",
+    [408] = "Request Timeout", [411] = "Length Required",
+    [413] = "Payload Too Large", [416] = "Range Not Satisfiable",
+    [417] = "Expectation Failed", [431] = "Request Header Fields Too Large",
+    [500] = "Internal Server Error", [501] = "Not Implemented",
+    [503] = "Service Unavailable"
+}
+
+-----------------------------------------------------------------------------
+-- Non-blocking I/O from inside a connection's coroutine. Whenever the
+-- socket would block, the coroutine yields what it waits for, and step
+-- resumes it once the poller says so
+-----------------------------------------------------------------------------
+local function wait(what)
+    coroutine.yield(what)
+end
+
+local function send(conn, data)
+    local i = 1
+    while true do
+        local last, err, sent = conn.sock:send(data, i)
+        if last then return 1 end
+        if err ~= "timeout" then return nil, err end
+        i = sent + 1
+        wait("w")
+    end
+end
+
+-- what the body sources see in place of the socket. it has no C header or
+-- chunk parsers, which cannot resume after a timeout
+local function proxy(conn)
+    return {
+        receive = function(self, pattern, prefix)
+            while true do
+                local chunk, err, partial = conn.sock:receive(pattern, prefix)
+                if err ~= "timeout" then return chunk, err, partial end
+                prefix = partial
+                wait("r")
+            end
+        end,
+        send = function(self, data) return send(conn, data) end,
+        getfd = function() return conn.sock:getfd() end,
+        dirty = function() return conn.sock:dirty() end
+    }
+end
+
+-----------------------------------------------------------------------------
+-- Requests
+-----------------------------------------------------------------------------
+local function has(value, token)
+    return value and string.find(string.lower(value), token, 1, true)
+end
+
+-- the body source remembers whether it was read to the end, so that the
+-- connection knows what is left to skip before the next request
+local function bodysource(conn, req)
+    local h = req.headers
+    local src
+    if h["transfer-encoding"] and h["transfer-encoding"] ~= "identity" then
+        if not has(h["transfer-encoding"], "chunked") then return nil end
+        src = socket.source("http-chunked", proxy(conn), h)
+    elseif h["content-length"] then
+        local length = base.tonumber(h["content-length"])
+        if not length or length < 0 then return nil end
+        if length == 0 then src = ltn12.source.empty()
+        else src = socket.source("by-length", proxy(conn), length) end
+    else
+        req.done = true
+        return ltn12.source.empty()
+    end
+    -- clients that wait for 100-continue send nothing until asked
+    req.expect = req.version == "HTTP/1.1" and has(h.expect, "100-continue")
+    return function()
+        if req.done then return nil end
+        if req.expect then
+            req.expect = nil
+            if not req.response.started then
+                local ok, err = send(conn, "HTTP/1.1 100 Continue\r\n\r\n")
+                if not ok then req.done = true; req.broken = true
+                    return nil, err end
+            end
+        end
+        local chunk, err = src()
+        if not chunk then
+            req.done = true
+            req.broken = err
+        end
+        return chunk, err
+    end
+end
+
+local function newrequest(conn, method, target, version, h)
+    local req = {
+        method = method,
+        target = target,
+        version = version,
+        headers = h,
+        path = url.unescape(string.match(target, "^[^?#]*")),
+        query = string.match(target, "%?([^#]*)")
+    }
+    req.source = bodysource(conn, req)
+    if not req.source then return nil end
+    return req
+end
+
+-----------------------------------------------------------------------------
+-- Responses
+-----------------------------------------------------------------------------
+local response = { __index = {} }
+
+local function newresponse(server, conn, req)
+    local res = base.setmetatable({ server = server, conn = conn,
+        req = req }, response)
+    req.response = res
+    return res
+end
+
+local function serialize(code, h)
+    return string.format("HTTP/1.1 %d %s\r\n", code,
+        reasons[code] or "Unknown") .. headers.serialize(h)
+end
+
+-- settles framing and persistence, and returns the response head
+local function begin(res, code, given)
+    local req = res.req
+    base.assert(not res.started, "response already started")
+    res.started = true
+    local h = {}
+    for name, value in base.pairs(given or {}) do
+        h[string.lower(name)] = value
+    end
+    h.server = h.server or SERVER
+    local keepalive
+    if req.version == "HTTP/1.1" then
+        keepalive = not has(req.headers.connection, "close")
+    else keepalive = has(req.headers.connection, "keep-alive") end
+    if res.server.closing or has(h.connection, "close") then keepalive = nil end
+    -- a client still holding back its body for 100-continue may send it
+    -- or not, so the connection cannot be trusted afterwards
+    if req.expect then keepalive = nil end
+    if req.method == "HEAD" or code == 204 or code == 304 or
+        (code >= 100 and code < 200) then
+        res.mode = "none"
+    elseif h["content-length"] then
+        res.mode = "length"
+    elseif req.version == "HTTP/1.1" then
+        res.mode = "chunked"
+        h["transfer-encoding"] = "chunked"
+    else
+        res.mode = "close"
+        keepalive = nil
+    end
+    if not keepalive then h.connection = "close"
+    elseif req.version ~= "HTTP/1.1" then h.connection = "keep-alive" end
+    res.keepalive = keepalive
+    res.code = code
+    return serialize(code, h)
+end
+
+-- the head goes out with the first chunk of the body
+function response.__index:sink(code, h)
+    local pending = begin(self, code, h)
+    local conn, mode = self.conn, self.mode
+    self.write = function(chunk, err)
+        if self.finished then return nil, "response finished" end
+        local data
+        if not chunk then
+            self.finished = true
+            if mode == "chunked" then data = "0\r\n\r\n" end
+        elseif chunk == "" or mode == "none" then
+            data = nil
+        elseif mode == "chunked" then
+            data = string.format("%X\r\n", string.len(chunk)) .. chunk .. "\r\n"
+        else data = chunk end
+        if pending then data = pending .. (data or ""); pending = nil end
+        if not data then return 1 end
+        local ok, err = send(conn, data)
+        if not ok then self.broken = err; self.finished = true end
+        return ok, err
+    end
+    return self.write
+end
+
+-- body is a string or an ltn12 source
+function response.__index:send(code, h, body)
+    body = body or ""
+    if base.type(body) == "string" then
+        local given = h or {}
+        h = {}
+        for name, value in base.pairs(given) do
+            h[string.lower(name)] = value
+        end
+        -- the length of a HEAD response is that of the body it stands for
+        if self.req.method ~= "HEAD" or not h["content-length"] then
+            h["content-length"] = string.len(body)
+        end
+        local head = begin(self, code, h)
+        self.finished = true
+        if self.mode == "none" then body = "" end
+        local ok, err = send(self.conn, head .. body)
+        if not ok then self.broken = err end
+        return ok, err
+    end
+    local ok, err = ltn12.pump.all(body, self:sink(code, h))
+    if not self.finished then self.broken = err or "aborted"
+        self.finished = true end
+    return ok, err
+end
+
+-----------------------------------------------------------------------------
+-- Connections
+-----------------------------------------------------------------------------
+local function refuse(conn, code)
+    send(conn, serialize(code, { ["content-length"] = 0,
+        connection = "close", server = SERVER }))
+end
+
+-- body of each connection's coroutine. returning closes the connection
+local function serve(self, conn)
+    local sock = conn.sock
+    while true do
+        conn.deadline = socket.gettime() + self.idle
+        local method, target, version, h
+        while true do
+            method, target, version, h = sock:receiverequest()
+            if method or target ~= "timeout" then break end
+            wait("r")
+        end
+        if not method then
+            if target == "bad request" then refuse(conn, 400)
+            elseif target == "request too large" then refuse(conn, 431) end
+            return
+        end
+        conn.deadline = socket.gettime() + self.timeout
+        self.stats.requests = self.stats.requests + 1
+        local req = newrequest(conn, method, target, version, h)
+        if not req then return refuse(conn, 400) end
+        local res = newresponse(self, conn, req)
+        conn.res = res
+        self.handler(req, res)
+        if not res.started then
+            res:send(500, nil, "handler sent no response\n")
+        elseif not res.finished then
+            res.write(nil)
+        end
+        conn.res = nil
+        if res.broken or not res.keepalive or self.closing then return end
+        -- skip whatever the handler left of the body
+        if not req.done then
+            ltn12.pump.all(req.source, ltn12.sink.null())
+        end
+        if req.broken then return end
+    end
+end
+
+local metat = { __index = {} }
+
+-- the poller goes once a closed server has no connections left
+local function shutdown(self)
+    if self.closing and self.count == 0 and self.poller then
+        self.poller:close()
+        self.poller = nil
+    end
+end
+
+local function finish(self, conn)
+    self.poller:remove(conn.sock)
+    conn.sock:close()
+    self.conns[conn.sock] = nil
+    self.count = self.count - 1
+    if self.paused and not self.closing and self.count < self.max then
+        self.poller:add(self.listener, "r")
+        self.paused = nil
+    end
+    shutdown(self)
+end
+
+local function resume(self, conn)
+    local ok, want = coroutine.resume(conn.co)
+    if not ok then
+        self.stats.errors = self.stats.errors + 1
+        self.onerror(debug.traceback(conn.co, want), conn.res and conn.res.req)
+        -- the socket is idle between responses, so an error page that
+        -- fits the send buffer goes out at once
+        if conn.res and not conn.res.started then
+            conn.sock:send(serialize(500, { ["content-length"] = 0,
+                connection = "close", server = SERVER }))
+        end
+        return finish(self, conn)
+    end
+    if coroutine.status(conn.co) == "dead" then return finish(self, conn) end
+    if want ~= conn.want then
+        self.poller:modify(conn.sock, want)
+        conn.want = want
+    end
+end
+
+-- unix listeners take one client at a time
+local function acceptmany(listener, n)
+    if listener.acceptmany then return listener:acceptmany(n) end
+    local clients = {}
+    while #clients < n do
+        local c = listener:accept()
+        if not c then break end
+        clients[#clients+1] = c
+    end
+    return clients
+end
+
+local function accept(self)
+    local clients = acceptmany(self.listener,
+        math.min(64, self.max - self.count))
+    if not clients then return end
+    local now = socket.gettime()
+    for _, sock in base.ipairs(clients) do
+        sock:settimeout(0)
+        if not self.unixpath then sock:setoption("tcp-nodelay", true) end
+        local conn = { sock = sock, want = "r", deadline = now + self.idle }
+        conn.co = coroutine.create(function() return serve(self, conn) end)
+        self.conns[sock] = conn
+        self.count = self.count + 1
+        self.stats.accepted = self.stats.accepted + 1
+        self.poller:add(sock, "r")
+    end
+    if self.count >= self.max then
+        self.poller:remove(self.listener)
+        self.paused = true
+    end
+end
+
+-- closes connections past their deadline
+local function expire(self, now)
+    local late = {}
+    for _, conn in base.pairs(self.conns) do
+        if conn.deadline < now then late[#late+1] = conn end
+    end
+    for _, conn in base.ipairs(late) do
+        self.stats.timeouts = self.stats.timeouts + 1
+        finish(self, conn)
+    end
+end
+
+local function report(err)
+    io.stderr:write("socket.http.server: ", err, "\n")
+end
+
+-- listens on a unix domain socket at path
+local function bindunix(path, backlog)
+    if not socket.unix then return nil, "unix sockets not supported" end
+    local listener, err = socket.unix()
+    if not listener then return nil, err end
+    local ok
+    ok, err = listener:bind(path)
+    if ok then ok, err = listener:listen(backlog) end
+    if not ok then listener:close(); return nil, err end
+    return listener
+end
+
+function new(options)
+    base.assert(options and options.handler, "handler required")
+    local listener, err
+    if options.unixpath then
+        listener, err = bindunix(options.unixpath,
+            options.backlog or BACKLOG)
+    else
+        listener, err = socket.bind(options.host or "*", options.port or 0,
+            options.backlog or BACKLOG)
+    end
+    if not listener then return nil, err end
+    listener:settimeout(0)
+    local poller
+    poller, err = socket.poller()
+    if not poller then listener:close(); return nil, err end
+    poller:add(listener, "r")
+    local self = base.setmetatable({
+        listener = listener,
+        unixpath = options.unixpath,
+        poller = poller,
+        handler = options.handler,
+        onerror = options.onerror or report,
+        max = options.maxconnections or MAXCONNECTIONS,
+        idle = options.idle or IDLE,
+        timeout = options.timeout or TIMEOUT,
+        conns = {},
+        count = 0,
+        stats = { accepted = 0, requests = 0, errors = 0, timeouts = 0 }
+    }, metat)
+    -- deadlines are checked a few times within the shortest of them
+    self.scan = math.min(self.idle, self.timeout, 1) / 4
+    self.nextscan = socket.gettime() + self.scan
+    return self
+end
+
+-- waits at most timeout seconds for something to do, and does it
+function metat.__index:step(timeout)
+    if not self.poller then return nil, "closed" end
+    local readable, writable = self.poller:wait(timeout, 256)
+    if not readable then return nil, writable end
+    for _, obj in base.ipairs(readable) do
+        if obj == self.listener then accept(self)
+        elseif self.conns[obj] then resume(self, self.conns[obj]) end
+    end
+    for _, obj in base.ipairs(writable) do
+        if self.conns[obj] then resume(self, self.conns[obj]) end
+    end
+    local now = socket.gettime()
+    if now >= self.nextscan then
+        expire(self, now)
+        self.nextscan = now + self.scan
+    end
+    return 1
+end
+
+-- serves until the server is closed, possibly by a handler
+function metat.__index:run()
+    while self.poller do
+        local ok, err = self:step(self.scan)
+        if not ok and err ~= "closed" then return nil, err end
+    end
+    return 1
+end
+
+function metat.__index:getsockname()
+    if not self.listener then return nil, "closed" end
+    if self.unixpath then return self.unixpath end
+    return self.listener:getsockname()
+end
+
+function metat.__index:getstats()
+    local stats = {}
+    for name, value in base.pairs(self.stats) do stats[name] = value end
+    stats.active = self.count
+    return stats
+end
+
+-- closes the listener and every connection, even in the middle of a
+-- request. a handler may call it, and its own response still goes out
+-- before its connection closes
+function metat.__index:close()
+    if not self.poller then return 1 end
+    self.closing = true
+    if not self.paused then self.poller:remove(self.listener) end
+    local current, conns = coroutine.running(), {}
+    for _, conn in base.pairs(self.conns) do
+        if conn.co ~= current then conns[#conns+1] = conn end
+    end
+    for _, conn in base.ipairs(conns) do finish(self, conn) end
+    self.listener:close()
+    self.listener = nil
+    if self.unixpath then os.remove(self.unixpath) end
+    shutdown(self)
+    return 1
+end
@@ -5,11 +5,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "auxiliar.h"
 #include "inet.h"
+#ifndef _WIN32
+#include "async.h"
+#endif
 
 /*=========================================================================*\
 * Internal function prototypes.
@@ -19,7 +26,25 @@ static int inet_global_getaddrinfo(lua_State *L);
 static int inet_global_tohostname(lua_State *L);
 static int inet_global_getnameinfo(lua_State *L);
 static void inet_pushresolved(lua_State *L, struct hostent *hp);
+static void inet_pushaddrinfo(lua_State *L, struct addrinfo *resolved);
+static int inet_global_setcache(lua_State *L);
+static int inet_global_flushcache(lua_State *L);
+static int inet_global_cachestats(lua_State *L);
 static int inet_global_gethostname(lua_State *L);
+#ifndef _WIN32
+static int inet_global_toip_async(lua_State *L);
+static int inet_global_tohostname_async(lua_State *L);
+static int inet_global_getaddrinfo_async(lua_State *L);
+static int inet_global_getnameinfo_async(lua_State *L);
+static int inet_global_resolve_async(lua_State *L);
+static int inet_batch_meth_receive(lua_State *L);
+static int inet_batch_meth_results(lua_State *L);
+static int inet_batch_meth_getstats(lua_State *L);
+static int inet_batch_meth_settimeout(lua_State *L);
+static int inet_batch_meth_getfd(lua_State *L);
+static int inet_batch_meth_dirty(lua_State *L);
+static int inet_batch_meth_close(lua_State *L);
+#endif
 
 /* DNS functions */
 static luaL_Reg func[] = {
@@ -28,8 +53,34 @@ static luaL_Reg func[] = {
     { "tohostname", inet_global_tohostname},
     { "getnameinfo", inet_global_getnameinfo},
     { "gethostname", inet_global_gethostname},
+    { "setcache", inet_global_setcache},
+    { "flushcache", inet_global_flushcache},
+    { "cachestats", inet_global_cachestats},
+#ifndef _WIN32
+    { "toip_async", inet_global_toip_async},
+    { "tohostname_async", inet_global_tohostname_async},
+    { "getaddrinfo_async", inet_global_getaddrinfo_async},
+    { "getnameinfo_async", inet_global_getnameinfo_async},
+    { "resolve_async", inet_global_resolve_async},
+#endif
+    { NULL, NULL}
+};
+
+#ifndef _WIN32
+/* batch methods */
+static luaL_Reg batch_methods[] = {
+    { "__gc", inet_batch_meth_close},
+    { "__tostring", auxiliar_tostring},
+    { "close", inet_batch_meth_close},
+    { "dirty", inet_batch_meth_dirty},
+    { "getfd", inet_batch_meth_getfd},
+    { "getstats", inet_batch_meth_getstats},
+    { "receive", inet_batch_meth_receive},
+    { "results", inet_batch_meth_results},
+    { "settimeout", inet_batch_meth_settimeout},
     { NULL, NULL}
 };
+#endif
 
 /*=========================================================================*\
 * Exported functions
@@ -39,6 +90,9 @@ static luaL_Reg func[] = {
 \*-------------------------------------------------------------------------*/
 int inet_open(lua_State *L)
 {
+#ifndef _WIN32
+    auxiliar_newclass(L, "dns{batch}", batch_methods);
+#endif
     lua_pushstring(L, "dns");
     lua_newtable(L);
     luaL_openlib(L, NULL, func, 0);
@@ -96,8 +150,8 @@ static int inet_global_getnameinfo(lua_State *L) {
     hints.ai_family = PF_UNSPEC;
 
     /* getaddrinfo must get a node and a service argument */
-    ret = getaddrinfo(node ? node : "127.0.0.1", service ? service : "7",
-        &hints, &resolved);
+    ret = inet_getaddrinfo(node ? node : "127.0.0.1",
+        service ? service : "7", &hints, &resolved);
     if (ret != 0) {
         lua_pushnil(L);
         lua_pushstring(L, socket_gaistrerror(ret));
@@ -115,7 +169,7 @@ static int inet_global_getnameinfo(lua_State *L) {
             lua_settable(L, -3);
         }
     }
-    freeaddrinfo(resolved);
+    inet_freeaddrinfo(resolved);
 
     if (service) {
         lua_pushstring(L, serv);
@@ -147,44 +201,20 @@ static int inet_global_toip(lua_State *L)
 static int inet_global_getaddrinfo(lua_State *L)
 {
     const char *hostname = luaL_checkstring(L, 1);
-    struct addrinfo *iterator = NULL, *resolved = NULL;
+    struct addrinfo *resolved = NULL;
     struct addrinfo hints;
-    int i = 1, ret = 0;
+    int ret = 0;
     memset(&hints, 0, sizeof(hints));
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_family = PF_UNSPEC;
-    ret = getaddrinfo(hostname, NULL, &hints, &resolved);
+    ret = inet_getaddrinfo(hostname, NULL, &hints, &resolved);
     if (ret != 0) {
         lua_pushnil(L);
         lua_pushstring(L, socket_gaistrerror(ret));
         return 2;
     }
-    lua_newtable(L);
-    for (iterator = resolved; iterator; iterator = iterator->ai_next) {
-        char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
-        getnameinfo(iterator->ai_addr, iterator->ai_addrlen, hbuf, sizeof(hbuf),
-                sbuf, 0, NI_NUMERICHOST);
-        lua_pushnumber(L, i);
-        lua_newtable(L);
-        switch (iterator->ai_family) {
-            case AF_INET:
-                lua_pushliteral(L, "family");
-                lua_pushliteral(L, "inet");
-                lua_settable(L, -3);
-                break;
-            case AF_INET6:
-                lua_pushliteral(L, "family");
-                lua_pushliteral(L, "inet6");
-                lua_settable(L, -3);
-                break;;
-        }
-        lua_pushliteral(L, "addr");
-        lua_pushstring(L, hbuf);
-        lua_settable(L, -3);
-        lua_settable(L, -3);
-        i++;
-    }
-    freeaddrinfo(resolved);
+    inet_pushaddrinfo(L, resolved);
+    inet_freeaddrinfo(resolved);
     return 1;
 }
 
@@ -208,6 +238,891 @@ static int inet_global_gethostname(lua_State *L)
 
 
 
+/*=========================================================================*\
+* Resolver cache
+\*=========================================================================*/
+#define DNS_BUCKETS 1024        /* hash table size, must be a power of 2 */
+#define DNS_MAXKEY 512          /* longer names are not cached */
+
+typedef struct t_dnsentry_ t_dnsentry;
+typedef t_dnsentry *p_dnsentry;
+
+struct t_dnsentry_ {
+    p_dnsentry chain;           /* next entry in the same bucket */
+    p_dnsentry newer, older;    /* neighbours in least recently used order */
+    unsigned long hash;
+    double expires;             /* absolute time */
+    int err;                    /* getaddrinfo error code, if negative */
+    struct addrinfo *resolved;  /* copy of the answer, if positive */
+    int family, socktype, protocol, flags;
+    size_t len;                 /* length of key */
+    char key[1];                /* node and service, see inet_dnskey */
+};
+
+static struct {
+    p_dnsentry buckets[DNS_BUCKETS];
+    p_dnsentry newest, oldest;
+    int count, size;            /* current and maximum number of entries */
+    double ttl, negttl;         /* lifetime of answers and of failures */
+    double hits, neghits, misses, evictions, expirations;
+} dns = { {NULL}, NULL, NULL, 0, 0, 60, 5, 0, 0, 0, 0, 0 };
+
+#ifdef _WIN32
+#define dns_lock()
+#define dns_unlock()
+#else
+static pthread_mutex_t dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define dns_lock() pthread_mutex_lock(&dns_mutex)
+#define dns_unlock() pthread_mutex_unlock(&dns_mutex)
+#endif
+
+/*-------------------------------------------------------------------------*\
+* Copies a list returned by getaddrinfo into a single block of memory, so
+* that cached and fresh answers alike are released with free
+\*-------------------------------------------------------------------------*/
+#define DNS_ALIGN(n) (((n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+
+static struct addrinfo *inet_copyaddrinfo(const struct addrinfo *src) {
+    const struct addrinfo *iter;
+    struct addrinfo *copy, *dst, *prev = NULL;
+    size_t size = 0;
+    char *p;
+    if (!src) return NULL;
+    for (iter = src; iter; iter = iter->ai_next) {
+        size += DNS_ALIGN(sizeof(struct addrinfo));
+        size += DNS_ALIGN(iter->ai_addrlen);
+        if (iter->ai_canonname)
+            size += DNS_ALIGN(strlen(iter->ai_canonname) + 1);
+    }
+    if (!(p = (char *) malloc(size))) return NULL;
+    copy = (struct addrinfo *) p;
+    for (iter = src; iter; iter = iter->ai_next) {
+        dst = (struct addrinfo *) p;
+        *dst = *iter;
+        dst->ai_next = NULL;
+        p += DNS_ALIGN(sizeof(struct addrinfo));
+        dst->ai_addr = (struct sockaddr *) p;
+        memcpy(p, iter->ai_addr, iter->ai_addrlen);
+        p += DNS_ALIGN(iter->ai_addrlen);
+        if (iter->ai_canonname) {
+            dst->ai_canonname = p;
+            strcpy(p, iter->ai_canonname);
+            p += DNS_ALIGN(strlen(iter->ai_canonname) + 1);
+        }
+        if (prev) prev->ai_next = dst;
+        prev = dst;
+    }
+    return copy;
+}
+
+/*-------------------------------------------------------------------------*\
+* Builds the lookup key. A missing node or service is distinguished from
+* an empty one by the leading character. Returns the key length, or 0
+* if the key does not fit
+\*-------------------------------------------------------------------------*/
+static size_t inet_dnskey(char *key, const char *node, const char *serv) {
+    size_t n = node? strlen(node): 0, s = serv? strlen(serv): 0;
+    if (n + s + 4 > DNS_MAXKEY) return 0;
+    key[0] = node? '+': '-';
+    memcpy(key+1, node? node: "", n+1);
+    key[n+2] = serv? '+': '-';
+    memcpy(key+n+3, serv? serv: "", s+1);
+    return n + s + 4;
+}
+
+static unsigned long inet_dnshash(const char *key, size_t len,
+        const struct addrinfo *hints) {
+    unsigned long h = 2166136261UL;
+    size_t i;
+    for (i = 0; i < len; i++) h = (h ^ (unsigned char) key[i]) * 16777619UL;
+    h ^= (unsigned long) (hints->ai_family*31 + hints->ai_socktype*7 +
+        hints->ai_protocol*3 + hints->ai_flags);
+    return h;
+}
+
+/*-------------------------------------------------------------------------*\
+* Cache maintenance. Callers must hold the lock
+\*-------------------------------------------------------------------------*/
+static p_dnsentry inet_dnsfind(const char *key, size_t len,
+        unsigned long hash, const struct addrinfo *hints) {
+    p_dnsentry e = dns.buckets[hash & (DNS_BUCKETS-1)];
+    for ( ; e; e = e->chain) {
+        if (e->hash == hash && e->len == len &&
+                e->family == hints->ai_family &&
+                e->socktype == hints->ai_socktype &&
+                e->protocol == hints->ai_protocol &&
+                e->flags == hints->ai_flags &&
+                memcmp(e->key, key, len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void inet_dnsunlink(p_dnsentry e) {
+    if (e->newer) e->newer->older = e->older;
+    else dns.newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else dns.oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void inet_dnspushfront(p_dnsentry e) {
+    e->older = dns.newest;
+    e->newer = NULL;
+    if (dns.newest) dns.newest->newer = e;
+    else dns.oldest = e;
+    dns.newest = e;
+}
+
+static void inet_dnsremove(p_dnsentry e) {
+    p_dnsentry *link = &dns.buckets[e->hash & (DNS_BUCKETS-1)];
+    while (*link != e) link = &(*link)->chain;
+    *link = e->chain;
+    inet_dnsunlink(e);
+    dns.count--;
+    free(e->resolved);
+    free(e);
+}
+
+static void inet_dnsinsert(const char *key, size_t len, unsigned long hash,
+        const struct addrinfo *hints, int err, const struct addrinfo *res) {
+    p_dnsentry e = inet_dnsfind(key, len, hash, hints);
+    if (e) inet_dnsremove(e);
+    while (dns.count >= dns.size && dns.oldest) {
+        inet_dnsremove(dns.oldest);
+        dns.evictions++;
+    }
+    e = (p_dnsentry) malloc(sizeof(t_dnsentry) + len);
+    if (!e) return;
+    e->resolved = NULL;
+    if (err == 0 && !(e->resolved = inet_copyaddrinfo(res))) {
+        free(e);
+        return;
+    }
+    e->hash = hash;
+    e->err = err;
+    e->expires = timeout_gettime() + (err == 0? dns.ttl: dns.negttl);
+    e->family = hints->ai_family;
+    e->socktype = hints->ai_socktype;
+    e->protocol = hints->ai_protocol;
+    e->flags = hints->ai_flags;
+    e->len = len;
+    memcpy(e->key, key, len);
+    e->chain = dns.buckets[hash & (DNS_BUCKETS-1)];
+    dns.buckets[hash & (DNS_BUCKETS-1)] = e;
+    inet_dnspushfront(e);
+    dns.count++;
+}
+
+/*-------------------------------------------------------------------------*\
+* Numeric addresses cost nothing to resolve and are not worth caching
+\*-------------------------------------------------------------------------*/
+int inet_isnumeric(const char *node) {
+    struct in_addr addr;
+    return !node || strchr(node, ':') || inet_aton(node, &addr);
+}
+
+/*-------------------------------------------------------------------------*\
+* Replacements for getaddrinfo and freeaddrinfo that go through the cache.
+* Answers are single blocks of memory owned by the caller
+\*-------------------------------------------------------------------------*/
+int inet_getaddrinfo(const char *node, const char *serv,
+        const struct addrinfo *hints, struct addrinfo **res) {
+    char key[DNS_MAXKEY];
+    struct addrinfo nohints, *resolved = NULL;
+    unsigned long hash = 0;
+    size_t len = 0;
+    int err;
+    *res = NULL;
+    if (!hints) {
+        memset(&nohints, 0, sizeof(nohints));
+        hints = &nohints;
+    }
+    if (dns.size > 0 && !inet_isnumeric(node) &&
+            (len = inet_dnskey(key, node, serv)) > 0) {
+        p_dnsentry e;
+        hash = inet_dnshash(key, len, hints);
+        dns_lock();
+        e = inet_dnsfind(key, len, hash, hints);
+        if (e && e->expires <= timeout_gettime()) {
+            inet_dnsremove(e);
+            dns.expirations++;
+            e = NULL;
+        }
+        if (e) {
+            inet_dnsunlink(e);
+            inet_dnspushfront(e);
+            if ((err = e->err) != 0) dns.neghits++;
+            else {
+                dns.hits++;
+                if (!(*res = inet_copyaddrinfo(e->resolved)))
+                    err = EAI_MEMORY;
+            }
+            dns_unlock();
+            return err;
+        }
+        dns.misses++;
+        dns_unlock();
+    }
+    err = getaddrinfo(node, serv, hints, &resolved);
+    if (err == 0) {
+        *res = inet_copyaddrinfo(resolved);
+        freeaddrinfo(resolved);
+        if (!*res) return EAI_MEMORY;
+    }
+    /* only definite answers are cached, not temporary failures */
+    if (len > 0 && (err == 0 || err == EAI_NONAME
+#ifdef EAI_NODATA
+            || err == EAI_NODATA
+#endif
+            )) {
+        dns_lock();
+        if (dns.size > 0) inet_dnsinsert(key, len, hash, hints, err, *res);
+        dns_unlock();
+    }
+    return err;
+}
+
+void inet_freeaddrinfo(struct addrinfo *res) {
+    free(res);
+}
+
+/*-------------------------------------------------------------------------*\
+* Configures the cache. A size of zero disables it
+\*-------------------------------------------------------------------------*/
+static int inet_global_setcache(lua_State *L) {
+    int size = luaL_checkint(L, 1);
+    double ttl = luaL_optnumber(L, 2, dns.ttl);
+    double negttl = luaL_optnumber(L, 3, dns.negttl);
+    luaL_argcheck(L, size >= 0, 1, "invalid size");
+    luaL_argcheck(L, ttl >= 0, 2, "invalid ttl");
+    luaL_argcheck(L, negttl >= 0, 3, "invalid negative ttl");
+    dns_lock();
+    dns.size = size;
+    dns.ttl = ttl;
+    dns.negttl = negttl;
+    while (dns.count > dns.size && dns.oldest) {
+        inet_dnsremove(dns.oldest);
+        dns.evictions++;
+    }
+    dns_unlock();
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Removes all entries, or only those for the given host
+\*-------------------------------------------------------------------------*/
+static int inet_global_flushcache(lua_State *L) {
+    const char *host = luaL_optstring(L, 1, NULL);
+    p_dnsentry e, older;
+    dns_lock();
+    for (e = dns.newest; e; e = older) {
+        older = e->older;
+        if (!host || (e->key[0] == '+' && strcmp(e->key+1, host) == 0))
+            inet_dnsremove(e);
+    }
+    dns_unlock();
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns a table with cache statistics
+\*-------------------------------------------------------------------------*/
+static int inet_global_cachestats(lua_State *L) {
+    lua_newtable(L);
+    dns_lock();
+    lua_pushnumber(L, dns.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, dns.neghits);
+    lua_setfield(L, -2, "neghits");
+    lua_pushnumber(L, dns.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, dns.evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushnumber(L, dns.expirations);
+    lua_setfield(L, -2, "expirations");
+    lua_pushnumber(L, dns.count);
+    lua_setfield(L, -2, "entries");
+    lua_pushnumber(L, dns.size);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, dns.ttl);
+    lua_setfield(L, -2, "ttl");
+    lua_pushnumber(L, dns.negttl);
+    lua_setfield(L, -2, "negttl");
+    dns_unlock();
+    return 1;
+}
+
+#ifndef _WIN32
+/*=========================================================================*\
+* Asynchronous resolver
+\*=========================================================================*/
+/* the function a resolver job was created by */
+enum {
+    RESOLVE_TOIP,
+    RESOLVE_TOHOSTNAME,
+    RESOLVE_GETADDRINFO,
+    RESOLVE_GETNAMEINFO
+};
+
+typedef struct t_resolve_ {
+    t_job job;                  /* must come first */
+    t_event event;              /* raised when the job is done */
+    int kind;                   /* one of the values above */
+    char *node, *serv;          /* copies of the arguments */
+    int wantnode, wantserv;     /* getnameinfo results asked for */
+    struct addrinfo hints;
+    int err;                    /* getaddrinfo error code */
+    struct addrinfo *resolved;
+    char (*names)[NI_MAXHOST];  /* host names, for reverse lookups */
+    int count;                  /* number of names */
+    char servname[NI_MAXSERV];
+} t_resolve;
+typedef t_resolve *p_resolve;
+
+/*-------------------------------------------------------------------------*\
+* Runs the resolver, in a worker thread
+\*-------------------------------------------------------------------------*/
+static void inet_resolve_run(p_job job) {
+    p_resolve r = (p_resolve) job;
+    struct addrinfo *iter;
+    int i;
+    r->err = inet_getaddrinfo(r->node, r->serv, &r->hints, &r->resolved);
+    if (r->err != 0) return;
+    if (r->kind == RESOLVE_TOIP || r->kind == RESOLVE_GETADDRINFO) return;
+    if (r->kind == RESOLVE_TOHOSTNAME) r->count = 1;
+    else for (iter = r->resolved; iter; iter = iter->ai_next) r->count++;
+    r->names = malloc(r->count*sizeof(*r->names));
+    if (!r->names) {
+        r->err = EAI_MEMORY;
+        return;
+    }
+    if (r->kind == RESOLVE_TOHOSTNAME) {
+        iter = r->resolved;
+        if (getnameinfo(iter->ai_addr, iter->ai_addrlen, r->names[0],
+                sizeof(r->names[0]), NULL, 0, NI_NAMEREQD) != 0) {
+            strncpy(r->names[0], iter->ai_canonname? iter->ai_canonname:
+                r->node, sizeof(r->names[0])-1);
+            r->names[0][sizeof(r->names[0])-1] = '\0';
+        }
+        return;
+    }
+    for (i = 0, iter = r->resolved; iter; i++, iter = iter->ai_next) {
+        getnameinfo(iter->ai_addr, iter->ai_addrlen, r->names[i],
+            r->wantnode? sizeof(r->names[i]): 0, r->servname,
+            r->wantserv? sizeof(r->servname): 0, 0);
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Frees a resolver job, in whatever thread releases it last
+\*-------------------------------------------------------------------------*/
+static void inet_resolve_free(p_job job) {
+    p_resolve r = (p_resolve) job;
+    inet_freeaddrinfo(r->resolved);
+    event_destroy(&r->event);
+    free(r->names);
+    free(r->node);
+    free(r->serv);
+    free(r);
+}
+
+/*-------------------------------------------------------------------------*\
+* Passes the results of a finished job to Lua. The resolved table has the
+* same layout as the one returned by toip, but aliases are not available
+\*-------------------------------------------------------------------------*/
+static int inet_resolve_push(lua_State *L, p_job job) {
+    p_resolve r = (p_resolve) job;
+    struct addrinfo *iter;
+    int i;
+    if (r->err != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_gaistrerror(r->err));
+        return 2;
+    }
+    switch (r->kind) {
+        case RESOLVE_GETADDRINFO:
+            inet_pushaddrinfo(L, r->resolved);
+            return 1;
+        case RESOLVE_GETNAMEINFO:
+            lua_newtable(L);
+            for (i = 0; r->wantnode && i < r->count; i++) {
+                lua_pushnumber(L, i+1);
+                lua_pushstring(L, r->names[i]);
+                lua_settable(L, -3);
+            }
+            if (!r->wantserv) return 1;
+            lua_pushstring(L, r->servname);
+            return 2;
+        default:
+            break;
+    }
+    iter = r->resolved;
+    if (r->kind == RESOLVE_TOIP) lua_pushstring(L, inet_ntoa(
+        ((struct sockaddr_in *) iter->ai_addr)->sin_addr));
+    else lua_pushstring(L, r->names[0]);
+    lua_newtable(L);
+    lua_pushstring(L, "name");
+    if (r->kind == RESOLVE_TOHOSTNAME) lua_pushstring(L, r->names[0]);
+    else lua_pushstring(L, iter->ai_canonname? iter->ai_canonname: r->node);
+    lua_settable(L, -3);
+    lua_pushstring(L, "alias");
+    lua_newtable(L);
+    lua_settable(L, -3);
+    lua_pushstring(L, "ip");
+    lua_newtable(L);
+    for (i = 1; iter; i++, iter = iter->ai_next) {
+        lua_pushnumber(L, i);
+        lua_pushstring(L, inet_ntoa(
+            ((struct sockaddr_in *) iter->ai_addr)->sin_addr));
+        lua_settable(L, -3);
+    }
+    lua_settable(L, -3);
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a resolver job. Returns NULL and sets err on failure
+\*-------------------------------------------------------------------------*/
+static p_resolve inet_resolve_create(int kind, const char *node,
+        const char *serv, const struct addrinfo *hints, const char **err) {
+    p_resolve r = (p_resolve) calloc(1, sizeof(t_resolve));
+    int ret;
+    if (!r) {
+        *err = "out of memory";
+        return NULL;
+    }
+    if ((ret = event_init(&r->event)) != IO_DONE) {
+        free(r);
+        *err = socket_strerror(ret);
+        return NULL;
+    }
+    async_init(&r->job, inet_resolve_run, inet_resolve_free, &r->event);
+    r->kind = kind;
+    if (hints) r->hints = *hints;
+    if (node) r->node = strdup(node);
+    if (serv) r->serv = strdup(serv);
+    if ((node && !r->node) || (serv && !r->serv)) {
+        async_release(&r->job);
+        *err = "out of memory";
+        return NULL;
+    }
+    return r;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a resolver job for Lua. Returns NULL and pushes an error on
+* failure
+\*-------------------------------------------------------------------------*/
+static p_resolve inet_resolve_new(lua_State *L, int kind, const char *node,
+        const char *serv, int family) {
+    struct addrinfo hints;
+    const char *err = NULL;
+    p_resolve r;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = family;
+    if (kind == RESOLVE_TOIP || kind == RESOLVE_TOHOSTNAME)
+        hints.ai_flags = AI_CANONNAME;
+    r = inet_resolve_create(kind, node, serv, &hints, &err);
+    if (!r) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+    }
+    return r;
+}
+
+/*-------------------------------------------------------------------------*\
+* Non-blocking versions of the resolver functions. Each returns a job
+* object whose result method returns what the blocking version would
+\*-------------------------------------------------------------------------*/
+static int inet_global_toip_async(lua_State *L) {
+    const char *address = luaL_checkstring(L, 1);
+    p_resolve r = inet_resolve_new(L, RESOLVE_TOIP, address, NULL, PF_INET);
+    if (!r) return 2;
+    return async_pushjob(L, &r->job, inet_resolve_push);
+}
+
+static int inet_global_tohostname_async(lua_State *L) {
+    const char *address = luaL_checkstring(L, 1);
+    p_resolve r = inet_resolve_new(L, RESOLVE_TOHOSTNAME, address, NULL,
+        PF_INET);
+    if (!r) return 2;
+    return async_pushjob(L, &r->job, inet_resolve_push);
+}
+
+static int inet_global_getaddrinfo_async(lua_State *L) {
+    const char *hostname = luaL_checkstring(L, 1);
+    p_resolve r = inet_resolve_new(L, RESOLVE_GETADDRINFO, hostname, NULL,
+        PF_UNSPEC);
+    if (!r) return 2;
+    return async_pushjob(L, &r->job, inet_resolve_push);
+}
+
+static int inet_global_getnameinfo_async(lua_State *L) {
+    const char *node = luaL_optstring(L, 1, NULL);
+    const char *service = luaL_optstring(L, 2, NULL);
+    p_resolve r;
+    if (!(node || service))
+        luaL_error(L, "You have to specify a hostname, a service, or both");
+    /* getaddrinfo must get a node and a service argument */
+    r = inet_resolve_new(L, RESOLVE_GETNAMEINFO, node? node: "127.0.0.1",
+        service? service: "7", PF_UNSPEC);
+    if (!r) return 2;
+    r->wantnode = node != NULL;
+    r->wantserv = service != NULL;
+    return async_pushjob(L, &r->job, inet_resolve_push);
+}
+
+/*=========================================================================*\
+* Batched asynchronous resolver
+\*=========================================================================*/
+/* lookup states, as seen by the Lua thread */
+enum {
+    LOOKUP_PENDING,             /* waiting for a free concurrency slot */
+    LOOKUP_SUBMITTED,           /* handed to the worker pool */
+    LOOKUP_DELIVERED            /* result returned to Lua */
+};
+
+typedef struct t_batch_ t_batch;
+typedef t_batch *p_batch;
+
+typedef struct t_lookup_ {
+    t_job job;                  /* must come first */
+    p_batch batch;              /* the batch the lookup belongs to */
+    char *host;
+    int state;                  /* one of the values above */
+    const char *failure;        /* set if the lookup was given up on */
+    int err;                    /* getaddrinfo error code */
+    struct addrinfo *resolved;
+} t_lookup;
+typedef t_lookup *p_lookup;
+
+struct t_batch_ {
+    t_event event;              /* raised whenever a lookup finishes */
+    int refs;                   /* the Lua object plus one per lookup */
+    int count;                  /* number of lookups */
+    int first;                  /* first lookup not yet delivered */
+    int next;                   /* first lookup not yet submitted */
+    int inflight;               /* submitted but not yet delivered */
+    int delivered;
+    int concurrency;            /* maximum number of lookups in flight */
+    double deadline;            /* absolute time, or -1 for none */
+    t_timeout tm;
+    p_lookup lookups;
+};
+
+/*-------------------------------------------------------------------------*\
+* Reference counting. The batch goes away once the Lua object and all
+* lookups, some of which may still be running, have let go of it
+\*-------------------------------------------------------------------------*/
+static void inet_batch_release(p_batch b) {
+    int i;
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    for (i = 0; i < b->count; i++) {
+        inet_freeaddrinfo(b->lookups[i].resolved);
+        free(b->lookups[i].host);
+    }
+    event_destroy(&b->event);
+    free(b->lookups);
+    free(b);
+}
+
+static void inet_lookup_run(p_job job) {
+    p_lookup l = (p_lookup) job;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = PF_UNSPEC;
+    l->err = inet_getaddrinfo(l->host, NULL, &hints, &l->resolved);
+}
+
+static void inet_lookup_free(p_job job) {
+    inet_batch_release(((p_lookup) job)->batch);
+}
+
+/*-------------------------------------------------------------------------*\
+* Submits pending lookups while there are free concurrency slots
+\*-------------------------------------------------------------------------*/
+static void inet_batch_fill(p_batch b) {
+    while (b->inflight < b->concurrency && b->next < b->count) {
+        p_lookup l = &b->lookups[b->next];
+        if (!l->failure && async_submit(&l->job) != IO_DONE) {
+            /* try again once one of ours is done, unless none is */
+            if (b->inflight > 0) break;
+            l->failure = "queue full";
+        }
+        l->state = LOOKUP_SUBMITTED;
+        b->inflight++;
+        b->next++;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Gives up on every lookup that is not done once the deadline has passed
+\*-------------------------------------------------------------------------*/
+static int inet_batch_expired(p_batch b) {
+    return b->deadline >= 0 && timeout_gettime() >= b->deadline;
+}
+
+static void inet_batch_expire(p_batch b) {
+    int i;
+    if (!inet_batch_expired(b)) return;
+    for (i = b->first; i < b->count; i++) {
+        p_lookup l = &b->lookups[i];
+        if (l->state == LOOKUP_DELIVERED) continue;
+        if (l->state == LOOKUP_SUBMITTED) {
+            if (l->failure || async_isdone(&l->job)) continue;
+            async_cancel(&l->job);
+        } else b->inflight++;
+        l->state = LOOKUP_SUBMITTED;
+        /* lookups that never started keep the reason they did not */
+        if (!l->failure) l->failure = "timeout";
+    }
+    b->next = b->count;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns a lookup whose result can be delivered, or NULL
+\*-------------------------------------------------------------------------*/
+static p_lookup inet_batch_ready(p_batch b) {
+    int i;
+    while (b->first < b->count &&
+            b->lookups[b->first].state == LOOKUP_DELIVERED)
+        b->first++;
+    for (i = b->first; i < b->next; i++) {
+        p_lookup l = &b->lookups[i];
+        if (l->state == LOOKUP_SUBMITTED &&
+                (l->failure || async_isdone(&l->job)))
+            return l;
+    }
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Waits until a lookup can be delivered. Returns IO_DONE, IO_CLOSED once
+* every lookup has been delivered, or IO_TIMEOUT.
+\*-------------------------------------------------------------------------*/
+static int inet_batch_wait(p_batch b, p_lookup *pl) {
+    for ( ;; ) {
+        t_timeout tm;
+        double left;
+        int err;
+        inet_batch_fill(b);
+        inet_batch_expire(b);
+        if ((*pl = inet_batch_ready(b)) != NULL) break;
+        if (b->delivered == b->count) return IO_CLOSED;
+        /* clear, then check again, so that no wake-up is lost */
+        event_clear(&b->event);
+        if ((*pl = inet_batch_ready(b)) != NULL) break;
+        left = timeout_getretry(&b->tm);
+        if (b->deadline >= 0) {
+            double until = b->deadline - timeout_gettime();
+            if (until < 0) until = 0;
+            if (left < 0 || until < left) left = until;
+        }
+        timeout_init(&tm, left, -1);
+        timeout_markstart(&tm);
+        err = event_wait(&b->event, &tm);
+        if (err == IO_TIMEOUT && inet_batch_expired(b)) continue;
+        if (err != IO_DONE) return err;
+    }
+    /* others may be ready too, and select must still see them */
+    (*pl)->state = LOOKUP_DELIVERED;
+    b->inflight--;
+    b->delivered++;
+    if (inet_batch_ready(b)) event_signal(&b->event);
+    return IO_DONE;
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes the result of a lookup, or nil followed by an error message
+\*-------------------------------------------------------------------------*/
+static void inet_batch_pushresult(lua_State *L, p_lookup l) {
+    if (l->failure) {
+        lua_pushnil(L);
+        lua_pushstring(L, l->failure);
+    } else if (l->err != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_gaistrerror(l->err));
+    } else {
+        inet_pushaddrinfo(L, l->resolved);
+        lua_pushnil(L);
+    }
+}
+
+static p_batch inet_batch_check(lua_State *L) {
+    p_batch *pb = (p_batch *) auxiliar_checkclass(L, "dns{batch}", 1);
+    if (!*pb) luaL_argerror(L, 1, "closed batch");
+    return *pb;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a batch of lookups, one per host name in the list
+\*-------------------------------------------------------------------------*/
+static int inet_global_resolve_async(lua_State *L) {
+    int i, n, err, concurrency = 16;
+    double timeout = -1;
+    p_batch b, *pb;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = (int) lua_objlen(L, 1);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, 1, i);
+        if (!lua_isstring(L, -1))
+            luaL_argerror(L, 1, "host names must be strings");
+        lua_pop(L, 1);
+    }
+    if (!lua_isnoneornil(L, 2)) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_getfield(L, 2, "concurrency");
+        concurrency = luaL_optint(L, -1, concurrency);
+        lua_getfield(L, 2, "timeout");
+        timeout = luaL_optnumber(L, -1, timeout);
+        lua_pop(L, 2);
+        luaL_argcheck(L, concurrency > 0, 2, "invalid concurrency");
+    }
+    pb = (p_batch *) lua_newuserdata(L, sizeof(p_batch));
+    *pb = NULL;
+    auxiliar_setclass(L, "dns{batch}", -1);
+    b = (p_batch) calloc(1, sizeof(t_batch));
+    if (b) b->lookups = (p_lookup) calloc(n > 0? n: 1, sizeof(t_lookup));
+    if (!b || !b->lookups) {
+        if (b) free(b);
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    if ((err = event_init(&b->event)) != IO_DONE) {
+        free(b->lookups);
+        free(b);
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    b->count = n;
+    b->refs = n+1;
+    b->concurrency = concurrency;
+    b->deadline = timeout >= 0? timeout_gettime() + timeout: -1;
+    timeout_init(&b->tm, -1, -1);
+    *pb = b;
+    for (i = 0; i < n; i++) {
+        p_lookup l = &b->lookups[i];
+        async_init(&l->job, inet_lookup_run, inet_lookup_free, &b->event);
+        l->batch = b;
+        lua_rawgeti(L, 1, i+1);
+        l->host = strdup(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        if (!l->host) l->failure = "out of memory";
+    }
+    inet_batch_fill(b);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the next host whose lookup finished, with its result
+\*-------------------------------------------------------------------------*/
+static int inet_batch_meth_receive(lua_State *L) {
+    p_batch b = inet_batch_check(L);
+    p_lookup l;
+    int err;
+    timeout_markstart(&b->tm);
+    if ((err = inet_batch_wait(b, &l)) != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushnil(L);
+        lua_pushstring(L, err == IO_CLOSED? "done": socket_strerror(err));
+        return 3;
+    }
+    lua_pushstring(L, l->host);
+    inet_batch_pushresult(L, l);
+    return 3;
+}
+
+/*-------------------------------------------------------------------------*\
+* Waits for every lookup and returns a table of results and one of
+* errors, both indexed by host name
+\*-------------------------------------------------------------------------*/
+static int inet_batch_meth_results(lua_State *L) {
+    p_batch b = inet_batch_check(L);
+    p_lookup l;
+    int err;
+    lua_settop(L, 1);
+    lua_newtable(L);
+    lua_newtable(L);
+    timeout_markstart(&b->tm);
+    while ((err = inet_batch_wait(b, &l)) == IO_DONE) {
+        lua_pushstring(L, l->host);
+        inet_batch_pushresult(L, l);
+        if (lua_isnil(L, -2)) {
+            lua_remove(L, -2);
+            lua_settable(L, 3);
+        } else {
+            lua_pop(L, 1);
+            lua_settable(L, 2);
+        }
+    }
+    if (err == IO_CLOSED) return 2;
+    lua_pushstring(L, socket_strerror(err));
+    return 3;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the number of lookups delivered, in flight and not yet started
+\*-------------------------------------------------------------------------*/
+static int inet_batch_meth_getstats(lua_State *L) {
+    p_batch b = inet_batch_check(L);
+    lua_pushnumber(L, b->delivered);
+    lua_pushnumber(L, b->inflight);
+    lua_pushnumber(L, b->count - b->next);
+    return 3;
+}
+
+static int inet_batch_meth_settimeout(lua_State *L) {
+    p_batch b = inet_batch_check(L);
+    return timeout_meth_settimeout(L, &b->tm);
+}
+
+static int inet_batch_meth_getfd(lua_State *L) {
+    p_batch *pb = (p_batch *) auxiliar_checkclass(L, "dns{batch}", 1);
+    lua_pushnumber(L, *pb? (int) event_getfd(&(*pb)->event):
+        (int) SOCKET_INVALID);
+    return 1;
+}
+
+static int inet_batch_meth_dirty(lua_State *L) {
+    p_batch *pb = (p_batch *) auxiliar_checkclass(L, "dns{batch}", 1);
+    p_batch b = *pb;
+    if (b) {
+        inet_batch_fill(b);
+        inet_batch_expire(b);
+    }
+    lua_pushboolean(L, b && inet_batch_ready(b) != NULL);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Cancels lookups that have not started and releases the batch
+\*-------------------------------------------------------------------------*/
+static int inet_batch_meth_close(lua_State *L) {
+    p_batch *pb = (p_batch *) auxiliar_checkclass(L, "dns{batch}", 1);
+    p_batch b = *pb;
+    int i;
+    if (b) {
+        *pb = NULL;
+        for (i = 0; i < b->count; i++) {
+            p_lookup l = &b->lookups[i];
+            if (l->state != LOOKUP_PENDING && !l->failure)
+                async_cancel(&l->job);
+            async_release(&l->job);
+        }
+        inet_batch_release(b);
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+#endif
+
 /*=========================================================================*\
 * Lua methods
 \*=========================================================================*/
@@ -244,6 +1159,25 @@ int inet_meth_getpeername(lua_State *L, p_socket ps, int family)
     }
     return 3;
 }
+/*-------------------------------------------------------------------------*\
+* Pushes the numeric host and port of a socket address
+\*-------------------------------------------------------------------------*/
+int inet_pushsockaddr(lua_State *L, SA *addr, socklen_t len)
+{
+    char name[INET6_ADDRSTRLEN];
+    char port[6]; /* 65535 = 5 bytes + 0 to terminate it */
+    int err = getnameinfo(addr, len, name, INET6_ADDRSTRLEN,
+        port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+    if (err) {
+        lua_pushnil(L);
+        lua_pushstring(L, gai_strerror(err));
+        return 2;
+    }
+    lua_pushstring(L, name);
+    lua_pushinteger(L, (int) strtol(port, (char **) NULL, 10));
+    return 2;
+}
+
 /*-------------------------------------------------------------------------*\
 * Retrieves socket local name
 \*-------------------------------------------------------------------------*/
@@ -332,6 +1266,40 @@ static void inet_pushresolved(lua_State *L, struct hostent *hp)
     lua_settable(L, resolved);
 }
 
+/*-------------------------------------------------------------------------*\
+* Passes a list of resolved addresses to Lua as a table
+\*-------------------------------------------------------------------------*/
+static void inet_pushaddrinfo(lua_State *L, struct addrinfo *resolved)
+{
+    int i = 1;
+    struct addrinfo *iterator;
+    lua_newtable(L);
+    for (iterator = resolved; iterator; iterator = iterator->ai_next) {
+        char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
+        getnameinfo(iterator->ai_addr, iterator->ai_addrlen, hbuf, sizeof(hbuf),
+                sbuf, 0, NI_NUMERICHOST);
+        lua_pushnumber(L, i);
+        lua_newtable(L);
+        switch (iterator->ai_family) {
+            case AF_INET:
+                lua_pushliteral(L, "family");
+                lua_pushliteral(L, "inet");
+                lua_settable(L, -3);
+                break;
+            case AF_INET6:
+                lua_pushliteral(L, "family");
+                lua_pushliteral(L, "inet6");
+                lua_settable(L, -3);
+                break;;
+        }
+        lua_pushliteral(L, "addr");
+        lua_pushstring(L, hbuf);
+        lua_settable(L, -3);
+        lua_settable(L, -3);
+        i++;
+    }
+}
+
 /*-------------------------------------------------------------------------*\
 * Tries to create a new inet socket
 \*-------------------------------------------------------------------------*/
@@ -339,6 +1307,43 @@ const char *inet_trycreate(p_socket ps, int family, int type) {
     return socket_strerror(socket_create(ps, family, type, 0));
 }
 
+/*-------------------------------------------------------------------------*\
+* Resolves (address, port) for the functions below. Names go to a worker
+* thread, and the wait is bounded by tm, so that a slow name server holds
+* the caller no longer than its own timeout. Addresses, zero timeouts and
+* a full queue are resolved right here
+\*-------------------------------------------------------------------------*/
+const char *inet_tryresolve(const char *address, const char *serv,
+        const struct addrinfo *hints, struct addrinfo **res, p_timeout tm)
+{
+#ifndef _WIN32
+    const char *err = NULL;
+    p_resolve r = NULL;
+    /* a zero timeout leaves no time to wait, and addresses need none */
+    if (!timeout_iszero(tm) && !inet_isnumeric(address))
+        r = inet_resolve_create(RESOLVE_GETADDRINFO, address, serv, hints,
+            &err);
+    if (r && async_submit(&r->job) == IO_DONE) {
+        int ret = event_wait(&r->event, tm);
+        if (ret != IO_DONE) {
+            /* a worker that already started frees the job when done */
+            async_cancel(&r->job);
+            async_release(&r->job);
+            *res = NULL;
+            return socket_strerror(ret);
+        }
+        *res = r->resolved;
+        r->resolved = NULL;
+        err = socket_gaistrerror(r->err);
+        async_release(&r->job);
+        return err;
+    }
+    /* with the queue full, there is nothing to do but wait here */
+    if (r) async_release(&r->job);
+#endif
+    return socket_gaistrerror(inet_getaddrinfo(address, serv, hints, res));
+}
+
 /*-------------------------------------------------------------------------*\
 * Tries to connect to remote address (address, port)
 \*-------------------------------------------------------------------------*/
@@ -348,15 +1353,14 @@ const char *inet_tryconnect(p_socket ps, const char *address,
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(address, serv,
-                connecthints, &resolved));
+    err = inet_tryresolve(address, serv, connecthints, &resolved, tm);
     if (err != NULL) {
-        if (resolved) freeaddrinfo(resolved);
+        if (resolved) inet_freeaddrinfo(resolved);
         return err;
     }
-    /* iterate over all returned addresses trying to connect */
+    /* iterate over all returned addresses trying to connect. the caller
+     * marked the start, so that all attempts share a single deadline */
     for (iterator = resolved; iterator; iterator = iterator->ai_next) {
-        timeout_markstart(tm);
         /* try connecting to remote address */
         err = socket_strerror(socket_connect(ps,
             (SA *) iterator->ai_addr,
@@ -365,16 +1369,145 @@ const char *inet_tryconnect(p_socket ps, const char *address,
         if (err == NULL) break;
     }
 
-    freeaddrinfo(resolved);
+    inet_freeaddrinfo(resolved);
     /* here, if err is set, we failed */
     return err;
 }
 
+/*-------------------------------------------------------------------------*\
+* Tries to connect to remote address (address, port), racing connection
+* attempts as described in RFC 8305. A new attempt is started every delay
+* seconds, or as soon as the previous one fails, alternating between
+* address families. The first socket to connect wins and the others are
+* closed. All attempts share the deadline of tm, which the caller marks.
+\*-------------------------------------------------------------------------*/
+const char *inet_racingconnect(p_socket ps, const char *address,
+        const char *serv, p_timeout tm, struct addrinfo *connecthints,
+        double delay)
+{
+    struct addrinfo *iterator, *resolved = NULL, **order = NULL;
+    t_socket *socks = NULL;
+    int *result = NULL;
+    int i, j, n = 0, started = 0, pending = 0, winner = -1;
+    int family;
+    double next = 0.0;
+    const char *err;
+    /* try resolving */
+    err = inet_tryresolve(address, serv, connecthints, &resolved, tm);
+    if (err != NULL) return err;
+    for (iterator = resolved; iterator; iterator = iterator->ai_next) n++;
+    order = (struct addrinfo **) malloc(n*sizeof(*order));
+    socks = (t_socket *) malloc(n*sizeof(*socks));
+    result = (int *) malloc(n*sizeof(*result));
+    if (!order || !socks || !result) {
+        err = "out of memory";
+        goto done;
+    }
+    /* interleave families, starting with the one the resolver put first */
+    family = resolved->ai_family;
+    for (i = 0; i < n; i++) {
+        struct addrinfo *pick = NULL, *other = NULL;
+        for (iterator = resolved; iterator; iterator = iterator->ai_next) {
+            for (j = 0; j < i && order[j] != iterator; j++) ;
+            if (j < i) continue;
+            if (iterator->ai_family == family) { pick = iterator; break; }
+            if (!other) other = iterator;
+        }
+        order[i] = pick? pick: other;
+        family = order[i]->ai_family == AF_INET? AF_INET6: AF_INET;
+        socks[i] = SOCKET_INVALID;
+    }
+    err = NULL;
+    for ( ;; ) {
+        t_timeout wait;
+        double left = timeout_getretry(tm);
+        int ret;
+        /* start the next attempt when due */
+        if (started < n && (pending == 0 || timeout_gettime() >= next)) {
+            t_timeout zero;
+            struct addrinfo *ai = order[started];
+            p_socket sock = &socks[started];
+            /* nothing new starts once the deadline has passed */
+            if (started > 0 && left == 0.0) {
+                err = socket_strerror(IO_TIMEOUT);
+                break;
+            }
+            started++;
+            ret = socket_create(sock, ai->ai_family, ai->ai_socktype,
+                ai->ai_protocol);
+            if (ret != IO_DONE) {
+                err = socket_strerror(ret);
+                continue;
+            }
+            timeout_init(&zero, 0.0, -1);
+            ret = socket_connect(sock, (SA *) ai->ai_addr, ai->ai_addrlen,
+                &zero);
+            if (ret == IO_DONE) {
+                winner = started-1;
+                break;
+            } else if (ret != IO_TIMEOUT) {
+                err = socket_strerror(ret);
+                socket_destroy(sock);
+                continue;
+            }
+            pending++;
+            next = timeout_gettime() + delay;
+            continue;
+        }
+        if (pending == 0) break;
+        /* wait for a result, but not past the start of the next attempt */
+        if (left == 0.0) {
+            err = socket_strerror(IO_TIMEOUT);
+            break;
+        }
+        if (started < n) {
+            double until = next - timeout_gettime();
+            if (until < 0.0) until = 0.0;
+            if (left < 0.0 || until < left) left = until;
+        }
+        timeout_init(&wait, left, -1);
+        timeout_markstart(&wait);
+        ret = socket_waitconnect(socks, started, result, SOCKET_INVALID,
+            &wait);
+        if (ret == IO_TIMEOUT) continue;
+        if (ret != IO_DONE) {
+            err = socket_strerror(ret);
+            break;
+        }
+        for (i = 0; i < started && winner < 0; i++) {
+            if (socks[i] == SOCKET_INVALID || result[i] == IO_TIMEOUT)
+                continue;
+            if (result[i] == IO_DONE) winner = i;
+            else {
+                /* a failure lets the next attempt start right away */
+                err = socket_strerror(result[i]);
+                socket_destroy(&socks[i]);
+                pending--;
+                next = 0.0;
+            }
+        }
+        if (winner >= 0) break;
+    }
+    /* keep the winner, close everything else */
+    for (i = 0; i < started; i++)
+        if (i != winner) socket_destroy(&socks[i]);
+    if (winner >= 0) {
+        *ps = socks[winner];
+        err = NULL;
+    } else if (!err) err = "no info on address";
+done:
+    free(order);
+    free(socks);
+    free(result);
+    inet_freeaddrinfo(resolved);
+    return err;
+}
+
 /*-------------------------------------------------------------------------*\
 * Tries to bind socket to (address, port)
 \*-------------------------------------------------------------------------*/
 const char *inet_trybind(p_socket ps, const char *address, const char *serv,
-        struct addrinfo *bindhints)
+        struct addrinfo *bindhints, p_timeout tm)
 {
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
@@ -382,10 +1515,9 @@ const char *inet_trybind(p_socket ps, const char *address, const char *serv,
     if (strcmp(address, "*") == 0) address = NULL;
     if  (!serv) serv = "0";
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(address, serv,
-            bindhints, &resolved));
+    err = inet_tryresolve(address, serv, bindhints, &resolved, tm);
     if (err) {
-        if (resolved) freeaddrinfo(resolved);
+        if (resolved) inet_freeaddrinfo(resolved);
         return err;
     }
     /* iterate over resolved addresses until one is good */
@@ -400,7 +1532,7 @@ const char *inet_trybind(p_socket ps, const char *address, const char *serv,
         else break;
     }
     /* cleanup and return error */
-    freeaddrinfo(resolved);
+    inet_freeaddrinfo(resolved);
     return err;
 }
 
@@ -13,6 +13,10 @@
 * getpeername and getsockname functions as seen by Lua programs.
 *
 * The Lua functions toip and tohostname are also implemented here.
+*
+* All name resolution goes through inet_getaddrinfo, which consults an
+* optional cache of recent answers, including failures. Answers must be
+* released with inet_freeaddrinfo.
 \*=========================================================================*/
 #include "lua.h"
 #include "socket.h"
@@ -24,13 +28,26 @@
 
 int inet_open(lua_State *L);
 
+int inet_getaddrinfo(const char *node, const char *serv,
+        const struct addrinfo *hints, struct addrinfo **res);
+void inet_freeaddrinfo(struct addrinfo *res);
+/* whether node looks like an address, so that resolving it is instant */
+int inet_isnumeric(const char *node);
+
 const char *inet_trycreate(p_socket ps, int family, int type);
+/* resolves on a worker thread, waiting no longer than tm allows */
+const char *inet_tryresolve(const char *address, const char *serv,
+        const struct addrinfo *hints, struct addrinfo **res, p_timeout tm);
 const char *inet_tryconnect(p_socket ps, const char *address,
         const char *serv, p_timeout tm, struct addrinfo *connecthints);
+const char *inet_racingconnect(p_socket ps, const char *address,
+        const char *serv, p_timeout tm, struct addrinfo *connecthints,
+        double delay);
 const char *inet_trybind(p_socket ps, const char *address, const char *serv,
-        struct addrinfo *bindhints);
+        struct addrinfo *bindhints, p_timeout tm);
 
 int inet_meth_getpeername(lua_State *L, p_socket ps, int family);
+int inet_pushsockaddr(lua_State *L, SA *addr, socklen_t len);
 int inet_meth_getsockname(lua_State *L, p_socket ps, int family);
 
 #ifdef INET_ATON
@@ -34,9 +34,13 @@
 #include "tcp.h"
 #include "udp.h"
 #include "select.h"
+#include "url.h"
 #ifndef _WIN32
 #include "serial.h"
 #include "unix.h"
+#include "channel.h"
+#include "async.h"
+#include "poller.h"
 #endif
 
 /*-------------------------------------------------------------------------*\
@@ -58,9 +62,13 @@ static const luaL_Reg mod[] = {
     {"tcp", tcp_open},
     {"udp", udp_open},
     {"select", select_open},
+    {"url", url_open},
 #ifndef _WIN32
     {"serial", serial_open},
     {"unix", unix_open},
+    {"channel", channel_open},
+    {"async", async_open},
+    {"poller", poller_open},
 #endif
     {NULL, NULL}
 };
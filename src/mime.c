@@ -11,6 +11,10 @@
 #include "compat-5.1.h"
 #endif
 
+#ifdef MIME_ZLIB
+#include <zlib.h>
+#endif
+
 #include "mime.h"
 
 /*=========================================================================*\
@@ -45,10 +49,21 @@ static size_t qpencode(UC c, UC *input, size_t size,
         const char *marker, luaL_Buffer *buffer);
 static size_t qppad(UC *input, size_t size, luaL_Buffer *buffer);
 
+#ifdef MIME_ZLIB
+static int mime_global_inflate(lua_State *L);
+static int mime_global_deflate(lua_State *L);
+static int zstream_call(lua_State *L);
+static int zstream_gc(lua_State *L);
+#endif
+
 /* code support functions */
 static luaL_Reg func[] = {
     { "dot", mime_global_dot },
     { "b64", mime_global_b64 },
+#ifdef MIME_ZLIB
+    { "deflate", mime_global_deflate },
+    { "inflate", mime_global_inflate },
+#endif
     { "eol", mime_global_eol },
     { "qp", mime_global_qp },
     { "qpwrp", mime_global_qpwrp },
@@ -73,6 +88,29 @@ static const UC b64base[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static UC b64unbase[256];
 
+#ifdef MIME_ZLIB
+/*-------------------------------------------------------------------------*\
+* Zlib globals
+\*-------------------------------------------------------------------------*/
+#define ZSTREAM "mime{zstream}"
+enum {Z_MODE_INFLATE, Z_MODE_DEFLATE};
+enum {Z_STATE_NEW, Z_STATE_RUNNING, Z_STATE_FINISHED, Z_STATE_DONE};
+
+typedef struct t_zstream_ {
+    z_stream z;
+    int mode;               /* inflate or deflate */
+    int state;              /* how far along the stream is */
+    int ready;              /* z was initialized and must be ended */
+} t_zstream;
+typedef t_zstream *p_zstream;
+
+static luaL_Reg zstream[] = {
+    { "__call", zstream_call },
+    { "__gc", zstream_gc },
+    { NULL, NULL }
+};
+#endif
+
 /*=========================================================================*\
 * Exported functions
 \*=========================================================================*/
@@ -89,6 +127,11 @@ MIME_API int luaopen_mime_core(lua_State *L)
     /* initialize lookup tables */
     qpsetup(qpclass, qpunbase);
     b64setup(b64unbase);
+#ifdef MIME_ZLIB
+    luaL_newmetatable(L, ZSTREAM);
+    luaL_openlib(L, NULL, zstream, 0);
+    lua_pop(L, 1);
+#endif
     return 1;
 }
 
@@ -713,3 +756,148 @@ static int mime_global_dot(lua_State *L)
     return 2;
 }
 
+
+#ifdef MIME_ZLIB
+/*=========================================================================*\
+* Zlib compression filters
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates a stream object, which works as a filter when called
+\*-------------------------------------------------------------------------*/
+static p_zstream znew(lua_State *L, int mode)
+{
+    p_zstream zs = (p_zstream) lua_newuserdata(L, sizeof(t_zstream));
+    memset(zs, 0, sizeof(t_zstream));
+    zs->mode = mode;
+    luaL_getmetatable(L, ZSTREAM);
+    lua_setmetatable(L, -2);
+    return zs;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a decompressing filter
+* f = inflate()
+* Accepts gzip and zlib streams, and raw deflate data as some servers
+* send for the deflate content coding.
+\*-------------------------------------------------------------------------*/
+static int mime_global_inflate(lua_State *L)
+{
+    p_zstream zs = znew(L, Z_MODE_INFLATE);
+    /* 32 lets zlib detect a gzip or zlib header */
+    if (inflateInit2(&zs->z, MAX_WBITS + 32) != Z_OK)
+        luaL_error(L, "not enough memory");
+    zs->ready = 1;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Creates a compressing filter
+* f = deflate([level [, format]])
+* Format is "zlib", the default, or "gzip".
+\*-------------------------------------------------------------------------*/
+static int mime_global_deflate(lua_State *L)
+{
+    int level = (int) luaL_optnumber(L, 1, Z_DEFAULT_COMPRESSION);
+    const char *format = luaL_optstring(L, 2, "zlib");
+    int bits = MAX_WBITS;
+    p_zstream zs;
+    if (strcmp(format, "gzip") == 0) bits += 16;
+    else if (strcmp(format, "zlib") != 0)
+        luaL_argerror(L, 2, "invalid format");
+    luaL_argcheck(L, level >= -1 && level <= 9, 1, "invalid level");
+    zs = znew(L, Z_MODE_DEFLATE);
+    if (deflateInit2(&zs->z, level, Z_DEFLATED, bits, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK)
+        luaL_error(L, "not enough memory");
+    zs->ready = 1;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Runs zlib over the input until it is consumed and all output that can
+* be produced is in the buffer
+\*-------------------------------------------------------------------------*/
+static int zrun(p_zstream zs, const char *input, size_t size, int flush,
+        luaL_Buffer *buffer)
+{
+    int ret;
+    zs->z.next_in = (Bytef *) input;
+    zs->z.avail_in = (uInt) size;
+    do {
+        zs->z.next_out = (Bytef *) luaL_prepbuffer(buffer);
+        zs->z.avail_out = LUAL_BUFFERSIZE;
+        if (zs->mode == Z_MODE_INFLATE) ret = inflate(&zs->z, flush);
+        else ret = deflate(&zs->z, flush);
+        luaL_addsize(buffer, LUAL_BUFFERSIZE - zs->z.avail_out);
+    } while (ret == Z_OK && (zs->z.avail_out == 0 || zs->z.avail_in > 0 ||
+        flush == Z_FINISH));
+    return ret;
+}
+
+/*-------------------------------------------------------------------------*\
+* Filters a chunk
+* A = f(C)
+* A is the output for C. Once C is nil, A is whatever output was left,
+* or nil if there was none, and later calls return nil. Corrupt or
+* truncated input gives nil and an error message.
+\*-------------------------------------------------------------------------*/
+static int zstream_call(lua_State *L)
+{
+    p_zstream zs = (p_zstream) luaL_checkudata(L, 1, ZSTREAM);
+    size_t size = 0;
+    const char *input = luaL_optlstring(L, 2, NULL, &size);
+    int ret, flush = input ? Z_NO_FLUSH : Z_FINISH;
+    luaL_Buffer buffer;
+    /* at the end, ltn12 wants more output or nil */
+    if (zs->state == Z_STATE_DONE ||
+            (!input && zs->state == Z_STATE_FINISHED)) {
+        zs->state = Z_STATE_DONE;
+        lua_pushnil(L);
+        return 1;
+    }
+    /* data after the end of a compressed stream is ignored */
+    if (zs->state == Z_STATE_FINISHED) {
+        lua_pushliteral(L, "");
+        return 1;
+    }
+    luaL_buffinit(L, &buffer);
+    ret = zrun(zs, input, size, flush, &buffer);
+    /* the deflate content coding is often sent without its zlib header */
+    if (ret == Z_DATA_ERROR && zs->mode == Z_MODE_INFLATE &&
+            zs->state == Z_STATE_NEW && zs->z.total_out == 0) {
+        inflateReset2(&zs->z, -MAX_WBITS);
+        ret = zrun(zs, input, size, flush, &buffer);
+    }
+    if (size > 0) zs->state = Z_STATE_RUNNING;
+    if (ret == Z_STREAM_END) {
+        zs->state = input ? Z_STATE_FINISHED : Z_STATE_DONE;
+    } else if (!input) {
+        zs->state = Z_STATE_DONE;
+        lua_pushnil(L);
+        lua_pushstring(L, "incomplete compressed data");
+        return 2;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        zs->state = Z_STATE_DONE;
+        lua_pushnil(L);
+        lua_pushstring(L, zs->z.msg ? zs->z.msg : "invalid compressed data");
+        return 2;
+    }
+    luaL_pushresult(&buffer);
+    if (!input && lua_objlen(L, -1) == 0) lua_pushnil(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Frees zlib state
+\*-------------------------------------------------------------------------*/
+static int zstream_gc(lua_State *L)
+{
+    p_zstream zs = (p_zstream) luaL_checkudata(L, 1, ZSTREAM);
+    if (zs->ready) {
+        if (zs->mode == Z_MODE_INFLATE) inflateEnd(&zs->z);
+        else deflateEnd(&zs->z);
+        zs->ready = 0;
+    }
+    return 0;
+}
+#endif
@@ -10,12 +10,60 @@
 #include "options.h"
 #include "inet.h"
 
+/* options this platform lacks fail when used, not when compiled */
+#define OPT_UNSUPPORTED (-1)
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN OPT_UNSUPPORTED
+#endif
+#ifndef TCP_QUICKACK
+#define TCP_QUICKACK OPT_UNSUPPORTED
+#endif
+#ifndef TCP_CORK
+#define TCP_CORK OPT_UNSUPPORTED
+#endif
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT OPT_UNSUPPORTED
+#endif
+#ifndef TCP_USER_TIMEOUT
+#define TCP_USER_TIMEOUT OPT_UNSUPPORTED
+#endif
+#ifndef TCP_KEEPIDLE
+#define TCP_KEEPIDLE OPT_UNSUPPORTED
+#endif
+#ifndef TCP_KEEPINTVL
+#define TCP_KEEPINTVL OPT_UNSUPPORTED
+#endif
+#ifndef TCP_KEEPCNT
+#define TCP_KEEPCNT OPT_UNSUPPORTED
+#endif
+#ifndef TCP_DEFER_ACCEPT
+#define TCP_DEFER_ACCEPT OPT_UNSUPPORTED
+#endif
+#ifndef TCP_CONGESTION
+#define TCP_CONGESTION OPT_UNSUPPORTED
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL OPT_UNSUPPORTED
+#endif
+#ifndef SO_PRIORITY
+#define SO_PRIORITY OPT_UNSUPPORTED
+#endif
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU OPT_UNSUPPORTED
+#endif
+
+/* longest congestion control algorithm name */
+#define OPT_NAMELEN 16
+
 /*=========================================================================*\
 * Internal functions prototypes
 \*=========================================================================*/
 static int opt_setmembership(lua_State *L, p_socket ps, int level, int name);
 static int opt_setboolean(lua_State *L, p_socket ps, int level, int name);
 static int opt_getboolean(lua_State *L, p_socket ps, int level, int name);
+static int opt_setint(lua_State *L, p_socket ps, int level, int name);
+static int opt_getint(lua_State *L, p_socket ps, int level, int name);
+static int opt_unsupported(lua_State *L);
 static int opt_set(lua_State *L, p_socket ps, int level, int name, 
         void *val, int len);
 static int opt_get(lua_State *L, p_socket ps, int level, int name, 
@@ -53,6 +101,44 @@ int opt_meth_getoption(lua_State *L, p_opt opt, p_socket ps)
     return opt->func(L, ps);
 }
 
+/*-------------------------------------------------------------------------*\
+* Sets every option in a table of name/value pairs, stopping at the first
+* failure. Each pair goes through the same handler setoption would use
+\*-------------------------------------------------------------------------*/
+static int opt_callset(lua_State *L)
+{
+    p_opt opt = (p_opt) lua_touserdata(L, lua_upvalueindex(1));
+    p_socket ps = (p_socket) lua_touserdata(L, 1); /* ps, name, value */
+    return opt_meth_setoption(L, opt, ps);
+}
+
+int opt_meth_setoptions(lua_State *L, p_opt opt, p_socket ps)
+{
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);                               /* obj, table */
+    lua_pushlightuserdata(L, opt);
+    lua_pushcclosure(L, opt_callset, 1);            /* obj, table, f */
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {                        /* ..., f, name, value */
+        if (lua_type(L, 4) != LUA_TSTRING)
+            luaL_argerror(L, 2, "option names must be strings");
+        lua_pushvalue(L, 3);
+        lua_pushlightuserdata(L, ps);
+        lua_pushvalue(L, 4);
+        lua_pushvalue(L, 5);
+        lua_call(L, 3, 2);                          /* ..., value, r, err */
+        if (lua_isnil(L, -2)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s: %s", lua_tostring(L, 4),
+                lua_tostring(L, -2));
+            return 2;
+        }
+        lua_pop(L, 3);                              /* ..., f, name */
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
 /* enables reuse of local address */
 int opt_set_reuseaddr(lua_State *L, p_socket ps)
 {
@@ -86,6 +172,191 @@ int opt_get_tcp_nodelay(lua_State *L, p_socket ps)
     return opt_getboolean(L, ps, IPPROTO_TCP, TCP_NODELAY);
 }
 
+/* length of the queue of pending TCP Fast Open requests on a listener */
+int opt_set_tcp_fastopen(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_FASTOPEN);
+}
+
+int opt_get_tcp_fastopen(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_FASTOPEN);
+}
+
+/* sends ACKs right away instead of delaying them. the kernel clears the
+ * flag again on its own, so it must be set after every receive */
+int opt_set_tcp_quickack(lua_State *L, p_socket ps)
+{
+    return opt_setboolean(L, ps, IPPROTO_TCP, TCP_QUICKACK);
+}
+
+int opt_get_tcp_quickack(lua_State *L, p_socket ps)
+{
+    return opt_getboolean(L, ps, IPPROTO_TCP, TCP_QUICKACK);
+}
+
+/* holds back partial frames until the flag is cleared */
+int opt_set_tcp_cork(lua_State *L, p_socket ps)
+{
+    return opt_setboolean(L, ps, IPPROTO_TCP, TCP_CORK);
+}
+
+int opt_get_tcp_cork(lua_State *L, p_socket ps)
+{
+    return opt_getboolean(L, ps, IPPROTO_TCP, TCP_CORK);
+}
+
+/* unsent bytes above which the socket stops being writable */
+int opt_set_tcp_notsent_lowat(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+}
+
+int opt_get_tcp_notsent_lowat(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+}
+
+/* milliseconds transmitted data may stay unacknowledged */
+int opt_set_tcp_user_timeout(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_USER_TIMEOUT);
+}
+
+int opt_get_tcp_user_timeout(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_USER_TIMEOUT);
+}
+
+/* keepalive probing: idle seconds, seconds between probes, probe count */
+int opt_set_tcp_keepidle(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_KEEPIDLE);
+}
+
+int opt_get_tcp_keepidle(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPIDLE);
+}
+
+int opt_set_tcp_keepintvl(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_KEEPINTVL);
+}
+
+int opt_get_tcp_keepintvl(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPINTVL);
+}
+
+int opt_set_tcp_keepcnt(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_KEEPCNT);
+}
+
+int opt_get_tcp_keepcnt(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_KEEPCNT);
+}
+
+/* seconds a listener waits for data before waking accept */
+int opt_set_tcp_defer_accept(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+}
+
+int opt_get_tcp_defer_accept(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+}
+
+/* congestion control algorithm, by name */
+int opt_set_tcp_congestion(lua_State *L, p_socket ps)
+{
+    size_t len;
+    const char *name = luaL_checklstring(L, 3, &len);  /* obj, name, string */
+    return opt_set(L, ps, IPPROTO_TCP, TCP_CONGESTION, (char *) name, 
+        (int) len);
+}
+
+int opt_get_tcp_congestion(lua_State *L, p_socket ps)
+{
+    char name[OPT_NAMELEN+1];
+    int len = OPT_NAMELEN;
+    int err = opt_get(L, ps, IPPROTO_TCP, TCP_CONGESTION, name, &len);
+    if (err)
+        return err;
+    name[len] = '\0';
+    lua_pushstring(L, name);
+    return 1;
+}
+
+/* kernel buffer sizes. linux reports twice the value set, to account
+ * for its bookkeeping overhead */
+int opt_set_rcvbuf(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, SOL_SOCKET, SO_RCVBUF);
+}
+
+int opt_get_rcvbuf(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_RCVBUF);
+}
+
+int opt_set_sndbuf(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, SOL_SOCKET, SO_SNDBUF);
+}
+
+int opt_get_sndbuf(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_SNDBUF);
+}
+
+/* microseconds to busy poll the device queue on blocking receives */
+int opt_set_busy_poll(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, SOL_SOCKET, SO_BUSY_POLL);
+}
+
+int opt_get_busy_poll(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_BUSY_POLL);
+}
+
+/* queueing priority of outgoing packets */
+int opt_set_priority(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, SOL_SOCKET, SO_PRIORITY);
+}
+
+int opt_get_priority(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_PRIORITY);
+}
+
+/* cpu that handles the socket's incoming packets */
+int opt_set_incoming_cpu(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, SOL_SOCKET, SO_INCOMING_CPU);
+}
+
+int opt_get_incoming_cpu(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, SOL_SOCKET, SO_INCOMING_CPU);
+}
+
+/* type of service field of outgoing IPv4 packets */
+int opt_set_ip_tos(lua_State *L, p_socket ps)
+{
+    return opt_setint(L, ps, IPPROTO_IP, IP_TOS);
+}
+
+int opt_get_ip_tos(lua_State *L, p_socket ps)
+{
+    return opt_getint(L, ps, IPPROTO_IP, IP_TOS);
+}
+
 int opt_set_keepalive(lua_State *L, p_socket ps)
 {
     return opt_setboolean(L, ps, SOL_SOCKET, SO_KEEPALIVE); 
@@ -218,10 +489,19 @@ static int opt_setmembership(lua_State *L, p_socket ps, int level, int name)
     return opt_set(L, ps, level, name, (char *) &val, sizeof(val));
 }
 
+static int opt_unsupported(lua_State *L)
+{
+    lua_pushnil(L);
+    lua_pushstring(L, "not supported");
+    return 2;
+}
+
 static 
 int opt_get(lua_State *L, p_socket ps, int level, int name, void *val, int* len)
 {
     socklen_t socklen = *len;
+    if (name == OPT_UNSUPPORTED)
+        return opt_unsupported(L);
     if (getsockopt(*ps, level, name, (char *) val, &socklen) < 0) {
         lua_pushnil(L);
         lua_pushstring(L, "getsockopt failed");
@@ -234,6 +514,8 @@ int opt_get(lua_State *L, p_socket ps, int level, int name, void *val, int* len)
 static 
 int opt_set(lua_State *L, p_socket ps, int level, int name, void *val, int len)
 {
+    if (name == OPT_UNSUPPORTED)
+        return opt_unsupported(L);
     if (setsockopt(*ps, level, name, (char *) val, len) < 0) {
         lua_pushnil(L);
         lua_pushstring(L, "setsockopt failed");
@@ -260,3 +542,19 @@ static int opt_setboolean(lua_State *L, p_socket ps, int level, int name)
     return opt_set(L, ps, level, name, (char *) &val, sizeof(val));
 }
 
+static int opt_getint(lua_State *L, p_socket ps, int level, int name)
+{
+    int val = 0;
+    int len = sizeof(val);
+    int err = opt_get(L, ps, level, name, (char *) &val, &len);
+    if (err)
+        return err;
+    lua_pushnumber(L, val);
+    return 1;
+}
+
+static int opt_setint(lua_State *L, p_socket ps, int level, int name)
+{
+    int val = (int) luaL_checknumber(L, 3);             /* obj, name, int */
+    return opt_set(L, ps, level, name, (char *) &val, sizeof(val));
+}
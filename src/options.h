@@ -23,6 +23,22 @@ int opt_set_dontroute(lua_State *L, p_socket ps);
 int opt_set_broadcast(lua_State *L, p_socket ps);
 int opt_set_reuseaddr(lua_State *L, p_socket ps);
 int opt_set_tcp_nodelay(lua_State *L, p_socket ps);
+int opt_set_tcp_fastopen(lua_State *L, p_socket ps);
+int opt_set_tcp_quickack(lua_State *L, p_socket ps);
+int opt_set_tcp_cork(lua_State *L, p_socket ps);
+int opt_set_tcp_notsent_lowat(lua_State *L, p_socket ps);
+int opt_set_tcp_user_timeout(lua_State *L, p_socket ps);
+int opt_set_tcp_keepidle(lua_State *L, p_socket ps);
+int opt_set_tcp_keepintvl(lua_State *L, p_socket ps);
+int opt_set_tcp_keepcnt(lua_State *L, p_socket ps);
+int opt_set_tcp_defer_accept(lua_State *L, p_socket ps);
+int opt_set_tcp_congestion(lua_State *L, p_socket ps);
+int opt_set_rcvbuf(lua_State *L, p_socket ps);
+int opt_set_sndbuf(lua_State *L, p_socket ps);
+int opt_set_busy_poll(lua_State *L, p_socket ps);
+int opt_set_priority(lua_State *L, p_socket ps);
+int opt_set_incoming_cpu(lua_State *L, p_socket ps);
+int opt_set_ip_tos(lua_State *L, p_socket ps);
 int opt_set_keepalive(lua_State *L, p_socket ps);
 int opt_set_linger(lua_State *L, p_socket ps);
 int opt_set_reuseaddr(lua_State *L, p_socket ps);
@@ -37,6 +53,22 @@ int opt_set_ip6_v6only(lua_State *L, p_socket ps);
 /* supported options for getoption */
 int opt_get_reuseaddr(lua_State *L, p_socket ps);
 int opt_get_tcp_nodelay(lua_State *L, p_socket ps);
+int opt_get_tcp_fastopen(lua_State *L, p_socket ps);
+int opt_get_tcp_quickack(lua_State *L, p_socket ps);
+int opt_get_tcp_cork(lua_State *L, p_socket ps);
+int opt_get_tcp_notsent_lowat(lua_State *L, p_socket ps);
+int opt_get_tcp_user_timeout(lua_State *L, p_socket ps);
+int opt_get_tcp_keepidle(lua_State *L, p_socket ps);
+int opt_get_tcp_keepintvl(lua_State *L, p_socket ps);
+int opt_get_tcp_keepcnt(lua_State *L, p_socket ps);
+int opt_get_tcp_defer_accept(lua_State *L, p_socket ps);
+int opt_get_tcp_congestion(lua_State *L, p_socket ps);
+int opt_get_rcvbuf(lua_State *L, p_socket ps);
+int opt_get_sndbuf(lua_State *L, p_socket ps);
+int opt_get_busy_poll(lua_State *L, p_socket ps);
+int opt_get_priority(lua_State *L, p_socket ps);
+int opt_get_incoming_cpu(lua_State *L, p_socket ps);
+int opt_get_ip_tos(lua_State *L, p_socket ps);
 int opt_get_keepalive(lua_State *L, p_socket ps);
 int opt_get_linger(lua_State *L, p_socket ps);
 int opt_get_reuseaddr(lua_State *L, p_socket ps);
@@ -46,5 +78,6 @@ int opt_get_ip_multicast_if(lua_State *L, p_socket ps);
 /* invokes the appropriate option handler */
 int opt_meth_setoption(lua_State *L, p_opt opt, p_socket ps);
 int opt_meth_getoption(lua_State *L, p_opt opt, p_socket ps);
+int opt_meth_setoptions(lua_State *L, p_opt opt, p_socket ps);
 
 #endif
@@ -0,0 +1,389 @@
+/*=========================================================================*\
+* Readiness notification for many descriptors
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "auxiliar.h"
+#include "socket.h"
+#include "poller.h"
+
+/* events returned by a single wait, unless asked otherwise */
+#define POLLER_MAXEVENTS 256
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_create(lua_State *L);
+static int meth_add(lua_State *L);
+static int meth_modify(lua_State *L);
+static int meth_remove(lua_State *L);
+static int meth_wait(lua_State *L);
+static int meth_getfd(lua_State *L);
+static int meth_count(lua_State *L);
+static int meth_close(lua_State *L);
+
+static t_socket getfd(lua_State *L, int idx);
+static int getevents(lua_State *L, int idx);
+static int control(p_poller p, int op, t_socket fd, int events);
+
+/* poller object methods */
+static luaL_Reg poller_methods[] = {
+    {"__gc",        meth_close},
+    {"__tostring",  auxiliar_tostring},
+    {"add",         meth_add},
+    {"close",       meth_close},
+    {"count",       meth_count},
+    {"getfd",       meth_getfd},
+    {"modify",      meth_modify},
+    {"remove",      meth_remove},
+    {"wait",        meth_wait},
+    {NULL,          NULL}
+};
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"poller",      global_create},
+    {NULL,          NULL}
+};
+
+/* event bits, the same in both implementations */
+enum { EV_READ = 1, EV_WRITE = 2 };
+
+/* control operations */
+enum { OP_ADD, OP_MODIFY, OP_REMOVE };
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int poller_open(lua_State *L) {
+    auxiliar_newclass(L, "poller{client}", poller_methods);
+    luaL_openlib(L, NULL, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates a poller
+\*-------------------------------------------------------------------------*/
+static int global_create(lua_State *L) {
+    p_poller p = (p_poller) lua_newuserdata(L, sizeof(t_poller));
+    memset(p, 0, sizeof(t_poller));
+    p->fd = -1;
+    p->objects = LUA_NOREF;
+    auxiliar_setclass(L, "poller{client}", -1);
+#ifdef __linux__
+    p->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+#else
+    p->fd = 0;
+#endif
+    lua_newtable(L);
+    p->objects = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Starts watching an object for the events given as "r", "w" or "rw"
+\*-------------------------------------------------------------------------*/
+static int meth_add(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+    t_socket fd = getfd(L, 2);
+    int err, events = getevents(L, 3);
+    if (p->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, p->objects);
+    lua_pushnumber(L, fd);
+    lua_rawget(L, -2);
+    if (!lua_isnil(L, -1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "already added");
+        return 2;
+    }
+    lua_pop(L, 1);
+    err = control(p, OP_ADD, fd, events);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, fd);
+    lua_pushvalue(L, 2);
+    lua_rawset(L, -3);
+    p->count++;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Changes the events an object is watched for
+\*-------------------------------------------------------------------------*/
+static int meth_modify(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+    t_socket fd = getfd(L, 2);
+    int err, events = getevents(L, 3);
+    if (p->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    err = control(p, OP_MODIFY, fd, events);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Stops watching an object. Objects must be removed before they are
+* closed, or their descriptor is forgotten by epoll but not by the poller
+\*-------------------------------------------------------------------------*/
+static int meth_remove(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+    t_socket fd = getfd(L, 2);
+    if (p->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, p->objects);
+    lua_pushnumber(L, fd);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "not added");
+        return 2;
+    }
+    lua_pop(L, 1);
+    control(p, OP_REMOVE, fd, 0);
+    lua_pushnumber(L, fd);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    p->count--;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Waits until some objects are ready, or the timeout expires
+* readable, writable = poller:wait([timeout [, max]])
+* Errors and hang-ups make an object readable, so that its next read
+* reports them.
+\*-------------------------------------------------------------------------*/
+static int meth_wait(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+    double t = luaL_optnumber(L, 2, -1);
+    int max = luaL_optint(L, 3, POLLER_MAXEVENTS);
+    int i, n, ms, nr = 0, nw = 0;
+    t_timeout tm;
+    luaL_argcheck(L, max > 0, 3, "invalid count");
+    if (p->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+    lua_settop(L, 3);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, p->objects);
+    lua_newtable(L);
+    lua_newtable(L);
+    timeout_init(&tm, t, -1);
+    timeout_markstart(&tm);
+#ifdef __linux__
+    {
+        struct epoll_event *evs = (struct epoll_event *)
+            lua_newuserdata(L, max * sizeof(struct epoll_event));
+        do {
+            double left = timeout_getretry(&tm);
+            ms = left < 0 ? -1 : (int) (left * 1000.0 + 0.999);
+            n = epoll_wait(p->fd, evs, max, ms);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, socket_strerror(errno));
+            return 2;
+        }
+        lua_pop(L, 1);
+        for (i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+            if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                lua_pushnumber(L, fd);
+                lua_rawget(L, 4);
+                lua_rawseti(L, 5, ++nr);
+            }
+            if (evs[i].events & EPOLLOUT) {
+                lua_pushnumber(L, fd);
+                lua_rawget(L, 4);
+                lua_rawseti(L, 6, ++nw);
+            }
+        }
+    }
+#else
+    do {
+        double left = timeout_getretry(&tm);
+        ms = left < 0 ? -1 : (int) (left * 1000.0 + 0.999);
+        n = poll(p->fds, p->count, ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    for (i = 0; i < p->count && nr + nw < 2*max; i++) {
+        short re = p->fds[i].revents;
+        if (re & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+            lua_pushnumber(L, p->fds[i].fd);
+            lua_rawget(L, 4);
+            lua_rawseti(L, 5, ++nr);
+        }
+        if (re & POLLOUT) {
+            lua_pushnumber(L, p->fds[i].fd);
+            lua_rawget(L, 4);
+            lua_rawseti(L, 6, ++nw);
+        }
+    }
+#endif
+    if (n == 0) {
+        lua_pushstring(L, "timeout");
+        return 3;
+    }
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Select support methods. An epoll descriptor is readable when some of its
+* objects are ready, so pollers can be nested
+\*-------------------------------------------------------------------------*/
+static int meth_getfd(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+#ifdef __linux__
+    lua_pushnumber(L, p->fd);
+#else
+    (void) p;
+    lua_pushnumber(L, -1);
+#endif
+    return 1;
+}
+
+static int meth_count(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+    lua_pushnumber(L, p->count);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Releases the poller. The objects it watched are left alone
+\*-------------------------------------------------------------------------*/
+static int meth_close(lua_State *L) {
+    p_poller p = (p_poller) auxiliar_checkclass(L, "poller{client}", 1);
+#ifdef __linux__
+    if (p->fd >= 0) close(p->fd);
+#else
+    free(p->fds);
+    p->fds = NULL;
+    p->size = 0;
+#endif
+    p->fd = -1;
+    p->count = 0;
+    luaL_unref(L, LUA_REGISTRYINDEX, p->objects);
+    p->objects = LUA_NOREF;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*=========================================================================*\
+* Internal functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Gets the descriptor of an object through its getfd method
+\*-------------------------------------------------------------------------*/
+static t_socket getfd(lua_State *L, int idx) {
+    t_socket fd = SOCKET_INVALID;
+    luaL_checkany(L, idx);
+    lua_getfield(L, idx, "getfd");
+    if (!lua_isnil(L, -1)) {
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+        if (lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0)
+            fd = (t_socket) lua_tonumber(L, -1);
+    }
+    lua_pop(L, 1);
+    if (fd == SOCKET_INVALID) luaL_argerror(L, idx, "invalid descriptor");
+    return fd;
+}
+
+static int getevents(lua_State *L, int idx) {
+    const char *s = luaL_optstring(L, idx, "r");
+    int events = 0;
+    if (strchr(s, 'r')) events |= EV_READ;
+    if (strchr(s, 'w')) events |= EV_WRITE;
+    luaL_argcheck(L, events != 0, idx, "invalid events");
+    return events;
+}
+
+/*-------------------------------------------------------------------------*\
+* Adds, changes or removes a descriptor in the kernel's or our own set
+\*-------------------------------------------------------------------------*/
+#ifdef __linux__
+static int control(p_poller p, int op, t_socket fd, int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (events & EV_READ) ev.events |= EPOLLIN;
+    if (events & EV_WRITE) ev.events |= EPOLLOUT;
+    op = op == OP_ADD ? EPOLL_CTL_ADD :
+        op == OP_MODIFY ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    if (epoll_ctl(p->fd, op, fd, &ev) < 0) return errno;
+    return IO_DONE;
+}
+#else
+static int control(p_poller p, int op, t_socket fd, int events) {
+    int i;
+    short pe = 0;
+    if (events & EV_READ) pe |= POLLIN;
+    if (events & EV_WRITE) pe |= POLLOUT;
+    if (op == OP_ADD) {
+        if (p->count >= p->size) {
+            int size = p->size ? 2*p->size : 16;
+            struct pollfd *fds = (struct pollfd *)
+                realloc(p->fds, size * sizeof(struct pollfd));
+            if (!fds) return ENOMEM;
+            p->fds = fds;
+            p->size = size;
+        }
+        p->fds[p->count].fd = fd;
+        p->fds[p->count].events = pe;
+        p->fds[p->count].revents = 0;
+        return IO_DONE;
+    }
+    for (i = 0; i < p->count; i++) {
+        if (p->fds[i].fd != fd) continue;
+        /* the last one takes the place of the one removed */
+        if (op == OP_REMOVE) p->fds[i] = p->fds[p->count-1];
+        else p->fds[i].events = pe;
+        return IO_DONE;
+    }
+    return ENOENT;
+}
+#endif
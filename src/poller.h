@@ -0,0 +1,40 @@
+#ifndef POLLER_H
+#define POLLER_H
+/*=========================================================================*\
+* Readiness notification for many descriptors
+* LuaSocket toolkit
+*
+* socket.select hands every descriptor to the kernel again on each call,
+* which costs time in proportion to the number of sockets watched rather
+* than the number that are ready. A poller keeps its set of descriptors
+* registered between calls, so waiting costs time in proportion to the
+* events delivered.
+*
+* On Linux the poller is backed by epoll, in level-triggered mode.
+* Elsewhere it falls back to poll. Objects are added through their getfd
+* method, as with select, and are returned by wait. Unlike select, wait
+* does not call dirty: data already buffered by an object does not make
+* it ready, so callers should drain buffers before they wait.
+\*=========================================================================*/
+#include "lua.h"
+
+#include "timeout.h"
+
+#ifndef __linux__
+#include <poll.h>
+#endif
+
+typedef struct t_poller_ {
+    int fd;                 /* epoll descriptor, or -1 once closed */
+    int objects;            /* registry reference to the fd to object table */
+    int count;              /* number of descriptors added */
+#ifndef __linux__
+    struct pollfd *fds;     /* descriptors watched by poll */
+    int size;               /* slots allocated in fds */
+#endif
+} t_poller;
+typedef t_poller *p_poller;
+
+int poller_open(lua_State *L);
+
+#endif /* POLLER_H */
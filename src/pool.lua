@@ -0,0 +1,221 @@
+-----------------------------------------------------------------------------
+-- Keyed pool of idle TCP connections
+-- LuaSocket toolkit.
+-----------------------------------------------------------------------------
+
+-----------------------------------------------------------------------------
+-- Declare module and import dependencies
+-----------------------------------------------------------------------------
+local base = _G
+local string = require("string")
+local table = require("table")
+local socket = require("socket")
+module("socket.pool")
+
+-----------------------------------------------------------------------------
+-- Program constants
+-----------------------------------------------------------------------------
+-- idle connections kept per key
+MAXIDLE = 8
+-- seconds an idle connection is kept
+IDLE = 15
+-- idle connections kept across all keys
+MAXTOTAL = 64
+
+-----------------------------------------------------------------------------
+-- Implementation
+-----------------------------------------------------------------------------
+local metat = { __index = {} }
+
+function new(options)
+    options = options or {}
+    return base.setmetatable({
+        maxidle = options.maxidle or MAXIDLE,
+        maxtotal = options.maxtotal or MAXTOTAL,
+        max = options.max,
+        idletime = options.idle or IDLE,
+        reaped = socket.gettime(),
+        idle = {},      -- idle connections by key, most recent last
+        count = {},     -- open connections by key, idle or busy
+        busy = {},      -- key of each busy connection
+        nidle = 0,
+        nbusy = 0,
+        metrics = { hits = 0, misses = 0, stale = 0, expired = 0,
+            discarded = 0, evicted = 0 }
+    }, metat)
+end
+
+local function getkey(host, port, family)
+    return string.format("%s:%s:%s", host, base.tostring(port),
+        family or "any")
+end
+
+local function forget(self, key)
+    self.count[key] = self.count[key] - 1
+    if self.count[key] == 0 then self.count[key] = nil end
+end
+
+-- closes idle connections that have outlived the idle timeout. the oldest
+-- are at the front of each list
+local function expire(self, key, now)
+    local idle = self.idle[key]
+    if not idle then return end
+    while idle[1] and now - idle[1].t > self.idletime do
+        table.remove(idle, 1).c:close()
+        self.nidle = self.nidle - 1
+        self.metrics.expired = self.metrics.expired + 1
+        forget(self, key)
+    end
+    if not idle[1] then self.idle[key] = nil end
+end
+
+-- expires the key in use, and every other key a few times per idle
+-- timeout, so that hosts nobody talks to anymore do not keep descriptors
+local function tidy(self, key, now)
+    if now - self.reaped >= self.idletime/4 then self:reap()
+    else expire(self, key, now) end
+end
+
+-- closes the connection that has been idle the longest, whatever its key
+local function evict(self)
+    local oldest
+    for key, idle in base.pairs(self.idle) do
+        if not oldest or idle[1].t < self.idle[oldest][1].t then
+            oldest = key
+        end
+    end
+    local idle = self.idle[oldest]
+    table.remove(idle, 1).c:close()
+    if not idle[1] then self.idle[oldest] = nil end
+    self.nidle = self.nidle - 1
+    self.metrics.evicted = self.metrics.evicted + 1
+    forget(self, oldest)
+end
+
+-- opens a new connection, counted against the key's limit
+function metat.__index:connect(host, port, family, timeout)
+    local key = getkey(host, port, family)
+    if self.max and (self.count[key] or 0) >= self.max then
+        return nil, "too many connections"
+    end
+    local c, err
+    if family == "unix" then
+        -- the host is the path of the socket
+        c, err = socket.connectunix(host, timeout)
+        if not c then return nil, err end
+    elseif family then
+        c, err = (family == "inet6" and socket.tcp6 or socket.tcp)()
+        if not c then return nil, err end
+        c:settimeout(timeout or -1)
+        local r
+        r, err = c:connect(host, port)
+        if not r then c:close(); return nil, err end
+    else
+        -- lets the C code try every address of the host, of any family
+        local clients, errors = socket.connectmany({{host, port}}, timeout)
+        c, err = clients[1], errors[1]
+        if not c then return nil, err end
+    end
+    self.count[key] = (self.count[key] or 0) + 1
+    self.busy[c] = key
+    self.nbusy = self.nbusy + 1
+    return c
+end
+
+-- hands out an idle connection to the key if a live one is left, or
+-- opens a new one. the second return value tells which happened
+function metat.__index:checkout(host, port, family, timeout)
+    local key = getkey(host, port, family)
+    tidy(self, key, socket.gettime())
+    local idle = self.idle[key]
+    while idle and idle[1] do
+        -- the most recently used connection is the least likely to have
+        -- been closed by the server
+        local c = table.remove(idle).c
+        self.nidle = self.nidle - 1
+        if not idle[1] then self.idle[key] = nil end
+        if c:alive() then
+            self.metrics.hits = self.metrics.hits + 1
+            self.busy[c] = key
+            self.nbusy = self.nbusy + 1
+            return c, true
+        end
+        c:close()
+        self.metrics.stale = self.metrics.stale + 1
+        forget(self, key)
+    end
+    self.metrics.misses = self.metrics.misses + 1
+    local c, err = self:connect(host, port, family, timeout)
+    if not c then return nil, err end
+    return c, false
+end
+
+-- takes back a connection that is ready for another request
+function metat.__index:checkin(c)
+    local key = self.busy[c]
+    if not key then return nil, "not from this pool" end
+    self.busy[c] = nil
+    self.nbusy = self.nbusy - 1
+    local now = socket.gettime()
+    tidy(self, key, now)
+    local idle = self.idle[key] or {}
+    if #idle >= self.maxidle or self.maxtotal <= 0 or not c:alive() then
+        c:close()
+        self.metrics.discarded = self.metrics.discarded + 1
+        forget(self, key)
+        return 1
+    end
+    if self.nidle >= self.maxtotal then evict(self) end
+    idle[#idle+1] = { c = c, t = now }
+    self.idle[key] = idle
+    self.nidle = self.nidle + 1
+    return 1
+end
+
+-- closes a connection that cannot be reused
+function metat.__index:discard(c)
+    local key = self.busy[c]
+    c:close()
+    if not key then return nil, "not from this pool" end
+    self.busy[c] = nil
+    self.nbusy = self.nbusy - 1
+    self.metrics.discarded = self.metrics.discarded + 1
+    forget(self, key)
+    return 1
+end
+
+-- closes every idle connection past the idle timeout
+function metat.__index:reap()
+    local now = socket.gettime()
+    local keys = {}
+    self.reaped = now
+    for key in base.pairs(self.idle) do keys[#keys+1] = key end
+    for _, key in base.ipairs(keys) do expire(self, key, now) end
+    return 1
+end
+
+function metat.__index:getstats()
+    local stats = {}
+    for name, value in base.pairs(self.metrics) do stats[name] = value end
+    stats.idle = self.nidle
+    stats.busy = self.nbusy
+    return stats
+end
+
+-- closes idle connections. busy ones are closed when discarded or
+-- checked back in
+function metat.__index:close()
+    for key, idle in base.pairs(self.idle) do
+        for _, entry in base.ipairs(idle) do
+            entry.c:close()
+            forget(self, key)
+        end
+    end
+    self.idle = {}
+    self.nidle = 0
+    self.maxidle = 0
+    return 1
+end
+
+-- shared by the protocol modules
+default = new()
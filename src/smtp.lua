@@ -147,12 +147,7 @@ local send_message
 
 -- yield the headers all at once, it's faster
 local function send_headers(tosend)
-    local canonic = headers.canonic
-    local h = "\r\n"
-    for f,v in base.pairs(tosend) do
-        h = (canonic[f] or f) .. ': ' .. v .. "\r\n" .. h
-    end
-    coroutine.yield(h)
+    coroutine.yield(headers.serialize(tosend))
 end
 
 -- yield multipart message body from a multipart message table
@@ -52,6 +52,9 @@ int socket_select(t_socket n, fd_set *rfds, fd_set *wfds, fd_set *efds,
         p_timeout tm);
 
 int socket_connect(p_socket ps, SA *addr, socklen_t addr_len, p_timeout tm); 
+int socket_waitconnect(p_socket ps, int n, int *result, t_socket wake,
+        p_timeout tm);
+/* sockets returned by socket_create and socket_accept are non-blocking */
 int socket_create(p_socket ps, int domain, int type, int protocol);
 int socket_bind(p_socket ps, SA *addr, socklen_t addr_len); 
 int socket_listen(p_socket ps, int backlog);
@@ -70,6 +73,7 @@ int socket_recv(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm
 int socket_write(p_socket ps, const char *data, size_t count, 
         size_t *sent, p_timeout tm);
 int socket_read(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm);
+int socket_peek(p_socket ps);
 const char *socket_ioerror(p_socket ps, int err);
 
 int socket_gethostbyaddr(const char *addr, socklen_t len, struct hostent **hp);
@@ -17,6 +17,8 @@ module("socket")
 -----------------------------------------------------------------------------
 function connect(address, port, laddress, lport)
     if address == "*" then address = "0.0.0.0" end
+    -- without a local address, the C code can race attempts across families
+    if not laddress then return socket.connect6(address, port) end
     local addrinfo, err = socket.dns.getaddrinfo(address)
     if not addrinfo then return nil, err end
     local sock, res
@@ -46,6 +48,20 @@ function connect(address, port, laddress, lport)
     return nil, err
 end
 
+function connectunix(path, timeout)
+    if not socket.unix then return nil, "unix sockets not supported" end
+    local sock, err = socket.unix()
+    if not sock then return nil, err end
+    sock:settimeout(timeout or -1)
+    local res
+    res, err = sock:connect(path)
+    if not res then
+        sock:close()
+        return nil, err
+    end
+    return sock
+end
+
 function bind(host, port, backlog)
     if host == "*" then host = "0.0.0.0" end
     local addrinfo, err = socket.dns.getaddrinfo(host)
@@ -79,13 +95,13 @@ end
 try = newtry()
 
 function choose(table)
-    return function(name, opt1, opt2)
+    return function(name, opt1, opt2, opt3)
         if base.type(name) ~= "string" then
-            name, opt1, opt2 = "default", name, opt1
+            name, opt1, opt2, opt3 = "default", name, opt1, opt2
         end
         local f = table[name or "nil"]
         if not f then base.error("unknown key (".. base.tostring(name) ..")", 3)
-        else return f(opt1, opt2) end
+        else return f(opt1, opt2, opt3) end
     end
 end
 
@@ -3,6 +3,13 @@
 * LuaSocket toolkit
 \*=========================================================================*/
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -12,6 +19,10 @@
 #include "inet.h"
 #include "options.h"
 #include "tcp.h"
+#ifndef _WIN32
+#include "event.h"
+#include "async.h"
+#endif
 
 /*=========================================================================*\
 * Internal function prototypes
@@ -19,6 +30,8 @@
 static int global_create(lua_State *L);
 static int global_create6(lua_State *L);
 static int global_connect6(lua_State *L);
+static int global_setconnectdelay(lua_State *L);
+static int global_connectmany(lua_State *L);
 static int meth_connect(lua_State *L);
 static int meth_listen(lua_State *L);
 static int meth_getfamily(lua_State *L);
@@ -30,10 +43,18 @@ static int meth_getsockname(lua_State *L);
 static int meth_getpeername(lua_State *L);
 static int meth_shutdown(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receivechunk(lua_State *L);
+static int meth_receiveheaders(lua_State *L);
+static int meth_receiverequest(lua_State *L);
+static int meth_sendheaders(lua_State *L);
 static int meth_accept(lua_State *L);
+static int meth_acceptmany(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_getoption(lua_State *L);
 static int meth_setoption(lua_State *L);
+static int meth_setoptions(lua_State *L);
+static int meth_getinfo(lua_State *L);
+static int meth_alive(lua_State *L);
 static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
 static int meth_setfd(lua_State *L);
@@ -44,12 +65,15 @@ static luaL_Reg tcp_methods[] = {
     {"__gc",        meth_close},
     {"__tostring",  auxiliar_tostring},
     {"accept",      meth_accept},
+    {"acceptmany",  meth_acceptmany},
+    {"alive",       meth_alive},
     {"bind",        meth_bind},
     {"close",       meth_close},
     {"connect",     meth_connect},
     {"dirty",       meth_dirty},
     {"getfamily",   meth_getfamily},
     {"getfd",       meth_getfd},
+    {"getinfo",     meth_getinfo},
     {"getoption",   meth_getoption},
     {"getpeername", meth_getpeername},
     {"getsockname", meth_getsockname},
@@ -57,9 +81,14 @@ static luaL_Reg tcp_methods[] = {
     {"setstats",    meth_setstats},
     {"listen",      meth_listen},
     {"receive",     meth_receive},
+    {"receivechunk", meth_receivechunk},
+    {"receiveheaders", meth_receiveheaders},
+    {"receiverequest", meth_receiverequest},
     {"send",        meth_send},
+    {"sendheaders", meth_sendheaders},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
+    {"setoptions",  meth_setoptions},
     {"setpeername", meth_connect},
     {"setsockname", meth_bind},
     {"settimeout",  meth_settimeout},
@@ -69,20 +98,52 @@ static luaL_Reg tcp_methods[] = {
 
 /* socket option handlers */
 static t_opt optget[] = {
-    {"keepalive",   opt_get_keepalive},
-    {"reuseaddr",   opt_get_reuseaddr},
-    {"tcp-nodelay", opt_get_tcp_nodelay},
-    {"linger",      opt_get_linger},
-    {NULL,          NULL}
+    {"keepalive",         opt_get_keepalive},
+    {"reuseaddr",         opt_get_reuseaddr},
+    {"tcp-nodelay",       opt_get_tcp_nodelay},
+    {"linger",            opt_get_linger},
+    {"tcp-fastopen",      opt_get_tcp_fastopen},
+    {"tcp-quickack",      opt_get_tcp_quickack},
+    {"tcp-cork",          opt_get_tcp_cork},
+    {"tcp-notsent-lowat", opt_get_tcp_notsent_lowat},
+    {"tcp-user-timeout",  opt_get_tcp_user_timeout},
+    {"tcp-keepidle",      opt_get_tcp_keepidle},
+    {"tcp-keepintvl",     opt_get_tcp_keepintvl},
+    {"tcp-keepcnt",       opt_get_tcp_keepcnt},
+    {"tcp-defer-accept",  opt_get_tcp_defer_accept},
+    {"tcp-congestion",    opt_get_tcp_congestion},
+    {"rcvbuf",            opt_get_rcvbuf},
+    {"sndbuf",            opt_get_sndbuf},
+    {"busy-poll",         opt_get_busy_poll},
+    {"priority",          opt_get_priority},
+    {"incoming-cpu",      opt_get_incoming_cpu},
+    {"ip-tos",            opt_get_ip_tos},
+    {NULL,                NULL}
 };
 
 static t_opt optset[] = {
-    {"keepalive",   opt_set_keepalive},
-    {"reuseaddr",   opt_set_reuseaddr},
-    {"tcp-nodelay", opt_set_tcp_nodelay},
-    {"ipv6-v6only", opt_set_ip6_v6only},
-    {"linger",      opt_set_linger},
-    {NULL,          NULL}
+    {"keepalive",         opt_set_keepalive},
+    {"reuseaddr",         opt_set_reuseaddr},
+    {"tcp-nodelay",       opt_set_tcp_nodelay},
+    {"ipv6-v6only",       opt_set_ip6_v6only},
+    {"linger",            opt_set_linger},
+    {"tcp-fastopen",      opt_set_tcp_fastopen},
+    {"tcp-quickack",      opt_set_tcp_quickack},
+    {"tcp-cork",          opt_set_tcp_cork},
+    {"tcp-notsent-lowat", opt_set_tcp_notsent_lowat},
+    {"tcp-user-timeout",  opt_set_tcp_user_timeout},
+    {"tcp-keepidle",      opt_set_tcp_keepidle},
+    {"tcp-keepintvl",     opt_set_tcp_keepintvl},
+    {"tcp-keepcnt",       opt_set_tcp_keepcnt},
+    {"tcp-defer-accept",  opt_set_tcp_defer_accept},
+    {"tcp-congestion",    opt_set_tcp_congestion},
+    {"rcvbuf",            opt_set_rcvbuf},
+    {"sndbuf",            opt_set_sndbuf},
+    {"busy-poll",         opt_set_busy_poll},
+    {"priority",          opt_set_priority},
+    {"incoming-cpu",      opt_set_incoming_cpu},
+    {"ip-tos",            opt_set_ip_tos},
+    {NULL,                NULL}
 };
 
 /* functions in library namespace */
@@ -90,6 +151,8 @@ static luaL_Reg func[] = {
     {"tcp", global_create},
     {"tcp6", global_create6},
     {"connect6", global_connect6},
+    {"connectmany", global_connectmany},
+    {"setconnectdelay", global_setconnectdelay},
     {NULL, NULL}
 };
 
@@ -127,6 +190,26 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &tcp->buf);
 }
 
+static int meth_receivechunk(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    return buffer_meth_receivechunk(L, &tcp->buf);
+}
+
+static int meth_receiveheaders(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    return buffer_meth_receiveheaders(L, &tcp->buf);
+}
+
+static int meth_receiverequest(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    return buffer_meth_receiverequest(L, &tcp->buf);
+}
+
+static int meth_sendheaders(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    return buffer_meth_sendheaders(L, &tcp->buf);
+}
+
 static int meth_getstats(lua_State *L) {
     p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
     return buffer_meth_getstats(L, &tcp->buf);
@@ -152,6 +235,140 @@ static int meth_setoption(lua_State *L)
     return opt_meth_setoption(L, optset, &tcp->sock);
 }
 
+static int meth_setoptions(lua_State *L)
+{
+    p_tcp tcp = (p_tcp) auxiliar_checkgroup(L, "tcp{any}", 1);
+    return opt_meth_setoptions(L, optset, &tcp->sock);
+}
+
+/*-------------------------------------------------------------------------*\
+* Checks, without blocking, that an idle connection can still be used:
+* the peer has not closed it and has sent nothing we did not ask for
+\*-------------------------------------------------------------------------*/
+static int meth_alive(lua_State *L)
+{
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    int err = buffer_isempty(&tcp->buf)? socket_peek(&tcp->sock): IO_DONE;
+    if (err == IO_TIMEOUT) {
+        lua_pushnumber(L, 1);
+        return 1;
+    }
+    lua_pushnil(L);
+    if (err == IO_DONE) lua_pushstring(L, "unexpected data");
+    else lua_pushstring(L, socket_strerror(err));
+    return 2;
+}
+
+/*-------------------------------------------------------------------------*\
+* Reports what the kernel knows about the connection: round trip times,
+* congestion window, losses, and how much data sits in each queue.
+* Fills the table given as argument, or a new one
+\*-------------------------------------------------------------------------*/
+#if defined(__linux__) && defined(TCP_INFO)
+/* the kernel only ever appends to struct tcp_info, but the C library may
+ * stop short of the fields we want, so we spell out the rest. fields the
+ * running kernel does not fill in are left out of the result */
+typedef struct t_tcpinfo_ {
+    struct tcp_info base;
+    uint64_t pacing_rate;
+    uint64_t max_pacing_rate;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t segs_out;
+    uint32_t segs_in;
+    uint32_t notsent_bytes;
+    uint32_t min_rtt;
+    uint32_t data_segs_in;
+    uint32_t data_segs_out;
+    uint64_t delivery_rate;
+} t_tcpinfo;
+
+#define HAS(len, field) ((len) >= offsetof(t_tcpinfo, field) + \
+    sizeof(((t_tcpinfo *) 0)->field))
+
+static const char *tcpstates[] = {
+    "unknown", "established", "syn-sent", "syn-received", "fin-wait-1",
+    "fin-wait-2", "time-wait", "closed", "close-wait", "last-ack",
+    "listen", "closing", "new-syn-received"
+};
+
+static void setnumber(lua_State *L, const char *name, double value)
+{
+    lua_pushnumber(L, value);
+    lua_setfield(L, -2, name);
+}
+
+static int meth_getinfo(lua_State *L)
+{
+    p_tcp tcp = (p_tcp) auxiliar_checkgroup(L, "tcp{any}", 1);
+    t_tcpinfo info;
+    socklen_t len = sizeof(info);
+    int state, queued;
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(tcp->sock, IPPROTO_TCP, TCP_INFO, (char *) &info,
+            &len) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(errno));
+        return 2;
+    }
+    if (lua_istable(L, 2)) lua_settop(L, 2);
+    else lua_newtable(L);
+    state = info.base.tcpi_state;
+    if (state < 0 || state >= (int) (sizeof(tcpstates)/sizeof(*tcpstates)))
+        state = 0;
+    lua_pushstring(L, tcpstates[state]);
+    lua_setfield(L, -2, "state");
+    if (info.base.tcpi_state == TCP_LISTEN) {
+        /* for listeners, these count pending connections instead */
+        setnumber(L, "backlog", info.base.tcpi_unacked);
+        setnumber(L, "maxbacklog", info.base.tcpi_sacked);
+        return 1;
+    }
+    /* times are in seconds, as everywhere else in the library */
+    setnumber(L, "rtt", info.base.tcpi_rtt/1e6);
+    setnumber(L, "rttvar", info.base.tcpi_rttvar/1e6);
+    setnumber(L, "rto", info.base.tcpi_rto/1e6);
+    setnumber(L, "snd_cwnd", info.base.tcpi_snd_cwnd);
+    setnumber(L, "snd_ssthresh", info.base.tcpi_snd_ssthresh);
+    setnumber(L, "snd_mss", info.base.tcpi_snd_mss);
+    setnumber(L, "rcv_mss", info.base.tcpi_rcv_mss);
+    setnumber(L, "retransmits", info.base.tcpi_retransmits);
+    setnumber(L, "total_retrans", info.base.tcpi_total_retrans);
+    setnumber(L, "unacked", info.base.tcpi_unacked);
+    setnumber(L, "sacked", info.base.tcpi_sacked);
+    setnumber(L, "lost", info.base.tcpi_lost);
+    setnumber(L, "retrans", info.base.tcpi_retrans);
+    setnumber(L, "reordering", info.base.tcpi_reordering);
+    if (HAS(len, bytes_received)) {
+        setnumber(L, "pacing_rate", (double) info.pacing_rate);
+        setnumber(L, "bytes_acked", (double) info.bytes_acked);
+        setnumber(L, "bytes_received", (double) info.bytes_received);
+    }
+    if (HAS(len, min_rtt)) {
+        setnumber(L, "notsent", info.notsent_bytes);
+        setnumber(L, "min_rtt", info.min_rtt/1e6);
+    }
+    if (HAS(len, delivery_rate))
+        setnumber(L, "delivery_rate", (double) info.delivery_rate);
+    /* bytes not yet acknowledged, bytes not yet read by us, and bytes
+     * read from the kernel but still in our own buffer */
+    if (ioctl(tcp->sock, SIOCOUTQ, &queued) == 0)
+        setnumber(L, "outq", queued);
+    if (ioctl(tcp->sock, SIOCINQ, &queued) == 0)
+        setnumber(L, "inq", queued);
+    setnumber(L, "buffered", (double) (tcp->buf.last - tcp->buf.first));
+    return 1;
+}
+#else
+static int meth_getinfo(lua_State *L)
+{
+    auxiliar_checkgroup(L, "tcp{any}", 1);
+    lua_pushnil(L);
+    lua_pushstring(L, "not supported");
+    return 2;
+}
+#endif
+
 /*-------------------------------------------------------------------------*\
 * Select support methods
 \*-------------------------------------------------------------------------*/
@@ -192,8 +409,8 @@ static int meth_accept(lua_State *L)
         p_tcp clnt = (p_tcp) lua_newuserdata(L, sizeof(t_tcp));
         auxiliar_setclass(L, "tcp{client}", -1);
         /* initialize structure fields */
-        socket_setnonblocking(&sock);
         clnt->sock = sock;
+        clnt->family = server->family;
         io_init(&clnt->io, (p_send) socket_send, (p_recv) socket_recv,
                 (p_error) socket_ioerror, &clnt->sock);
         timeout_init(&clnt->tm, -1, -1);
@@ -206,6 +423,54 @@ static int meth_accept(lua_State *L)
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Waits for a connection, then accepts as many as are pending, up to n.
+* Returns a table of client objects and a table of {ip, port} pairs
+\*-------------------------------------------------------------------------*/
+static int meth_acceptmany(lua_State *L)
+{
+    p_tcp server = (p_tcp) auxiliar_checkclass(L, "tcp{server}", 1);
+    int i, n = luaL_optint(L, 2, 64);
+    p_timeout tm = timeout_markstart(&server->tm);
+    t_timeout zero;
+    int err = IO_DONE;
+    luaL_argcheck(L, n > 0, 2, "invalid count");
+    timeout_init(&zero, 0.0, -1);
+    lua_settop(L, 2);
+    lua_newtable(L);
+    lua_newtable(L);
+    for (i = 1; i <= n; i++) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        t_socket sock;
+        p_tcp clnt;
+        /* only the first accept waits */
+        err = socket_accept(&server->sock, &sock, (SA *) &addr, &len,
+            i == 1? tm: &zero);
+        if (err != IO_DONE) break;
+        clnt = (p_tcp) lua_newuserdata(L, sizeof(t_tcp));
+        auxiliar_setclass(L, "tcp{client}", -1);
+        clnt->sock = sock;
+        clnt->family = server->family;
+        io_init(&clnt->io, (p_send) socket_send, (p_recv) socket_recv,
+                (p_error) socket_ioerror, &clnt->sock);
+        timeout_init(&clnt->tm, -1, -1);
+        buffer_init(&clnt->buf, &clnt->io, &clnt->tm);
+        lua_rawseti(L, 3, i);
+        lua_newtable(L);
+        inet_pushsockaddr(L, (SA *) &addr, len);
+        lua_rawseti(L, -3, 2);
+        lua_rawseti(L, -2, 1);
+        lua_rawseti(L, 4, i);
+    }
+    if (i == 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(err));
+        return 2;
+    }
+    return 2;
+}
+
 /*-------------------------------------------------------------------------*\
 * Binds an object to an address
 \*-------------------------------------------------------------------------*/
@@ -220,7 +485,8 @@ static int meth_bind(lua_State *L)
     bindhints.ai_socktype = SOCK_STREAM;
     bindhints.ai_family = tcp->family;
     bindhints.ai_flags = AI_PASSIVE;
-    err = inet_trybind(&tcp->sock, address, port, &bindhints);
+    err = inet_trybind(&tcp->sock, address, port, &bindhints,
+        timeout_markstart(&tcp->tm));
     if (err) {
         lua_pushnil(L);
         lua_pushstring(L, err);
@@ -230,6 +496,55 @@ static int meth_bind(lua_State *L)
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Connects and sends the first bytes of the conversation. Where TCP Fast
+* Open is available and the kernel holds a cookie for the peer, connect
+* returns at once and the data leaves in the SYN. Otherwise, the handshake
+* completes as usual and the data follows it
+\*-------------------------------------------------------------------------*/
+static const char *tryconnectdata(p_tcp tcp, const char *address,
+        const char *port, struct addrinfo *connecthints,
+        const char *data, size_t count, int *insyn)
+{
+    size_t total = 0;
+    const char *err;
+#ifdef TCP_FASTOPEN_CONNECT
+    int on = 1;
+    /* older kernels refuse the option and we fall back to a plain connect */
+    setsockopt(tcp->sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+        (char *) &on, sizeof(on));
+#endif
+    *insyn = 0;
+    err = inet_tryconnect(&tcp->sock, address, port, &tcp->tm, connecthints);
+    if (err) return err;
+    while (total < count) {
+        size_t sent = 0;
+        int ioerr = socket_send(&tcp->sock, data + total, count - total,
+            &sent, &tcp->tm);
+        total += sent;
+        tcp->buf.sent += sent;
+        if (ioerr != IO_DONE) return socket_strerror(ioerr);
+    }
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+    {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        int result;
+        /* the peer acknowledges data in the SYN with its SYN-ACK, so wait
+         * for the handshake, which a plain connect would have done anyway.
+         * this is also where a refused fast open connect shows up */
+        if (socket_waitconnect(&tcp->sock, 1, &result, SOCKET_INVALID,
+                &tcp->tm) == IO_DONE) {
+            if (result != IO_DONE) return socket_strerror(result);
+            if (getsockopt(tcp->sock, IPPROTO_TCP, TCP_INFO,
+                    (char *) &info, &len) == 0)
+                *insyn = (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+        }
+    }
+#endif
+    return NULL;
+}
+
 /*-------------------------------------------------------------------------*\
 * Turns a master tcp object into a client object.
 \*-------------------------------------------------------------------------*/
@@ -238,14 +553,24 @@ static int meth_connect(lua_State *L)
     p_tcp tcp = (p_tcp) auxiliar_checkgroup(L, "tcp{any}", 1);
     const char *address =  luaL_checkstring(L, 2);
     const char *port = luaL_checkstring(L, 3);
+    const char *data = NULL;
+    size_t count = 0;
+    int insyn = 0;
     struct addrinfo connecthints;
     const char *err;
+    if (!lua_isnoneornil(L, 4)) {
+        luaL_checktype(L, 4, LUA_TTABLE);
+        lua_getfield(L, 4, "data");
+        data = luaL_optlstring(L, -1, NULL, &count);
+    }
     memset(&connecthints, 0, sizeof(connecthints));
     connecthints.ai_socktype = SOCK_STREAM;
     /* make sure we try to connect only to the same family */
     connecthints.ai_family = tcp->family;
     timeout_markstart(&tcp->tm);
-    err = inet_tryconnect(&tcp->sock, address, port,
+    if (data) err = tryconnectdata(tcp, address, port, &connecthints,
+        data, count, &insyn);
+    else err = inet_tryconnect(&tcp->sock, address, port,
 		    &tcp->tm, &connecthints);
     /* have to set the class even if it failed due to non-blocking connects */
     auxiliar_setclass(L, "tcp{client}", 1);
@@ -255,7 +580,9 @@ static int meth_connect(lua_State *L)
         return 2;
     }
     lua_pushnumber(L, 1);
-    return 1;
+    if (!data) return 1;
+    lua_pushboolean(L, insyn);
+    return 2;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -357,7 +684,6 @@ static int tcp_create(lua_State *L, int family) {
         /* set its type as master object */
         auxiliar_setclass(L, "tcp{master}", -1);
         /* initialize remaining structure fields */
-        socket_setnonblocking(&sock);
         if (family == PF_INET6) {
             int yes = 1;
             setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
@@ -385,41 +711,70 @@ static int global_create6(lua_State *L) {
     return tcp_create(L, AF_INET6);
 }
 
+/*-------------------------------------------------------------------------*\
+* Delay between racing connection attempts. Negative disables racing
+\*-------------------------------------------------------------------------*/
+static double connectdelay = 0.25;
+
+static int global_setconnectdelay(lua_State *L) {
+    connectdelay = lua_toboolean(L, 1)? luaL_checknumber(L, 1): -1;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+static int sockfamily(p_socket ps) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(*ps, (SA *) &addr, &len) < 0) return PF_UNSPEC;
+    return addr.ss_family;
+}
+
 static const char *tryconnect6(const char *remoteaddr, const char *remoteserv,
     struct addrinfo *connecthints, p_tcp tcp) {
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
+    /* a socket created by the bind stage is the only one we may use */
+    int bound = tcp->sock != SOCKET_INVALID;
+    /* all attempts share a single deadline */
+    p_timeout tm = timeout_markstart(&tcp->tm);
+    /* race attempts, unless a socket was created by the bind stage */
+    if (!bound && connectdelay >= 0) {
+        err = inet_racingconnect(&tcp->sock, remoteaddr, remoteserv, tm,
+            connecthints, connectdelay);
+        if (!err) tcp->family = sockfamily(&tcp->sock);
+        return err;
+    }
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(remoteaddr, remoteserv,
-                connecthints, &resolved));
+    err = inet_tryresolve(remoteaddr, remoteserv, connecthints, &resolved, tm);
     if (err != NULL) {
-        if (resolved) freeaddrinfo(resolved);
+        if (resolved) inet_freeaddrinfo(resolved);
         return err;
     }
     /* iterate over all returned addresses trying to connect */
     for (iterator = resolved; iterator; iterator = iterator->ai_next) {
-        p_timeout tm = timeout_markstart(&tcp->tm);
-        /* create new socket if one wasn't created by the bind stage */
-        if (tcp->sock == SOCKET_INVALID) {
+        /* otherwise, each address gets a fresh socket of its own family */
+        if (!bound) {
+            socket_destroy(&tcp->sock);
             err = socket_strerror(socket_create(&tcp->sock,
                 iterator->ai_family, iterator->ai_socktype,
                 iterator->ai_protocol));
             if (err != NULL) {
-                freeaddrinfo(resolved);
+                inet_freeaddrinfo(resolved);
                 return err;
             }
-            /* all sockets initially non-blocking */
-            socket_setnonblocking(&tcp->sock);
         }
         /* finally try connecting to remote address */
         err = socket_strerror(socket_connect(&tcp->sock,
             (SA *) iterator->ai_addr,
             iterator->ai_addrlen, tm));
         /* if success, break out of loop */
-        if (err == NULL) break;
+        if (err == NULL) {
+            tcp->family = iterator->ai_family;
+            break;
+        }
     }
 
-    freeaddrinfo(resolved);
+    inet_freeaddrinfo(resolved);
     /* here, if err is set, we failed */
     return err;
 }
@@ -438,13 +793,15 @@ static int global_connect6(lua_State *L) {
     timeout_init(&tcp->tm, -1, -1);
     buffer_init(&tcp->buf, &tcp->io, &tcp->tm);
     tcp->sock = SOCKET_INVALID;
+    tcp->family = PF_UNSPEC;
     /* allow user to pick local address and port */
     memset(&bindhints, 0, sizeof(bindhints));
     bindhints.ai_socktype = SOCK_STREAM;
     bindhints.ai_family = PF_UNSPEC;
     bindhints.ai_flags = AI_PASSIVE;
     if (localaddr) {
-        err = inet_trybind(&tcp->sock, localaddr, localserv, &bindhints);
+        err = inet_trybind(&tcp->sock, localaddr, localserv, &bindhints,
+            timeout_markstart(&tcp->tm));
         if (err) {
             lua_pushnil(L);
             lua_pushstring(L, err);
@@ -466,3 +823,298 @@ static int global_connect6(lua_State *L) {
     auxiliar_setclass(L, "tcp{client}", -1);
     return 1;
 }
+
+/*-------------------------------------------------------------------------*\
+* Connects to many targets at once. The names of all targets go to the
+* worker threads up front, and each target starts connecting as soon as
+* its own lookup is done, so that a slow name holds up no other target.
+* The total time is bounded by the slowest lookup and connect rather
+* than by the sum of all
+\*-------------------------------------------------------------------------*/
+/* target states */
+enum {
+    TARGET_PENDING,             /* lookup waiting for room in the queue */
+    TARGET_RESOLVING,           /* lookup handed to the worker threads */
+    TARGET_CONNECTING,          /* connect started */
+    TARGET_DONE                 /* connected, or out of addresses */
+};
+
+typedef struct t_many_ t_many;
+
+typedef struct t_target_ {
+#ifndef _WIN32
+    t_job job;                  /* the lookup, must come first */
+    t_many *many;               /* the call the target belongs to */
+#endif
+    char *host, *port;          /* copies the worker threads can read */
+    int state;                  /* one of the values above */
+    int gaierr;                 /* getaddrinfo error code */
+    struct addrinfo *resolved;  /* addresses of the target */
+    struct addrinfo *next;      /* next address to try */
+    t_socket sock;
+    const char *err;            /* error of the last attempt */
+} t_target;
+
+struct t_many_ {
+#ifndef _WIN32
+    t_event event;              /* raised whenever a lookup finishes */
+    int refs;                   /* the call plus one per lookup */
+#endif
+    int count;
+    t_target *targets;
+};
+
+/* the call may return while lookups are still running. whoever lets go
+ * of the set last frees it */
+static void many_release(t_many *m) {
+    int i;
+#ifndef _WIN32
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    event_destroy(&m->event);
+#endif
+    for (i = 0; i < m->count; i++) {
+        inet_freeaddrinfo(m->targets[i].resolved);
+        free(m->targets[i].host);
+        free(m->targets[i].port);
+    }
+    free(m->targets);
+    free(m);
+}
+
+static int target_resolve(t_target *t, int flags) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_flags = flags;
+    return inet_getaddrinfo(t->host, t->port, &hints, &t->resolved);
+}
+
+static void target_start(t_target *t) {
+    t_timeout zero;
+    timeout_init(&zero, 0.0, -1);
+    while (t->next) {
+        struct addrinfo *ai = t->next;
+        int ret;
+        t->next = ai->ai_next;
+        socket_destroy(&t->sock);
+        ret = socket_create(&t->sock, ai->ai_family, ai->ai_socktype,
+            ai->ai_protocol);
+        if (ret != IO_DONE) {
+            t->err = socket_strerror(ret);
+            continue;
+        }
+        ret = socket_connect(&t->sock, (SA *) ai->ai_addr, ai->ai_addrlen,
+            &zero);
+        if (ret == IO_DONE || ret == IO_TIMEOUT) {
+            t->err = NULL;
+            t->state = ret == IO_DONE? TARGET_DONE: TARGET_CONNECTING;
+            return;
+        }
+        t->err = socket_strerror(ret);
+    }
+    socket_destroy(&t->sock);
+    t->state = TARGET_DONE;
+}
+
+/* starts connecting once the addresses are known */
+static void target_resolved(t_target *t) {
+    if (t->gaierr != 0) {
+        t->err = socket_gaistrerror(t->gaierr);
+        t->state = TARGET_DONE;
+    } else {
+        t->next = t->resolved;
+        target_start(t);
+    }
+}
+
+#ifndef _WIN32
+static void target_run(p_job job) {
+    t_target *t = (t_target *) job;
+    t->gaierr = target_resolve(t, 0);
+}
+
+static void target_free(p_job job) {
+    many_release(((t_target *) job)->many);
+}
+
+/* submits pending lookups until the queue is full. with nothing of ours
+ * left in it to wait for, a rejected lookup is made right here */
+static void many_fill(t_many *m, int *resolving) {
+    int i;
+    for (i = 0; i < m->count; i++) {
+        t_target *t = &m->targets[i];
+        if (t->state != TARGET_PENDING) continue;
+        if (async_submit(&t->job) == IO_DONE) {
+            t->state = TARGET_RESOLVING;
+            (*resolving)++;
+        } else if (*resolving > 0) {
+            break;
+        } else {
+            t->gaierr = target_resolve(t, 0);
+            target_resolved(t);
+        }
+    }
+}
+
+/* starts connecting the targets whose lookups are done */
+static void many_collect(t_many *m, int *resolving) {
+    int i;
+    for (i = 0; i < m->count; i++) {
+        t_target *t = &m->targets[i];
+        if (t->state != TARGET_RESOLVING || !async_isdone(&t->job)) continue;
+        (*resolving)--;
+        target_resolved(t);
+    }
+}
+#endif
+
+static int global_connectmany(lua_State *L) {
+    int i, n, ret, pending, resolving = 0;
+    t_many *m;
+    t_socket *socks, wake = SOCKET_INVALID;
+    int *result;
+    t_timeout tm;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = (int) lua_objlen(L, 1);
+    timeout_init(&tm, -1, luaL_optnumber(L, 2, -1));
+    timeout_markstart(&tm);
+    m = (t_many *) calloc(1, sizeof(t_many));
+    if (m) m->targets = (t_target *) calloc(n > 0? n: 1, sizeof(t_target));
+    socks = (t_socket *) malloc((n > 0? n: 1)*sizeof(t_socket));
+    result = (int *) malloc((n > 0? n: 1)*sizeof(int));
+    if (!m || !m->targets || !socks || !result) {
+        if (m) free(m->targets);
+        free(m); free(socks); free(result);
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    m->count = n;
+#ifndef _WIN32
+    if ((ret = event_init(&m->event)) != IO_DONE) {
+        free(m->targets); free(m); free(socks); free(result);
+        lua_pushnil(L);
+        lua_pushstring(L, socket_strerror(ret));
+        return 2;
+    }
+    m->refs = n+1;
+    wake = event_getfd(&m->event);
+#endif
+    /* addresses are resolved at once, names are left to the workers */
+    for (i = 0; i < n; i++) {
+        t_target *t = &m->targets[i];
+        const char *host = NULL, *port = NULL;
+        t->sock = SOCKET_INVALID;
+#ifndef _WIN32
+        async_init(&t->job, target_run, target_free, &m->event);
+        t->many = m;
+#endif
+        lua_rawgeti(L, 1, i+1);
+        if (lua_istable(L, -1)) {
+            lua_rawgeti(L, -1, 1);
+            lua_rawgeti(L, -2, 2);
+            host = lua_tostring(L, -2);
+            port = lua_tostring(L, -1);
+        }
+        if (host && port) {
+            t->host = strdup(host);
+            t->port = strdup(port);
+        }
+        lua_settop(L, 2);
+        if (!host || !port) {
+            t->err = "invalid target";
+            t->state = TARGET_DONE;
+        } else if (!t->host || !t->port) {
+            t->err = "out of memory";
+            t->state = TARGET_DONE;
+        } else {
+#ifndef _WIN32
+            if (!inet_isnumeric(t->host) || (t->gaierr = target_resolve(t,
+                    AI_NUMERICHOST)) == EAI_NONAME) {
+                t->gaierr = 0;
+                t->state = TARGET_PENDING;
+                continue;
+            }
+#else
+            t->gaierr = target_resolve(t, 0);
+#endif
+            target_resolved(t);
+        }
+    }
+#ifndef _WIN32
+    many_fill(m, &resolving);
+#endif
+    /* wait on the connects and the lookups together, moving on to the
+     * next address on failure */
+    for ( ;; ) {
+#ifndef _WIN32
+        /* clear, then check, so that no finished lookup goes unnoticed */
+        event_clear(&m->event);
+        many_collect(m, &resolving);
+        many_fill(m, &resolving);
+#endif
+        pending = 0;
+        for (i = 0; i < n; i++) {
+            t_target *t = &m->targets[i];
+            socks[i] = t->state == TARGET_CONNECTING? t->sock: SOCKET_INVALID;
+            if (t->state != TARGET_DONE) pending++;
+        }
+        if (pending == 0) break;
+        ret = socket_waitconnect(socks, n, result, resolving > 0? wake:
+            SOCKET_INVALID, &tm);
+        if (ret == IO_TIMEOUT) break;
+        for (i = 0; i < n; i++) {
+            t_target *t = &m->targets[i];
+            if (t->state == TARGET_DONE) continue;
+            if (ret != IO_DONE) {
+#ifndef _WIN32
+                if (t->state == TARGET_RESOLVING) async_cancel(&t->job);
+#endif
+                t->err = socket_strerror(ret);
+                socket_destroy(&t->sock);
+                t->state = TARGET_DONE;
+            } else if (t->state != TARGET_CONNECTING) {
+                continue;
+            } else if (result[i] == IO_DONE) {
+                t->state = TARGET_DONE;
+            } else if (result[i] != IO_TIMEOUT) {
+                t->err = socket_strerror(result[i]);
+                target_start(t);
+            }
+        }
+        if (ret != IO_DONE) break;
+    }
+    /* build the table of clients and the table of errors */
+    lua_newtable(L);
+    lua_newtable(L);
+    for (i = 0; i < n; i++) {
+        t_target *t = &m->targets[i];
+        if (t->state == TARGET_DONE && !t->err &&
+                t->sock != SOCKET_INVALID) {
+            p_tcp tcp = (p_tcp) lua_newuserdata(L, sizeof(t_tcp));
+            auxiliar_setclass(L, "tcp{client}", -1);
+            tcp->sock = t->sock;
+            tcp->family = sockfamily(&tcp->sock);
+            io_init(&tcp->io, (p_send) socket_send, (p_recv) socket_recv,
+                    (p_error) socket_ioerror, &tcp->sock);
+            timeout_init(&tcp->tm, -1, -1);
+            buffer_init(&tcp->buf, &tcp->io, &tcp->tm);
+            lua_rawseti(L, -3, i+1);
+        } else {
+            socket_destroy(&t->sock);
+            lua_pushstring(L, t->state == TARGET_DONE? t->err:
+                socket_strerror(IO_TIMEOUT));
+            lua_rawseti(L, -2, i+1);
+        }
+#ifndef _WIN32
+        /* lookups still running finish on their own, and then let go */
+        if (t->state == TARGET_RESOLVING) async_cancel(&t->job);
+        async_release(&t->job);
+#endif
+    }
+    many_release(m);
+    free(socks);
+    free(result);
+    return 2;
+}
@@ -37,6 +37,7 @@ static int meth_setsockname(lua_State *L);
 static int meth_setpeername(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_setoption(lua_State *L);
+static int meth_setoptions(lua_State *L);
 static int meth_getoption(lua_State *L);
 static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
@@ -59,6 +60,7 @@ static luaL_Reg udp_methods[] = {
     {"sendto",      meth_sendto},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
+    {"setoptions",  meth_setoptions},
     {"getoption",   meth_getoption},
     {"setpeername", meth_setpeername},
     {"setsockname", meth_setsockname},
@@ -78,6 +80,12 @@ static t_opt optset[] = {
     {"ip-add-membership",  opt_set_ip_add_membership},
     {"ip-drop-membership", opt_set_ip_drop_membersip},
     {"ipv6-v6only",        opt_set_ip6_v6only},
+    {"rcvbuf",             opt_set_rcvbuf},
+    {"sndbuf",             opt_set_sndbuf},
+    {"busy-poll",          opt_set_busy_poll},
+    {"priority",           opt_set_priority},
+    {"incoming-cpu",       opt_set_incoming_cpu},
+    {"ip-tos",             opt_set_ip_tos},
     {NULL,                 NULL}
 };
 
@@ -85,6 +93,13 @@ static t_opt optset[] = {
 static t_opt optget[] = {
     {"ip-multicast-if",    opt_get_ip_multicast_if},
     {"ip-multicast-loop",  opt_get_ip_multicast_loop},
+    {"reuseaddr",          opt_get_reuseaddr},
+    {"rcvbuf",             opt_get_rcvbuf},
+    {"sndbuf",             opt_get_sndbuf},
+    {"busy-poll",          opt_get_busy_poll},
+    {"priority",           opt_get_priority},
+    {"incoming-cpu",       opt_get_incoming_cpu},
+    {"ip-tos",             opt_get_ip_tos},
     {NULL,                 NULL}
 };
 
@@ -285,6 +300,11 @@ static int meth_setoption(lua_State *L) {
     return opt_meth_setoption(L, optset, &udp->sock);
 }
 
+static int meth_setoptions(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    return opt_meth_setoptions(L, optset, &udp->sock);
+}
+
 /*-------------------------------------------------------------------------*\
 * Just call option handler
 \*-------------------------------------------------------------------------*/
@@ -306,7 +326,7 @@ static int meth_settimeout(lua_State *L) {
 \*-------------------------------------------------------------------------*/
 static int meth_setpeername(lua_State *L) {
     p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
-    p_timeout tm = &udp->tm;
+    p_timeout tm = timeout_markstart(&udp->tm);
     const char *address =  luaL_checkstring(L, 2);
     int connecting = strcmp(address, "*");
     const char *port = connecting ?
@@ -355,7 +375,8 @@ static int meth_setsockname(lua_State *L) {
     bindhints.ai_socktype = SOCK_DGRAM;
     bindhints.ai_family = udp->family;
     bindhints.ai_flags = AI_PASSIVE;
-    err = inet_trybind(&udp->sock, address, port, &bindhints);
+    err = inet_trybind(&udp->sock, address, port, &bindhints,
+        timeout_markstart(&udp->tm));
     if (err) {
         lua_pushnil(L);
         lua_pushstring(L, err);
@@ -380,7 +401,6 @@ static int udp_create(lua_State *L, int family) {
         p_udp udp = (p_udp) lua_newuserdata(L, sizeof(t_udp));
         auxiliar_setclass(L, "udp{unconnected}", -1);
         /* initialize remaining structure fields */
-        socket_setnonblocking(&sock);
         if (family == PF_INET6) {
             int yes = 1;
             setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
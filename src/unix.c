@@ -23,9 +23,16 @@ static int meth_bind(lua_State *L);
 static int meth_send(lua_State *L);
 static int meth_shutdown(lua_State *L);
 static int meth_receive(lua_State *L);
+static int meth_receivechunk(lua_State *L);
+static int meth_receiveheaders(lua_State *L);
+static int meth_receiverequest(lua_State *L);
+static int meth_sendheaders(lua_State *L);
 static int meth_accept(lua_State *L);
+static int meth_alive(lua_State *L);
 static int meth_close(lua_State *L);
 static int meth_setoption(lua_State *L);
+static int meth_setoptions(lua_State *L);
+static int meth_getoption(lua_State *L);
 static int meth_settimeout(lua_State *L);
 static int meth_getfd(lua_State *L);
 static int meth_setfd(lua_State *L);
@@ -41,18 +48,25 @@ static luaL_Reg unix_methods[] = {
     {"__gc",        meth_close},
     {"__tostring",  auxiliar_tostring},
     {"accept",      meth_accept},
+    {"alive",       meth_alive},
     {"bind",        meth_bind},
     {"close",       meth_close},
     {"connect",     meth_connect},
     {"dirty",       meth_dirty},
     {"getfd",       meth_getfd},
+    {"getoption",   meth_getoption},
     {"getstats",    meth_getstats},
     {"setstats",    meth_setstats},
     {"listen",      meth_listen},
     {"receive",     meth_receive},
+    {"receivechunk", meth_receivechunk},
+    {"receiveheaders", meth_receiveheaders},
+    {"receiverequest", meth_receiverequest},
     {"send",        meth_send},
+    {"sendheaders", meth_sendheaders},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
+    {"setoptions",  meth_setoptions},
     {"setpeername", meth_connect},
     {"setsockname", meth_bind},
     {"settimeout",  meth_settimeout},
@@ -65,6 +79,19 @@ static t_opt optset[] = {
     {"keepalive",   opt_set_keepalive},
     {"reuseaddr",   opt_set_reuseaddr},
     {"linger",      opt_set_linger},
+    {"rcvbuf",      opt_set_rcvbuf},
+    {"sndbuf",      opt_set_sndbuf},
+    {"priority",    opt_set_priority},
+    {NULL,          NULL}
+};
+
+static t_opt optget[] = {
+    {"keepalive",   opt_get_keepalive},
+    {"reuseaddr",   opt_get_reuseaddr},
+    {"linger",      opt_get_linger},
+    {"rcvbuf",      opt_get_rcvbuf},
+    {"sndbuf",      opt_get_sndbuf},
+    {"priority",    opt_get_priority},
     {NULL,          NULL}
 };
 
@@ -113,6 +140,26 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &un->buf);
 }
 
+static int meth_receivechunk(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
+    return buffer_meth_receivechunk(L, &un->buf);
+}
+
+static int meth_receiveheaders(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
+    return buffer_meth_receiveheaders(L, &un->buf);
+}
+
+static int meth_receiverequest(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
+    return buffer_meth_receiverequest(L, &un->buf);
+}
+
+static int meth_sendheaders(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
+    return buffer_meth_sendheaders(L, &un->buf);
+}
+
 static int meth_getstats(lua_State *L) {
     p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
     return buffer_meth_getstats(L, &un->buf);
@@ -131,6 +178,16 @@ static int meth_setoption(lua_State *L) {
     return opt_meth_setoption(L, optset, &un->sock);
 }
 
+static int meth_setoptions(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkgroup(L, "unix{any}", 1);
+    return opt_meth_setoptions(L, optset, &un->sock);
+}
+
+static int meth_getoption(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkgroup(L, "unix{any}", 1);
+    return opt_meth_getoption(L, optget, &un->sock);
+}
+
 /*-------------------------------------------------------------------------*\
 * Select support methods
 \*-------------------------------------------------------------------------*/
@@ -153,6 +210,23 @@ static int meth_dirty(lua_State *L) {
     return 1;
 }
 
+/*-------------------------------------------------------------------------*\
+* Checks, without blocking, that an idle connection can still be used, so
+* that connection pools can keep unix sockets as they keep TCP ones
+\*-------------------------------------------------------------------------*/
+static int meth_alive(lua_State *L) {
+    p_unix un = (p_unix) auxiliar_checkclass(L, "unix{client}", 1);
+    int err = buffer_isempty(&un->buf)? socket_peek(&un->sock): IO_DONE;
+    if (err == IO_TIMEOUT) {
+        lua_pushnumber(L, 1);
+        return 1;
+    }
+    lua_pushnil(L);
+    if (err == IO_DONE) lua_pushstring(L, "unexpected data");
+    else lua_pushstring(L, socket_strerror(err));
+    return 2;
+}
+
 /*-------------------------------------------------------------------------*\
 * Waits for and returns a client object attempting connection to the 
 * server object 
@@ -167,7 +241,6 @@ static int meth_accept(lua_State *L) {
         p_unix clnt = (p_unix) lua_newuserdata(L, sizeof(t_unix));
         auxiliar_setclass(L, "unix{client}", -1);
         /* initialize structure fields */
-        socket_setnonblocking(&sock);
         clnt->sock = sock;
         io_init(&clnt->io, (p_send)socket_send, (p_recv)socket_recv, 
                 (p_error) socket_ioerror, &clnt->sock);
@@ -327,7 +400,6 @@ static int global_create(lua_State *L) {
         /* set its type as master object */
         auxiliar_setclass(L, "unix{master}", -1);
         /* initialize remaining structure fields */
-        socket_setnonblocking(&sock);
         un->sock = sock;
         io_init(&un->io, (p_send) socket_send, (p_recv) socket_recv, 
                 (p_error) socket_ioerror, &un->sock);
@@ -0,0 +1,626 @@
+/*=========================================================================*\
+* URL parsing, escaping and composition
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "url.h"
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_escape(lua_State *L);
+static int global_unescape(lua_State *L);
+static int global_parse(lua_State *L);
+static int global_build(lua_State *L);
+static int global_absolute(lua_State *L);
+static int global_parsepath(lua_State *L);
+static int global_buildpath(lua_State *L);
+static int global_parsequery(lua_State *L);
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"urlabsolute",   global_absolute},
+    {"urlbuild",      global_build},
+    {"urlbuildpath",  global_buildpath},
+    {"urlescape",     global_escape},
+    {"urlparse",      global_parse},
+    {"urlparsepath",  global_parsepath},
+    {"urlparsequery", global_parsequery},
+    {"urlunescape",   global_unescape},
+    {NULL,            NULL}
+};
+
+/* character classes */
+#define URL_ALNUM   1   /* letters and digits, as %w */
+#define URL_WORD    2   /* left alone by escape: letters, digits and _ */
+#define URL_SEGMENT 4   /* left alone in path segments */
+#define URL_SCHEME  8   /* letters, digits, +, - and . */
+#define URL_HEX     16  /* hexadecimal digits, as %x */
+
+static unsigned char cls[256];
+static const char hexdigits[] = "0123456789abcdef";
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int url_open(lua_State *L) {
+    const char *p;
+    int c;
+    for (c = 0; c < 256; c++) {
+        int alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9');
+        int hex = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+            (c >= 'A' && c <= 'F');
+        cls[c] = (unsigned char) ((alnum? URL_ALNUM | URL_WORD |
+            URL_SEGMENT | URL_SCHEME: 0) | (hex? URL_HEX: 0));
+    }
+    cls['_'] |= URL_WORD;
+    for (p = "-_.!~*'():@&=+$,"; *p; p++) cls[(unsigned char) *p] |= URL_SEGMENT;
+    for (p = "+-."; *p; p++) cls[(unsigned char) *p] |= URL_SCHEME;
+    luaL_openlib(L, NULL, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Escaping
+\*=========================================================================*/
+static int hexvalue(unsigned char c) {
+    if (c <= '9') return c - '0';
+    return (c | 0x20) - 'a' + 10;
+}
+
+/* appends one byte, escaped unless it is in the class keep */
+static void addbyte(luaL_Buffer *b, unsigned char c, int keep) {
+    if (cls[c] & keep) luaL_addchar(b, c);
+    else {
+        luaL_addchar(b, '%');
+        luaL_addchar(b, hexdigits[c >> 4]);
+        luaL_addchar(b, hexdigits[c & 15]);
+    }
+}
+
+static void addescaped(luaL_Buffer *b, const char *s, size_t len, int keep) {
+    size_t i = 0;
+    while (i < len) {
+        /* runs that need no escaping are copied at once */
+        size_t j = i;
+        while (j < len && (cls[(unsigned char) s[j]] & keep)) j++;
+        luaL_addlstring(b, s + i, j - i);
+        if (j < len) addbyte(b, (unsigned char) s[j], keep);
+        i = j + 1;
+    }
+}
+
+/* appends s with its %xx escapes decoded, and with + as space if plus is
+ * set. given a class, each byte is then escaped unless it is in the
+ * class, as parse_path followed by build_path does */
+static void addunescaped(luaL_Buffer *b, const char *s, size_t len,
+        int plus, int keep) {
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = (unsigned char) s[i];
+        if (c == '%' && len - i > 2 && (cls[(unsigned char) s[i+1]] & URL_HEX)
+                && (cls[(unsigned char) s[i+2]] & URL_HEX)) {
+            c = (unsigned char) (hexvalue((unsigned char) s[i+1])*16 +
+                hexvalue((unsigned char) s[i+2]));
+            i += 3;
+        } else {
+            if (plus && c == '+') c = ' ';
+            i++;
+        }
+        if (keep) addbyte(b, c, keep);
+        else luaL_addchar(b, c);
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Escapes every byte but letters, digits and _ as %xx
+\*-------------------------------------------------------------------------*/
+static int global_escape(lua_State *L) {
+    size_t len;
+    const char *s = luaL_checklstring(L, 1, &len);
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    addescaped(&b, s, len, URL_WORD);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Decodes %xx escapes. a % without two hex digits is left as it is
+\*-------------------------------------------------------------------------*/
+static int global_unescape(lua_State *L) {
+    size_t len;
+    const char *s = luaL_checklstring(L, 1, &len);
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    addunescaped(&b, s, len, 0, 0);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*=========================================================================*\
+* Parsing
+\*=========================================================================*/
+static void setfield(lua_State *L, const char *name, const char *s,
+        size_t len) {
+    lua_pushlstring(L, s, len);
+    lua_setfield(L, -2, name);
+}
+
+static const char *lastchar(const char *s, const char *e, char c) {
+    while (e > s) if (*--e == c) return e;
+    return NULL;
+}
+
+/* userinfo, host and port, into the table on top of the stack */
+static void parseauthority(lua_State *L, const char *a, const char *e) {
+    const char *p = memchr(a, '@', e - a);
+    const char *u = NULL, *ue = NULL;
+    if (p) {
+        u = a; ue = p;
+        setfield(L, "userinfo", u, ue - u);
+        a = p + 1;
+    }
+    /* the port follows the last colon, unless a bracket closes after it */
+    p = lastchar(a, e, ':');
+    if (p && !memchr(p + 1, ']', e - p - 1)) {
+        setfield(L, "port", p + 1, e - p - 1);
+        e = p;
+    }
+    if (a < e) {
+        if (e - a > 2 && *a == '[' && e[-1] == ']')
+            setfield(L, "host", a + 1, e - a - 2);
+        else setfield(L, "host", a, e - a);
+    }
+    if (!u) return;
+    p = lastchar(u, ue, ':');
+    if (p) {
+        setfield(L, "password", p + 1, ue - p - 1);
+        ue = p;
+    }
+    setfield(L, "user", u, ue - u);
+}
+
+/*-------------------------------------------------------------------------*\
+* Breaks an url into its parts, over a copy of the defaults
+* parsed = urlparse(url [, default])
+\*-------------------------------------------------------------------------*/
+static int global_parse(lua_State *L) {
+    size_t len;
+    const char *s, *e, *p, *a = NULL, *ae = NULL;
+    lua_settop(L, 2);
+    lua_newtable(L);
+    if (!lua_isnil(L, 2)) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_pushnil(L);
+        while (lua_next(L, 2)) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_settable(L, 3);
+        }
+    }
+    if (!lua_toboolean(L, 1)) len = 0, s = NULL;
+    else s = luaL_checklstring(L, 1, &len);
+    if (len == 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "invalid url");
+        return 2;
+    }
+    e = s + len;
+    p = memchr(s, '#', len);
+    if (p) {
+        setfield(L, "fragment", p + 1, e - p - 1);
+        e = p;
+    }
+    if (s < e && (cls[(unsigned char) *s] & URL_ALNUM)) {
+        p = s + 1;
+        while (p < e && (cls[(unsigned char) *p] & URL_SCHEME)) p++;
+        if (p < e && *p == ':') {
+            setfield(L, "scheme", s, p - s);
+            s = p + 1;
+        }
+    }
+    /* the authority runs up to the path, over any ; or ? on the way */
+    if (e - s >= 2 && s[0] == '/' && s[1] == '/') {
+        a = s + 2;
+        ae = memchr(a, '/', e - a);
+        if (!ae) ae = e;
+        setfield(L, "authority", a, ae - a);
+        s = ae;
+    }
+    p = memchr(s, '?', e - s);
+    if (p) {
+        setfield(L, "query", p + 1, e - p - 1);
+        e = p;
+    }
+    p = memchr(s, ';', e - s);
+    if (p) {
+        setfield(L, "params", p + 1, e - p - 1);
+        e = p;
+    }
+    if (s < e) setfield(L, "path", s, e - s);
+    if (a) parseauthority(L, a, ae);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Breaks a path into its unescaped segments
+* parsed = urlparsepath(path)
+\*-------------------------------------------------------------------------*/
+static int global_parsepath(lua_State *L) {
+    size_t len = 0, i = 0;
+    const char *s = lua_toboolean(L, 1)? luaL_checklstring(L, 1, &len): "";
+    int n = 0;
+    lua_newtable(L);
+    while (i < len) {
+        size_t j = i;
+        while (j < len && s[j] != '/') j++;
+        if (j > i) {
+            luaL_Buffer b;
+            luaL_buffinit(L, &b);
+            addunescaped(&b, s + i, j - i, 0, 0);
+            luaL_pushresult(&b);
+            lua_rawseti(L, -2, ++n);
+        }
+        i = j + 1;
+    }
+    if (len > 0 && s[0] == '/') {
+        lua_pushnumber(L, 1);
+        lua_setfield(L, -2, "is_absolute");
+    }
+    if (len > 0 && s[len-1] == '/') {
+        lua_pushnumber(L, 1);
+        lua_setfield(L, -2, "is_directory");
+    }
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Breaks a query string into a table of unescaped values by name. names
+* given more than once get an array of their values
+* fields = urlparsequery(query)
+\*-------------------------------------------------------------------------*/
+static void pushunescaped(lua_State *L, const char *s, size_t len) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    addunescaped(&b, s, len, 1, 0);
+    luaL_pushresult(&b);
+}
+
+static int global_parsequery(lua_State *L) {
+    size_t len, i = 0;
+    const char *s = luaL_optlstring(L, 1, "", &len);
+    lua_settop(L, 1);
+    lua_newtable(L);
+    while (i < len) {
+        const char *eq;
+        size_t j = i;
+        while (j < len && s[j] != '&') j++;
+        if (j > i) {
+            eq = memchr(s + i, '=', j - i);
+            if (eq) {
+                pushunescaped(L, s + i, eq - s - i);
+                pushunescaped(L, eq + 1, s + j - eq - 1);
+            } else {
+                pushunescaped(L, s + i, j - i);
+                lua_pushliteral(L, "");
+            }
+            lua_pushvalue(L, -2);
+            lua_rawget(L, 2);
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                lua_rawset(L, 2);
+            } else if (lua_istable(L, -1)) {
+                lua_insert(L, -2);
+                lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+                lua_pop(L, 2);
+            } else {
+                /* the second value turns the first into an array */
+                lua_createtable(L, 2, 0);
+                lua_insert(L, -2);
+                lua_rawseti(L, -2, 1);
+                lua_insert(L, -2);
+                lua_rawseti(L, -2, 2);
+                lua_rawset(L, 2);
+            }
+        }
+        i = j + 1;
+    }
+    return 1;
+}
+
+/*=========================================================================*\
+* Composition
+\*=========================================================================*/
+/* the string value of a field, or NULL if it is nil or false. the value
+ * is left on the stack, to keep the string alive */
+static const char *getfield(lua_State *L, int t, const char *name,
+        size_t *len) {
+    const char *s;
+    lua_getfield(L, t, name);
+    if (!lua_toboolean(L, -1)) return NULL;
+    s = lua_tolstring(L, -1, len);
+    if (!s) luaL_error(L, "invalid url field '%s' (a %s value)", name,
+        luaL_typename(L, -1));
+    return s;
+}
+
+/* a path normalized as build_path(parse_path(path)) does */
+static void addpath(luaL_Buffer *b, const char *s, size_t len) {
+    size_t i = 0;
+    int n = 0;
+    if (len > 0 && s[0] == '/') luaL_addchar(b, '/');
+    while (i < len) {
+        size_t j = i;
+        while (j < len && s[j] != '/') j++;
+        if (j > i) {
+            if (n++ > 0) luaL_addchar(b, '/');
+            addunescaped(b, s + i, j - i, 0, URL_SEGMENT);
+        }
+        i = j + 1;
+    }
+    if (n > 0 && s[len-1] == '/') luaL_addchar(b, '/');
+}
+
+/*-------------------------------------------------------------------------*\
+* Rebuilds an url from its parts, protecting the path segments
+* url = urlbuild(parsed)
+\*-------------------------------------------------------------------------*/
+static int global_build(lua_State *L) {
+    size_t len[11];
+    const char *scheme, *authority, *host, *port, *userinfo, *user;
+    const char *password, *path, *params, *query, *fragment;
+    luaL_Buffer b;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    scheme = getfield(L, 1, "scheme", &len[0]);
+    authority = getfield(L, 1, "authority", &len[1]);
+    host = getfield(L, 1, "host", &len[2]);
+    port = getfield(L, 1, "port", &len[3]);
+    userinfo = getfield(L, 1, "userinfo", &len[4]);
+    user = getfield(L, 1, "user", &len[5]);
+    password = getfield(L, 1, "password", &len[6]);
+    path = getfield(L, 1, "path", &len[7]);
+    params = getfield(L, 1, "params", &len[8]);
+    query = getfield(L, 1, "query", &len[9]);
+    fragment = getfield(L, 1, "fragment", &len[10]);
+    luaL_buffinit(L, &b);
+    if (scheme) {
+        luaL_addlstring(&b, scheme, len[0]);
+        luaL_addchar(&b, ':');
+    }
+    if (host) {
+        /* user and password take over from userinfo */
+        luaL_addstring(&b, "//");
+        if (user) {
+            luaL_addlstring(&b, user, len[5]);
+            if (password) {
+                luaL_addchar(&b, ':');
+                luaL_addlstring(&b, password, len[6]);
+            }
+            luaL_addchar(&b, '@');
+        } else if (userinfo) {
+            luaL_addlstring(&b, userinfo, len[4]);
+            luaL_addchar(&b, '@');
+        }
+        /* IPv6 addresses go in brackets */
+        if (memchr(host, ':', len[2])) {
+            luaL_addchar(&b, '[');
+            luaL_addlstring(&b, host, len[2]);
+            luaL_addchar(&b, ']');
+        } else luaL_addlstring(&b, host, len[2]);
+        if (port) {
+            luaL_addchar(&b, ':');
+            luaL_addlstring(&b, port, len[3]);
+        }
+    } else if (authority) {
+        luaL_addstring(&b, "//");
+        luaL_addlstring(&b, authority, len[1]);
+    }
+    if (path) addpath(&b, path, len[7]);
+    if (params) {
+        luaL_addchar(&b, ';');
+        luaL_addlstring(&b, params, len[8]);
+    }
+    if (query) {
+        luaL_addchar(&b, '?');
+        luaL_addlstring(&b, query, len[9]);
+    }
+    if (fragment) {
+        luaL_addchar(&b, '#');
+        luaL_addlstring(&b, fragment, len[10]);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Builds a path from its segments, protecting them unless told not to
+* path = urlbuildpath(parsed [, unsafe])
+\*-------------------------------------------------------------------------*/
+static int global_buildpath(lua_State *L) {
+    int i, n, unsafe = lua_toboolean(L, 2);
+    luaL_Buffer b;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    n = (int) lua_objlen(L, 1);
+    lua_getfield(L, 1, "is_absolute");
+    lua_getfield(L, 1, "is_directory");
+    luaL_buffinit(L, &b);
+    if (lua_toboolean(L, 2)) luaL_addchar(&b, '/');
+    for (i = 1; i <= n; i++) {
+        size_t len;
+        const char *s;
+        lua_rawgeti(L, 1, i);
+        s = lua_tolstring(L, -1, &len);
+        if (!s) luaL_error(L, "invalid path segment %d (a %s value)", i,
+            luaL_typename(L, -1));
+        if (i > 1) luaL_addchar(&b, '/');
+        if (unsafe) luaL_addvalue(&b);
+        else {
+            /* the segment stays on the stack while it is escaped */
+            lua_insert(L, 4);
+            addescaped(&b, s, len, URL_SEGMENT);
+            lua_remove(L, 4);
+        }
+    }
+    if (n > 0 && lua_toboolean(L, 3)) luaL_addchar(&b, '/');
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Resolves . and .. segments of a path joined to the directory of its
+* base, in place, returning the new length. The steps, and what they
+* leave alone, are those of the string patterns url.lua used to apply
+\*-------------------------------------------------------------------------*/
+static size_t copysegment(char *p, size_t w, size_t r, size_t n) {
+    if (w != r) memmove(p + w, p + r, n);
+    return w + n;
+}
+
+static size_t dotsegments(char *p, size_t n) {
+    size_t r, w;
+    int changed;
+    /* "./" segments go */
+    r = w = 0;
+    while (r < n) {
+        char *slash = memchr(p + r, '/', n - r);
+        size_t e;
+        if (!slash) {
+            w = copysegment(p, w, r, n - r);
+            break;
+        }
+        e = slash - p;
+        if (!(e - r == 1 && p[r] == '.')) w = copysegment(p, w, r, e - r + 1);
+        r = e + 1;
+    }
+    n = w;
+    /* so does a final "." after a slash */
+    if (n >= 2 && p[n-2] == '/' && p[n-1] == '.') n--;
+    /* each segment followed by "/../" goes along with it, unless it is
+     * ".." itself, until there is none left */
+    do {
+        changed = 0;
+        r = w = 0;
+        while (r < n) {
+            char *slash = memchr(p + r, '/', n - r);
+            size_t e;
+            if (!slash) {
+                w = copysegment(p, w, r, n - r);
+                break;
+            }
+            e = slash - p;
+            if (n - e >= 4 && p[e+1] == '.' && p[e+2] == '.' && p[e+3] == '/') {
+                if (e - r == 2 && p[r] == '.' && p[r+1] == '.')
+                    w = copysegment(p, w, r, e - r + 4);
+                else changed = 1;
+                r = e + 4;
+            } else {
+                w = copysegment(p, w, r, e - r + 1);
+                r = e + 1;
+            }
+        }
+        n = w;
+    } while (changed);
+    /* and a final "/.." takes the segment before it */
+    if (n >= 3 && p[n-3] == '/' && p[n-2] == '.' && p[n-1] == '.') {
+        size_t k = n - 3, j = k;
+        while (j > 0 && p[j-1] != '/') j--;
+        if (!(k - j == 2 && p[j] == '.' && p[j+1] == '.')) n = j;
+    }
+    return n;
+}
+
+/* pushes the path relative resolves to, from the base path */
+static void pushabsolutepath(lua_State *L, const char *base, size_t blen,
+        const char *rel, size_t rlen) {
+    char *p;
+    size_t n;
+    if (rlen > 0 && rel[0] == '/') {
+        lua_pushlstring(L, rel, rlen);
+        return;
+    }
+    /* the base loses its last segment */
+    while (blen > 0 && base[blen-1] != '/') blen--;
+    p = (char *) lua_newuserdata(L, blen + rlen + 1);
+    memcpy(p, base, blen);
+    memcpy(p + blen, rel, rlen);
+    n = dotsegments(p, blen + rlen);
+    lua_pushlstring(L, p, n);
+    lua_remove(L, -2);
+}
+
+/* copies a field from the table at index from to the one at index to */
+static void copyfield(lua_State *L, int from, int to, const char *name) {
+    lua_getfield(L, from, name);
+    lua_setfield(L, to, name);
+}
+
+static int isnilfield(lua_State *L, int t, const char *name) {
+    int isnil;
+    lua_getfield(L, t, name);
+    isnil = !lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return isnil;
+}
+
+/*-------------------------------------------------------------------------*\
+* Builds an absolute url from a base url, or its parts, and a relative url
+* url = urlabsolute(base, relative)
+\*-------------------------------------------------------------------------*/
+static int global_absolute(lua_State *L) {
+    lua_settop(L, 2);
+    /* 3: the parts of the base, 4: the base as a string */
+    if (lua_istable(L, 1)) {
+        lua_pushvalue(L, 1);
+        lua_pushcfunction(L, global_build);
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+    } else {
+        lua_pushcfunction(L, global_parse);
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+        lua_pushvalue(L, 1);
+    }
+    /* 5: the parts of the relative url */
+    lua_pushcfunction(L, global_parse);
+    lua_pushvalue(L, 2);
+    lua_call(L, 1, 1);
+    if (lua_isnil(L, 3) || (!lua_isnil(L, 5) && !isnilfield(L, 5, "scheme"))) {
+        lua_pushvalue(L, 2);
+        return 1;
+    }
+    if (lua_isnil(L, 5)) {
+        lua_pushvalue(L, 4);
+        return 1;
+    }
+    copyfield(L, 3, 5, "scheme");
+    if (isnilfield(L, 5, "authority")) {
+        copyfield(L, 3, 5, "authority");
+        if (isnilfield(L, 5, "path")) {
+            copyfield(L, 3, 5, "path");
+            if (isnilfield(L, 5, "params")) {
+                copyfield(L, 3, 5, "params");
+                if (isnilfield(L, 5, "query")) copyfield(L, 3, 5, "query");
+            }
+        } else {
+            size_t blen = 0, rlen;
+            const char *base = getfield(L, 3, "path", &blen);
+            const char *rel = getfield(L, 5, "path", &rlen);
+            if (!base) base = "", blen = 0;
+            pushabsolutepath(L, base, blen, rel, rlen);
+            lua_setfield(L, 5, "path");
+            lua_pop(L, 2);
+        }
+    }
+    lua_pushcfunction(L, global_build);
+    lua_pushvalue(L, 5);
+    lua_call(L, 1, 1);
+    return 1;
+}
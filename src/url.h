@@ -0,0 +1,17 @@
+#ifndef URL_H
+#define URL_H
+/*=========================================================================*\
+* URL parsing, escaping and composition
+* LuaSocket toolkit
+*
+* The functions here do the work of url.lua, which only gives them their
+* public names. They replace a series of string patterns each, and return
+* exactly what those patterns did, down to their quirks, so that code
+* written against the Lua module sees no difference. Character classes
+* come from a table, and each string is walked once.
+\*=========================================================================*/
+#include "lua.h"
+
+int url_open(lua_State *L);
+
+#endif /* URL_H */
@@ -7,9 +7,7 @@
 -----------------------------------------------------------------------------
 -- Declare module
 -----------------------------------------------------------------------------
-local string = require("string")
-local base = _G
-local table = require("table")
+local core = require("socket.core")
 module("socket.url")
 
 -----------------------------------------------------------------------------
@@ -24,83 +22,16 @@ _VERSION = "URL 1.0.2"
 -- Returns
 --   escaped representation of string binary
 -----------------------------------------------------------------------------
-function escape(s)
-    return (string.gsub(s, "([^A-Za-z0-9_])", function(c)
-        return string.format("%%%02x", string.byte(c))
-    end))
-end
+escape = core.urlescape
 
 -----------------------------------------------------------------------------
--- Protects a path segment, to prevent it from interfering with the
--- url parsing.
+-- Decodes a string from its escaped hexadecimal representation
 -- Input
---   s: binary string to be encoded
--- Returns
---   escaped representation of string binary
------------------------------------------------------------------------------
-local function make_set(t)
-    local s = {}
-    for i,v in base.ipairs(t) do
-        s[t[i]] = 1
-    end
-    return s
-end
-
--- these are allowed withing a path segment, along with alphanum
--- other characters must be escaped
-local segment_set = make_set {
-    "-", "_", ".", "!", "~", "*", "'", "(",
-    ")", ":", "@", "&", "=", "+", "$", ",",
-}
-
-local function protect_segment(s)
-    return string.gsub(s, "([^A-Za-z0-9_])", function (c)
-        if segment_set[c] then return c
-        else return string.format("%%%02x", string.byte(c)) end
-    end)
-end
-
------------------------------------------------------------------------------
--- Encodes a string into its escaped hexadecimal representation
--- Input
---   s: binary string to be encoded
+--   s: escaped string to be decoded
 -- Returns
---   escaped representation of string binary
------------------------------------------------------------------------------
-function unescape(s)
-    return (string.gsub(s, "%%(%x%x)", function(hex)
-        return string.char(base.tonumber(hex, 16))
-    end))
-end
-
------------------------------------------------------------------------------
--- Builds a path from a base path and a relative path
--- Input
---   base_path
---   relative_path
--- Returns
---   corresponding absolute path
+--   decoded binary string
 -----------------------------------------------------------------------------
-local function absolute_path(base_path, relative_path)
-    if string.sub(relative_path, 1, 1) == "/" then return relative_path end
-    local path = string.gsub(base_path, "[^/]*$", "")
-    path = path .. relative_path
-    path = string.gsub(path, "([^/]*%./)", function (s)
-        if s ~= "./" then return s else return "" end
-    end)
-    path = string.gsub(path, "/%.$", "/")
-    local reduced
-    while reduced ~= path do
-        reduced = path
-        path = string.gsub(reduced, "([^/]*/%.%./)", function (s)
-            if s ~= "../../" then return "" else return s end
-        end)
-    end
-    path = string.gsub(reduced, "([^/]*/%.%.)$", function (s)
-        if s ~= "../.." then return "" else return s end
-    end)
-    return path
-end
+unescape = core.urlunescape
 
 -----------------------------------------------------------------------------
 -- Parses a url and returns a table with all its parts according to RFC 2396
@@ -120,56 +51,7 @@ end
 -- Obs:
 --   the leading '/' in {/<path>} is considered part of <path>
 -----------------------------------------------------------------------------
-function parse(url, default)
-    -- initialize default parameters
-    local parsed = {}
-    for i,v in base.pairs(default or parsed) do parsed[i] = v end
-    -- empty url is parsed to nil
-    if not url or url == "" then return nil, "invalid url" end
-    -- remove whitespace
-    -- url = string.gsub(url, "%s", "")
-    -- get fragment
-    url = string.gsub(url, "#(.*)$", function(f)
-        parsed.fragment = f
-        return ""
-    end)
-    -- get scheme
-    url = string.gsub(url, "^([%w][%w%+%-%.]*)%:",
-        function(s) parsed.scheme = s; return "" end)
-    -- get authority
-    url = string.gsub(url, "^//([^/]*)", function(n)
-        parsed.authority = n
-        return ""
-    end)
-    -- get query string
-    url = string.gsub(url, "%?(.*)", function(q)
-        parsed.query = q
-        return ""
-    end)
-    -- get params
-    url = string.gsub(url, "%;(.*)", function(p)
-        parsed.params = p
-        return ""
-    end)
-    -- path is whatever was left
-    if url ~= "" then parsed.path = url end
-    local authority = parsed.authority
-    if not authority then return parsed end
-    authority = string.gsub(authority,"^([^@]*)@",
-        function(u) parsed.userinfo = u; return "" end)
-    authority = string.gsub(authority, ":([^:%]]*)$",
-        function(p) parsed.port = p; return "" end)
-    if authority ~= "" then 
-        -- IPv6?
-        parsed.host = string.match(authority, "^%[(.+)%]$") or authority 
-    end
-    local userinfo = parsed.userinfo
-    if not userinfo then return parsed end
-    userinfo = string.gsub(userinfo, ":([^:]*)$",
-        function(p) parsed.password = p; return "" end)
-    parsed.user = userinfo
-    return parsed
-end
+parse = core.urlparse
 
 -----------------------------------------------------------------------------
 -- Rebuilds a parsed URL from its components.
@@ -179,33 +61,7 @@ end
 -- Returns
 --   a stringing with the corresponding URL
 -----------------------------------------------------------------------------
-function build(parsed)
-    local ppath = parse_path(parsed.path or "")
-    local url = build_path(ppath)
-    if parsed.params then url = url .. ";" .. parsed.params end
-    if parsed.query then url = url .. "?" .. parsed.query end
-    local authority = parsed.authority
-    if parsed.host then
-        authority = parsed.host
-        if string.find(authority, ":") then -- IPv6?
-            authority = "[" .. authority .. "]"
-        end
-        if parsed.port then authority = authority .. ":" .. parsed.port end
-        local userinfo = parsed.userinfo
-        if parsed.user then
-            userinfo = parsed.user
-            if parsed.password then
-                userinfo = userinfo .. ":" .. parsed.password
-            end
-        end
-        if userinfo then authority = userinfo .. "@" .. authority end
-    end
-    if authority then url = "//" .. authority .. url end
-    if parsed.scheme then url = parsed.scheme .. ":" .. url end
-    if parsed.fragment then url = url .. "#" .. parsed.fragment end
-    -- url = string.gsub(url, "%s", "")
-    return url
-end
+build = core.urlbuild
 
 -----------------------------------------------------------------------------
 -- Builds a absolute URL from a base and a relative URL according to RFC 2396
@@ -215,37 +71,7 @@ end
 -- Returns
 --   corresponding absolute url
 -----------------------------------------------------------------------------
-function absolute(base_url, relative_url)
-    if base.type(base_url) == "table" then
-        base_parsed = base_url
-        base_url = build(base_parsed)
-    else
-        base_parsed = parse(base_url)
-    end
-    local relative_parsed = parse(relative_url)
-    if not base_parsed then return relative_url
-    elseif not relative_parsed then return base_url
-    elseif relative_parsed.scheme then return relative_url
-    else
-        relative_parsed.scheme = base_parsed.scheme
-        if not relative_parsed.authority then
-            relative_parsed.authority = base_parsed.authority
-            if not relative_parsed.path then
-                relative_parsed.path = base_parsed.path
-                if not relative_parsed.params then
-                    relative_parsed.params = base_parsed.params
-                    if not relative_parsed.query then
-                        relative_parsed.query = base_parsed.query
-                    end
-                end
-            else    
-                relative_parsed.path = absolute_path(base_parsed.path or "",
-                    relative_parsed.path)
-            end
-        end
-        return build(relative_parsed)
-    end
-end
+absolute = core.urlabsolute
 
 -----------------------------------------------------------------------------
 -- Breaks a path into its segments, unescaping the segments
@@ -254,18 +80,7 @@ end
 -- Returns
 --   segment: a table with one entry per segment
 -----------------------------------------------------------------------------
-function parse_path(path)
-    local parsed = {}
-    path = path or ""
-    --path = string.gsub(path, "%s", "")
-    string.gsub(path, "([^/]+)", function (s) table.insert(parsed, s) end)
-    for i = 1, table.getn(parsed) do
-        parsed[i] = unescape(parsed[i])
-    end
-    if string.sub(path, 1, 1) == "/" then parsed.is_absolute = 1 end
-    if string.sub(path, -1, -1) == "/" then parsed.is_directory = 1 end
-    return parsed
-end
+parse_path = core.urlparsepath
 
 -----------------------------------------------------------------------------
 -- Builds a path component from its segments, escaping protected characters.
@@ -275,28 +90,15 @@ end
 -- Returns
 --   path: corresponding path stringing
 -----------------------------------------------------------------------------
-function build_path(parsed, unsafe)
-    local path = ""
-    local n = table.getn(parsed)
-    if unsafe then
-        for i = 1, n-1 do
-            path = path .. parsed[i]
-            path = path .. "/"
-        end
-        if n > 0 then
-            path = path .. parsed[n]
-            if parsed.is_directory then path = path .. "/" end
-        end
-    else
-        for i = 1, n-1 do
-            path = path .. protect_segment(parsed[i])
-            path = path .. "/"
-        end
-        if n > 0 then
-            path = path .. protect_segment(parsed[n])
-            if parsed.is_directory then path = path .. "/" end
-        end
-    end
-    if parsed.is_absolute then path = "/" .. path end
-    return path
-end
+build_path = core.urlbuildpath
+
+-----------------------------------------------------------------------------
+-- Breaks a query string into its fields, unescaping names and values
+-- Input
+--   query: query string, as in the query field returned by parse
+-- Returns
+--   table with the value of each field by name. + stands for a space.
+--   fields given more than once get an array of their values, in order.
+--   fields without a value get the empty string
+-----------------------------------------------------------------------------
+parse_query = core.urlparsequery
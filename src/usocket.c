@@ -6,7 +6,12 @@
 * The penalty of calling select to avoid busy-wait is only paid when
 * the I/O call fail in the first place. 
 \*=========================================================================*/
+#ifdef __linux__
+/* for accept4 */
+#define _GNU_SOURCE
+#endif
 #include <string.h> 
+#include <stdlib.h>
 #include <signal.h>
 
 #include "socket.h"
@@ -116,17 +121,21 @@ int socket_select(t_socket n, fd_set *rfds, fd_set *wfds, fd_set *efds,
 }
 
 /*-------------------------------------------------------------------------*\
-* Creates and sets up a socket
+* Creates and sets up a non-blocking socket
 \*-------------------------------------------------------------------------*/
 int socket_create(p_socket ps, int domain, int type, int protocol) {
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+    /* saves the fcntl calls where the system can do it all at once */
+    *ps = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if (*ps == SOCKET_INVALID) return errno;
+#else
     *ps = socket(domain, type, protocol);
-    if (*ps != SOCKET_INVALID) {
-        /*  We don't want to share the file descriptor with any children we fork. */
-        fcntl(*ps, F_SETFD, FD_CLOEXEC);
-        return IO_DONE;
-    } else {
-        return errno;
-    }
+    if (*ps == SOCKET_INVALID) return errno;
+    /*  We don't want to share the file descriptor with any children we fork. */
+    fcntl(*ps, F_SETFD, FD_CLOEXEC);
+    socket_setnonblocking(ps);
+#endif
+    return IO_DONE;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -183,7 +192,83 @@ int socket_connect(p_socket ps, SA *addr, socklen_t len, p_timeout tm) {
 }
 
 /*-------------------------------------------------------------------------*\
-* Accept with timeout
+* Waits until at least one of n connecting sockets has a result, which is
+* stored in the corresponding entry of the result array. Invalid sockets
+* are skipped. Entries of sockets still connecting are set to IO_TIMEOUT.
+* The wait also ends, with IO_DONE, once wake is readable, unless it is
+* SOCKET_INVALID
+\*-------------------------------------------------------------------------*/
+static int socket_connresult(p_socket ps) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(*ps, SOL_SOCKET, SO_ERROR, (char *) &err, &len) < 0)
+        return errno;
+    return err? err: IO_DONE;
+}
+
+#ifndef SOCKET_SELECT
+int socket_waitconnect(p_socket ps, int n, int *result, t_socket wake,
+        p_timeout tm) {
+    struct pollfd stack[17], *pfd = stack;
+    int i, ret = 0, err;
+    if (n > 16 && !(pfd = (struct pollfd *) malloc((n+1)*sizeof(*pfd))))
+        return ENOMEM;
+    for (i = 0; i < n; i++) {
+        /* poll ignores negative descriptors */
+        pfd[i].fd = ps[i];
+        pfd[i].events = POLLOUT;
+        pfd[i].revents = 0;
+        result[i] = IO_TIMEOUT;
+    }
+    pfd[n].fd = wake;
+    pfd[n].events = POLLIN;
+    pfd[n].revents = 0;
+    if (!timeout_iszero(tm)) {
+        do {
+            int t = (int)(timeout_getretry(tm)*1e3);
+            ret = poll(pfd, n+1, t >= 0? t: -1);
+        } while (ret == -1 && errno == EINTR);
+    }
+    err = ret == -1? errno: ret == 0? IO_TIMEOUT: IO_DONE;
+    for (i = 0; ret > 0 && i < n; i++)
+        if (pfd[i].revents) result[i] = socket_connresult(&ps[i]);
+    if (pfd != stack) free(pfd);
+    return err;
+}
+#else
+int socket_waitconnect(p_socket ps, int n, int *result, t_socket wake,
+        p_timeout tm) {
+    fd_set rfds, wfds;
+    t_socket max = 0;
+    int i, ret = 0;
+    for (i = 0; i < n; i++) {
+        result[i] = IO_TIMEOUT;
+        if (ps[i] >= FD_SETSIZE) return EINVAL;
+        if (ps[i] != SOCKET_INVALID && ps[i] >= max) max = ps[i]+1;
+    }
+    if (wake >= FD_SETSIZE) return EINVAL;
+    if (wake != SOCKET_INVALID && wake >= max) max = wake+1;
+    if (timeout_iszero(tm)) return IO_TIMEOUT;
+    do {
+        /* must set bits within loop, because select may have modifed them */
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        if (wake != SOCKET_INVALID) FD_SET(wake, &rfds);
+        for (i = 0; i < n; i++)
+            if (ps[i] != SOCKET_INVALID) FD_SET(ps[i], &wfds);
+        ret = socket_select(max, &rfds, &wfds, NULL, tm);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) return errno;
+    if (ret == 0) return IO_TIMEOUT;
+    for (i = 0; i < n; i++)
+        if (ps[i] != SOCKET_INVALID && FD_ISSET(ps[i], &wfds))
+            result[i] = socket_connresult(&ps[i]);
+    return IO_DONE;
+}
+#endif
+
+/*-------------------------------------------------------------------------*\
+* Accept with timeout. The new socket is non-blocking
 \*-------------------------------------------------------------------------*/
 int socket_accept(p_socket ps, p_socket pa, SA *addr, socklen_t *len, p_timeout tm) {
     SA daddr;
@@ -193,7 +278,16 @@ int socket_accept(p_socket ps, p_socket pa, SA *addr, socklen_t *len, p_timeout
     if (!len) len = &dlen;
     for ( ;; ) {
         int err;
-        if ((*pa = accept(*ps, addr, len)) != SOCKET_INVALID) return IO_DONE;
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+        *pa = accept4(*ps, addr, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (*pa != SOCKET_INVALID) return IO_DONE;
+#else
+        if ((*pa = accept(*ps, addr, len)) != SOCKET_INVALID) {
+            fcntl(*pa, F_SETFD, FD_CLOEXEC);
+            socket_setnonblocking(pa);
+            return IO_DONE;
+        }
+#endif
         err = errno;
         if (err == EINTR) continue;
         if (err != EAGAIN && err != ECONNABORTED) return err;
@@ -226,8 +320,9 @@ int socket_send(p_socket ps, const char *data, size_t count,
         if (err == EPIPE) return IO_CLOSED;
         /* we call was interrupted, just try again */
         if (err == EINTR) continue;
-        /* if failed fatal reason, report error */
-        if (err != EAGAIN) return err;
+        /* a fast open connect still in its handshake looks like a full
+         * buffer: the socket becomes writable once it is established */
+        if (err != EAGAIN && err != EINPROGRESS) return err;
         /* wait until we can send something or we timeout */
         if ((err = socket_waitfd(ps, WAITFD_W, tm)) != IO_DONE) return err;
     }
@@ -281,6 +376,28 @@ int socket_recv(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm
     return IO_UNKNOWN;
 }
 
+/*-------------------------------------------------------------------------*\
+* Checks, without blocking, whether data or end of file is waiting to be
+* read. Returns IO_TIMEOUT if there is nothing to read yet
+\*-------------------------------------------------------------------------*/
+#ifdef MSG_DONTWAIT
+#define PEEK_FLAGS (MSG_PEEK|MSG_DONTWAIT)
+#else
+#define PEEK_FLAGS MSG_PEEK
+#endif
+int socket_peek(p_socket ps) {
+    char c;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    for ( ;; ) {
+        long taken = (long) recv(*ps, &c, 1, PEEK_FLAGS);
+        if (taken > 0) return IO_DONE;
+        if (taken == 0) return IO_CLOSED;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN) return IO_TIMEOUT;
+        return errno;
+    }
+}
+
 /*-------------------------------------------------------------------------*\
 * Recvfrom with timeout
 \*-------------------------------------------------------------------------*/
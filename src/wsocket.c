@@ -109,8 +109,9 @@ void socket_shutdown(p_socket ps, int how) {
 \*-------------------------------------------------------------------------*/
 int socket_create(p_socket ps, int domain, int type, int protocol) {
     *ps = socket(domain, type, protocol);
-    if (*ps != SOCKET_INVALID) return IO_DONE;
-    else return WSAGetLastError();
+    if (*ps == SOCKET_INVALID) return WSAGetLastError();
+    socket_setnonblocking(ps);
+    return IO_DONE;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -142,6 +143,45 @@ int socket_connect(p_socket ps, SA *addr, socklen_t len, p_timeout tm) {
 
 }
 
+/*-------------------------------------------------------------------------*\
+* Waits until at least one of n connecting sockets has a result, which is
+* stored in the corresponding entry of the result array. Invalid sockets
+* are skipped. Entries of sockets still connecting are set to IO_TIMEOUT.
+* The wait also ends, with IO_DONE, once wake is readable, unless it is
+* SOCKET_INVALID
+\*-------------------------------------------------------------------------*/
+int socket_waitconnect(p_socket ps, int n, int *result, t_socket wake,
+        p_timeout tm) {
+    fd_set rfds, wfds, efds;
+    int i, ret;
+    for (i = 0; i < n; i++) result[i] = IO_TIMEOUT;
+    if (n >= FD_SETSIZE) return WSAEINVAL;
+    if (timeout_iszero(tm)) return IO_TIMEOUT;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+    if (wake != SOCKET_INVALID) FD_SET(wake, &rfds);
+    for (i = 0; i < n; i++) {
+        if (ps[i] == SOCKET_INVALID) continue;
+        FD_SET(ps[i], &wfds);
+        FD_SET(ps[i], &efds);
+    }
+    ret = socket_select(1, &rfds, &wfds, &efds, tm);
+    if (ret == -1) return WSAGetLastError();
+    if (ret == 0) return IO_TIMEOUT;
+    for (i = 0; i < n; i++) {
+        if (ps[i] == SOCKET_INVALID) continue;
+        if (FD_ISSET(ps[i], &efds)) {
+            int err = 0, len = sizeof(err);
+            /* give windows time to set the error (yes, disgusting) */
+            Sleep(10);
+            getsockopt(ps[i], SOL_SOCKET, SO_ERROR, (char *)&err, &len);
+            result[i] = err > 0? err: IO_UNKNOWN;
+        } else if (FD_ISSET(ps[i], &wfds)) result[i] = IO_DONE;
+    }
+    return IO_DONE;
+}
+
 /*-------------------------------------------------------------------------*\
 * Binds or returns error message
 \*-------------------------------------------------------------------------*/
@@ -177,7 +217,10 @@ int socket_accept(p_socket ps, p_socket pa, SA *addr, socklen_t *len,
     for ( ;; ) {
         int err;
         /* try to get client socket */
-        if ((*pa = accept(*ps, addr, len)) != SOCKET_INVALID) return IO_DONE;
+        if ((*pa = accept(*ps, addr, len)) != SOCKET_INVALID) {
+            socket_setnonblocking(pa);
+            return IO_DONE;
+        }
         /* find out why we failed */
         err = WSAGetLastError(); 
         /* if we failed because there was no connectoin, keep trying */
@@ -265,6 +308,22 @@ int socket_recv(p_socket ps, char *data, size_t count, size_t *got, p_timeout tm
     return IO_UNKNOWN;
 }
 
+/*-------------------------------------------------------------------------*\
+* Checks, without blocking, whether data or end of file is waiting to be
+* read. Returns IO_TIMEOUT if there is nothing to read yet
+\*-------------------------------------------------------------------------*/
+int socket_peek(p_socket ps) {
+    char c;
+    int taken, err;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    taken = recv(*ps, &c, 1, MSG_PEEK);
+    if (taken > 0) return IO_DONE;
+    if (taken == 0) return IO_CLOSED;
+    err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK) return IO_TIMEOUT;
+    return err;
+}
+
 /*-------------------------------------------------------------------------*\
 * Recvfrom with timeout
 \*-------------------------------------------------------------------------*/
@@ -0,0 +1,166 @@
+local socket = require("socket")
+dofile("testsupport.lua")
+
+-- results match the blocking versions
+local job = assert(socket.dns.toip_async("localhost"))
+local ip, resolved = job:result()
+assert(ip == "127.0.0.1", ip)
+assert(resolved.ip[1] == "127.0.0.1" and resolved.alias and resolved.name)
+job:close()
+assert(select(2, job:result()) == "closed")
+
+job = assert(socket.dns.tohostname_async("127.0.0.1"))
+assert(job:result() == socket.dns.tohostname("127.0.0.1"))
+
+job = assert(socket.dns.getaddrinfo_async("127.0.0.1"))
+local addrs = assert(job:result())
+assert(addrs[1].family == "inet" and addrs[1].addr == "127.0.0.1")
+
+job = assert(socket.dns.getnameinfo_async(nil, "80"))
+assert(select(2, job:result()) == select(2, socket.dns.getnameinfo(nil, "80")))
+print("results: ok")
+
+-- errors come back from result
+job = assert(socket.dns.getaddrinfo_async("no.such.host.invalid"))
+local r, err = job:result()
+assert(not r and type(err) == "string")
+print("errors: ok")
+
+-- jobs take part in select
+local jobs = {}
+for i = 1, 8 do jobs[i] = assert(socket.dns.toip_async("localhost")) end
+local pending = 8
+while pending > 0 do
+    local ready = assert(socket.select(jobs, nil, 5))
+    assert(#ready > 0)
+    for _, j in ipairs(ready) do
+        assert(j:dirty())
+        assert(j:result() == "127.0.0.1")
+        for i, k in ipairs(jobs) do
+            if k == j then table.remove(jobs, i) end
+        end
+        pending = pending - 1
+    end
+end
+print("select: ok")
+
+-- a full queue rejects jobs instead of growing
+local before = socket.async.stats()
+assert(socket.async.setlimits(1, 1))
+local rejected = 0
+for i = 1, 50 do
+    local j, err = socket.dns.toip_async("localhost")
+    if not j then
+        assert(err == "queue full")
+        rejected = rejected + 1
+    else
+        jobs[#jobs+1] = j
+    end
+end
+local after = socket.async.stats()
+assert(after.rejected - before.rejected == rejected)
+assert(after.maxdepth <= math.max(before.maxdepth, 1))
+assert(socket.async.setlimits(4, 256))
+for _, j in ipairs(jobs) do j:settimeout(5); assert(j:result()) end
+print("bounded queue: ok")
+
+-- batches deliver one result per host, in completion order
+local hosts = {"localhost", "127.0.0.1", "no.such.host.invalid"}
+for i = 2, 21 do hosts[#hosts+1] = "127.0.0." .. i end
+local batch = assert(socket.dns.resolve_async(hosts, {concurrency = 4}))
+local delivered, inflight, pending = batch:getstats()
+assert(delivered == 0 and inflight <= 4 and inflight + pending == #hosts)
+local seen = {}
+while true do
+    local host, addrs, err = batch:receive()
+    if not host then assert(err == "done"); break end
+    assert(not seen[host])
+    seen[host] = true
+    if host == "no.such.host.invalid" then assert(not addrs and err)
+    else assert(addrs[1].addr and not err) end
+end
+for _, host in ipairs(hosts) do assert(seen[host]) end
+batch:close()
+
+batch = assert(socket.dns.resolve_async(hosts))
+local results, errors = batch:results()
+assert(errors["no.such.host.invalid"] and not results["no.such.host.invalid"])
+assert(results["127.0.0.7"][1].addr == "127.0.0.7")
+print("batch: ok")
+
+-- batches take part in select
+batch = assert(socket.dns.resolve_async(hosts))
+local count = 0
+while count < #hosts do
+    assert(socket.select({batch}, nil, 5)[1] == batch)
+    batch:settimeout(0)
+    while batch:receive() do count = count + 1 end
+end
+assert(select(3, batch:receive()) == "done")
+print("batch select: ok")
+
+-- a deadline bounds the whole batch
+batch = assert(socket.dns.resolve_async(hosts, {timeout = 0}))
+count = 0
+local t0 = socket.gettime()
+for host, addrs, err in function() return batch:receive() end do
+    assert(addrs or err == "timeout" or host == "no.such.host.invalid")
+    count = count + 1
+end
+assert(count == #hosts and socket.gettime() - t0 < 1)
+print("batch deadline: ok")
+
+-- pool statistics
+local stats = socket.async.stats()
+assert(stats.threads >= 1 and stats.threads <= 4)
+assert(stats.completed > 0 and stats.wait >= 0 and stats.maxwait >= stats.wait)
+assert(stats.depth == 0)
+print("stats: ok")
+
+-- connect and bind send names to the workers
+local server = assert(socket.bind("127.0.0.1", 0, 16))
+local port = select(2, server:getsockname())
+local function lookups(f)
+    local submitted = socket.async.stats().submitted
+    f()
+    return socket.async.stats().submitted - submitted
+end
+assert(lookups(function()
+    local c = socket.tcp()
+    c:settimeout(5)
+    assert(c:bind("localhost", 0))
+    assert(c:connect("localhost", port))
+    c:close()
+    local u = socket.udp()
+    u:settimeout(5)
+    assert(u:setpeername("localhost", port))
+    u:close()
+end) == 3)
+-- addresses need no lookup, and zero timeouts leave no time to wait
+assert(lookups(function()
+    local c = socket.tcp()
+    c:settimeout(5)
+    assert(c:connect("127.0.0.1", port))
+    c:close()
+    c = socket.tcp()
+    c:settimeout(0)
+    local r, err = c:connect("localhost", port)
+    assert(r or err == "timeout", err)
+    c:close()
+end) == 0)
+print("connect lookups: ok")
+
+-- a name server that never answers holds connect no longer than its timeout
+local dns = quietdns()
+if dns then
+    local c = socket.tcp()
+    c:settimeout(1)
+    local t0 = socket.gettime()
+    local r, err = c:connect("slow.example.com", port)
+    assert(not r and err == "timeout", err)
+    assert(socket.gettime() - t0 < 1.5)
+    c:close()
+    dns:close()
+    print("connect slow name: ok")
+end
+server:close()
@@ -0,0 +1,81 @@
+-----------------------------------------------------------------------------
+-- Compares passing messages through a channel with a loopback TCP pair
+-- Usage: lua channelbench.lua [messages] [size]
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+local count = tonumber(arg and arg[1]) or 100000
+local size = tonumber(arg and arg[2]) or 64
+local payload = string.rep("x", size)
+local batch = 32
+
+local function report(name, elapsed)
+    print(string.format("%-10s %8d msgs of %5d bytes in %.3fs: %10.0f msgs/s",
+        name, count, size, elapsed, count/elapsed))
+end
+
+-- both sides are driven the same way: the producer writes up to a batch
+-- without blocking, then the consumer sleeps in socket.select until the
+-- object's descriptor wakes it, and drains whatever is ready
+local function run(name, waitable, produce, consume)
+    local sent, received = 0, 0
+    local t = socket.gettime()
+    while received < count do
+        sent = sent + produce(math.min(batch, count - sent))
+        local r = socket.select({waitable}, nil, 5)
+        assert(r[1] == waitable, "consumer was not woken up")
+        received = received + consume()
+    end
+    report(name, socket.gettime() - t)
+end
+
+local function channel()
+    local c = assert(socket.channel(nil, batch, "spsc"))
+    c:settimeout(0)
+    run("channel", c, function(n)
+        for i = 1, n do
+            if not c:send(payload) then return i - 1 end
+        end
+        return n
+    end, function()
+        local n = 0
+        while c:receive() do n = n + 1 end
+        return n
+    end)
+    c:close()
+end
+
+local function tcp()
+    local server = assert(socket.bind("127.0.0.1", 0))
+    local ip, port = server:getsockname()
+    local client = assert(socket.connect(ip, port))
+    local peer = assert(server:accept())
+    client:setoption("tcp-nodelay", true)
+    client:settimeout(0)
+    peer:settimeout(0)
+    -- a message the socket took only part of is finished first
+    local last, partial = size, nil
+    run("loopback", peer, function(n)
+        local done = 0
+        while done < n or last < size do
+            if last == size then last = 0; done = done + 1 end
+            local i, err, j = client:send(payload, last + 1)
+            last = i or j
+            if not i then break end
+        end
+        return done
+    end, function()
+        local n = 0
+        while true do
+            local s, err, part = peer:receive(size, partial)
+            if not s then partial = part; break end
+            partial = nil
+            n = n + 1
+        end
+        return n
+    end)
+    client:close(); peer:close(); server:close()
+end
+
+channel()
+tcp()
@@ -0,0 +1,65 @@
+local socket = require("socket")
+
+-- values of every supported type survive the trip
+local c = assert(socket.channel(nil, 8))
+for _, v in ipairs{"hello", "", string.rep("x", 100000), 0, -1.5, 2^53,
+        true, false} do
+    assert(c:send(v))
+    assert(c:receive() == v)
+end
+local t = {1, 2, 3, name = "x", [true] = false, ["10"] = 10}
+assert(c:send(t))
+local r = assert(c:receive())
+for k, v in pairs(t) do assert(r[k] == v) end
+for k, v in pairs(r) do assert(t[k] == v) end
+print("round trip: ok")
+
+-- messages come out in order
+for i = 1, 8 do assert(c:send(i)) end
+for i = 1, 8 do assert(c:receive() == i) end
+print("ordering: ok")
+
+-- full and empty channels time out
+c:settimeout(0)
+assert(select(2, c:receive()) == "timeout")
+for i = 1, 8 do assert(c:send(i)) end
+assert(select(2, c:send(9)) == "timeout")
+assert(select(3, c:getstats()) == 8)
+c:settimeout(0.1)
+local t0 = socket.gettime()
+assert(select(2, c:send(9)) == "timeout")
+assert(socket.gettime() - t0 >= 0.09)
+for i = 1, 8 do assert(c:receive() == i) end
+print("timeouts: ok")
+
+-- unsupported values are rejected
+assert(not pcall(c.send, c, {{}}))
+assert(not pcall(c.send, c, print))
+assert(not pcall(c.send, c, nil))
+print("type checking: ok")
+
+-- select sees channels with pending messages
+local r, w, e = socket.select({c}, nil, 0)
+assert(#r == 0 and e == "timeout")
+assert(c:send("wake up"))
+assert(c:dirty())
+r = socket.select({c}, nil, 1)
+assert(r[1] == c)
+assert(c:receive() == "wake up")
+assert(not c:dirty())
+print("select: ok")
+
+-- objects opened by name share the same queue
+local a = assert(socket.channel("channeltest", 4, "spsc"))
+local b = assert(socket.channel("channeltest"))
+assert(a:send({fd = 7}))
+assert(b:receive().fd == 7)
+a:close()
+b:settimeout(0)
+assert(b:send("still here"))
+assert(b:receive() == "still here")
+assert(select(2, a:receive()) == "closed")
+b:close()
+print("named channels: ok")
+
+print("done")
@@ -0,0 +1,103 @@
+-----------------------------------------------------------------------------
+-- Chunked transfer decoding in C, checked against the Lua source
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local ltn12 = require("ltn12")
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+local client = assert(socket.connect(ip, port))
+local peer = assert(server:accept())
+client:settimeout(5)
+
+-- hides the C methods, so the source falls back to Lua
+local wrapped = {
+    receive = function(self, ...) return client:receive(...) end,
+    getfd = function() return client:getfd() end,
+    dirty = function() return client:dirty() end
+}
+
+local function chunked(...)
+    local t = {}
+    for i, chunk in ipairs{...} do
+        t[i] = string.format("%x\r\n%s\r\n", #chunk, chunk)
+    end
+    return table.concat(t) .. "0\r\n"
+end
+
+-- decodes with both sources and compares body and trailers
+local function check(encoded, coalesce, msg)
+    assert(peer:send(encoded .. "tail\n" .. encoded .. "tail\n"))
+    local results = {}
+    for k, sock in ipairs{client, wrapped} do
+        local body, headers = {}, {}
+        local src = socket.source("http-chunked", sock, headers, coalesce)
+        local ok, err = ltn12.pump.all(src, (ltn12.sink.table(body)))
+        results[k] = { body = body, headers = headers, err = err }
+        assert(client:receive() == "tail", msg)
+    end
+    local a, b = results[1], results[2]
+    assert(a.err == b.err, msg)
+    assert(table.concat(a.body) == table.concat(b.body), msg)
+    for k, v in pairs(b.headers) do assert(a.headers[k] == v, msg) end
+    for k, v in pairs(a.headers) do assert(b.headers[k] == v, msg) end
+    return a
+end
+
+local r = check(chunked("hello", " ", "world") .. "\r\n")
+assert(table.concat(r.body) == "hello world" and #r.body == 3)
+r = check("5;name=value\r\nhello\r\nA \r\n0123456789\r\n0;x\r\n\r\n")
+assert(table.concat(r.body) == "hello0123456789")
+check("0\r\n\r\n")
+print("decoding: ok")
+
+r = check(chunked("a", "b", "c", "d") .. "\r\n", 3)
+assert(#r.body == 2 and r.body[1] == "abc" and r.body[2] == "d")
+r = check(chunked("a", "b", "c", "d") .. "\r\n", 1000)
+assert(#r.body == 1 and r.body[1] == "abcd")
+print("coalescing: ok")
+
+r = check(chunked("x") .. "Expires: never\r\nX-Sum: 1\r\n x\r\n\r\n")
+assert(r.headers.expires == "never" and r.headers["x-sum"] == "1 x")
+print("trailers: ok")
+
+r = check("zz\r\n")
+assert(r.err == "invalid chunk size")
+-- Lua would wait for a chunk this large
+assert(peer:send("1ffffffffffffffffffff\r\n"))
+assert(select(2, client:receivechunk()) == "invalid chunk size")
+r = check(";\r\n")
+assert(r.err == "invalid chunk size")
+print("invalid sizes: ok")
+
+-- sizes and chunks that cross buffer refills
+local t = {}
+for i = 1, 3000 do t[i] = ("y"):rep(i % 13 + 1) end
+t[#t+1] = ("z"):rep(20000)
+r = check(chunked(unpack(t)) .. "\r\n", 4096)
+assert(table.concat(r.body) == table.concat(t))
+print("buffer boundaries: ok")
+
+-- http.request decodes chunked responses through the C source
+assert(peer:send("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" ..
+    chunked("chunked", " body") .. "X-Trailer: yes\r\n\r\n"))
+local h = { c = client, try = socket.newtry() }
+setmetatable(h, getmetatable(http.open(ip, port, nil, false)))
+assert(h:receivestatusline() == 200)
+local headers = h:receiveheaders()
+local body = {}
+h:receivebody(headers, (ltn12.sink.table(body)))
+assert(table.concat(body) == "chunked body" and headers["x-trailer"] == "yes")
+print("http: ok")
+
+-- errors come from the connection
+assert(peer:send("10\r\nshort"))
+peer:close()
+local chunk, err = client:receivechunk()
+assert(chunk == nil and err == "closed")
+print("errors: ok")
+
+client:close()
+server:close()
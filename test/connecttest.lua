@@ -0,0 +1,123 @@
+local socket = require("socket")
+dofile("testsupport.lua")
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+
+-- racing connects reach the server by name and by address
+for _, host in ipairs{"localhost", "127.0.0.1"} do
+    local c = assert(socket.connect(host, port))
+    local s = assert(server:accept())
+    assert(c:send("hello\n"))
+    assert(s:receive() == "hello")
+    c:close(); s:close()
+end
+print("race: ok")
+
+-- failures are reported quickly, with the error of the last attempt
+server:close()
+local t0 = socket.gettime()
+local c, err = socket.connect("localhost", port)
+assert(not c and err == "connection refused", err)
+assert(socket.gettime() - t0 < 1)
+print("refused: ok")
+
+-- racing can be turned off. where localhost also resolves to ::1, the
+-- attempt that reaches the server needs a socket of the other family
+server = assert(socket.bind("127.0.0.1", port))
+assert(socket.setconnectdelay(nil))
+c = assert(socket.connect("localhost", port))
+assert(server:accept()):close()
+c:close()
+assert(socket.setconnectdelay(0.25))
+print("sequential: ok")
+
+-- the local address still goes through the old path
+c = assert(socket.connect("127.0.0.1", port, "127.0.0.1", 0))
+assert(server:accept()):close()
+c:close()
+server:close()
+print("bind: ok")
+
+-- many connects at once
+server = assert(socket.bind("127.0.0.1", 0, 64))
+ip, port = server:getsockname()
+local closed = assert(socket.bind("127.0.0.1", 0))
+local _, deadport = closed:getsockname()
+closed:close()
+local targets = {}
+for i = 1, 20 do targets[i] = {"127.0.0.1", port} end
+targets[21] = {"localhost", port}
+targets[22] = {"127.0.0.1", deadport}
+targets[23] = {"no.such.host.invalid", port}
+targets[24] = "bogus"
+local clients, errors = socket.connectmany(targets, 5)
+for i = 1, 21 do
+    assert(clients[i] and not errors[i], errors[i])
+    assert(string.find(tostring(clients[i]), "^tcp{client}"))
+end
+assert(not clients[22] and errors[22] == "connection refused")
+assert(not clients[23] and errors[23])
+assert(not clients[24] and errors[24] == "invalid target")
+for i = 1, 21 do
+    local peer = assert(server:accept())
+    assert(clients[i]:send(i .. "\n"))
+    assert(tonumber(peer:receive()))
+    peer:close()
+    clients[i]:close()
+end
+server:close()
+print("connectmany: ok")
+
+-- names are resolved by the worker threads, addresses right away
+server = assert(socket.bind("127.0.0.1", 0, 64))
+ip, port = server:getsockname()
+local submitted = socket.async.stats().submitted
+clients, errors = socket.connectmany({{"127.0.0.1", port},
+    {"localhost", port}, {"no.such.host.invalid", port}}, 5)
+assert(socket.async.stats().submitted - submitted == 2)
+assert(clients[1] and clients[2] and errors[3])
+for i = 1, 2 do
+    clients[i]:close()
+    assert(server:accept()):close()
+end
+print("connectmany lookups: ok")
+
+-- a name server that never answers makes for a slow name, which must not
+-- hold up the other targets
+local dns = quietdns()
+if dns then
+    t0 = socket.gettime()
+    clients, errors = socket.connectmany({{"slow.example.com", port},
+        {"127.0.0.1", port}, {"127.0.0.1", port}}, 1)
+    local elapsed = socket.gettime() - t0
+    assert(elapsed < 1.5, elapsed)
+    assert(not clients[1] and errors[1] == "timeout", errors[1])
+    for i = 2, 3 do
+        assert(clients[i], errors[i])
+        clients[i]:close()
+        assert(server:accept()):close()
+    end
+    print("connectmany slow name: ok")
+    dns:close()
+end
+server:close()
+
+-- many accepts at once, with peer addresses
+server = assert(socket.bind("127.0.0.1", 0, 64))
+ip, port = server:getsockname()
+local cs = {}
+for i = 1, 10 do cs[i] = assert(socket.connect(ip, port)) end
+socket.sleep(0.05)
+local accepted, peers = assert(server:acceptmany(4))
+assert(#accepted == 4 and #peers == 4)
+assert(peers[1][1] == "127.0.0.1")
+assert(peers[1][2] == select(2, cs[1]:getsockname()))
+assert(accepted[1]:getfamily() == "inet4")
+accepted = assert(server:acceptmany())
+assert(#accepted == 6)
+server:settimeout(0)
+assert(select(2, server:acceptmany()) == "timeout")
+for i = 1, 10 do cs[i]:close() end
+server:close()
+print("acceptmany: ok")
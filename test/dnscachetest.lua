@@ -0,0 +1,72 @@
+local socket = require("socket")
+
+local function stats()
+    return socket.dns.cachestats()
+end
+
+-- the cache is off until configured
+assert(stats().size == 0)
+socket.dns.getaddrinfo("localhost")
+assert(stats().misses == 0 and stats().entries == 0)
+
+-- repeated lookups are answered from the cache
+assert(socket.dns.setcache(16, 60, 60))
+local first = assert(socket.dns.getaddrinfo("localhost"))
+local again = assert(socket.dns.getaddrinfo("localhost"))
+assert(#first == #again and first[1].addr == again[1].addr)
+local s = stats()
+assert(s.misses == 1 and s.hits == 1 and s.entries == 1, s.hits)
+print("hits: ok")
+
+-- numeric addresses bypass the cache
+assert(socket.dns.getaddrinfo("127.0.0.1"))
+assert(socket.dns.getaddrinfo("::1"))
+assert(stats().misses == 1)
+print("numeric: ok")
+
+-- the service is part of the key, and the cache stays within its size
+socket.dns.flushcache()
+assert(stats().entries == 0)
+assert(socket.dns.setcache(2))
+local server = assert(socket.bind("127.0.0.1", 0))
+local _, port = server:getsockname()
+for i = 1, 3 do
+    local c = assert(socket.connect("localhost", port))
+    c:close()
+    server:accept():close()
+end
+s = stats()
+assert(s.entries == 1 and s.hits >= 3)
+for i = 1, 3 do socket.tcp():connect("localhost", port + i) end
+s = stats()
+assert(s.entries == 2 and s.evictions >= 2)
+print("bounded: ok")
+
+-- entries expire after their ttl
+assert(socket.dns.setcache(16, 0))
+socket.dns.getaddrinfo("localhost")
+socket.dns.getaddrinfo("localhost")
+assert(stats().expirations >= 1)
+print("ttl: ok")
+
+-- failures are remembered when the resolver gives a definite answer
+assert(socket.dns.setcache(16, 60, 60))
+socket.dns.flushcache()
+local r, err = socket.dns.getaddrinfo("no.such.host.invalid")
+assert(not r)
+local neg = stats().neghits
+r, err = socket.dns.getaddrinfo("no.such.host.invalid")
+if stats().entries == 0 then
+    print("negative caching: skipped (" .. err .. ")")
+else
+    assert(stats().neghits == neg + 1)
+    print("negative caching: ok")
+end
+
+-- flushing a single host
+socket.dns.getaddrinfo("localhost")
+local n = stats().entries
+socket.dns.flushcache("localhost")
+assert(stats().entries < n)
+assert(socket.dns.setcache(0))
+server:close()
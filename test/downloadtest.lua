@@ -0,0 +1,92 @@
+-----------------------------------------------------------------------------
+-- Segmented downloads from a server in the same process
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local ltn12 = require("ltn12")
+
+local t = {}
+for i = 1, 20000 do t[i] = string.format("%05d\n", i) end
+local data = table.concat(t)
+
+-- serves data, in ranges if the path says so. a broken server drops the
+-- first response to each range half way
+local ranges, heads, dropped = 0, 0, {}
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    onerror = function() end,
+    handler = function(req, res)
+        local h = { etag = '"v1"' }
+        if req.path ~= "/plain" then h["accept-ranges"] = "bytes" end
+        if req.method == "HEAD" then
+            heads = heads + 1
+            h["content-length"] = #data
+            return res:send(200, h)
+        end
+        local first, last = string.match(req.headers.range or "",
+            "^bytes=(%d+)%-(%d+)$")
+        if not first or req.path == "/plain" then
+            return res:send(200, h, data)
+        end
+        if req.headers["if-range"] ~= '"v1"' then
+            return res:send(200, h, data)
+        end
+        ranges = ranges + 1
+        local body = string.sub(data, first + 1, last + 1)
+        h["content-range"] = string.format("bytes %d-%d/%d", first, last,
+            #data)
+        if req.path == "/broken" and not dropped[last] then
+            dropped[last] = true
+            h["content-length"] = #body
+            local sink = res:sink(206, h)
+            sink(string.sub(body, 1, #body/2))
+            error("dropped")
+        end
+        res:send(206, h, body)
+    end })
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+local step = function() srv:step(0) end
+
+local function contents(f)
+    f:seek("set", 0)
+    return f:read("*a")
+end
+
+-- ranges land at their offsets in a file
+local f = assert(io.tmpfile())
+local size, headers = http.download(base .. "/file", f,
+    { segments = 4, step = step })
+assert(size == #data and headers.etag == '"v1"')
+assert(contents(f) == data and ranges == 4 and heads == 1)
+print("file: ok")
+
+-- a sink gets the whole body in order
+local chunks = {}
+ranges = 0
+size = http.download(base .. "/file", ltn12.sink.table(chunks),
+    { segments = 7, step = step })
+assert(size == #data and table.concat(chunks) == data and ranges == 7)
+print("sink: ok")
+
+-- dropped ranges resume where they stopped
+f = assert(io.tmpfile())
+ranges = 0
+size = http.download(base .. "/broken", f, { segments = 3, step = step })
+assert(size == #data and contents(f) == data and ranges == 6, ranges)
+print("resume: ok")
+
+-- without Accept-Ranges, a single stream
+f = assert(io.tmpfile())
+ranges = 0
+size = http.download(base .. "/plain", f, { segments = 4, step = step })
+assert(size == #data and contents(f) == data and ranges == 0)
+print("single stream: ok")
+
+-- errors
+local r, err = http.download("http://" .. ip .. ":1/", ltn12.sink.null(),
+    { step = step })
+assert(not r and err == "connection refused", err)
+print("errors: ok")
+
+srv:close()
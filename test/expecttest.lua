@@ -0,0 +1,95 @@
+-----------------------------------------------------------------------------
+-- Expect: 100-continue uploads against servers in the same process
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local ltn12 = require("ltn12")
+
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    handler = function(req, res)
+        if req.path == "/upload" then
+            local t = {}
+            ltn12.pump.all(req.source, (ltn12.sink.table(t)))
+            res:send(200, { ["x-expect"] = req.headers.expect },
+                table.concat(t))
+        else
+            res:send(413, nil, "too large")
+        end
+    end })
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+local step = function() srv:step(0) end
+
+-- a source that counts how often it is read
+local reads
+local function body()
+    reads = 0
+    local source = ltn12.source.string(string.rep("x", 100000))
+    return function()
+        reads = reads + 1
+        return source()
+    end
+end
+
+local function upload(url, expect, step)
+    local t = {}
+    local responses, errors = http.requestmany({ { url = url,
+        method = "PUT", source = body(), expect = expect,
+        headers = { ["content-length"] = 100000 },
+        sink = ltn12.sink.table(t) } }, { step = step })
+    assert(responses[1], errors[1])
+    return responses[1], table.concat(t)
+end
+
+-- the body follows the 100 Continue
+local r, data = upload(base .. "/upload", true, step)
+assert(r.code == 200 and data == string.rep("x", 100000))
+assert(r.headers["x-expect"] == "100-continue")
+print("continue: ok")
+
+-- a final status means the body is never read
+r, data = upload(base .. "/reject", true, step)
+assert(r.code == 413 and data == "too large" and reads == 0, reads)
+print("rejected: ok")
+
+-- without expect, the body goes out with the headers
+r, data = upload(base .. "/reject", nil, step)
+assert(r.code == 413 and reads > 1 and not r.headers["x-expect"])
+print("opt-in: ok")
+
+-- a server that never answers the header gets the body after the wait
+local old = assert(socket.bind("127.0.0.1", 0))
+old:settimeout(0)
+local oip, oport = old:getsockname()
+local conn, head, got, headat, bodyat = nil, "", 0, nil, nil
+local function oldstep()
+    if not conn then
+        conn = old:accept()
+        if conn then conn:settimeout(0) end
+        return
+    end
+    local chunk, err, partial = conn:receive(8192)
+    chunk = chunk or partial
+    if not headat then
+        head = head .. chunk
+        local i = string.find(head, "\r\n\r\n", 1, true)
+        if i then
+            headat = socket.gettime()
+            got = string.len(head) - i - 3
+        end
+    else got = got + string.len(chunk) end
+    if headat and not bodyat and got > 0 then bodyat = socket.gettime() end
+    if got == 100000 then
+        conn:send("HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n")
+        got = -1
+    end
+end
+r = upload("http://" .. oip .. ":" .. oport .. "/", 0.2, oldstep)
+assert(r.code == 201 and string.find(head, "Expect: 100%-continue"))
+assert(bodyat - headat >= 0.15, bodyat - headat)
+conn:close()
+old:close()
+print("timeout: ok")
+
+srv:close()
@@ -0,0 +1,54 @@
+-----------------------------------------------------------------------------
+-- TCP Fast Open over loopback
+-- Data goes in the SYN only if net.ipv4.tcp_fastopen enables both the
+-- client (1) and the server (2) side. Otherwise the test only checks that
+-- connect with data falls back to a regular handshake.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+local mode = 0
+local f = io.open("/proc/sys/net/ipv4/tcp_fastopen")
+if f then mode = tonumber(f:read("*l")) or 0; f:close() end
+local enabled = mode % 4 == 3
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+local ok, err = server:setoption("tcp-fastopen", 16)
+if ok then
+    assert(server:getoption("tcp-fastopen") == 16)
+    print("listener option: ok")
+else
+    print("listener option: " .. err)
+end
+
+-- the first connection only fetches a cookie, later ones use it
+local carried = false
+for i = 1, 3 do
+    local client = assert(socket.tcp())
+    client:settimeout(5)
+    local r, insyn = client:connect(ip, port, {data = "hello " .. i})
+    assert(r == 1 and type(insyn) == "boolean", insyn)
+    carried = carried or insyn
+    local peer = assert(server:accept())
+    assert(peer:receive(7) == "hello " .. i)
+    assert(client:getstats() == 0 and select(2, client:getstats()) == 7)
+    peer:send("bye\n")
+    assert(client:receive() == "bye")
+    peer:close()
+    client:close()
+end
+assert(carried or not enabled or not ok)
+print((carried and "data in syn" or "fallback handshake") .. ": ok")
+
+-- plain connects are unaffected
+local client = assert(socket.tcp())
+assert(select("#", client:connect(ip, port)) == 1)
+client:close()
+
+-- errors are reported as usual
+client = assert(socket.tcp())
+server:close()
+local r, e = client:connect(ip, port, {data = "x"})
+assert(not r and e, "connected to a closed port")
+print("errors: ok")
@@ -0,0 +1,265 @@
+-----------------------------------------------------------------------------
+-- A small h2c server for the HTTP/2 tests
+-- It runs in the same process as its clients, one step at a time, and
+-- can be told to hold responses back, limit streams and windows, reset
+-- streams and send GOAWAY.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http2 = require("socket.http2")
+
+local fixture = {}
+
+local PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+local function pack(n, size)
+    local t = {}
+    for i = size, 1, -1 do
+        t[i] = n % 256
+        n = math.floor(n / 256)
+    end
+    return string.char(unpack(t))
+end
+
+local function number(s, i, size)
+    local n = 0
+    for k = i, i + size - 1 do n = n * 256 + string.byte(s, k) end
+    return n
+end
+
+local function has(flags, bit)
+    return math.floor(flags / bit) % 2 == 1
+end
+
+local methods = {}
+local metat = { __index = methods }
+
+-- options: handler(req) returns code, headers and body. maxstreams and
+-- window are sent as settings. hold keeps responses back until that
+-- many requests are complete, then answers them last first. goaway
+-- sends GOAWAY once that many streams were opened on a connection
+function fixture.new(options)
+    local self = setmetatable({
+        server = assert(socket.bind("127.0.0.1", 0)),
+        handler = options.handler,
+        maxstreams = options.maxstreams,
+        window = options.window,
+        hold = options.hold or 1,
+        goaway = options.goaway,
+        conns = {},
+        stats = { connections = 0, streams = 0, maxactive = 0, pings = 0,
+            blocks = {} }
+    }, metat)
+    self.server:settimeout(0)
+    return self
+end
+
+function methods:getsockname()
+    return self.server:getsockname()
+end
+
+local function frame(conn, kind, flags, id, payload)
+    conn.out[#conn.out+1] = pack(#payload, 3) .. string.char(kind, flags) ..
+        pack(id, 4) .. payload
+end
+
+local function accept(self, c)
+    c:settimeout(0)
+    local conn = { c = c, inbuf = "", out = {}, streams = {}, ready = {},
+        responding = {}, window = 65535, initial = 65535, active = 0,
+        opened = 0, enc = http2.newencoder(), dec = http2.newdecoder() }
+    local settings = ""
+    if self.maxstreams then settings = pack(3, 2) .. pack(self.maxstreams, 4) end
+    if self.window then settings = settings .. pack(4, 2) .. pack(self.window, 4) end
+    frame(conn, 4, 0, 0, settings)
+    frame(conn, 6, 0, 0, "12345678")
+    self.conns[#self.conns+1] = conn
+    self.stats.connections = self.stats.connections + 1
+end
+
+local function respond(self, conn, s)
+    local fields = {}
+    for _, f in ipairs(s.fields) do
+        if string.sub(f[1], 1, 1) ~= ":" then fields[f[1]] = f[2] end
+    end
+    local pseudo = {}
+    for _, f in ipairs(s.fields) do pseudo[f[1]] = f[2] end
+    local req = { method = pseudo[":method"], path = pseudo[":path"],
+        authority = pseudo[":authority"], headers = fields,
+        body = table.concat(s.body) }
+    local code, headers, body = self.handler(req)
+    if code == "reset" then
+        frame(conn, 3, 0, s.id, pack(headers, 4))
+        conn.streams[s.id] = nil
+        conn.active = conn.active - 1
+        return
+    end
+    local list = { { ":status", tostring(code) } }
+    for name, value in pairs(headers or {}) do
+        list[#list+1] = { name, tostring(value) }
+    end
+    s.list, s.body, s.sent = list, body or "", 0
+    table.insert(conn.ready, s)
+    if #conn.ready >= self.hold then
+        for i = #conn.ready, 1, -1 do
+            table.insert(conn.responding, conn.ready[i])
+        end
+        conn.ready = {}
+    end
+end
+
+local function opened(self, conn, id, block, last)
+    local fields = assert(conn.dec:decode(block))
+    table.insert(self.stats.blocks, #block)
+    if conn.goaway then return end
+    local s = { id = id, fields = fields, body = {}, window = conn.initial }
+    conn.streams[id] = s
+    conn.active = conn.active + 1
+    conn.opened = conn.opened + 1
+    if conn.active > self.stats.maxactive then
+        self.stats.maxactive = conn.active
+    end
+    if self.goaway and conn.opened == self.goaway then
+        conn.goaway = id
+        frame(conn, 7, 0, 0, pack(id, 4) .. pack(0, 4))
+    end
+    if last then respond(self, conn, s) end
+end
+
+local function process(self, conn, kind, flags, id, payload)
+    if kind == 4 then
+        if has(flags, 1) then return end
+        for i = 1, #payload, 6 do
+            if number(payload, i, 2) == 4 then
+                local value = number(payload, i + 2, 4)
+                for _, s in pairs(conn.streams) do
+                    s.window = s.window + value - conn.initial
+                end
+                conn.initial = value
+            end
+        end
+        frame(conn, 4, 1, 0, "")
+    elseif kind == 1 then
+        local block = payload
+        if has(flags, 8) then
+            block = string.sub(block, 2, #block - string.byte(block, 1))
+        end
+        if has(flags, 32) then block = string.sub(block, 6) end
+        if has(flags, 4) then opened(self, conn, id, block, has(flags, 1))
+        else conn.continuing = { id, { block }, has(flags, 1) } end
+    elseif kind == 9 then
+        local cont = assert(conn.continuing)
+        table.insert(cont[2], payload)
+        if has(flags, 4) then
+            conn.continuing = nil
+            opened(self, conn, cont[1], table.concat(cont[2]), cont[3])
+        end
+    elseif kind == 0 then
+        if #payload > 0 then
+            frame(conn, 8, 0, 0, pack(#payload, 4))
+        end
+        local s = conn.streams[id]
+        if not s then return end
+        table.insert(s.body, payload)
+        if has(flags, 1) then respond(self, conn, s)
+        elseif #payload > 0 then frame(conn, 8, 0, id, pack(#payload, 4)) end
+    elseif kind == 8 then
+        local increment = number(payload, 1, 4)
+        if id == 0 then conn.window = conn.window + increment
+        elseif conn.streams[id] then
+            conn.streams[id].window = conn.streams[id].window + increment
+        end
+    elseif kind == 6 then
+        if has(flags, 1) then self.stats.pings = self.stats.pings + 1 end
+    elseif kind == 3 then
+        if conn.streams[id] then
+            conn.streams[id] = nil
+            conn.active = conn.active - 1
+        end
+    end
+end
+
+-- sends what the client's windows allow of each response
+local function pump(self, conn)
+    local left = {}
+    for _, s in ipairs(conn.responding) do
+        if not s.headers then
+            -- blocks must be encoded in the order they are sent
+            s.headers = true
+            frame(conn, 1, 4 + (s.body == "" and 1 or 0), s.id,
+                conn.enc:encode(s.list))
+        end
+        while s.sent < #s.body do
+            local n = math.min(#s.body - s.sent, s.window, conn.window, 16384)
+            if n <= 0 then break end
+            s.window, conn.window = s.window - n, conn.window - n
+            local flags = 0
+            if s.sent + n == #s.body then flags = 1 end
+            frame(conn, 0, flags, s.id, string.sub(s.body, s.sent + 1,
+                s.sent + n))
+            s.sent = s.sent + n
+        end
+        if s.sent < #s.body then left[#left+1] = s
+        else
+            conn.streams[s.id] = nil
+            conn.active = conn.active - 1
+            self.stats.streams = self.stats.streams + 1
+        end
+    end
+    conn.responding = left
+end
+
+local function flush(conn)
+    local data = table.concat(conn.out)
+    conn.out = {}
+    if data == "" then return true end
+    local last, err, sent = conn.c:send(data)
+    if last then return true end
+    if err ~= "timeout" then return false end
+    conn.out[1] = string.sub(data, sent + 1)
+    return true
+end
+
+-- with a timeout, waits that long for something to read, unless there
+-- is output left to flush
+function methods:step(timeout)
+    local recvt = { self.server }
+    for _, conn in ipairs(self.conns) do
+        if conn.out[1] then recvt = nil; break end
+        recvt[#recvt+1] = conn.c
+    end
+    if timeout and recvt then socket.select(recvt, nil, timeout) end
+    local c = self.server:accept()
+    if c then accept(self, c) end
+    local alive = {}
+    for _, conn in ipairs(self.conns) do
+        local data, err, partial = conn.c:receive(65536)
+        conn.inbuf = conn.inbuf .. (data or partial)
+        if not conn.preface and #conn.inbuf >= 24 then
+            assert(string.sub(conn.inbuf, 1, 24) == PREFACE)
+            conn.preface = true
+            conn.inbuf = string.sub(conn.inbuf, 25)
+        end
+        while conn.preface and #conn.inbuf >= 9 do
+            local length = number(conn.inbuf, 1, 3)
+            if #conn.inbuf < 9 + length then break end
+            local kind, flags = string.byte(conn.inbuf, 4, 5)
+            local id = number(conn.inbuf, 6, 4) % 2^31
+            local payload = string.sub(conn.inbuf, 10, 9 + length)
+            conn.inbuf = string.sub(conn.inbuf, 10 + length)
+            process(self, conn, kind, flags, id, payload)
+        end
+        pump(self, conn)
+        if err ~= "closed" and flush(conn) then alive[#alive+1] = conn
+        else conn.c:close() end
+    end
+    self.conns = alive
+end
+
+
+function methods:close()
+    for _, conn in ipairs(self.conns) do conn.c:close() end
+    self.conns = {}
+    self.server:close()
+end
+
+return fixture
@@ -0,0 +1,123 @@
+-----------------------------------------------------------------------------
+-- Header block parsing in C, checked against the line by line reader
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+-- the reader http.lua used before the C parser
+local function reference(sock, headers)
+    local line, name, value, err
+    headers = headers or {}
+    line, err = sock:receive()
+    if err then return nil, err end
+    while line ~= "" do
+        name, value = socket.skip(2, string.find(line, "^(.-):%s*(.*)"))
+        if not (name and value) then return nil, "malformed reponse headers" end
+        name = string.lower(name)
+        line, err  = sock:receive()
+        if err then return nil, err end
+        while string.find(line, "^%s") do
+            value = value .. line
+            line, err = sock:receive()
+            if err then return nil, err end
+        end
+        if headers[name] then headers[name] = headers[name] .. ", " .. value
+        else headers[name] = value end
+    end
+    return headers
+end
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+local client = assert(socket.connect(ip, port))
+local peer = assert(server:accept())
+client:settimeout(5)
+
+local function same(a, b)
+    for k, v in pairs(a) do if b[k] ~= v then return false end end
+    for k, v in pairs(b) do if a[k] ~= v then return false end end
+    return true
+end
+
+local function check(block, msg)
+    assert(peer:send(block .. "tail\n" .. block .. "tail\n"))
+    local a, aerr = client:receiveheaders()
+    assert(client:receive() == "tail")
+    local b, berr = reference(client)
+    assert(client:receive() == "tail")
+    assert(aerr == berr, msg)
+    if a then assert(same(a, b), msg) end
+    return a, aerr
+end
+
+local h = check("Content-Length: 10\r\nX-A:b\r\n\r\n")
+assert(h["content-length"] == "10" and h["x-a"] == "b")
+check("\r\n")
+check("a: 1\nb:   2  \n\n")
+print("fields: ok")
+
+h = check("Set-Cookie: a=1\r\nset-cookie: b=2\r\nSET-COOKIE: c=3\r\n\r\n")
+assert(h["set-cookie"] == "a=1, b=2, c=3")
+h = check("X-Long: first\r\n  second\r\n\tthird\r\nX-B: b\r\n\r\n")
+assert(h["x-long"] == "first  second\tthird" and h["x-b"] == "b")
+print("folding and repeats: ok")
+
+check("Empty:\r\n\r\n")
+-- the whole block is consumed even if it is malformed
+assert(peer:send("A: 1\r\nno colon here\r\nB: 2\r\n\r\ntail\n"))
+h, err = client:receiveheaders()
+assert(h == nil and err == "malformed reponse headers")
+assert(client:receive() == "tail")
+print("malformed: ok")
+
+-- a block larger than the read buffer crosses several refills, and the
+-- CR LF pair that ends it may be split between them
+local t = {}
+for i = 1, 500 do t[i] = string.format("X-Field-%03d: %s\r\n", i, ("v"):rep(i % 37)) end
+for pad = 0, 3 do
+    check(("x"):rep(8192 - 24 - pad) .. ": y\r\n" .. table.concat(t) .. "\r\n")
+end
+print("buffer boundaries: ok")
+
+-- an existing table is filled in
+local tbl = { keep = "me" }
+assert(peer:send("A: 1\r\n\r\n"))
+assert(client:receiveheaders(tbl) == tbl and tbl.a == "1" and tbl.keep == "me")
+print("table argument: ok")
+
+-- serialized blocks read back the same, with canonic names
+local headers = require("socket.headers")
+local sent = { ["content-length"] = 12, ["x-custom"] = "a, b", host = "h" }
+local block = headers.serialize(sent)
+assert(string.find(block, "Content-Length: 12\r\n", 1, true))
+assert(string.find(block, "\r\nx-custom: a, b\r\n", 1, true) or
+    string.find(block, "^x-custom: a, b\r\n"))
+assert(string.sub(block, -4) == "\r\n\r\n" and #block == 47)
+assert(headers.serialize({}) == "\r\n")
+assert(headers.serialize({ host = "h" }, {}) == "host: h\r\n\r\n")
+assert(headers.serialize({ host = "h" }, { host = "HOST" }) ==
+    "HOST: h\r\n\r\n")
+assert(not pcall(headers.serialize, { host = true }))
+assert(not pcall(headers.serialize, { "positional" }))
+assert(client:send(block))
+h = assert(peer:receiveheaders())
+assert(h["content-length"] == "12" and h["x-custom"] == "a, b" and h.host == "h")
+print("serialize: ok")
+
+-- sendheaders writes the same block, however large
+for i = 1, 200 do sent["x-field-" .. i] = ("v"):rep(i) end
+block = headers.serialize(sent)
+assert(client:sendheaders(sent, headers.canonic) == #block)
+assert(peer:receive(#block) == block)
+assert(client:sendheaders({}) == 2 and peer:receive(2) == "\r\n")
+print("sendheaders: ok")
+
+-- errors come from the connection
+assert(peer:send("A: 1\r\n"))
+peer:close()
+h, err = client:receiveheaders()
+assert(h == nil and err == "closed")
+print("errors: ok")
+
+client:close()
+server:close()
@@ -0,0 +1,187 @@
+-----------------------------------------------------------------------------
+-- HTTP/2 client against the h2c fixture in h2server.lua
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http2 = require("socket.http2")
+local ltn12 = require("ltn12")
+dofile("testsupport.lua")
+local fixture = dofile("h2server.lua")
+
+local function hex(s)
+    return (string.gsub(s, ".", function(c)
+        return string.format("%02x", string.byte(c))
+    end))
+end
+
+-- HPACK, against the examples in RFC 7541, C.4
+local encoder, decoder = http2.newencoder(), http2.newdecoder()
+local examples = {
+    { { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+        { ":authority", "www.example.com" } },
+        "828684418cf1e3c2e5f23a6ba0ab90f4ff" },
+    { { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+        { ":authority", "www.example.com" },
+        { "cache-control", "no-cache" } },
+        "828684be5886a8eb10649cbf" },
+    { { { ":method", "GET" }, { ":scheme", "https" },
+        { ":path", "/index.html" }, { ":authority", "www.example.com" },
+        { "custom-key", "custom-value" } },
+        "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf" }
+}
+for _, example in ipairs(examples) do
+    local block = encoder:encode(example[1])
+    assert(hex(block) == example[2], hex(block))
+    local fields = assert(decoder:decode(block))
+    for i, f in ipairs(example[1]) do
+        assert(fields[i][1] == f[1] and fields[i][2] == f[2])
+    end
+end
+-- every byte value survives, and broken blocks are refused
+local all = {}
+for i = 0, 255 do all[#all+1] = string.char(i) end
+all = table.concat(all)
+local fields = decoder:decode(encoder:encode{ { "x-all", all } })
+assert(fields[1][2] == all)
+assert(not decoder:decode("\255") and not decoder:decode("\130\190\255"))
+print("hpack: ok")
+
+local srv
+srv = fixture.new{ handler = function(req)
+    local path = req.path
+    if path == "/echo" then
+        return 200, { ["x-method"] = req.method }, req.body
+    elseif path == "/big" then
+        return 200, nil, string.rep("0123456789", 300000)
+    elseif path == "/redirect" then
+        return 302, { location = "/page/moved" }, "moved"
+    elseif path == "/reset" then
+        return "reset", 2
+    end
+    return 200, { ["x-agent"] = req.headers["user-agent"],
+        ["x-authority"] = req.authority }, "page " .. string.sub(path, 7)
+end }
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+-- a client socket that runs the server whenever it would block
+local create = stepping(srv, socket.tcp)
+
+local function get(path, reqt)
+    local t = {}
+    reqt = reqt or {}
+    reqt.url, reqt.create = base .. path, create
+    reqt.sink = ltn12.sink.table(t)
+    local r, code, headers, status = http2.request(reqt)
+    assert(r, code)
+    return table.concat(t), code, headers, status
+end
+
+-- a plain request
+local body, code, headers, status = get("/page/one")
+assert(body == "page one" and code == 200 and status == "HTTP/2 200")
+assert(headers["x-agent"] == http2.USERAGENT)
+assert(headers["x-authority"] == ip .. ":" .. port)
+body, code, headers = get("/echo", { method = "PUT",
+    source = ltn12.source.string("hello"),
+    headers = { ["content-length"] = 5 } })
+assert(body == "hello" and headers["x-method"] == "PUT")
+print("request: ok")
+
+-- many requests share one connection, all in flight at once: the
+-- server answers none of them before it has them all
+local function many(n, path)
+    local reqts, sinks = {}, {}
+    for i = 1, n do
+        sinks[i] = {}
+        reqts[i] = { url = base .. (path or "/page/") .. i, create = create,
+            sink = ltn12.sink.table(sinks[i]) }
+    end
+    local responses, errors = http2.requestmany(reqts)
+    for i = 1, n do
+        assert(responses[i], errors[i])
+        sinks[i] = table.concat(sinks[i])
+    end
+    return responses, sinks
+end
+srv.hold = 20
+local before = srv.stats.connections
+local responses, bodies = many(20)
+for i = 1, 20 do assert(bodies[i] == "page " .. i) end
+assert(srv.stats.connections == before + 1 and srv.stats.maxactive == 20)
+assert(srv.stats.pings > 0)
+srv.hold = 1
+print("multiplexing: ok")
+
+-- repeated fields come from the header table
+local blocks = srv.stats.blocks
+assert(blocks[#blocks] < blocks[#blocks - 19] / 2,
+    blocks[#blocks] .. " " .. blocks[#blocks - 19])
+print("compression: ok")
+
+-- the server's stream limit holds the rest back. Settings only reach
+-- new connections, so the cached ones are dropped first
+http2.close()
+srv.stats.maxactive = 0
+srv.maxstreams = 4
+many(10)
+assert(srv.stats.maxactive <= 4)
+srv.maxstreams = nil
+http2.close()
+print("stream limit: ok")
+
+-- uploads wait for the server's window, downloads open the client's
+srv.window = 1000
+local upload = string.rep("abcdefghij", 20000)
+body = get("/echo", { method = "POST", source = ltn12.source.string(upload),
+    headers = { ["content-length"] = #upload } })
+assert(body == upload)
+srv.window = nil
+http2.close()
+body = get("/big")
+assert(body == string.rep("0123456789", 300000))
+print("flow control: ok")
+
+-- a server going away has the requests it did not see sent again
+srv.goaway = 3
+before = srv.stats.connections
+responses, bodies = many(8)
+for i = 1, 8 do assert(bodies[i] == "page " .. i) end
+assert(srv.stats.connections == before + 3, srv.stats.connections - before)
+srv.goaway = nil
+print("goaway: ok")
+
+-- redirects are followed, without their bodies
+body, code, headers = get("/redirect")
+assert(body == "page moved" and code == 200)
+assert(headers.location == base .. "/page/moved")
+body, code = get("/redirect", { redirect = false })
+assert(body == "moved" and code == 302)
+print("redirect: ok")
+
+-- errors are per stream, or per request
+local reqts = { { url = base .. "/reset", create = create },
+    { url = base .. "/page/fine", create = create },
+    { url = "https://" .. ip .. "/", create = create } }
+local errors
+responses, errors = http2.requestmany(reqts)
+assert(errors[1] == "internal error" and responses[2].code == 200)
+assert(string.find(errors[3], "scheme"))
+local dead = assert(socket.bind("127.0.0.1", 0))
+local dip, dport = dead:getsockname()
+dead:close()
+local r, err = http2.request("http://" .. dip .. ":" .. dport .. "/")
+assert(not r and err == "connection refused", err)
+print("errors: ok")
+
+-- a connection of one's own
+local conn = assert(http2.connect(ip, port, create))
+local t = {}
+assert(conn:request{ url = base .. "/page/own", sink = ltn12.sink.table(t) })
+assert(table.concat(t) == "page own" and conn:alive())
+responses, errors = conn:requestmany{ { url = base .. "/page/a" },
+    { url = "ftp://" .. ip .. "/" } }
+assert(responses[1].code == 200 and string.find(errors[2], "scheme"))
+conn:close()
+assert(not conn:alive())
+print("connection: ok")
+
+srv:close()
@@ -0,0 +1,78 @@
+-----------------------------------------------------------------------------
+-- Measures the HTTP server with keep-alive clients in the same process
+-- Usage: lua httpbench.lua [connections] [requests]
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local server = require("socket.http.server")
+
+local nconns = tonumber(arg and arg[1]) or 64
+local total = tonumber(arg and arg[2]) or 50000
+local body = "hello, world\n"
+local request = "GET / HTTP/1.1\r\nHost: bench\r\n\r\n"
+
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    maxconnections = nconns + 1, handler = function(req, res)
+        res:send(200, {["content-type"] = "text/plain"}, body)
+    end })
+local ip, port = srv:getsockname()
+
+-- one request first, to learn how long each response is
+local probe = assert(socket.connect(ip, port))
+probe:settimeout(0)
+probe:send(request)
+local data = ""
+repeat
+    srv:step(0.01)
+    local chunk, err, partial = probe:receive(8192)
+    data = data .. (chunk or partial)
+until string.sub(data, -#body) == body
+local length = #data
+probe:close()
+
+local clients = {}
+for i = 1, nconns do
+    local c = assert(socket.connect(ip, port))
+    c:settimeout(0)
+    c:setoption("tcp-nodelay", true)
+    clients[i] = { sock = c, got = 0 }
+end
+
+-- each client keeps one request outstanding, like wrk with no pipelining
+local latencies, sent, done = {}, 0, 0
+local t0 = socket.gettime()
+while done < total do
+    local now = socket.gettime()
+    for _, c in ipairs(clients) do
+        if not c.start and sent < total then
+            assert(c.sock:send(request))
+            c.start, c.got = now, 0
+            sent = sent + 1
+        end
+    end
+    srv:step(0)
+    now = socket.gettime()
+    for _, c in ipairs(clients) do
+        if c.start then
+            local chunk, err, partial = c.sock:receive(length - c.got)
+            c.got = c.got + #(chunk or partial)
+            if c.got == length then
+                done = done + 1
+                latencies[done] = now - c.start
+                c.start = nil
+            end
+        end
+    end
+end
+local elapsed = socket.gettime() - t0
+
+table.sort(latencies)
+local function percentile(p)
+    return 1000*latencies[math.max(1, math.ceil(#latencies*p))]
+end
+print(string.format("%d requests over %d connections in %.3fs: " ..
+    "%.0f req/s, p50 %.3fms, p99 %.3fms", total, nconns, elapsed,
+    total/elapsed, percentile(0.5), percentile(0.99)))
+local stats = srv:getstats()
+assert(stats.requests == total + 1 and stats.errors == 0)
+for _, c in ipairs(clients) do c.sock:close() end
+srv:close()
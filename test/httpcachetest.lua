@@ -0,0 +1,153 @@
+-----------------------------------------------------------------------------
+-- HTTP response cache against a server in the same process
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local cache = require("socket.http.cache")
+local ltn12 = require("ltn12")
+dofile("testsupport.lua")
+
+local date = "Mon, 15 Oct 2012 10:00:00 GMT"
+local served = {}
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    handler = function(req, res)
+        local path = req.path
+        served[path] = (served[path] or 0) + 1
+        local body = path .. " " .. served[path]
+        local h = { date = date }
+        if path == "/fresh" then
+            h["cache-control"] = "max-age=60"
+        elseif path == "/etag" then
+            h["cache-control"] = "no-cache"
+            h.etag = '"v1"'
+            if req.headers["if-none-match"] == '"v1"' then
+                return res:send(304, h)
+            end
+        elseif path == "/modified" then
+            h["cache-control"] = "max-age=0"
+            h["last-modified"] = "Sun, 14 Oct 2012 10:00:00 GMT"
+            if req.headers["if-modified-since"] == h["last-modified"] then
+                h["cache-control"] = "max-age=60"
+                return res:send(304, h)
+            end
+        elseif path == "/expired" then
+            h.expires = "Mon, 15 Oct 2012 09:00:00 GMT"
+        elseif path == "/expires" then
+            -- asctime form, one hour after the date
+            h.expires = "Mon Oct 15 11:00:00 2012"
+        elseif path == "/nostore" then
+            h["cache-control"] = "no-store, max-age=60"
+        elseif path == "/vary" then
+            h["cache-control"] = "max-age=60"
+            h.vary = "Accept-Language"
+            body = body .. " " .. (req.headers["accept-language"] or "")
+        elseif string.find(path, "^/big") then
+            h["cache-control"] = "max-age=60"
+            body = string.rep(path, 200000 / #path)
+        end
+        res:send(200, h, body)
+    end })
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+
+-- a client socket that runs the server whenever it would block
+local create = stepping(srv, socket.tcp)
+
+local name = os.tmpname()
+os.remove(name)
+local dir = string.match(name, "^(.*)/") or "."
+local store = cache.new{ dir = dir, maxdisk = 300000 }
+local function get(path, headers)
+    local t = {}
+    local r, code, h = store:request{ url = base .. path, create = create,
+        headers = headers, sink = ltn12.sink.table(t) }
+    assert(r, code)
+    return table.concat(t), code, h
+end
+
+-- fresh responses come from the cache
+local body, code, h = get("/fresh")
+assert(body == "/fresh 1" and code == 200 and h["cache-control"])
+body, code, h = get("/fresh")
+assert(body == "/fresh 1" and code == 200 and served["/fresh"] == 1)
+assert(h.date == date)
+local stats = store:getstats()
+assert(stats.hits == 1 and stats.misses == 1 and stats.hitrate == 0.5)
+print("fresh: ok")
+
+-- stale ones are revalidated, with either validator
+assert(get("/etag") == "/etag 1")
+body, code = get("/etag")
+assert(body == "/etag 1" and code == 200 and served["/etag"] == 2)
+assert(get("/modified") == "/modified 1")
+assert(get("/modified") == "/modified 1" and served["/modified"] == 2)
+-- the 304 made it fresh for a minute
+assert(get("/modified") == "/modified 1" and served["/modified"] == 2)
+assert(store:getstats().revalidated == 2)
+print("revalidation: ok")
+
+-- Expires is measured against Date, and no-store is never kept
+assert(get("/expired") == "/expired 1")
+assert(get("/expired") == "/expired 2")
+assert(get("/expires") == "/expires 1")
+assert(get("/expires") == "/expires 1")
+assert(get("/nostore") == "/nostore 1")
+assert(get("/nostore") == "/nostore 2")
+print("freshness: ok")
+
+-- requests can insist on the server
+assert(get("/fresh", { ["Cache-Control"] = "no-cache" }) == "/fresh 2")
+assert(get("/fresh", { pragma = "no-cache" }) == "/fresh 3")
+assert(get("/fresh") == "/fresh 3")
+print("request directives: ok")
+
+-- each variant is stored apart
+assert(get("/vary", { ["accept-language"] = "en" }) == "/vary 1 en")
+assert(get("/vary", { ["accept-language"] = "nl" }) == "/vary 2 nl")
+assert(get("/vary", { ["accept-language"] = "en" }) == "/vary 1 en")
+assert(get("/vary", { ["accept-language"] = "nl" }) == "/vary 2 nl")
+print("vary: ok")
+
+-- changes through an url invalidate it
+assert(store:request{ url = base .. "/fresh", method = "POST",
+    create = create, source = ltn12.source.string("x"),
+    headers = { ["content-length"] = 1 } })
+assert(get("/fresh") == "/fresh 5")
+print("invalidation: ok")
+
+-- large bodies go to disk, least recently used first out
+local big1 = get("/big1")
+assert(#big1 >= 199990 and store:getstats().disk == #big1)
+assert(get("/big1") == big1 and served["/big1"] == 1)
+local big2 = get("/big2")
+stats = store:getstats()
+assert(stats.evicted == 1 and stats.disk == #big2)
+assert(get("/big2") == big2 and served["/big2"] == 1)
+assert(get("/big1") == big1 and served["/big1"] == 2)
+print("disk: ok")
+
+-- caches sharing a directory name their files apart, and a collected
+-- cache removes its own
+local other = cache.new{ dir = dir }
+assert(other:request{ url = base .. "/big2", create = create,
+    sink = ltn12.sink.null() })
+local path = other.lru.next.path
+assert(path and path ~= store.lru.next.path and io.open(path, "rb")):close()
+other = nil
+collectgarbage()
+collectgarbage()
+assert(not io.open(path, "rb"))
+print("disk files: ok")
+
+-- the simple form
+body, code = store:request(base .. "/fresh")
+assert(code == 200 and body == "/fresh 5")
+print("simple: ok")
+
+store:clear()
+stats = store:getstats()
+assert(stats.entries == 0 and stats.memory == 0 and stats.disk == 0)
+print("clear: ok")
+
+srv:close()
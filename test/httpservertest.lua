@@ -0,0 +1,187 @@
+-----------------------------------------------------------------------------
+-- HTTP server over loopback
+-- Clients and server share the process: whenever a client would block, it
+-- steps the server instead.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local ltn12 = require("ltn12")
+dofile("testsupport.lua")
+
+local errors = {}
+local srv
+srv = assert(server.new{
+    host = "127.0.0.1",
+    port = 0,
+    handler = function(req, res)
+        if req.path == "/echo" then
+            local t = {}
+            local ok, err = ltn12.pump.all(req.source, (ltn12.sink.table(t)))
+            if not ok then return res:send(400, nil, err) end
+            res:send(200, {["content-type"] = "text/plain",
+                ["x-method"] = req.method, ["x-query"] = req.query},
+                table.concat(t))
+        elseif req.path == "/stream" then
+            local parts, i = {"one ", "two ", "three"}, 0
+            res:send(200, nil, function() i = i + 1; return parts[i] end)
+        elseif req.path == "/sink" then
+            local sink = res:sink(201, {["x-kind"] = "sink"})
+            sink("partial")
+        elseif req.path == "/ignore" then
+            res:send(204)
+        elseif req.path == "/fail" then
+            error("handler failed")
+        elseif req.path == "/quit" then
+            res:send(200, nil, "bye")
+            srv:close()
+        else
+            res:send(404, nil, "no " .. req.path)
+        end
+    end,
+    onerror = function(err) errors[#errors+1] = err end
+})
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+
+-- a client socket that runs the server whenever it would block
+local create = stepping(srv, socket.tcp)
+
+local function request(reqt)
+    local t = {}
+    reqt.url = base .. reqt.at
+    reqt.sink = ltn12.sink.table(t)
+    reqt.create = create
+    local r, code, headers = assert(http.request(reqt))
+    return table.concat(t), code, headers
+end
+
+-- a raw client that collects whatever comes back until cond holds
+local function raw(text, cond)
+    local c = assert(socket.connect(ip, port))
+    c:settimeout(0)
+    c:send(text)
+    local data, closed = "", false
+    for i = 1, 500 do
+        local chunk, err, partial = c:receive(8192)
+        data = data .. (chunk or partial)
+        if err == "closed" then closed = true; break end
+        if cond and cond(data) then break end
+        srv:step(0.01)
+    end
+    return data, closed, c
+end
+
+local function count(s, pattern)
+    local n = 0
+    for _ in string.gmatch(s, pattern) do n = n + 1 end
+    return n
+end
+
+-- plain requests through the client
+local body, code, headers = request{ at = "/missing" }
+assert(code == 404 and body == "no /missing", body)
+assert(headers["content-length"] == "11" and headers.server)
+body, code, headers = request{ at = "/echo?a=1",
+    method = "POST",
+    source = ltn12.source.string("hello"),
+    headers = {["content-length"] = 5}
+}
+assert(code == 200 and body == "hello" and headers["x-method"] == "POST")
+assert(headers["x-query"] == "a=1")
+body, code, headers = request{ at = "/echo", method = "HEAD" }
+assert(code == 200 and body == "" and headers["content-length"] == "0")
+print("requests: ok")
+
+-- streamed responses are chunked, request bodies can be too
+body, code, headers = request{ at = "/stream" }
+assert(code == 200 and body == "one two three")
+assert(headers["transfer-encoding"] == "chunked")
+body, code = request{ at = "/sink" }
+assert(code == 201 and body == "partial")
+body, code = request{ at = "/echo", method = "PUT",
+    source = ltn12.source.cat(ltn12.source.string("chunked "),
+        ltn12.source.string("upload")),
+    headers = {["transfer-encoding"] = "chunked"}
+}
+assert(code == 200 and body == "chunked upload", body)
+print("streaming: ok")
+
+-- keep-alive and pipelining on one connection
+local text = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n" ..
+    "POST /echo HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc" ..
+    "GET /ignore HTTP/1.1\r\n\r\n" ..
+    "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n"
+local data, closed = raw(text)
+assert(closed and count(data, "HTTP/1.1 %d+") == 4, data)
+assert(string.find(data, "no /a.-abc.-204 No Content.-no /b$"))
+print("pipelining: ok")
+
+-- unread bodies are skipped before the next request
+text = "POST /missing HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789" ..
+    "POST /missing2 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" ..
+    "3\r\nabc\r\n0\r\n\r\n" ..
+    "GET /last HTTP/1.1\r\nConnection: close\r\n\r\n"
+data, closed = raw(text)
+assert(closed and count(data, "HTTP/1.1 404") == 3, data)
+print("unread bodies: ok")
+
+-- HTTP/1.0 closes unless asked not to, and gets no chunks
+data, closed = raw("GET /stream HTTP/1.0\r\n\r\n")
+assert(closed and string.find(data, "Connection: close"))
+assert(string.find(data, "\r\n\r\none two three$"), data)
+data, closed = raw("GET /x HTTP/1.0\r\nConnection: keep-alive\r\n\r\n" ..
+    "GET /y HTTP/1.0\r\n\r\n")
+assert(closed and count(data, "HTTP/1.1 404") == 2, data)
+assert(string.find(data, "Connection: keep%-alive"))
+print("HTTP/1.0: ok")
+
+-- 100-continue is sent only once the handler reads the body
+data = raw("POST /echo HTTP/1.1\r\nExpect: 100-continue\r\n" ..
+    "Content-Length: 2\r\n\r\n", function(d)
+        return string.find(d, "100 Continue") end)
+assert(string.find(data, "^HTTP/1.1 100 Continue\r\n\r\n"))
+data = raw("POST /missing HTTP/1.1\r\nExpect: 100-continue\r\n" ..
+    "Content-Length: 2\r\n\r\n")
+assert(not string.find(data, "100 Continue") and
+    string.find(data, "^HTTP/1.1 404"), data)
+print("100-continue: ok")
+
+-- bad requests, and handler errors
+data, closed = raw("garbage\r\n\r\n")
+assert(closed and string.find(data, "^HTTP/1.1 400"), data)
+data, closed = raw("GET / HTTP/1.1\r\nX: " .. string.rep("x", 9000) ..
+    "\r\n\r\n")
+assert(closed and string.find(data, "^HTTP/1.1 431"), data)
+data, closed = raw("GET /fail HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n")
+assert(closed and string.find(data, "^HTTP/1.1 500") and
+    count(data, "HTTP/1.1") == 1, data)
+assert(#errors == 1 and string.find(errors[1], "handler failed"))
+print("errors: ok")
+
+-- idle connections and connection limits
+local idle = assert(server.new{ host = "127.0.0.1", port = 0, idle = 0.1,
+    maxconnections = 2, handler = function(req, res) res:send(200) end })
+local iip, iport = idle:getsockname()
+local clients = {}
+for i = 1, 3 do clients[i] = assert(socket.connect(iip, iport)) end
+local t = socket.gettime()
+while socket.gettime() - t < 0.05 do idle:step(0.01) end
+assert(idle:getstats().accepted == 2 and idle:getstats().active == 2)
+local t = socket.gettime()
+while idle:getstats().accepted < 3 and socket.gettime() - t < 2 do
+    idle:step(0.01)
+end
+local stats = idle:getstats()
+assert(stats.accepted == 3 and stats.timeouts >= 2, stats.timeouts)
+for i = 1, 3 do clients[i]:close() end
+idle:close()
+print("limits: ok")
+
+-- a handler can stop the server
+data, closed = raw("GET /quit HTTP/1.1\r\n\r\n")
+assert(closed and string.find(data, "bye$"))
+assert(srv:step(0) == nil)
+stats = srv:getstats()
+assert(stats.errors == 1 and stats.requests > 15 and stats.active == 0)
+print("close: ok")
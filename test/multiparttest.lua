@@ -0,0 +1,108 @@
+-----------------------------------------------------------------------------
+-- Streaming multipart/form-data bodies
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local ltn12 = require("ltn12")
+dofile("testsupport.lua")
+
+local function readall(src)
+    local t = {}
+    assert(ltn12.pump.all(src, (ltn12.sink.table(t))))
+    return table.concat(t)
+end
+
+local name = os.tmpname()
+local f = assert(io.open(name, "wb"))
+local content = string.rep("0123456789abcdef", 20000)
+f:write(content)
+f:close()
+
+-- fields and files, in order, with the length known up front
+local src, headers = assert(http.multipart{ boundary = "XyZ",
+    { name = "title", value = "a file" },
+    { name = "upload", path = name, type = "text/plain" },
+    { name = 'we"ird\r\n', value = "" },
+    { name = "raw", file = io.open(name, "rb"), filename = "raw.bin" } })
+assert(headers["content-type"] == "multipart/form-data; boundary=XyZ")
+local body = readall(src)
+assert(headers["content-length"] == #body)
+local base = string.match(name, "([^/\\]*)$")
+local expected = table.concat{
+    '--XyZ\r\nContent-Disposition: form-data; name="title"\r\n\r\n',
+    'a file\r\n',
+    '--XyZ\r\nContent-Disposition: form-data; name="upload"; filename="',
+    base, '"\r\nContent-Type: text/plain\r\n\r\n', content, '\r\n',
+    '--XyZ\r\nContent-Disposition: form-data; name="we%22ird%0D%0A"',
+    '\r\n\r\n\r\n',
+    '--XyZ\r\nContent-Disposition: form-data; name="raw"; ',
+    'filename="raw.bin"\r\nContent-Type: application/octet-stream\r\n\r\n',
+    content, '\r\n--XyZ--\r\n' }
+assert(body == expected)
+print("format: ok")
+
+-- files are read a block at a time, however large
+f = assert(io.open(name, "wb"))
+local block = string.rep("x", 65536)
+for i = 1, 128 do f:write(block) end
+f:close()
+src, headers = assert(http.multipart{ { name = "big", path = name } })
+assert(headers["content-length"] > 8 * 2^20)
+collectgarbage()
+local before, peak, total = collectgarbage("count"), 0, 0
+assert(ltn12.pump.all(src, function(chunk)
+    if chunk then
+        assert(#chunk <= http.BLOCKSIZE)
+        total = total + #chunk
+        peak = math.max(peak, collectgarbage("count") - before)
+    end
+    return 1
+end))
+assert(total == headers["content-length"])
+assert(peak < 2048, peak)
+print("memory: ok")
+
+-- the boundary changes from one body to the next
+local _, h1 = http.multipart{ { name = "a", value = "1" } }
+local _, h2 = http.multipart{ { name = "a", value = "1" } }
+assert(h1["content-type"] ~= h2["content-type"])
+print("boundary: ok")
+
+-- files that go missing or shrink are errors
+local r, err = http.multipart{ { name = "x", path = name .. ".missing" } }
+assert(not r and err)
+src = assert(http.multipart{ { name = "x", path = name } })
+assert(io.open(name, "wb")):close()
+r, err = ltn12.pump.all(src, ltn12.sink.null())
+assert(not r and string.find(err, "shrank"), err)
+print("errors: ok")
+
+-- the body goes out with its length
+f = assert(io.open(name, "wb"))
+f:write(content)
+f:close()
+local received
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    handler = function(req, res)
+        received = { length = req.headers["content-length"],
+            chunked = req.headers["transfer-encoding"],
+            body = readall(req.source) }
+        res:send(200, nil, "ok")
+    end })
+local ip, port = srv:getsockname()
+-- a client socket that runs the server whenever it would block
+local create = stepping(srv, socket.tcp)
+src, headers = assert(http.multipart{ { name = "title", value = "t" },
+    { name = "upload", path = name } })
+local t = {}
+assert(http.request{ url = "http://" .. ip .. ":" .. port .. "/",
+    method = "POST", source = src, headers = headers, create = create,
+    sink = ltn12.sink.table(t) })
+assert(table.concat(t) == "ok" and not received.chunked)
+assert(tonumber(received.length) == #received.body)
+assert(string.find(received.body, content, 1, true))
+srv:close()
+print("upload: ok")
+
+os.remove(name)
@@ -0,0 +1,80 @@
+-----------------------------------------------------------------------------
+-- Socket options: every getter reads back what its setter wrote
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+-- options some kernels refuse are reported, not fatal
+local function check(sock, name, value, expect)
+    local ok, err = sock:setoption(name, value)
+    if not ok then
+        print(name .. ": " .. err)
+        return
+    end
+    local got = sock:getoption(name)
+    if expect then assert(expect(got), name .. ": " .. tostring(got))
+    else assert(got == value, name .. ": " .. tostring(got)) end
+end
+
+local function atleast(n)
+    return function(got) return got >= n end
+end
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+local client = assert(socket.connect(ip, port))
+local peer = assert(server:accept())
+
+check(client, "tcp-cork", true)
+check(client, "tcp-cork", false)
+check(client, "tcp-quickack", true)
+check(client, "tcp-notsent-lowat", 16384)
+check(client, "tcp-user-timeout", 5000)
+check(client, "tcp-keepidle", 30)
+check(client, "tcp-keepintvl", 5)
+check(client, "tcp-keepcnt", 3)
+check(client, "rcvbuf", 65536, atleast(65536))
+check(client, "sndbuf", 65536, atleast(65536))
+check(client, "busy-poll", 0)
+check(client, "priority", 4)
+check(client, "ip-tos", 16)
+check(client, "tcp-congestion", client:getoption("tcp-congestion"))
+check(server, "tcp-defer-accept", 1, atleast(1))
+assert(type(peer:getoption("incoming-cpu")) == "number"
+    or select(2, peer:getoption("incoming-cpu")))
+print("tcp: ok")
+
+-- many options cross into C in a single call
+assert(client:setoptions{["tcp-nodelay"] = true, ["tcp-keepcnt"] = 7,
+    keepalive = true})
+assert(client:getoption("tcp-nodelay") and client:getoption("keepalive"))
+assert(client:getoption("tcp-keepcnt") == 7)
+local r, err = client:setoptions{["tcp-keepcnt"] = -1}
+assert(not r and err:find("^tcp%-keepcnt: "), err)
+assert(not pcall(client.setoptions, client, {["no-such-option"] = 1}))
+assert(not pcall(client.setoptions, client, {1}))
+assert(client:setoptions{})
+r, err = client:setoption("tcp-congestion", "no-such-algorithm")
+assert(not r and err)
+print("setoptions: ok")
+
+client:close(); peer:close(); server:close()
+
+local udp = assert(socket.udp())
+check(udp, "rcvbuf", 32768, atleast(32768))
+check(udp, "sndbuf", 32768, atleast(32768))
+check(udp, "priority", 2)
+check(udp, "ip-tos", 8)
+assert(udp:setoptions{broadcast = true, priority = 1})
+assert(udp:getoption("priority") == 1)
+udp:close()
+print("udp: ok")
+
+if socket.unix then
+    local un = assert(socket.unix())
+    check(un, "sndbuf", 32768, atleast(32768))
+    check(un, "keepalive", true)
+    assert(un:setoptions{rcvbuf = 32768})
+    assert(un:getoption("rcvbuf") >= 32768)
+    un:close()
+    print("unix: ok")
+end
@@ -0,0 +1,128 @@
+-----------------------------------------------------------------------------
+-- HTTP pipelining over loopback
+-- A stand-in pool hands out connections whose responses the server side
+-- has already queued, so a single process can play both parts.
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local ltn12 = require("ltn12")
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+
+local function response(body, extra)
+    return "HTTP/1.1 200 OK\r\ncontent-length: " .. #body .. "\r\n" ..
+        (extra or "") .. "\r\n" .. body
+end
+
+-- each checkout reuses the connection checked in last, or gets the next
+-- scripted one
+local function fakepool(scripts)
+    local p = { checkouts = 0, checkins = 0, discards = 0, peers = {} }
+    function p:checkout()
+        if self.idle then
+            local c = self.idle
+            self.idle = nil
+            return c, true
+        end
+        self.checkouts = self.checkouts + 1
+        local script = assert(scripts[self.checkouts], "too many connections")
+        local c = assert(socket.connect(ip, port))
+        local peer = assert(server:accept())
+        peer:send(script.data)
+        if script.close then peer:shutdown("send") end
+        self.peers[#self.peers+1] = peer
+        return c, false
+    end
+    function p:checkin(c) self.checkins = self.checkins + 1; self.idle = c end
+    function p:discard(c) self.discards = self.discards + 1; c:close() end
+    return p
+end
+
+-- reads one request, returning its request line
+local function request(peer)
+    local line = assert(peer:receive())
+    local length = 0
+    repeat
+        local header = assert(peer:receive())
+        length = tonumber(header:lower():match("^content%-length: (%d+)")) or
+            length
+    until header == ""
+    if length > 0 then peer:receive(length) end
+    return line
+end
+
+local function gets(n, sinks)
+    local reqts = {}
+    for i = 1, n do
+        sinks[i] = {}
+        reqts[i] = { path = "/" .. i, sink = ltn12.sink.table(sinks[i]) }
+    end
+    return reqts
+end
+
+-- all responses come back in order on one connection
+local sinks = {}
+local p = fakepool{ { data = response("a") .. response("b") ..
+    response("c", "transfer-encoding: chunked\r\n"):gsub("\r\n\r\nc$",
+        "\r\n\r\n1\r\nc\r\n0\r\n\r\n") .. response("d") } }
+http.POOL = p
+local responses, errors = http.pipeline(ip .. ":" .. port, gets(4, sinks))
+for i, body in ipairs{"a", "b", "c", "d"} do
+    assert(responses[i].code == 200 and not errors[i])
+    assert(table.concat(sinks[i]) == body)
+end
+for i = 1, 4 do assert(request(p.peers[1]) == "GET /" .. i .. " HTTP/1.1") end
+assert(p.checkouts == 1 and p.checkins == 1)
+print("pipeline: ok")
+
+-- a close in the middle retries what was left unanswered
+p = fakepool{
+    { data = response("a") .. response("b"), close = true },
+    { data = response("c") .. response("d", "connection: close\r\n") },
+    { data = response("e") }
+}
+http.POOL = p
+responses, errors = http.pipeline("http://" .. ip .. ":" .. port, gets(5, sinks))
+for i, body in ipairs{"a", "b", "c", "d", "e"} do
+    assert(responses[i] and table.concat(sinks[i]) == body, i)
+end
+assert(p.checkouts == 3 and p.discards == 2 and p.checkins == 1)
+for i = 3, 5 do assert(request(p.peers[1])) end
+assert(request(p.peers[2]) == "GET /3 HTTP/1.1")
+assert(request(p.peers[3]) == "GET /5 HTTP/1.1")
+print("retry: ok")
+
+-- a request that is not idempotent waits for the ones before it, goes out
+-- alone and is never repeated
+p = fakepool{
+    { data = response("a") .. response("b"), close = true },
+    { data = response("c") },
+}
+http.POOL = p
+local reqts = gets(3, sinks)
+reqts[2].method = "POST"
+reqts[2].source = ltn12.source.string("x")
+reqts[2].headers = { ["content-length"] = 1 }
+reqts[3].method = "POST"
+responses, errors = http.pipeline(ip .. ":" .. port, reqts)
+assert(responses[1] and responses[2] and not responses[3])
+assert(errors[3] == "closed", errors[3])
+assert(p.checkouts == 1)
+assert(request(p.peers[1]) == "GET /1 HTTP/1.1")
+assert(request(p.peers[1]) == "POST /2 HTTP/1.1")
+assert(request(p.peers[1]) == "POST /3 HTTP/1.1")
+print("idempotency: ok")
+
+-- requests that fail repeatedly, or cannot be built, report errors
+p = fakepool{ { data = "", close = true }, { data = "", close = true } }
+http.POOL = p
+responses, errors = http.pipeline(ip .. ":" .. port,
+    { { path = "/" }, { path = false } })
+assert(errors[1] == "closed" and errors[2] and not next(responses))
+assert(p.checkouts == 2)
+print("errors: ok")
+
+for _, peer in ipairs(p.peers) do peer:close() end
+server:close()
@@ -0,0 +1,65 @@
+local socket = require("socket")
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(1)
+local client = assert(socket.connect(ip, port))
+local peer = assert(server:accept())
+
+-- nothing is ready to read yet, but the socket can be written
+local p = assert(socket.poller())
+assert(p:add(client, "r"))
+assert(select(2, p:add(client, "r")) == "already added")
+assert(p:count() == 1)
+local r, w, err = p:wait(0)
+assert(#r == 0 and #w == 0 and err == "timeout")
+assert(p:modify(client, "rw"))
+r, w = p:wait(0)
+assert(#r == 0 and w[1] == client)
+print("add and modify: ok")
+
+-- readable once data arrives, until it is read
+assert(p:modify(client, "r"))
+peer:send("hello\n")
+r, w = p:wait(1)
+assert(r[1] == client and #w == 0)
+r = p:wait(0)
+assert(r[1] == client)
+assert(client:receive() == "hello")
+assert(select(3, p:wait(0)) == "timeout")
+print("readiness: ok")
+
+-- hang-ups make a socket readable, so the next read reports them
+peer:close()
+r = p:wait(1)
+assert(r[1] == client)
+assert(select(2, client:receive()) == "closed")
+print("hang-up: ok")
+
+-- the listener is readable when a connection is pending
+assert(p:add(server))
+local other = assert(socket.connect(ip, port))
+r = p:wait(1)
+local found
+for _, obj in ipairs(r) do found = found or obj == server end
+assert(found)
+assert(server:accept()):close()
+other:close()
+print("listener: ok")
+
+-- the poller itself takes part in select
+assert(p:remove(client))
+assert(select(2, p:remove(client)) == "not added")
+assert(p:count() == 1)
+if p:getfd() >= 0 then
+    other = assert(socket.connect(ip, port))
+    assert(socket.select({p}, nil, 1)[1] == p)
+    assert(server:accept()):close()
+    other:close()
+end
+print("select: ok")
+
+assert(p:close())
+assert(select(2, p:wait(0)) == "closed")
+client:close()
+server:close()
@@ -0,0 +1,199 @@
+-----------------------------------------------------------------------------
+-- Connection pool and HTTP keep-alive over loopback
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local pool = require("socket.pool")
+local http = require("socket.http")
+local ltn12 = require("ltn12")
+
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+
+-- misses open connections, hits reuse them
+local p = pool.new{maxidle = 2, idle = 0.2}
+local c, reused = assert(p:checkout(ip, port, "inet", 5))
+assert(reused == false)
+local peer = assert(server:accept())
+assert(p:checkin(c))
+local c2, reused2 = assert(p:checkout(ip, port, "inet", 5))
+assert(c2 == c and reused2 == true)
+local stats = p:getstats()
+assert(stats.hits == 1 and stats.misses == 1 and stats.busy == 1)
+print("checkout: ok")
+
+-- a connection the peer closed is not handed out again
+assert(p:checkin(c))
+peer:close()
+socket.sleep(0.1)
+assert(not c:alive())
+c, reused = assert(p:checkout(ip, port, "inet", 5))
+assert(not reused and p:getstats().stale == 1)
+peer = assert(server:accept())
+print("stale: ok")
+
+-- so is one with unsolicited data waiting
+assert(p:checkin(c))
+peer:send("junk")
+socket.sleep(0.1)
+assert(select(2, c:alive()) == "unexpected data")
+c = assert(p:checkout(ip, port, "inet", 5))
+assert(p:getstats().stale == 2)
+assert(p:discard(c))
+peer:close()
+assert(server:accept()):close()
+print("unexpected data: ok")
+
+-- idle connections expire, and the extra ones are closed on checkin
+local conns = {}
+for i = 1, 3 do conns[i] = assert(p:checkout(ip, port, nil, 5)) end
+for i = 1, 3 do assert(server:accept()):close() end
+for i = 1, 3 do p:checkin(conns[i]) end
+stats = p:getstats()
+assert(stats.idle == 0 and stats.busy == 0, stats.idle)
+for i = 1, 3 do conns[i] = assert(p:checkout(ip, port, nil, 5)) end
+local peers = {}
+for i = 1, 3 do peers[i] = assert(server:accept()) end
+for i = 1, 3 do p:checkin(conns[i]) end
+assert(p:getstats().idle == 2)
+socket.sleep(0.3)
+p:reap()
+stats = p:getstats()
+assert(stats.idle == 0 and stats.expired == 2)
+for i = 1, 3 do peers[i]:close() end
+print("limits: ok")
+
+-- a per key limit on open connections
+local lp = pool.new{max = 1}
+c = assert(lp:checkout(ip, port))
+assert(select(2, lp:checkout(ip, port)) == "too many connections")
+assert(server:accept()):close()
+lp:discard(c)
+assert(lp:getstats().busy == 0)
+print("max: ok")
+
+-- idle connections are bounded across keys, and every key expires
+local tp = pool.new{maxtotal = 2, idle = 0.2}
+local keys = {{ip, "inet"}, {ip}, {"localhost", "inet"}}
+for i, k in ipairs(keys) do
+    conns[i] = assert(tp:checkout(k[1], port, k[2], 5))
+    peers[i] = assert(server:accept())
+end
+for i = 1, 3 do tp:checkin(conns[i]) end
+stats = tp:getstats()
+assert(stats.idle == 2 and stats.evicted == 1)
+socket.sleep(0.3)
+c = assert(tp:checkout("localhost", port, nil, 5))
+stats = tp:getstats()
+assert(stats.idle == 0 and stats.expired == 2)
+tp:discard(c)
+assert(server:accept()):close()
+for i = 1, 3 do peers[i]:close() end
+print("maxtotal: ok")
+
+-- http reuses the connection. a single process plays both parts: the
+-- server answers from within the source of the request body, which runs
+-- after the connection is checked out and before the response is read
+local hp = pool.new()
+c = assert(hp:connect(ip, port))
+hp:checkin(c)
+peer = assert(server:accept())
+local function answer(response, close)
+    local sent = false
+    return function()
+        if sent then return nil end
+        sent = true
+        peer:send(response)
+        if close then peer:shutdown("send") end
+        return "x"
+    end
+end
+local function post(response, close)
+    return http.request{url = "http://" .. ip .. ":" .. port .. "/",
+        method = "POST", pool = hp, source = answer(response, close),
+        headers = {["content-length"] = 1}}
+end
+local function request()
+    local line = assert(peer:receive())
+    local connection
+    repeat
+        line = assert(peer:receive())
+        connection = connection or line:lower():match("^connection: (.*)")
+    until line == ""
+    assert(peer:receive(1) == "x")
+    return connection
+end
+for i = 1, 3 do
+    local r, code = post("HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok")
+    assert(r == 1 and code == 200)
+    assert(not request():find("close"))
+end
+stats = hp:getstats()
+assert(stats.hits == 3 and stats.misses == 0 and stats.idle == 1)
+print("http keep-alive: ok")
+
+-- responses that end with the connection are not kept
+assert(post("HTTP/1.1 200 OK\r\nconnection: close\r\ncontent-length: 0\r\n\r\n"))
+request()
+assert(hp:getstats().idle == 0)
+peer:close()
+c = assert(hp:connect(ip, port))
+hp:checkin(c)
+peer = assert(server:accept())
+assert(post("HTTP/1.1 200 OK\r\n\r\nuntil closed", true) == 1)
+request()
+assert(hp:getstats().idle == 0)
+peer:close()
+print("http close: ok")
+
+-- a sink that raises an error still gives the connection back
+local mp = pool.new{max = 1}
+c = assert(mp:connect(ip, port))
+mp:checkin(c)
+peer = assert(server:accept())
+local ok, err = pcall(http.request, {url = "http://" .. ip .. ":" .. port ..
+    "/", method = "POST", pool = mp, headers = {["content-length"] = 1},
+    source = answer("HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok"),
+    sink = function(chunk) if chunk then error("sink failed") end end})
+assert(not ok and string.find(err, "sink failed"), err)
+assert(mp:getstats().busy == 0)
+c = assert(mp:checkout(ip, port))
+mp:discard(c)
+peer:close()
+assert(server:accept()):close()
+print("http errors: ok")
+
+-- a reused connection found closed is retried only for requests that can
+-- be replayed. the server is done with the first connection this pool
+-- hands out, the next one already holds the response
+local function stalepool()
+    local sp = {n = 0}
+    function sp:checkout()
+        self.n = self.n + 1
+        local c = assert(socket.connect(ip, port))
+        local s = assert(server:accept())
+        if self.n == 1 then s:shutdown("send")
+        else s:send("HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok") end
+        if self.peer then self.peer:close() end
+        self.peer = s
+        return c, self.n == 1
+    end
+    function sp:discard(c) c:close() end
+    sp.checkin = sp.discard
+    return sp
+end
+local sp = stalepool()
+local body = {}
+local r, code = http.request{url = "http://" .. ip .. ":" .. port .. "/",
+    pool = sp, sink = ltn12.sink.table(body)}
+assert(r == 1 and code == 200 and table.concat(body) == "ok" and sp.n == 2)
+sp.peer:close()
+sp = stalepool()
+r, err = http.request{url = "http://" .. ip .. ":" .. port .. "/",
+    method = "POST", pool = sp}
+assert(not r and err == "closed" and sp.n == 1, err)
+sp.peer:close()
+print("http retry: ok")
+
+hp:close()
+server:close()
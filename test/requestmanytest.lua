@@ -0,0 +1,89 @@
+-----------------------------------------------------------------------------
+-- Concurrent HTTP requests against a server in the same process
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local ltn12 = require("ltn12")
+
+local srv = assert(server.new{ host = "127.0.0.1", port = 0,
+    handler = function(req, res)
+        if req.path == "/echo" then
+            local t = {}
+            ltn12.pump.all(req.source, (ltn12.sink.table(t)))
+            res:send(200, nil, table.concat(t))
+        elseif req.path == "/redirect" then
+            res:send(302, {location = "/page/redirected"})
+        else
+            res:send(200, nil, "page " .. string.sub(req.path, 7))
+        end
+    end })
+local ip, port = srv:getsockname()
+local base = "http://" .. ip .. ":" .. port
+local step = function() srv:step(0) end
+
+-- every response arrives, in the slot of its request
+local reqts = {}
+for i = 1, 50 do reqts[i] = base .. "/page/" .. i end
+local completed = 0
+local responses, errors = http.requestmany(reqts, { concurrency = 8,
+    perhost = 3, step = step, oncomplete = function(i, response, err)
+        assert(response and not err)
+        completed = completed + 1
+    end })
+assert(completed == 50 and not next(errors))
+for i = 1, 50 do
+    assert(responses[i].code == 200 and responses[i].body == "page " .. i)
+end
+print("strings: ok")
+
+-- connections are kept alive, and limited per server
+local stats = srv:getstats()
+assert(stats.requests == 50 and stats.accepted <= 3, stats.accepted)
+print("perhost: ok")
+
+-- tables work like the arguments of request, sinks and all
+local sinks = {}
+reqts = {}
+for i = 1, 10 do
+    sinks[i] = {}
+    reqts[i] = { url = base .. "/echo", method = "POST",
+        source = ltn12.source.string(string.rep(tostring(i), 1000)),
+        headers = {["content-length"] = 1000 * #tostring(i)},
+        sink = ltn12.sink.table(sinks[i]) }
+end
+reqts[11] = { url = base .. "/redirect", sink = ltn12.sink.table(sinks) }
+responses, errors = http.requestmany(reqts, { step = step })
+for i = 1, 10 do
+    assert(responses[i].code == 200 and not responses[i].body)
+    assert(table.concat(sinks[i]) == string.rep(tostring(i), 1000))
+end
+assert(responses[11].code == 200 and sinks[1] and
+    sinks[#sinks] == "page redirected")
+print("tables: ok")
+
+-- failures are reported per request
+local dead = assert(socket.bind("127.0.0.1", 0))
+local dip, dport = dead:getsockname()
+dead:close()
+reqts = { base .. "/page/ok", "http://" .. dip .. ":" .. dport .. "/",
+    "http://no.such.host.invalid/" }
+responses, errors = http.requestmany(reqts, { step = step })
+assert(responses[1].body == "page ok")
+assert(errors[2] == "connection refused", errors[2])
+assert(errors[3] and not responses[3])
+print("errors: ok")
+
+-- a stalled server times out, and the requests wait for it together
+local stalled = assert(socket.bind("127.0.0.1", 0))
+local sip, sport = stalled:getsockname()
+reqts = {}
+for i = 1, 4 do reqts[i] = "http://" .. sip .. ":" .. sport .. "/" .. i end
+local t = socket.gettime()
+responses, errors = http.requestmany(reqts, { timeout = 0.2, perhost = 4 })
+for i = 1, 4 do assert(errors[i] == "timeout") end
+assert(socket.gettime() - t < 0.6)
+stalled:close()
+print("timeout: ok")
+
+srv:close()
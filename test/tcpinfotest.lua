@@ -0,0 +1,48 @@
+-----------------------------------------------------------------------------
+-- Kernel connection state through getinfo
+-----------------------------------------------------------------------------
+local socket = require("socket")
+
+local server = assert(socket.bind("127.0.0.1", 0, 8))
+local ip, port = server:getsockname()
+local info, err = server:getinfo()
+if not info then
+    print("getinfo: skipped (" .. err .. ")")
+    return
+end
+assert(info.state == "listen" and info.backlog == 0 and info.maxbacklog == 8)
+
+-- connections the kernel completed but nobody accepted yet
+local clients = {}
+for i = 1, 3 do clients[i] = assert(socket.connect(ip, port)) end
+socket.sleep(0.1)
+assert(server:getinfo(info) == info and info.backlog == 3, info.backlog)
+print("listener: ok")
+
+local client = clients[1]
+local peer = assert(server:accept())
+info = assert(client:getinfo())
+assert(info.state == "established")
+assert(info.rtt >= 0 and info.rttvar >= 0 and info.snd_cwnd > 0)
+assert(info.retransmits == 0 and info.unacked == 0 and info.lost == 0)
+assert(info.outq == 0 and info.inq == 0 and info.buffered == 0)
+print("client: ok")
+
+-- queues on both sides
+assert(client:send(string.rep("x", 1000) .. "\n"))
+socket.sleep(0.1)
+info = assert(peer:getinfo())
+assert(info.inq == 1001, info.inq)
+assert(peer:receive(10))
+peer:getinfo(info)
+assert(info.inq == 0 and info.buffered == 991, info.buffered)
+if info.bytes_received then assert(info.bytes_received == 1001) end
+print("queues: ok")
+
+-- the table is reused
+local t = {}
+assert(peer:getinfo(t) == t and t.state == "established")
+peer:close()
+socket.sleep(0.1)
+assert(client:getinfo(t) == t and t.state == "close-wait", t.state)
+print("reuse: ok")
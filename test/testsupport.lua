@@ -23,6 +23,51 @@ function compare(input, output)
     else print("ok") end
 end
 
+-- returns a function that creates client sockets with the given
+-- constructor, which step the server running in the same process
+-- whenever they would block
+function stepping(server, create)
+    return function()
+        local c = create()
+        local function retry(f)
+            return function(_, pattern, prefix)
+                c:settimeout(0)
+                for i = 1, 1000 do
+                    local r, err, partial = f(c, pattern, prefix)
+                    if err ~= "timeout" then return r, err, partial end
+                    if type(partial) == "number" then prefix = partial + 1
+                    else prefix = partial end
+                    server:step(0.01)
+                end
+                return nil, "timeout"
+            end
+        end
+        -- the C parsers cannot resume, so http falls back to Lua
+        local methods = { receive = retry(c.receive), send = retry(c.send),
+            receiveheaders = false, receivechunk = false }
+        return setmetatable({}, { __index = function(_, name)
+            if methods[name] ~= nil then return methods[name] or nil end
+            return function(_, ...) return c[name](c, ...) end
+        end })
+    end
+end
+
+-- takes the place of the name server when the local resolver is set to
+-- ask one on 127.0.0.1, so that names missing from the hosts file never
+-- get an answer. returns the socket to close when done, or nil if the
+-- resolver is set up otherwise
+function quietdns()
+    local f = io.open("/etc/resolv.conf")
+    local conf = f and f:read("*a") or ""
+    if f then f:close() end
+    if not string.find("\n" .. conf, "\nnameserver%s+127%.0%.0%.1%s") then
+        return nil
+    end
+    local dns = socket.udp()
+    if dns:setsockname("127.0.0.1", 53) then return dns end
+    dns:close()
+end
+
 local G = _G
 local set = rawset
 local warn = print
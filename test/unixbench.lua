@@ -0,0 +1,54 @@
+-----------------------------------------------------------------------------
+-- Compares HTTP requests over a unix domain socket and over loopback TCP,
+-- with the server in the same process
+-- Usage: lua unixbench.lua [requests] [concurrency]
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local url = require("socket.url")
+
+local total = tonumber(arg and arg[1]) or 5000
+local concurrency = tonumber(arg and arg[2]) or 16
+local body = "hello, world\n"
+
+local function handler(req, res)
+    res:send(200, {["content-type"] = "text/plain"}, body)
+end
+
+local path = os.tmpname()
+os.remove(path)
+local servers = {
+    { name = "unix", srv = assert(server.new{ unixpath = path,
+        handler = handler }) },
+    { name = "tcp", srv = assert(server.new{ host = "127.0.0.1", port = 0,
+        handler = handler }) }
+}
+servers[1].base = "http+unix://" .. url.escape(path)
+local ip, port = servers[2].srv:getsockname()
+servers[2].base = "http://" .. ip .. ":" .. port
+
+-- keep-alive requests, n at a time. one at a time, the time per request
+-- is its latency
+local function run(s, n)
+    local reqts = {}
+    for i = 1, total do reqts[i] = s.base .. "/" end
+    local t0 = socket.gettime()
+    local responses, errors = http.requestmany(reqts, { concurrency = n,
+        perhost = n, step = function() s.srv:step(0) end })
+    local elapsed = socket.gettime() - t0
+    for i = 1, total do
+        assert(responses[i] and responses[i].body == body, errors[i])
+    end
+    return elapsed
+end
+
+for _, s in ipairs(servers) do
+    run(s, 1)
+    local one = run(s, 1)
+    local many = run(s, concurrency)
+    print(string.format("%-4s %d requests: %.1fus per request one at a " ..
+        "time, %.0f req/s %d at a time", s.name, total,
+        1e6*one/total, total/many, concurrency))
+end
+for _, s in ipairs(servers) do s.srv:close() end
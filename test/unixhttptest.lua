@@ -0,0 +1,91 @@
+-----------------------------------------------------------------------------
+-- HTTP over unix domain sockets, against a server in the same process
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local server = require("socket.http.server")
+local pool = require("socket.pool")
+local url = require("socket.url")
+local ltn12 = require("ltn12")
+dofile("testsupport.lua")
+
+local path = os.tmpname()
+os.remove(path)
+local srv = assert(server.new{ unixpath = path,
+    handler = function(req, res)
+        if req.path == "/moved" then
+            return res:send(302, { location = "/hello" }, "")
+        end
+        local t = {}
+        assert(ltn12.pump.all(req.source, (ltn12.sink.table(t))))
+        local body = req.method .. " " .. req.path .. " " ..
+            (req.headers.host or "") .. " " .. table.concat(t)
+        res:send(200, { ["content-type"] = "text/plain" }, body)
+    end })
+assert(srv:getsockname() == path)
+local base = "http+unix://" .. url.escape(path)
+
+-- a client socket that runs the server whenever it would block
+local create = stepping(srv, socket.unix)
+
+local function get(reqt)
+    local t = {}
+    reqt.sink, reqt.create = ltn12.sink.table(t), create
+    local r, code, headers = http.request(reqt)
+    assert(r, code)
+    return table.concat(t), code, headers
+end
+
+-- the socket path comes from the url, or from the request
+local body, code = get{ url = base .. "/hello?x=1" }
+assert(code == 200 and body == "GET /hello localhost ", body)
+body = get{ url = "http://example.com/there", unixpath = path }
+assert(body == "GET /there example.com ", body)
+body = get{ url = base .. "/post", method = "POST",
+    source = ltn12.source.string("data"),
+    headers = { ["content-length"] = 4 } }
+assert(body == "POST /post localhost data", body)
+print("request: ok")
+
+-- proxies are for other hosts, and redirects stay on the socket
+body = get{ url = base .. "/direct", proxy = "http://127.0.0.1:1/" }
+assert(body == "GET /direct localhost ", body)
+body, code = get{ url = base .. "/moved" }
+assert(code == 200 and body == "GET /hello localhost ", body)
+print("routing: ok")
+
+-- idle connections are pooled like TCP ones
+local p = pool.new()
+local c, reused = assert(p:checkout(path, nil, "unix"))
+assert(reused == false and c:alive())
+assert(p:checkin(c))
+local again
+again, reused = assert(p:checkout(path, nil, "unix"))
+assert(again == c and reused == true)
+p:discard(again)
+srv:step(0.01)
+print("pool: ok")
+
+-- concurrent requests share a few connections
+local accepted = srv:getstats().accepted
+local reqts = {}
+for i = 1, 20 do reqts[i] = base .. "/many/" .. i end
+local responses, errors = http.requestmany(reqts, { perhost = 2,
+    step = function() srv:step(0) end })
+for i = 1, 20 do
+    assert(responses[i], errors[i])
+    assert(responses[i].body == "GET /many/" .. i .. " localhost ")
+end
+assert(srv:getstats().accepted - accepted <= 2)
+print("requestmany: ok")
+
+-- a missing socket is reported as such
+local r, err = http.request{ url = "http+unix://" ..
+    url.escape(path .. ".missing") .. "/" }
+assert(not r and err, err)
+r, err = socket.connectunix(path .. ".missing", 1)
+assert(not r and err, err)
+print("errors: ok")
+
+srv:close()
+assert(not io.open(path))
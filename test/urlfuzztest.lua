@@ -0,0 +1,325 @@
+-----------------------------------------------------------------------------
+-- URL parsing in C, checked against the string patterns it replaced
+-----------------------------------------------------------------------------
+local url = require("socket.url")
+
+-- the functions url.lua had before the C core
+local reference = {}
+do
+    local base = _G
+    local escape, unescape, parse, build, absolute, parse_path, build_path
+    function escape(s)
+        return (string.gsub(s, "([^A-Za-z0-9_])", function(c)
+            return string.format("%%%02x", string.byte(c))
+        end))
+    end
+
+    local function make_set(t)
+        local s = {}
+        for i,v in base.ipairs(t) do
+            s[t[i]] = 1
+        end
+        return s
+    end
+
+    -- these are allowed withing a path segment, along with alphanum
+    -- other characters must be escaped
+    local segment_set = make_set {
+        "-", "_", ".", "!", "~", "*", "'", "(",
+        ")", ":", "@", "&", "=", "+", "$", ",",
+    }
+
+    local function protect_segment(s)
+        return string.gsub(s, "([^A-Za-z0-9_])", function (c)
+            if segment_set[c] then return c
+            else return string.format("%%%02x", string.byte(c)) end
+        end)
+    end
+
+    function unescape(s)
+        return (string.gsub(s, "%%(%x%x)", function(hex)
+            return string.char(base.tonumber(hex, 16))
+        end))
+    end
+
+    local function absolute_path(base_path, relative_path)
+        if string.sub(relative_path, 1, 1) == "/" then return relative_path end
+        local path = string.gsub(base_path, "[^/]*$", "")
+        path = path .. relative_path
+        path = string.gsub(path, "([^/]*%./)", function (s)
+            if s ~= "./" then return s else return "" end
+        end)
+        path = string.gsub(path, "/%.$", "/")
+        local reduced
+        while reduced ~= path do
+            reduced = path
+            path = string.gsub(reduced, "([^/]*/%.%./)", function (s)
+                if s ~= "../../" then return "" else return s end
+            end)
+        end
+        path = string.gsub(reduced, "([^/]*/%.%.)$", function (s)
+            if s ~= "../.." then return "" else return s end
+        end)
+        return path
+    end
+
+    function parse(url, default)
+        -- initialize default parameters
+        local parsed = {}
+        for i,v in base.pairs(default or parsed) do parsed[i] = v end
+        -- empty url is parsed to nil
+        if not url or url == "" then return nil, "invalid url" end
+        -- remove whitespace
+        -- url = string.gsub(url, "%s", "")
+        -- get fragment
+        url = string.gsub(url, "#(.*)$", function(f)
+            parsed.fragment = f
+            return ""
+        end)
+        -- get scheme
+        url = string.gsub(url, "^([%w][%w%+%-%.]*)%:",
+            function(s) parsed.scheme = s; return "" end)
+        -- get authority
+        url = string.gsub(url, "^//([^/]*)", function(n)
+            parsed.authority = n
+            return ""
+        end)
+        -- get query string
+        url = string.gsub(url, "%?(.*)", function(q)
+            parsed.query = q
+            return ""
+        end)
+        -- get params
+        url = string.gsub(url, "%;(.*)", function(p)
+            parsed.params = p
+            return ""
+        end)
+        -- path is whatever was left
+        if url ~= "" then parsed.path = url end
+        local authority = parsed.authority
+        if not authority then return parsed end
+        authority = string.gsub(authority,"^([^@]*)@",
+            function(u) parsed.userinfo = u; return "" end)
+        authority = string.gsub(authority, ":([^:%]]*)$",
+            function(p) parsed.port = p; return "" end)
+        if authority ~= "" then 
+            -- IPv6?
+            parsed.host = string.match(authority, "^%[(.+)%]$") or authority 
+        end
+        local userinfo = parsed.userinfo
+        if not userinfo then return parsed end
+        userinfo = string.gsub(userinfo, ":([^:]*)$",
+            function(p) parsed.password = p; return "" end)
+        parsed.user = userinfo
+        return parsed
+    end
+
+    function build(parsed)
+        local ppath = parse_path(parsed.path or "")
+        local url = build_path(ppath)
+        if parsed.params then url = url .. ";" .. parsed.params end
+        if parsed.query then url = url .. "?" .. parsed.query end
+        local authority = parsed.authority
+        if parsed.host then
+            authority = parsed.host
+            if string.find(authority, ":") then -- IPv6?
+                authority = "[" .. authority .. "]"
+            end
+            if parsed.port then authority = authority .. ":" .. parsed.port end
+            local userinfo = parsed.userinfo
+            if parsed.user then
+                userinfo = parsed.user
+                if parsed.password then
+                    userinfo = userinfo .. ":" .. parsed.password
+                end
+            end
+            if userinfo then authority = userinfo .. "@" .. authority end
+        end
+        if authority then url = "//" .. authority .. url end
+        if parsed.scheme then url = parsed.scheme .. ":" .. url end
+        if parsed.fragment then url = url .. "#" .. parsed.fragment end
+        -- url = string.gsub(url, "%s", "")
+        return url
+    end
+
+    function absolute(base_url, relative_url)
+        local base_parsed
+        if base.type(base_url) == "table" then
+            base_parsed = base_url
+            base_url = build(base_parsed)
+        else
+            base_parsed = parse(base_url)
+        end
+        local relative_parsed = parse(relative_url)
+        if not base_parsed then return relative_url
+        elseif not relative_parsed then return base_url
+        elseif relative_parsed.scheme then return relative_url
+        else
+            relative_parsed.scheme = base_parsed.scheme
+            if not relative_parsed.authority then
+                relative_parsed.authority = base_parsed.authority
+                if not relative_parsed.path then
+                    relative_parsed.path = base_parsed.path
+                    if not relative_parsed.params then
+                        relative_parsed.params = base_parsed.params
+                        if not relative_parsed.query then
+                            relative_parsed.query = base_parsed.query
+                        end
+                    end
+                else    
+                    relative_parsed.path = absolute_path(base_parsed.path or "",
+                        relative_parsed.path)
+                end
+            end
+            return build(relative_parsed)
+        end
+    end
+
+    function parse_path(path)
+        local parsed = {}
+        path = path or ""
+        --path = string.gsub(path, "%s", "")
+        string.gsub(path, "([^/]+)", function (s) table.insert(parsed, s) end)
+        for i = 1, table.getn(parsed) do
+            parsed[i] = unescape(parsed[i])
+        end
+        if string.sub(path, 1, 1) == "/" then parsed.is_absolute = 1 end
+        if string.sub(path, -1, -1) == "/" then parsed.is_directory = 1 end
+        return parsed
+    end
+
+    function build_path(parsed, unsafe)
+        local path = ""
+        local n = table.getn(parsed)
+        if unsafe then
+            for i = 1, n-1 do
+                path = path .. parsed[i]
+                path = path .. "/"
+            end
+            if n > 0 then
+                path = path .. parsed[n]
+                if parsed.is_directory then path = path .. "/" end
+            end
+        else
+            for i = 1, n-1 do
+                path = path .. protect_segment(parsed[i])
+                path = path .. "/"
+            end
+            if n > 0 then
+                path = path .. protect_segment(parsed[n])
+                if parsed.is_directory then path = path .. "/" end
+            end
+        end
+        if parsed.is_absolute then path = "/" .. path end
+        return path
+    end
+    reference.escape, reference.unescape = escape, unescape
+    reference.parse, reference.build = parse, build
+    reference.absolute = absolute
+    reference.parse_path, reference.build_path = parse_path, build_path
+end
+
+local function same(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then return a == b end
+    for k, v in pairs(a) do if b[k] ~= v then return false end end
+    for k, v in pairs(b) do if a[k] ~= v then return false end end
+    return true
+end
+
+local function show(s)
+    return string.format("%q", tostring(s))
+end
+
+-- random strings, heavy on the characters urls are split at
+local alphabet = { "/", "/", "/", ".", ".", "..", ":", "@", "?", "#", ";",
+    "%", "%2f", "%4", "%zz", "[", "]", "+", "&", "=", "a", "b", "Z", "0",
+    "9", "f", "-", "_", "~", " ", "\0", "\255", "//", "http:", "[::1]",
+    "./", "../", "/..", "/.", "a.", "x:1" }
+
+local function random(n)
+    local t = {}
+    for i = 1, math.random(0, n) do
+        t[i] = alphabet[math.random(#alphabet)]
+    end
+    return table.concat(t)
+end
+
+local fields = { "scheme", "authority", "userinfo", "user", "password",
+    "host", "port", "path", "params", "query", "fragment" }
+
+math.randomseed(1234)
+local count = 0
+for i = 1, 20000 do
+    local s = random(12)
+    assert(url.escape(s) == reference.escape(s), show(s))
+    assert(url.unescape(s) == reference.unescape(s), show(s))
+    local a, aerr = url.parse(s)
+    local b, berr = reference.parse(s)
+    assert(same(a, b) and aerr == berr, show(s))
+    if a then
+        assert(url.build(a) == reference.build(b), show(s))
+        count = count + 1
+    end
+    -- parts that parse would never give
+    local parts = {}
+    for _, f in ipairs(fields) do
+        if math.random(3) == 1 then parts[f] = random(4) end
+    end
+    assert(url.build(parts) == reference.build(parts), show(s))
+    local p, q = url.parse_path(s), reference.parse_path(s)
+    assert(same(p, q), show(s))
+    assert(url.build_path(p) == reference.build_path(q), show(s))
+    assert(url.build_path(p, true) == reference.build_path(q, true), show(s))
+    local r = random(12)
+    assert(url.absolute(s, r) == reference.absolute(s, r),
+        show(s) .. " " .. show(r))
+    if a then
+        assert(url.absolute(a, r) == reference.absolute(b, r),
+            show(s) .. " " .. show(r))
+    end
+end
+assert(count > 10000)
+print("random: ok")
+
+-- relative paths heavy in dot segments
+local segments = { ".", "..", "a", "b", "", "...", "a..", ".b" }
+for i = 1, 20000 do
+    local t, u = {}, {}
+    for j = 1, math.random(0, 6) do t[j] = segments[math.random(#segments)] end
+    for j = 1, math.random(0, 6) do u[j] = segments[math.random(#segments)] end
+    local s = "http://h/" .. table.concat(t, "/")
+    local r = table.concat(u, "/")
+    assert(url.absolute(s, r) == reference.absolute(s, r),
+        show(s) .. " " .. show(r))
+end
+print("dot segments: ok")
+
+-- edge cases
+for _, s in ipairs{ "", "#", "?", ";", ":", "//", "///", "a:", "1:b",
+    "//@", "//:", "//[]", "//[:]", "//[::1]:80", "//u:p:q@h:1:2",
+    "//a]:b", "/%", "%%41", "%4g%41" } do
+    assert(same(url.parse(s), reference.parse(s)), show(s))
+    assert(url.unescape(s) == reference.unescape(s), show(s))
+end
+assert(not url.parse(nil) and not url.parse(false))
+local d = { scheme = "ftp", port = "21" }
+assert(same(url.parse("//h/x", d), reference.parse("//h/x", d)))
+assert(d.host == nil)
+assert(url.absolute("http://h/a", nil) == "http://h/a")
+assert(url.absolute(nil, "b") == "b")
+assert(url.build{ host = "h", port = 80, path = "/1" } == "//h:80/1")
+local n = { host = 1, port = 80, path = 2 }
+assert(url.build(n) == reference.build(n))
+assert(url.build_path{ "a", 1, is_absolute = 1 } == "/a/1")
+assert(not pcall(url.build_path, { "a", {} }))
+assert(same(url.parse_path(false), reference.parse_path(false)))
+print("edges: ok")
+
+-- query strings
+local q = url.parse_query("a=1&b=x+y%20z&&a=2&c&a=3&d=&=e&f=g=h&%41=%zz")
+assert(same(q.a, { "1", "2", "3" }))
+assert(q.b == "x y z" and q.c == "" and q.d == "" and q[""] == "e")
+assert(q.f == "g=h" and q.A == "%zz")
+assert(same(url.parse_query(""), {}) and same(url.parse_query(nil), {}))
+assert(same(url.parse_query("x=1&x=2").x, { "1", "2" }))
+print("query: ok")
@@ -0,0 +1,113 @@
+-----------------------------------------------------------------------------
+-- Zlib filters and transparent HTTP decompression
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local http = require("socket.http")
+local mime = require("mime")
+local ltn12 = require("ltn12")
+
+-- runs a filter over a string cut in pieces of the given size
+local function run(filter, s, size)
+    local t = {}
+    for i = 1, #s, size do
+        local out, err = filter(string.sub(s, i, i + size - 1))
+        if not out then return nil, err end
+        t[#t+1] = out
+    end
+    local out, err = filter(nil)
+    if err then return nil, err end
+    t[#t+1] = out
+    assert(out ~= "" and filter(nil) == nil)
+    return table.concat(t)
+end
+
+local text = {}
+for i = 1, 5000 do text[i] = "line " .. i .. " of some compressible text\n" end
+text = table.concat(text)
+
+for _, size in ipairs{1, 7, 1000, #text} do
+    for _, format in ipairs{"zlib", "gzip"} do
+        local packed = assert(run(mime.deflate(6, format), text, size))
+        assert(#packed < #text / 4)
+        assert(run(mime.inflate(), packed, size) == text)
+    end
+end
+assert(run(mime.inflate(), run(mime.deflate(), "", 1), 1) == "")
+assert(#run(mime.deflate(0), text, 4096) > #text)
+assert(#run(mime.deflate(9), text, 4096) <= #run(mime.deflate(1), text, 4096))
+print("round trip: ok")
+
+-- deflate bodies without the zlib header are accepted
+local zlib = run(mime.deflate(), text, #text)
+local raw = string.sub(zlib, 3, -5)
+assert(run(mime.inflate(), raw, 100) == text)
+print("raw deflate: ok")
+
+-- the filters work in ltn12 chains
+local t = {}
+assert(ltn12.pump.all(
+    ltn12.source.chain(ltn12.source.string(text),
+        ltn12.filter.chain(mime.deflate(), mime.inflate())),
+    (ltn12.sink.table(t))))
+assert(table.concat(t) == text)
+print("ltn12: ok")
+
+-- errors
+local r, err = run(mime.inflate(), "definitely not compressed", 5)
+assert(not r and err)
+r, err = run(mime.inflate(), string.sub(zlib, 1, -10), 100)
+assert(not r and err == "incomplete compressed data")
+assert(run(mime.inflate(), zlib .. "trailing garbage", 100) == text)
+assert(not pcall(mime.deflate, 10))
+assert(not pcall(mime.deflate, 1, "zip"))
+print("errors: ok")
+
+-- http asks for compressed bodies and undoes the compression
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+server:settimeout(5)
+
+local function serve(coding, body, decompress)
+    local peer, request
+    local reqt = {
+        url = "http://" .. ip .. ":" .. port .. "/",
+        method = "POST",
+        decompress = decompress,
+        headers = { ["content-length"] = 1 },
+        pool = false
+    }
+    local sent = false
+    -- answers from inside the request body, so one process plays both parts
+    reqt.source = function()
+        if sent then return nil end
+        sent = true
+        peer = assert(server:accept())
+        request = {}
+        repeat
+            local line = assert(peer:receive())
+            request[#request+1] = line:lower()
+        until line == ""
+        peer:send("HTTP/1.1 200 OK\r\ncontent-encoding: " .. coding ..
+            "\r\ncontent-length: " .. #body .. "\r\n\r\n" .. body)
+        peer:close()
+        return "x"
+    end
+    local t = {}
+    reqt.sink = ltn12.sink.table(t)
+    local ok, code = http.request(reqt)
+    return ok and table.concat(t), code, table.concat(request, "\n")
+end
+
+local body, code, request = serve("gzip", run(mime.deflate(9, "gzip"), text,
+    #text), true)
+assert(code == 200 and body == text)
+assert(string.find(request, "accept-encoding: gzip, deflate", 1, true))
+body = serve("deflate", raw, true)
+assert(body == text)
+body, code, request = serve("gzip", zlib, false)
+assert(body == zlib and not string.find(request, "accept-encoding"))
+body, code = serve("gzip", "corrupt", true)
+assert(not body and code)
+print("http: ok")
+
+server:close()